@@ -5,16 +5,25 @@
  */
 
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <string.h>
 #include <locale.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <vector>
 #include "addr.h"
 
 #if defined(__cplusplus)
     extern "C" {
 #endif
 #include "lctrie/lctrie.h"
+#include "lctrie/lctrie6.h"
+#include "lctrie/lctrie_dir24.h"
 #include "lctrie/lctrie_bgp.h"
 #if defined(__cplusplus)
     }
@@ -23,42 +32,146 @@
 /*
  * ipv4_subnet_trie and ipv4_subnet_array are global variables holding the
  * level compressed path trie data and subnet information for IPv4 BGP
- * Autonomous System Numbers and so on.
+ * Autonomous System Numbers and so on; ipv6_subnet_trie and
+ * ipv6_subnet_array hold the same information for IPv6.  If the
+ * DIR-24-8 table is selected for IPv4 lookups, then ipv4_dir24 holds
+ * the table, and the IPv4 trie is not built.
+ *
+ * If the data was loaded from a compiled ASN table file (see
+ * addr_init_from_table()), then the arrays point into the read-only
+ * mapping asn_table_map, which is shared with any other process that
+ * maps the same file.
  */
+enum asn_lookup_type ipv4_lookup_type;
 lct_t ipv4_subnet_trie;
 lct_subnet_t *ipv4_subnet_array;
+uint32_t ipv4_subnet_count;
+lct_dir24_t ipv4_dir24;
+lct6_t ipv6_subnet_trie;
+lct_subnet6_t *ipv6_subnet_array;
+uint32_t ipv6_subnet_count;
+void *asn_table_map;
+size_t asn_table_map_size;
+bool ipv4_dir24_is_mapped;
 
-uint32_t get_asn_info(char* dst_ip) {
-    uint32_t ipv4_addr;
+/*
+ * ASN_BATCH is the number of addresses that the batch lookup
+ * functions pass to the lctrie batch lookups at a time
+ */
+#define ASN_BATCH 64
 
-    if (inet_pton(AF_INET, dst_ip, &ipv4_addr) != 1) {
-        return 0;
+static inline uint32_t subnet_info_to_asn(const lct_subnet_info_t *info) {
+    if (info->type == IP_SUBNET_BGP) {
+        return info->bgp.asn;
     }
+    return 0;
+}
 
-    lct_subnet_t *subnet = lct_find(&ipv4_subnet_trie, ntohl(ipv4_addr));
+uint32_t get_asn_info_ipv4(uint32_t addr) {
+    if (ipv4_lookup_type == asn_lookup_dir_24_8) {
+        if (ipv4_dir24.tbl24 == NULL) {
+            return 0;
+        }
+        return lct_dir24_find(&ipv4_dir24, ntohl(addr));
+    }
+    if (ipv4_subnet_array == NULL) {
+        return 0;
+    }
+    lct_subnet_t *subnet = lct_find(&ipv4_subnet_trie, ntohl(addr));
     if (subnet == NULL) {
         return 0;
     }
-    if (subnet->info.type == IP_SUBNET_BGP) {
-        return subnet->info.bgp.asn;
+    return subnet_info_to_asn(&subnet->info);
+}
+
+uint32_t get_asn_info_ipv6(const uint8_t *addr) {
+    if (ipv6_subnet_array == NULL) {
+        return 0;
+    }
+    lct_subnet6_t *subnet = lct6_find(&ipv6_subnet_trie, lct_ip6_addr_from_bytes(addr));
+    if (subnet == NULL) {
+        return 0;
     }
+    return subnet_info_to_asn(&subnet->info);
+}
 
+uint32_t get_asn_info(char* dst_ip) {
+    uint8_t addr[16];
+
+    if (inet_pton(AF_INET, dst_ip, addr) == 1) {
+        uint32_t ipv4_addr;
+        memcpy(&ipv4_addr, addr, sizeof(ipv4_addr));
+        return get_asn_info_ipv4(ipv4_addr);
+    }
+    if (inet_pton(AF_INET6, dst_ip, addr) == 1) {
+        return get_asn_info_ipv6(addr);
+    }
     return 0;
 }
 
+void get_asn_info_batch_ipv4(const uint32_t *addr, uint32_t *asn, size_t num) {
+    uint32_t key[ASN_BATCH];
+    lct_subnet_t *subnet[ASN_BATCH];
+
+    if (ipv4_lookup_type == asn_lookup_dir_24_8 && ipv4_dir24.tbl24 != NULL) {
+        for (size_t first = 0; first < num; first += ASN_BATCH) {
+            size_t n = num - first < ASN_BATCH ? num - first : ASN_BATCH;
+            for (size_t i = 0; i < n; i++) {
+                key[i] = ntohl(addr[first + i]);
+            }
+            lct_dir24_find_batch(&ipv4_dir24, key, asn + first, n);
+        }
+        return;
+    }
+    if (ipv4_lookup_type == asn_lookup_dir_24_8 || ipv4_subnet_array == NULL) {
+        memset(asn, 0, num * sizeof(uint32_t));
+        return;
+    }
+    for (size_t first = 0; first < num; first += ASN_BATCH) {
+        size_t n = num - first < ASN_BATCH ? num - first : ASN_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            key[i] = ntohl(addr[first + i]);
+        }
+        lct_find_batch(&ipv4_subnet_trie, key, subnet, n);
+        for (size_t i = 0; i < n; i++) {
+            asn[first + i] = subnet[i] ? subnet_info_to_asn(&subnet[i]->info) : 0;
+        }
+    }
+}
+
+void get_asn_info_batch_ipv6(const uint8_t (*addr)[16], uint32_t *asn, size_t num) {
+    lct_ip6_addr_t key[ASN_BATCH];
+    lct_subnet6_t *subnet[ASN_BATCH];
+
+    if (ipv6_subnet_array == NULL) {
+        memset(asn, 0, num * sizeof(uint32_t));
+        return;
+    }
+    for (size_t first = 0; first < num; first += ASN_BATCH) {
+        size_t n = num - first < ASN_BATCH ? num - first : ASN_BATCH;
+        for (size_t i = 0; i < n; i++) {
+            key[i] = lct_ip6_addr_from_bytes(addr[first + i]);
+        }
+        lct6_find_batch(&ipv6_subnet_trie, key, subnet, n);
+        for (size_t i = 0; i < n; i++) {
+            asn[first + i] = subnet[i] ? subnet_info_to_asn(&subnet[i]->info) : 0;
+        }
+    }
+}
+
 /*
  * BGP_MAX_ENTRIES is the maximum number of subnets
  */
 #define BGP_MAX_ENTRIES             4000000
 
 /*
- * lct_init_from_file(lct, filename) initializes the lctrie lct by
- * reading data from the file filename.  On success, the location of
- * the subnet array allocated by this function is returned; on error,
- * NULL is returned, and the caller should use errno/perror to
- * determine the cause.
+ * subnet_array_from_file(filename, size) reads the IPv4 subnets from
+ * the file filename, along with the private and special subnets, into
+ * a sorted and prefixed subnet array.  On success, the location of
+ * the subnet array allocated by this function is returned, and its
+ * number of entries is written into size; on error, NULL is returned.
  */
-lct_subnet_t *lct_init_from_file(lct_t *lct, char *filename) {
+static lct_subnet_t *subnet_array_from_file(char *filename, uint32_t *size) {
   int num = 0;
   uint32_t prefix;
   lct_subnet_t *p;
@@ -121,10 +234,126 @@ lct_subnet_t *lct_init_from_file(lct_t *lct, char *filename) {
     }
   }
 
+  *size = num;
+  return p;
+
+ bail:   /* handle errors by freeing memory as needed */
+
+  free(p);
+  return NULL;
+}
+
+/*
+ * lct_init_from_file(lct, filename, size) initializes the lctrie lct
+ * by reading data from the file filename.  On success, the location
+ * of the subnet array allocated by this function is returned, and its
+ * number of entries is written into size; on error, NULL is returned,
+ * and the caller should use errno/perror to determine the cause.
+ */
+lct_subnet_t *lct_init_from_file(lct_t *lct, char *filename, uint32_t *size) {
+  uint32_t num;
+  lct_subnet_t *p = subnet_array_from_file(filename, &num);
+  if (p == NULL) {
+      return NULL;
+  }
+
   // actually build the trie and get the trie node count for statistics printing
   memset(lct, 0, sizeof(lct_t));
   lct_build(lct, p, num);
 
+  *size = num;
+  return p;
+}
+
+/*
+ * dir24_init_from_file(table, filename) initializes the DIR-24-8
+ * table by reading data from the file filename, and returns 0 on
+ * success and -1 otherwise.  The subnet array is only needed while
+ * the table is being built.
+ */
+int dir24_init_from_file(lct_dir24_t *table, char *filename) {
+  uint32_t num;
+  lct_subnet_t *p = subnet_array_from_file(filename, &num);
+  if (p == NULL) {
+      return -1;
+  }
+  int rc = lct_dir24_build(table, p, num);
+  free(p);
+
+  return rc;
+}
+
+/*
+ * BGP6_MAX_ENTRIES is the maximum number of IPv6 subnets
+ */
+#define BGP6_MAX_ENTRIES            1000000
+
+/*
+ * lct6_init_from_file(lct, filename, size) is the IPv6 counterpart of
+ * lct_init_from_file(), which reads the IPv6 entries from the same
+ * file
+ */
+lct_subnet6_t *lct6_init_from_file(lct6_t *lct, char *filename, uint32_t *size) {
+  int num = 0;
+  uint32_t prefix;
+  lct_subnet6_t *p;
+  lct_subnet6_t *tmp = NULL;
+  lct_ip6_stats_t *stats = NULL;
+
+  if (!(p = (lct_subnet6_t *)calloc(sizeof(lct_subnet6_t), BGP6_MAX_ENTRIES))) {
+      return NULL;  /* could not allocate subnet input buffer */
+  }
+
+  // start with the loopback, link local, unique local, multicast
+  // and documentation subnets
+  num += init_special_subnets6(&p[num], BGP6_MAX_ENTRIES);
+
+  // read in the ASN prefixes
+  int rc;
+  if (0 > (rc = read_prefix_table6(filename, &p[num], BGP6_MAX_ENTRIES - num))) {
+      goto bail; /* could not read prefix file */
+  }
+  num += rc;
+
+  // validate subnet prefixes against their netmasks
+  // and sort the resulting array
+  subnet6_mask(p, num);
+  qsort(p, num, sizeof(lct_subnet6_t), subnet6_cmp);
+
+  // de-duplicate subnets and shrink the buffer down to its
+  // actual size and split into prefixes and bases
+  num -= subnet6_dedup(p, num);
+  tmp = (lct_subnet6_t *)realloc(p, num * sizeof(lct_subnet6_t));
+  if (tmp != NULL) {
+      p = tmp;
+  } else {
+      goto bail;
+  }
+
+  // allocate a buffer for the IP stats
+  stats = (lct_ip6_stats_t *) calloc(num, sizeof(lct_ip6_stats_t));
+  if (!stats) {
+      goto bail; /* "could not allocate prefix statistics buffer */
+  }
+
+  // count which subnets are prefixes of other subnets
+  subnet6_prefix(p, stats, num);
+  free(stats);
+
+  for (int i = 0; i < num; i++) {
+    // quick error check on the optimized prefix indexes
+    prefix = p[i].prefix;
+    if (prefix != IP_PREFIX_NIL && p[prefix].type == IP_PREFIX_FULL) {
+        goto bail; /* error: optimized subnet index points to a full prefix */
+    }
+  }
+
+  memset(lct, 0, sizeof(lct6_t));
+  if (lct6_build(lct, p, num) != 0) {
+      goto bail;
+  }
+
+  *size = num;
   return p;
 
  bail:   /* handle errors by freeing memory as needed */
@@ -133,17 +362,411 @@ lct_subnet_t *lct_init_from_file(lct_t *lct, char *filename) {
   return NULL;
 }
 
-int addr_init(const char *resources_dir) {
+int addr_init(const char *resources_dir, enum asn_lookup_type ipv4_lookup) {
 
-    ipv4_subnet_array = lct_init_from_file(&ipv4_subnet_trie, (char *)resources_dir);
-    if (ipv4_subnet_array == NULL) {
+    ipv4_lookup_type = ipv4_lookup;
+    if (ipv4_lookup == asn_lookup_dir_24_8) {
+        if (dir24_init_from_file(&ipv4_dir24, (char *)resources_dir) != 0) {
+            return -1;
+        }
+    } else {
+        ipv4_subnet_array = lct_init_from_file(&ipv4_subnet_trie, (char *)resources_dir, &ipv4_subnet_count);
+        if (ipv4_subnet_array == NULL) {
+            return -1;
+        }
+    }
+    ipv6_subnet_array = lct6_init_from_file(&ipv6_subnet_trie, (char *)resources_dir, &ipv6_subnet_count);
+    if (ipv6_subnet_array == NULL) {
+        fprintf(stderr, "warning: could not build IPv6 subnet trie; IPv6 ASN lookups are disabled\n");
+    }
+    return 0;
+}
+
+/*
+ * The compiled ASN table file holds the IPv4 and IPv6 subnet arrays
+ * and tries, and optionally a DIR-24-8 table, exactly as they are laid
+ * out in memory, so that they can be used directly from a read-only
+ * mapping of the file.  The header identifies the file and describes
+ * the layout of the structures, so that a file written by a different
+ * version of mercury, or on an incompatible platform, is rejected
+ * rather than misread.  Each section starts on a cache line boundary.
+ *
+ * The subnet descriptors hold only the information needed for ASN
+ * lookups; the pointers in the info field (reserved subnet
+ * descriptions and user data) are not written.
+ */
+static const char asn_table_magic[8] = { 'M', 'E', 'R', 'C', 'A', 'S', 'N', '\0' };
+static const uint32_t asn_table_version = 1;
+static const uint32_t asn_table_byte_order = 0x01020304;
+static const size_t asn_table_alignment = 64;
+
+struct asn_table_section {
+    uint64_t offset;   // from start of file
+    uint64_t count;    // number of elements
+};
+
+struct asn_table_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t sizeof_subnet;
+    uint32_t sizeof_subnet6;
+    uint32_t sizeof_node;
+    uint32_t ipv4_shortest;
+    uint32_t ipv6_shortest;
+    uint32_t reserved;
+    struct asn_table_section ipv4_nets;
+    struct asn_table_section ipv4_bases;
+    struct asn_table_section ipv4_nodes;
+    struct asn_table_section ipv6_nets;
+    struct asn_table_section ipv6_bases;
+    struct asn_table_section ipv6_nodes;
+    struct asn_table_section dir24_tbl24;    // count is zero if absent
+    struct asn_table_section dir24_tbl8;
+};
+
+/*
+ * subnet_info_for_table(info) returns a copy of info without any
+ * pointers in it
+ */
+static lct_subnet_info_t subnet_info_for_table(const lct_subnet_info_t &info) {
+    lct_subnet_info_t tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.type = info.type;
+    if (info.type == IP_SUBNET_BGP) {
+        tmp.bgp.asn = info.bgp.asn;
+    } else if (info.type == IP_SUBNET_PRIVATE) {
+        tmp.priv.net_class = info.priv.net_class;
+    }
+    return tmp;
+}
+
+static bool table_write_section(FILE *f, struct asn_table_section *section,
+                                const void *data, size_t element_size, size_t count) {
+    long offset = ftell(f);
+    if (offset < 0) {
+        return false;
+    }
+    while (offset % asn_table_alignment) {
+        if (fputc(0, f) == EOF) {
+            return false;
+        }
+        offset++;
+    }
+    section->offset = offset;
+    section->count = count;
+    return count == 0 || fwrite(data, element_size, count, f) == count;
+}
+
+int addr_write_table(const char *table_file, bool include_dir_24_8) {
+
+    if (asn_table_map != NULL || ipv4_subnet_array == NULL || ipv6_subnet_array == NULL) {
+        fprintf(stderr, "error: the IPv4 and IPv6 tries must be built from a text file before writing an ASN table\n");
         return -1;
     }
+
+    // copy the subnet arrays without pointers, and with any padding
+    // bytes zeroed, so that the output is reproducible
+    //
+    std::vector<lct_subnet_t> nets(ipv4_subnet_count);
+    memset(nets.data(), 0, nets.size() * sizeof(lct_subnet_t));
+    for (size_t i = 0; i < nets.size(); i++) {
+        const lct_subnet_t &s = ipv4_subnet_array[i];
+        nets[i].addr = s.addr;
+        nets[i].type = s.type;
+        nets[i].len = s.len;
+        nets[i].prefix = s.prefix;
+        nets[i].fullprefix = s.fullprefix;
+        nets[i].info = subnet_info_for_table(s.info);
+    }
+    std::vector<lct_subnet6_t> nets6(ipv6_subnet_count);
+    memset(nets6.data(), 0, nets6.size() * sizeof(lct_subnet6_t));
+    for (size_t i = 0; i < nets6.size(); i++) {
+        const lct_subnet6_t &s = ipv6_subnet_array[i];
+        nets6[i].addr = s.addr;
+        nets6[i].type = s.type;
+        nets6[i].len = s.len;
+        nets6[i].prefix = s.prefix;
+        nets6[i].fullprefix = s.fullprefix;
+        nets6[i].info = subnet_info_for_table(s.info);
+    }
+
+    lct_dir24_t dir24;
+    memset(&dir24, 0, sizeof(dir24));
+    if (include_dir_24_8 && lct_dir24_build(&dir24, ipv4_subnet_array, ipv4_subnet_count) != 0) {
+        return -1;
+    }
+
+    // write into a temporary file, and then rename it, so that any
+    // process that has mapped the previous file is not affected
+    //
+    char tmp_file[PATH_MAX];
+    if (snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", table_file) >= (int)sizeof(tmp_file)) {
+        lct_dir24_free(&dir24);
+        return -1;
+    }
+    FILE *f = fopen(tmp_file, "w");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open file '%s' (%s)\n", tmp_file, strerror(errno));
+        lct_dir24_free(&dir24);
+        return -1;
+    }
+
+    struct asn_table_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, asn_table_magic, sizeof(header.magic));
+    header.version = asn_table_version;
+    header.byte_order = asn_table_byte_order;
+    header.sizeof_subnet = sizeof(lct_subnet_t);
+    header.sizeof_subnet6 = sizeof(lct_subnet6_t);
+    header.sizeof_node = sizeof(lct_node_t);
+    header.ipv4_shortest = ipv4_subnet_trie.shortest;
+    header.ipv6_shortest = ipv6_subnet_trie.shortest;
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && table_write_section(f, &header.ipv4_nets, nets.data(), sizeof(lct_subnet_t), nets.size())
+        && table_write_section(f, &header.ipv4_bases, ipv4_subnet_trie.bases, sizeof(uint32_t), ipv4_subnet_trie.bcount)
+        && table_write_section(f, &header.ipv4_nodes, ipv4_subnet_trie.root, sizeof(lct_node_t), ipv4_subnet_trie.ncount)
+        && table_write_section(f, &header.ipv6_nets, nets6.data(), sizeof(lct_subnet6_t), nets6.size())
+        && table_write_section(f, &header.ipv6_bases, ipv6_subnet_trie.bases, sizeof(uint32_t), ipv6_subnet_trie.bcount)
+        && table_write_section(f, &header.ipv6_nodes, ipv6_subnet_trie.root, sizeof(lct_node_t), ipv6_subnet_trie.ncount);
+    if (ok && include_dir_24_8) {
+        ok = table_write_section(f, &header.dir24_tbl24, dir24.tbl24, sizeof(uint32_t), 1 << 24)
+            && table_write_section(f, &header.dir24_tbl8, dir24.tbl8, 256 * sizeof(uint32_t), dir24.tbl8_count);
+    }
+    ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    lct_dir24_free(&dir24);
+
+    if (!ok || rename(tmp_file, table_file) != 0) {
+        fprintf(stderr, "error: could not write file '%s' (%s)\n", table_file, strerror(errno));
+        unlink(tmp_file);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * table_section(header, size, section, element_size) returns a
+ * pointer to section in the mapped table of size bytes that starts
+ * at header, or NULL if the section does not lie within the table
+ */
+static const void *table_section(const struct asn_table_header *header, size_t size,
+                                 const struct asn_table_section &section, size_t element_size) {
+    if (section.offset % asn_table_alignment != 0
+        || section.offset > size
+        || section.count > (size - section.offset) / element_size) {
+        return NULL;
+    }
+    return (const uint8_t *)header + section.offset;
+}
+
+/*
+ * trie_is_valid() checks that all of the indexes in a mapped trie and
+ * its subnet array are in range, that the prefix chains have no
+ * cycles, that the children of each internal node come after it (as
+ * the builder allocates them), so that the trie has no cycles, and
+ * that no path through it extracts bits past the end of a key, so
+ * that a corrupt table cannot cause an out of bounds read, or an
+ * endless loop, in a lookup
+ */
+template <typename subnet_type>
+static bool trie_is_valid(const lct_node_t *nodes, uint64_t ncount, const uint32_t *bases, uint64_t bcount,
+                          const subnet_type *nets, uint64_t nnets, unsigned int key_bits) {
+    if (ncount == 0 || bcount == 0) {
+        return false;
+    }
+    uint64_t num_children = 0;
+    for (uint64_t i = 0; i < ncount; i++) {
+        if (nodes[i].branch == 0) {
+            if (nodes[i].index >= bcount) {
+                return false;
+            }
+        } else if (nodes[i].branch > key_bits
+                   || nodes[i].branch >= 32          // more children than a 32-bit index can reach
+                   || nodes[i].index <= i
+                   || (uint64_t)nodes[i].index + (1ULL << nodes[i].branch) > ncount) {
+            return false;
+        } else {
+            num_children += 1ULL << nodes[i].branch;
+            if (num_children >= ncount) {
+                return false;   // every node but the root is the child of at most one node
+            }
+        }
+    }
+
+    // walk the trie in index order, which visits each node after its
+    // parent, and check that the bits that each internal node extracts
+    // are within the key; pos[i] is the position in the key at which
+    // node i extracts bits, or unreached
+    //
+    const uint32_t unreached = UINT32_MAX;
+    std::vector<uint32_t> pos(ncount, unreached);
+    pos[0] = nodes[0].skip;
+    for (uint64_t i = 0; i < ncount; i++) {
+        if (pos[i] == unreached || nodes[i].branch == 0) {
+            continue;
+        }
+        uint32_t child_pos = pos[i] + nodes[i].branch;
+        if (child_pos > key_bits) {
+            return false;
+        }
+        for (uint64_t c = nodes[i].index; c < nodes[i].index + (1ULL << nodes[i].branch); c++) {
+            uint32_t p = child_pos + nodes[c].skip;
+            if (pos[c] == unreached || pos[c] < p) {
+                pos[c] = p;      // a node with two parents is checked on the deeper path
+            }
+        }
+    }
+
+    for (uint64_t i = 0; i < bcount; i++) {
+        if (bases[i] >= nnets) {
+            return false;
+        }
+    }
+    for (uint64_t i = 0; i < nnets; i++) {
+        if (nets[i].len > key_bits || (nets[i].prefix != IP_PREFIX_NIL && nets[i].prefix >= i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool dir24_is_valid(const uint32_t *tbl24, uint64_t tbl8_count) {
+    for (uint32_t i = 0; i < (1 << 24); i++) {
+        if ((tbl24[i] & LCT_DIR24_TBL8) && (tbl24[i] & ~LCT_DIR24_TBL8) >= tbl8_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int addr_init_from_table(const char *table_file, const char *text_file, enum asn_lookup_type ipv4_lookup) {
+
+    int fd = open(table_file, O_RDONLY);
+    if (fd < 0) {
+        return -1;   // no compiled table; the caller will read the text file
+    }
+    struct stat table_stat, text_stat;
+    if (fstat(fd, &table_stat) != 0 || table_stat.st_size < (off_t)sizeof(struct asn_table_header)) {
+        fprintf(stderr, "warning: ASN table file '%s' is truncated\n", table_file);
+        close(fd);
+        return -1;
+    }
+    if (text_file && stat(text_file, &text_stat) == 0 && text_stat.st_mtime > table_stat.st_mtime) {
+        fprintf(stderr, "warning: ASN table file '%s' is older than '%s'; ignoring it\n", table_file, text_file);
+        close(fd);
+        return -1;
+    }
+    size_t size = table_stat.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "warning: could not map ASN table file '%s' (%s)\n", table_file, strerror(errno));
+        return -1;
+    }
+
+    const struct asn_table_header *header = (const struct asn_table_header *)map;
+    if (memcmp(header->magic, asn_table_magic, sizeof(asn_table_magic)) != 0
+        || header->version != asn_table_version
+        || header->byte_order != asn_table_byte_order
+        || header->sizeof_subnet != sizeof(lct_subnet_t)
+        || header->sizeof_subnet6 != sizeof(lct_subnet6_t)
+        || header->sizeof_node != sizeof(lct_node_t)) {
+        fprintf(stderr, "warning: ASN table file '%s' has an unsupported version or layout; ignoring it\n", table_file);
+        munmap(map, size);
+        return -1;
+    }
+
+    const lct_subnet_t *nets = (const lct_subnet_t *)table_section(header, size, header->ipv4_nets, sizeof(lct_subnet_t));
+    const uint32_t *bases = (const uint32_t *)table_section(header, size, header->ipv4_bases, sizeof(uint32_t));
+    const lct_node_t *nodes = (const lct_node_t *)table_section(header, size, header->ipv4_nodes, sizeof(lct_node_t));
+    const lct_subnet6_t *nets6 = (const lct_subnet6_t *)table_section(header, size, header->ipv6_nets, sizeof(lct_subnet6_t));
+    const uint32_t *bases6 = (const uint32_t *)table_section(header, size, header->ipv6_bases, sizeof(uint32_t));
+    const lct_node_t *nodes6 = (const lct_node_t *)table_section(header, size, header->ipv6_nodes, sizeof(lct_node_t));
+    const uint32_t *tbl24 = (const uint32_t *)table_section(header, size, header->dir24_tbl24, sizeof(uint32_t));
+    const uint32_t *tbl8 = (const uint32_t *)table_section(header, size, header->dir24_tbl8, 256 * sizeof(uint32_t));
+    bool has_dir24 = header->dir24_tbl24.count != 0;
+
+    if (nets == NULL || bases == NULL || nodes == NULL || nets6 == NULL || bases6 == NULL || nodes6 == NULL
+        || header->ipv4_nets.count > UINT32_MAX || header->ipv6_nets.count > UINT32_MAX
+        || header->ipv4_nodes.count > UINT32_MAX || header->ipv6_nodes.count > UINT32_MAX
+        || !trie_is_valid(nodes, header->ipv4_nodes.count, bases, header->ipv4_bases.count, nets, header->ipv4_nets.count, 32)
+        || !trie_is_valid(nodes6, header->ipv6_nodes.count, bases6, header->ipv6_bases.count, nets6, header->ipv6_nets.count, 128)
+        || (has_dir24 && ipv4_lookup == asn_lookup_dir_24_8
+            && (tbl24 == NULL || tbl8 == NULL || header->dir24_tbl24.count != (1 << 24) || !dir24_is_valid(tbl24, header->dir24_tbl8.count)))) {
+        fprintf(stderr, "warning: ASN table file '%s' is corrupt; ignoring it\n", table_file);
+        munmap(map, size);
+        return -1;
+    }
+
+    // the lookup functions only read the tries, tables, and subnet
+    // arrays, so they can point directly into the read-only mapping
+    //
+    ipv4_lookup_type = ipv4_lookup;
+    if (ipv4_lookup == asn_lookup_dir_24_8) {
+        if (has_dir24) {
+            ipv4_dir24.tbl24 = (uint32_t *)tbl24;
+            ipv4_dir24.tbl8 = (uint32_t *)tbl8;
+            ipv4_dir24.tbl8_count = ipv4_dir24.tbl8_alloc = header->dir24_tbl8.count;
+            ipv4_dir24_is_mapped = true;
+        } else if (lct_dir24_build(&ipv4_dir24, nets, header->ipv4_nets.count) != 0) {
+            munmap(map, size);
+            return -1;
+        }
+    } else {
+        ipv4_subnet_array = (lct_subnet_t *)nets;
+        ipv4_subnet_count = header->ipv4_nets.count;
+        ipv4_subnet_trie.ncount = header->ipv4_nodes.count;
+        ipv4_subnet_trie.bcount = header->ipv4_bases.count;
+        ipv4_subnet_trie.shortest = header->ipv4_shortest;
+        ipv4_subnet_trie.bases = (uint32_t *)bases;
+        ipv4_subnet_trie.nets = (lct_subnet_t *)nets;
+        ipv4_subnet_trie.root = (lct_node_t *)nodes;
+    }
+    ipv6_subnet_array = (lct_subnet6_t *)nets6;
+    ipv6_subnet_count = header->ipv6_nets.count;
+    ipv6_subnet_trie.ncount = header->ipv6_nodes.count;
+    ipv6_subnet_trie.bcount = header->ipv6_bases.count;
+    ipv6_subnet_trie.shortest = header->ipv6_shortest;
+    ipv6_subnet_trie.bases = (uint32_t *)bases6;
+    ipv6_subnet_trie.nets = (lct_subnet6_t *)nets6;
+    ipv6_subnet_trie.root = (lct_node_t *)nodes6;
+
+    asn_table_map = map;
+    asn_table_map_size = size;
+
     return 0;
 }
 
 void addr_finalize() {
-    free(ipv4_subnet_trie.root);
-    lct_free(&ipv4_subnet_trie);
-    free(ipv4_subnet_array);
+    if (asn_table_map) {
+        if (!ipv4_dir24_is_mapped) {
+            lct_dir24_free(&ipv4_dir24);
+        }
+        munmap(asn_table_map, asn_table_map_size);
+        asn_table_map = NULL;
+        asn_table_map_size = 0;
+        ipv4_dir24_is_mapped = false;
+        memset(&ipv4_dir24, 0, sizeof(ipv4_dir24));
+        memset(&ipv4_subnet_trie, 0, sizeof(ipv4_subnet_trie));
+        memset(&ipv6_subnet_trie, 0, sizeof(ipv6_subnet_trie));
+        ipv4_subnet_array = NULL;
+        ipv6_subnet_array = NULL;
+        ipv4_subnet_count = ipv6_subnet_count = 0;
+        return;
+    }
+    if (ipv4_subnet_array) {
+        free(ipv4_subnet_trie.root);
+        lct_free(&ipv4_subnet_trie);
+        free(ipv4_subnet_array);
+        ipv4_subnet_array = NULL;
+    }
+    lct_dir24_free(&ipv4_dir24);
+    if (ipv6_subnet_array) {
+        free(ipv6_subnet_trie.root);
+        lct6_free(&ipv6_subnet_trie);
+        free(ipv6_subnet_array);
+        ipv6_subnet_array = NULL;
+    }
 }
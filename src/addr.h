@@ -9,8 +9,60 @@
 #include <string>
 #include "mercury.h"
 
+/*
+ * get_asn_info(dst_ip) returns the autonomous system number of the
+ * longest matching prefix for the IPv4 or IPv6 address in the string
+ * dst_ip, or zero if there is none
+ */
 uint32_t get_asn_info(char* dst_ip);
 
-int addr_init(const char *resources_dir);
+/*
+ * get_asn_info_ipv4(addr) and get_asn_info_ipv6(addr) are as above,
+ * for an IPv4 address and a 16-byte IPv6 address in network byte
+ * order; they avoid the cost of converting the address to and from
+ * text
+ */
+uint32_t get_asn_info_ipv4(uint32_t addr);
+
+uint32_t get_asn_info_ipv6(const uint8_t *addr);
+
+/*
+ * the batch functions set asn[i] to the autonomous system number for
+ * the address addr[i], for each of the num addresses; they are much
+ * faster than the equivalent loop over individual lookups, because
+ * the trie walks for the different addresses are interleaved
+ */
+void get_asn_info_batch_ipv4(const uint32_t *addr, uint32_t *asn, size_t num);
+
+void get_asn_info_batch_ipv6(const uint8_t (*addr)[16], uint32_t *asn, size_t num);
+
+/*
+ * addr_init(filename, ipv4_lookup) reads the pyasn.db file filename
+ * and builds the IPv4 and IPv6 lookup structures, using the data
+ * structure selected by ipv4_lookup for IPv4; it returns 0 on
+ * success, and -1 otherwise
+ */
+int addr_init(const char *resources_dir, enum asn_lookup_type ipv4_lookup);
+
+/*
+ * addr_init_from_table(table_file, text_file, ipv4_lookup) is
+ * equivalent to addr_init(text_file, ipv4_lookup), but maps the
+ * compiled ASN table table_file read-only instead of parsing the text
+ * file, which is nearly instantaneous, and lets all of the processes
+ * that use the same table share one copy of it in the page cache.  It
+ * returns -1 if table_file does not exist, is not a valid table, or
+ * is older than text_file; the caller should then use addr_init().
+ */
+int addr_init_from_table(const char *table_file, const char *text_file, enum asn_lookup_type ipv4_lookup);
+
+/*
+ * addr_write_table(table_file, include_dir_24_8) writes the subnets
+ * and tries built by addr_init(), with the IPv4 lctrie lookup type,
+ * into the compiled ASN table table_file; if include_dir_24_8 is
+ * true, then a DIR-24-8 table is included as well, so that it need
+ * not be built at load time.  It returns 0 on success, and -1
+ * otherwise.
+ */
+int addr_write_table(const char *table_file, bool include_dir_24_8);
 
 void addr_finalize();
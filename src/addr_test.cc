@@ -0,0 +1,314 @@
+/*
+ * addr_test.cc
+ *
+ * correctness checks and a throughput benchmark for the IPv4 and IPv6
+ * autonomous system number lookups in addr.cc
+ *
+ * usage: addr_test <pyasn.db> [<pyasn.bin>]
+ *
+ * The checks and benchmarks are run once for each of the IPv4 lookup
+ * data structures, and if a compiled ASN table is given, they are run
+ * again with the lookup structures mapped from that table.
+ *
+ * The lookup addresses are generated by picking random host
+ * addresses inside of the prefixes listed in the file, so that nearly
+ * every lookup walks the trie down to a BGP subnet.  The ASN that
+ * each lookup should return is computed independently of the lookup
+ * data structures, by a longest prefix match over the parsed subnets.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <map>
+#include <random>
+#include <vector>
+#include "addr.h"
+#include "utils.h"
+
+extern "C" {
+#include "lctrie/lctrie_ip6.h"
+}
+
+struct ipv6_addr {
+    uint8_t bytes[16];
+};
+
+/*
+ * struct reference_lookup<A, bits> is a longest prefix match over a
+ * list of subnets, done the obvious way: one ordered map per prefix
+ * length, probed from the longest length down.  A subnet that is
+ * listed more than once with different ASNs is ambiguous, because
+ * the lookup tables keep whichever copy sorts first, so lookups that
+ * match it are not checked.
+ */
+template <typename A, unsigned int bits>
+struct reference_lookup {
+    static const uint32_t ambiguous = UINT32_MAX;
+
+    std::map<A, uint32_t> subnets[bits + 1];
+
+    static A mask(A addr, unsigned int len) {
+        return len ? addr >> (bits - len) << (bits - len) : 0;
+    }
+
+    void add(A addr, unsigned int len, uint32_t asn) {
+        auto x = subnets[len].emplace(mask(addr, len), asn);
+        if (x.second == false && x.first->second != asn) {
+            x.first->second = ambiguous;
+        }
+    }
+
+    // lookup(addr) returns the ASN of the longest subnet that contains
+    // addr, zero if there is none, or ambiguous
+    //
+    uint32_t lookup(A addr) const {
+        for (int len = bits; len >= 0; len--) {
+            auto x = subnets[len].find(mask(addr, len));
+            if (x != subnets[len].end()) {
+                return x->second;
+            }
+        }
+        return 0;
+    }
+};
+
+struct reference_lookup<uint32_t, 32> reference_ipv4;
+struct reference_lookup<lct_ip6_addr_t, 128> reference_ipv6;
+
+/*
+ * read_prefixes(filename, v4, v6) reads the subnets in the pyasn
+ * file filename, adds them to the reference lookups, and appends one
+ * random host address from each to either v4 or v6.  The private and
+ * special-purpose subnets that addr_init() adds to every table are
+ * added to the reference lookups with the ASN zero.
+ */
+static int read_prefixes(const char *filename, std::vector<uint32_t> &v4, std::vector<struct ipv6_addr> &v6) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        return -1;
+    }
+
+    lct_subnet_t special[64];
+    int num = init_private_subnets(special, 64);
+    num += init_special_subnets(special + num, 64 - num);
+    for (int i = 0; i < num; i++) {
+        reference_ipv4.add(special[i].addr, special[i].len, 0);
+    }
+    lct_subnet6_t special6[64];
+    num = init_special_subnets6(special6, 64);
+    for (int i = 0; i < num; i++) {
+        reference_ipv6.add(special6[i].addr, special6[i].len, 0);
+    }
+
+    std::mt19937_64 rng{0x5eed};
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        char *slash = strchr(line, '/');
+        if (line[0] == ';' || line[0] == '#' || slash == NULL) {
+            continue;
+        }
+        *slash = '\0';
+        unsigned int len;
+        uint32_t asn;
+        if (sscanf(slash + 1, "%u\t%u", &len, &asn) != 2 || len == 0) {
+            continue;
+        }
+        if (strchr(line, ':') != NULL) {
+            struct ipv6_addr a;
+            if (inet_pton(AF_INET6, line, a.bytes) != 1 || len > 128) {
+                continue;
+            }
+            reference_ipv6.add(lct_ip6_addr_from_bytes(a.bytes), len, asn);
+            for (unsigned int bit = len; bit < 128; bit++) {
+                if (rng() & 1) {
+                    a.bytes[bit / 8] |= 0x80 >> (bit % 8);
+                }
+            }
+            v6.push_back(a);
+        } else {
+            uint32_t a;
+            if (inet_pton(AF_INET, line, &a) != 1 || len > 32) {
+                continue;
+            }
+            reference_ipv4.add(ntohl(a), len, asn);
+            uint32_t host_mask = (uint32_t)(((uint64_t)1 << (32 - len)) - 1);
+            v4.push_back(htonl(ntohl(a) | (rng() & host_mask)));
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/*
+ * repeat(v, n) returns n elements drawn from v in a random order, so
+ * that successive lookups do not hit neighboring parts of the trie
+ */
+template <typename T>
+static std::vector<T> repeat(const std::vector<T> &v, size_t n) {
+    std::mt19937_64 rng{0xa5a};
+    std::vector<T> out;
+    out.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        out.push_back(v[rng() % v.size()]);
+    }
+    return out;
+}
+
+static void report(const char *name, size_t num, uint64_t ns, uint64_t checksum) {
+    fprintf(stdout, "%-12s lookups: %zu\ttime: %.3f s\trate: %.3e lookups/sec\tns/lookup: %.1f\t(checksum %lu)\n",
+            name, num, ns / 1e9, num * 1e9 / ns, (double)ns / num, checksum);
+}
+
+/*
+ * check_and_benchmark(v4, v6) checks that the text, binary, and batch
+ * lookups of the addresses in v4 and v6 return the ASNs that the
+ * reference lookups do, benchmarks them, and returns the number of
+ * lookups that did not
+ */
+static unsigned int check_and_benchmark(const std::vector<uint32_t> &v4, const std::vector<struct ipv6_addr> &v6) {
+    unsigned int failures = 0;
+    size_t unchecked = 0;
+    char addr_str[INET6_ADDRSTRLEN];
+    std::vector<uint32_t> asn(v4.size() > v6.size() ? v4.size() : v6.size());
+    get_asn_info_batch_ipv4(v4.data(), asn.data(), v4.size());
+    for (size_t i = 0; i < v4.size(); i++) {
+        uint32_t expected = reference_ipv4.lookup(ntohl(v4[i]));
+        if (expected == reference_ipv4.ambiguous) {
+            unchecked++;
+            continue;
+        }
+        inet_ntop(AF_INET, &v4[i], addr_str, sizeof(addr_str));
+        uint32_t a = get_asn_info_ipv4(v4[i]);
+        if (a != expected || asn[i] != expected || get_asn_info(addr_str) != expected) {
+            fprintf(stdout, "FAIL: %s -> %u (batch %u, expected %u)\n", addr_str, a, asn[i], expected);
+            failures++;
+        }
+    }
+    static_assert(sizeof(struct ipv6_addr) == 16, "ipv6_addr must be 16 bytes");
+    get_asn_info_batch_ipv6((const uint8_t (*)[16])v6.data(), asn.data(), v6.size());
+    for (size_t i = 0; i < v6.size(); i++) {
+        uint32_t expected = reference_ipv6.lookup(lct_ip6_addr_from_bytes(v6[i].bytes));
+        if (expected == reference_ipv6.ambiguous) {
+            unchecked++;
+            continue;
+        }
+        inet_ntop(AF_INET6, v6[i].bytes, addr_str, sizeof(addr_str));
+        uint32_t a = get_asn_info_ipv6(v6[i].bytes);
+        if (a != expected || asn[i] != expected || get_asn_info(addr_str) != expected) {
+            fprintf(stdout, "FAIL: %s -> %u (batch %u, expected %u)\n", addr_str, a, asn[i], expected);
+            failures++;
+        }
+    }
+    if (unchecked) {
+        fprintf(stdout, "unchecked: %zu lookups that match ambiguous subnets\n", unchecked);
+    }
+    fprintf(stdout, "correctness: %u failures\n", failures);
+
+    const size_t num_lookups = 20000000;
+    struct timer t;
+    uint64_t checksum;
+    uint64_t ns;
+    if (!v4.empty()) {
+        std::vector<uint32_t> keys = repeat(v4, num_lookups);
+        std::vector<uint32_t> out(num_lookups);
+
+        checksum = 0;
+        timer_start(&t);
+        for (size_t i = 0; i < num_lookups; i++) {
+            out[i] = get_asn_info_ipv4(keys[i]);
+        }
+        ns = timer_stop(&t);
+        for (uint32_t a : out) {
+            checksum += a;
+        }
+        report("ipv4", num_lookups, ns, checksum);
+
+        checksum = 0;
+        timer_start(&t);
+        get_asn_info_batch_ipv4(keys.data(), out.data(), num_lookups);
+        ns = timer_stop(&t);
+        for (uint32_t a : out) {
+            checksum += a;
+        }
+        report("ipv4 batch", num_lookups, ns, checksum);
+    }
+    if (!v6.empty()) {
+        std::vector<struct ipv6_addr> keys = repeat(v6, num_lookups);
+        std::vector<uint32_t> out(num_lookups);
+
+        checksum = 0;
+        timer_start(&t);
+        for (size_t i = 0; i < num_lookups; i++) {
+            out[i] = get_asn_info_ipv6(keys[i].bytes);
+        }
+        ns = timer_stop(&t);
+        for (uint32_t a : out) {
+            checksum += a;
+        }
+        report("ipv6", num_lookups, ns, checksum);
+
+        checksum = 0;
+        timer_start(&t);
+        get_asn_info_batch_ipv6((const uint8_t (*)[16])keys.data(), out.data(), num_lookups);
+        ns = timer_stop(&t);
+        for (uint32_t a : out) {
+            checksum += a;
+        }
+        report("ipv6 batch", num_lookups, ns, checksum);
+    }
+
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s <pyasn.db> [<pyasn.bin>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<uint32_t> v4;
+    std::vector<struct ipv6_addr> v6;
+    if (read_prefixes(argv[1], v4, v6) != 0 || (v4.empty() && v6.empty())) {
+        fprintf(stderr, "error: no subnets found in %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "subnets: %zu IPv4, %zu IPv6\n", v4.size(), v6.size());
+
+    struct {
+        enum asn_lookup_type type;
+        const char *name;
+    } ipv4_lookup[] = {
+        { asn_lookup_lctrie,   "lctrie" },
+        { asn_lookup_dir_24_8, "dir-24-8" }
+    };
+    unsigned int failures = 0;
+    for (const auto &l : ipv4_lookup) {
+        struct timer t;
+        timer_start(&t);
+        if (addr_init(argv[1], l.type) != 0) {
+            fprintf(stderr, "error: could not load subnets from %s\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+        fprintf(stdout, "\nipv4 lookup: %s\tbuild time: %.3f ms\n", l.name, timer_stop(&t) / 1000000.0);
+        failures += check_and_benchmark(v4, v6);
+        addr_finalize();
+
+        if (argc == 3) {
+            timer_start(&t);
+            if (addr_init_from_table(argv[2], NULL, l.type) != 0) {
+                fprintf(stderr, "error: could not load subnets from %s\n", argv[2]);
+                return EXIT_FAILURE;
+            }
+            fprintf(stdout, "\nipv4 lookup: %s (mapped)\tload time: %.3f ms\n", l.name, timer_stop(&t) / 1000000.0);
+            failures += check_and_benchmark(v4, v6);
+            addr_finalize();
+        }
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
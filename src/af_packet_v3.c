@@ -1,12 +1,15 @@
 /*
  * af_packet_v3.c
  *
- * interface to AF_PACKET/TPACKETv3 with RX_RING and FANOUT
+ * interface to AF_PACKET/TPACKETv3 with RX_RING and FANOUT, and to
+ * AF_XDP (see af_xdp.h), which share the worker and stats threads
  *
  * Copyright (c) 2019 Cisco Systems, Inc. All rights reserved.
  * License at https://github.com/cisco/mercury/blob/master/LICENSE
  */
 
+#define USE_JSON_FILE_OBJECT  /* for the stats records */
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -32,11 +35,16 @@
 #include <math.h>
 
 #include "af_packet_v3.h"
+#include "af_xdp.h"
 #include "signal_handling.h"
 #include "utils.h"
 #include "rnd_pkt_drop.h"
 #include "output.h"
 #include "pkt_proc.h"
+#include "bpf_prefilter.h"
+#include "extractor.h"
+#include "json_object.h"
+#include "metrics.h"
 
 /*
  * The thread_storage, stats_tracking, and ring_limits structs are
@@ -57,6 +65,16 @@ struct ring_limits {
 };
 
 
+/*
+ * The counters that the kernel keeps for each socket, since they were
+ * last read
+ */
+struct socket_stats {
+  uint64_t packets;
+  uint64_t drops;
+  uint64_t freezes;
+};
+
 /*
  * Our stats tracking function will get a pointer to a struct
  * that has the info it needs to track stats for each thread
@@ -74,6 +92,27 @@ struct stats_tracking {
   pthread_cond_t *t_start_c;  /* The clean start condition */
   pthread_mutex_t *t_start_m; /* The clean start mutex */
   int verbosity;
+  FILE *stats_file;           /* The JSON stats records, or NULL */
+  enum ring_tuning ring_tuning;     /* What to do with the ring recommendations */
+  const struct ring_limits *rl;     /* The limits on the ring recommendations */
+  struct tpacket_req3 ring_params;  /* The ring parameters of the AF_PACKET sockets */
+  unsigned int latency_sampling;    /* Packets per latency sample, or 0 */
+};
+
+/*
+ * struct thread_stats holds the statistics of a thread for the latest
+ * second, for the stats records; it is only used by the stats thread
+ */
+struct thread_stats {
+  struct socket_stats socket;
+  uint32_t block_count;
+  uint32_t block_size;
+  uint32_t block_timeout;
+  double rusage;              /* Average rbuffer usage */
+  double i_rusage;            /* Worst instantaneous rbuffer usage */
+  uint64_t blocks_read;
+  uint64_t blocks_timed_out;
+  double *block_streak_hist;  /* A copy of the block streak histogram (with --stats-file) */
 };
 
 /*
@@ -86,13 +125,21 @@ struct thread_storage {
   pthread_t tid;            /* Thread ID */
   pthread_attr_t thread_attributes;
   int sockfd;               /* Socket owned by this thread */
+  struct af_xdp_socket *xsk; /* AF_XDP socket owned by this thread, or NULL with AF_PACKET */
   const char *if_name;      /* The name of the interface to bind the socket to */
   uint8_t *mapped_buffer;   /* The pointer to the mmap()'d region */
   struct tpacket_block_desc **block_header; /* The pointer to each block in the mmap()'d region */
   struct tpacket_req3 ring_params; /* The ring allocation params to setsockopt() */
+  uint32_t block_count;       /* The number of blocks in the ring (with AF_XDP, batches of descriptors) */
+  uint32_t snaplen;           /* The number of bytes captured per packet (with AF_XDP), or 0 for all */
   struct stats_tracking *statst;   /* A pointer to the struct with the stats counters */
   double *block_streak_hist;  /* The block streak histogram */
   pthread_mutex_t bstreak_m;  /* The block streak mutex */
+  uint64_t blocks_read;       /* Blocks read since the stats thread last looked (under bstreak_m) */
+  uint64_t blocks_timed_out;  /* ...of which the kernel returned because of the block timeout */
+  bool resize_ring;           /* The stats thread requests a new ring (under bstreak_m) */
+  struct tpacket_req3 resize_params; /* The parameters of the new ring */
+  struct thread_stats last_stats;   /* The statistics of the latest second */
   int *t_start_p;             /* The clean start predicate */
   pthread_cond_t *t_start_c;  /* The clean start condition */
   pthread_mutex_t *t_start_m; /* The clean start mutex */
@@ -128,22 +175,51 @@ static double time_elapsed(struct timespec *ts) {
   return (ts->tv_sec + (ts->tv_nsec / 1000000000.0)) - time_s;
 }
 
-void af_packet_stats(int sockfd, struct stats_tracking *statst) {
+/*
+ * af_packet_stats() adds the counters of a socket to the stats, and
+ * returns them
+ */
+struct socket_stats af_packet_stats(int sockfd, struct stats_tracking *statst) {
   int err;
   struct tpacket_stats_v3 tp3_stats;
+  struct socket_stats ss = { 0, 0, 0 };
 
   socklen_t tp3_len = sizeof(tp3_stats);
   err = getsockopt(sockfd, SOL_PACKET, PACKET_STATISTICS, &tp3_stats, &tp3_len);
   if (err) {
     perror("error: could not get packet statistics for the given socket");
-    return;
+    return ss;
   }
+  ss.packets = tp3_stats.tp_packets;
+  ss.drops = tp3_stats.tp_drops;
+  ss.freezes = tp3_stats.tp_freeze_q_cnt;
 
   if (statst != NULL) {
-    statst->socket_packets += tp3_stats.tp_packets;
-    statst->socket_drops += tp3_stats.tp_drops;
-    statst->socket_freezes += tp3_stats.tp_freeze_q_cnt;
+    statst->socket_packets += ss.packets;
+    statst->socket_drops += ss.drops;
+    statst->socket_freezes += ss.freezes;
   }
+  return ss;
+}
+
+/*
+ * af_xdp_stats() is the AF_XDP counterpart of af_packet_stats(); the
+ * packets dropped because the fill ring was empty are counted as
+ * freezes, since both mean that the kernel had nowhere to put them
+ */
+struct socket_stats af_xdp_stats(struct af_xdp_socket *xsk, struct stats_tracking *statst) {
+  struct socket_stats ss = { 0, 0, 0 };
+
+  if (af_xdp_socket_stats(xsk, &ss.packets, &ss.drops, &ss.freezes) != status_ok) {
+    return ss;
+  }
+
+  if (statst != NULL) {
+    statst->socket_packets += ss.packets;
+    statst->socket_drops += ss.drops;
+    statst->socket_freezes += ss.freezes;
+  }
+  return ss;
 }
 
 void process_all_packets_in_block(struct tpacket_block_desc *block_hdr,
@@ -153,7 +229,13 @@ void process_all_packets_in_block(struct tpacket_block_desc *block_hdr,
   unsigned long byte_count = 0;
   struct tpacket3_hdr *pkt_hdr;
   //struct timespec ts;
-  struct packet_info pi;
+
+  /*
+   * The packets in the block are passed to the packet processor in
+   * batches of up to max_batch_size packets.
+   */
+  struct packet_descriptor batch[pkt_proc::max_batch_size];
+  size_t batch_size = 0;
 
   pkt_hdr = (struct tpacket3_hdr *) ((uint8_t *) block_hdr + block_hdr->hdr.bh1.offset_to_first_pkt);
   for (i = 0; i < num_pkts; ++i) {
@@ -165,18 +247,26 @@ void process_all_packets_in_block(struct tpacket_block_desc *block_hdr,
        */
       byte_count += pkt_hdr->tp_snaplen;
 
+    struct packet_info *pi = &batch[batch_size].info;
+
     /* Grab the times */
-    pi.ts.tv_sec = pkt_hdr->tp_sec;
-    pi.ts.tv_nsec = pkt_hdr->tp_nsec;
+    pi->ts.tv_sec = pkt_hdr->tp_sec;
+    pi->ts.tv_nsec = pkt_hdr->tp_nsec;
 
-    pi.caplen = pkt_hdr->tp_snaplen;
-    pi.len = pkt_hdr->tp_snaplen;
+    pi->caplen = pkt_hdr->tp_snaplen;
+    pi->len = pkt_hdr->tp_len;
 
-    uint8_t *eth = (uint8_t *)pkt_hdr + pkt_hdr->tp_mac;
-    pkt_processor->apply(&pi, eth);
+    batch[batch_size].eth = (uint8_t *)pkt_hdr + pkt_hdr->tp_mac;
+    if (++batch_size == pkt_proc::max_batch_size) {
+        pkt_processor->apply_batch(batch, batch_size);
+        batch_size = 0;
+    }
 
     pkt_hdr = (struct tpacket3_hdr *) ((uint8_t *)pkt_hdr + pkt_hdr->tp_next_offset);
   }
+  if (batch_size) {
+      pkt_processor->apply_batch(batch, batch_size);
+  }
 
   /* Atomic operations
    * https://gcc.gnu.org/onlinedocs/gcc-4.1.0/gcc/Atomic-Builtins.html
@@ -207,6 +297,88 @@ void check_socket_drops(int duration, uint64_t sdps, uint64_t sfps, int *socket_
     }
 }
 
+/*
+ * struct ring_usage accumulates the usage of the rings of all of the
+ * threads over a ring tuning interval
+ */
+struct ring_usage {
+  int seconds;
+  uint64_t drops;
+  uint64_t freezes;
+  uint64_t blocks_read;
+  uint64_t blocks_timed_out;
+  double worst_i_rusage;      /* Worst instantaneous rbuffer usage */
+};
+
+#define RING_TUNING_INTERVAL    10    /* seconds of usage behind each recommendation */
+#define RING_TUNING_MAX_TIMEOUT 1000  /* milliseconds */
+
+/*
+ * ring_params_recommend() sets rec to the ring parameters that it
+ * recommends for the usage u of rings with the parameters cur, and
+ * returns true if they differ from cur.  The memory of each ring
+ * stays the same, so that the block count is doubled by halving the
+ * block size.
+ *
+ * When a ring comes close to full, or the kernel froze it, the kernel
+ * is waiting for blocks that are still held by the thread.  If most
+ * blocks are returned by the block timeout, they are mostly empty,
+ * and a longer timeout packs more packets into each one; otherwise,
+ * more (and smaller) blocks are returned to the kernel sooner.  When
+ * a ring stays nearly empty, those changes are undone, one step at a
+ * time, to return to the defaults in rl.
+ */
+static bool ring_params_recommend(const struct ring_usage *u,
+				  const struct ring_limits *rl,
+				  const struct tpacket_req3 *cur,
+				  struct tpacket_req3 *rec) {
+  *rec = *cur;
+  bool mostly_timed_out = u->blocks_read && u->blocks_timed_out * 2 >= u->blocks_read;
+
+  if (u->drops || u->freezes || u->worst_i_rusage >= 0.75) {
+    if (mostly_timed_out && cur->tp_retire_blk_tov * 2 <= RING_TUNING_MAX_TIMEOUT) {
+      rec->tp_retire_blk_tov = cur->tp_retire_blk_tov * 2;
+    } else if ((cur->tp_block_size >> 1) >= rl->af_min_blocksize) {
+      rec->tp_block_size = cur->tp_block_size >> 1;
+      rec->tp_block_nr = cur->tp_block_nr * 2;
+    }
+  } else if (u->blocks_read && u->worst_i_rusage < 0.125) {
+    if (cur->tp_retire_blk_tov > rl->af_blocktimeout) {
+      rec->tp_retire_blk_tov = cur->tp_retire_blk_tov / 2;
+      if (rec->tp_retire_blk_tov < rl->af_blocktimeout) {
+	rec->tp_retire_blk_tov = rl->af_blocktimeout;
+      }
+    } else if ((cur->tp_block_size << 1) <= rl->af_blocksize && (cur->tp_block_nr >> 1) >= rl->af_target_blocks) {
+      rec->tp_block_size = cur->tp_block_size << 1;
+      rec->tp_block_nr = cur->tp_block_nr >> 1;
+    }
+  }
+  rec->tp_frame_nr = (rec->tp_block_size / rec->tp_frame_size) * rec->tp_block_nr;
+
+  return rec->tp_block_nr != cur->tp_block_nr || rec->tp_retire_blk_tov != cur->tp_retire_blk_tov;
+}
+
+#ifdef PKT_PROC_LATENCY
+/*
+ * latency_write_json(o, name, h) writes the summary of the latency
+ * histogram h, in nanoseconds, to the JSON object o
+ */
+static void latency_write_json(struct json_file_object &o, const char *name, const struct latency_histogram &h) {
+  struct latency_summary s = latency_histogram_summary(h);
+  if (s.count == 0) {
+    return;
+  }
+  struct json_file_object l(o, name);
+  l.print_key_uint("count", s.count);
+  l.print_key_float("p50", s.p50);
+  l.print_key_float("p90", s.p90);
+  l.print_key_float("p99", s.p99);
+  l.print_key_float("p999", s.p999);
+  l.print_key_float("max", s.max);
+  l.close();
+}
+#endif
+
 void *stats_thread_func(void *statst_arg) {
 
     struct stats_tracking *statst = (struct stats_tracking *)statst_arg;
@@ -236,6 +408,10 @@ void *stats_thread_func(void *statst_arg) {
   }
 
   char space[2] = " ";
+  struct ring_usage usage;
+  memset(&usage, 0, sizeof(usage));
+  struct tpacket_req3 recommended = statst->ring_params; /* The latest ring recommendation */
+  bool reported_full = false;
   struct timespec ts;
   double time_d; /* time delta */
   memset(&ts, 0, sizeof(ts));
@@ -269,11 +445,23 @@ void *stats_thread_func(void *statst_arg) {
     double tot_rusage = 0;   /* Sum of all threads rusage */
     double worst_rusage = 0; /* Worst average rbuffer usage */
     double worst_i_rusage = 0; /* Worst instantaneous rbuffer usage */
+    uint64_t max_thread_packets = 0; /* Most socket packets of a thread */
     for (int thread = 0; thread < statst->num_threads; thread++) {
-      af_packet_stats(statst->tstor[thread].sockfd, statst);
-
-      int thread_block_count = statst->tstor[thread].ring_params.tp_block_nr;
-      double *bstreak_hist = statst->tstor[thread].block_streak_hist;
+      struct thread_stats *tst = &(statst->tstor[thread].last_stats);
+      if (statst->tstor[thread].xsk) {
+        tst->socket = af_xdp_stats(statst->tstor[thread].xsk, statst);
+      } else {
+        tst->socket = af_packet_stats(statst->tstor[thread].sockfd, statst);
+      }
+      if (tst->socket.packets > max_thread_packets) {
+        max_thread_packets = tst->socket.packets;
+      }
+      struct thread_metrics *tm = metrics_thread(thread);
+      if (tm) {
+        pkt_proc_counter_add(tm->capture.socket_packets, tst->socket.packets);
+        pkt_proc_counter_add(tm->capture.socket_drops, tst->socket.drops);
+        pkt_proc_counter_add(tm->capture.socket_freezes, tst->socket.freezes);
+      }
 
       /* Get the lock for the bstreak histogram computation */
       err = pthread_mutex_lock(&(statst->tstor[thread].bstreak_m));
@@ -282,15 +470,26 @@ void *stats_thread_func(void *statst_arg) {
 	exit(255);
       }
 
+      /* The ring of the thread can be resized while it holds the lock */
+      int thread_block_count = statst->tstor[thread].block_count;
+      double *bstreak_hist = statst->tstor[thread].block_streak_hist;
+      tst->block_size = statst->tstor[thread].ring_params.tp_block_size;
+      tst->block_timeout = statst->tstor[thread].ring_params.tp_retire_blk_tov;
+      tst->blocks_read = statst->tstor[thread].blocks_read;
+      tst->blocks_timed_out = statst->tstor[thread].blocks_timed_out;
+      statst->tstor[thread].blocks_read = 0;
+      statst->tstor[thread].blocks_timed_out = 0;
+
       /* First compute the time total */
       double ttot = 0;
+      double i_rusage = 0;
       for (int i = 0; i <= thread_block_count; i++) {
 	ttot += bstreak_hist[i];
 
 	if (bstreak_hist[i] > 0) {
 	  double utmp = (double)(i) / (double)thread_block_count;
-	  if (utmp > worst_i_rusage) {
-	    worst_i_rusage = utmp;
+	  if (utmp > i_rusage) {
+	    i_rusage = utmp;
 	  }
 	}
 	//fprintf(stderr, "%d: %lu\n", i, bstreak_hist[i]);
@@ -305,6 +504,19 @@ void *stats_thread_func(void *statst_arg) {
 	}
       }
 
+      /* Keep a copy of the bstreak histogram for the stats records */
+      if (statst->stats_file) {
+	if (tst->block_count != (uint32_t)thread_block_count) {
+	  free(tst->block_streak_hist);
+	  tst->block_streak_hist = (double *)calloc(thread_block_count + 1, sizeof(double));
+	  tst->block_count = tst->block_streak_hist ? thread_block_count : 0;
+	}
+	if (tst->block_streak_hist) {
+	  memcpy(tst->block_streak_hist, bstreak_hist, (thread_block_count + 1) * sizeof(double));
+	}
+      }
+      tst->block_count = thread_block_count;
+
       /* Now clear the bstreak histogram */
       for (int i = 0; i <= thread_block_count; i++) {
 	bstreak_hist[i] = 0;
@@ -317,10 +529,22 @@ void *stats_thread_func(void *statst_arg) {
       }
 
       //fprintf(stderr, "[thread %d] Got ring usage of %4f\n", thread, rusage);
+      tst->rusage = rusage;
+      tst->i_rusage = i_rusage;
       tot_rusage += rusage;
       if (rusage > worst_rusage) {
 	worst_rusage = rusage;
       }
+      if (i_rusage > worst_i_rusage) {
+	worst_i_rusage = i_rusage;
+      }
+      usage.freezes += tst->socket.freezes;
+      usage.drops += tst->socket.drops;
+      usage.blocks_read += tst->blocks_read;
+      usage.blocks_timed_out += tst->blocks_timed_out;
+    }
+    if (worst_i_rusage > usage.worst_i_rusage) {
+      usage.worst_i_rusage = worst_i_rusage;
     }
 
     /* The per-second stats scaled by the time delta */
@@ -332,6 +556,16 @@ void *stats_thread_func(void *statst_arg) {
     uint64_t sdps = statst->socket_drops - socket_drops_before;
     uint64_t sfps = statst->socket_freezes - socket_freezes_before;
 
+    /* The skew is the ratio of the most packets that a thread's socket
+     * received to the average over all threads, so that 1.0 is an even
+     * division of the packets, and num_threads is the worst case
+     */
+    uint64_t socket_packets = statst->socket_packets - socket_packets_before;
+    double skew = 1.0;
+    if (socket_packets) {
+      skew = (double)max_thread_packets * statst->num_threads / socket_packets;
+    }
+
     /* Compute the estimated Ethernet rate which accounts for the
      * "extra" per-packet data including the:
      * interpacket gap (12 bytes)
@@ -376,12 +610,133 @@ void *stats_thread_func(void *statst_arg) {
                 "%7.03f%s Packets/s; Data Rate %7.03f%s bytes/s; "
                 "Ethernet Rate (est.) %7.03f%s bits/s; "
                 "Socket Packets %7.03f%s; Socket Drops %" PRIu64 " (packets); Socket Freezes %" PRIu64 "; "
-                "All threads avg. rbuf %4.1f%%; Worst thread avg. rbuf %4.1f%%; Worst instantaneous rbuf %4.1f%%\n",
+                "All threads avg. rbuf %4.1f%%; Worst thread avg. rbuf %4.1f%%; Worst instantaneous rbuf %4.1f%%; "
+                "Thread skew %.2f\n",
                 r_pps, r_pps_s, r_byps, r_byps_s,
                 r_ebips, r_ebips_s,
                 r_spps, r_spps_s, sdps, sfps,
                 (tot_rusage / (statst->num_threads)) * 100.0, worst_rusage * 100.0,
-                worst_i_rusage * 100.0);
+                worst_i_rusage * 100.0, skew);
+    }
+
+    /* Every RING_TUNING_INTERVAL seconds, compare the usage of the
+     * rings with their parameters, and recommend new ones, which the
+     * threads apply with --ring-tuning apply
+     */
+    if (statst->ring_tuning != ring_tuning_off && ++usage.seconds >= RING_TUNING_INTERVAL) {
+      struct tpacket_req3 rec;
+      if (ring_params_recommend(&usage, statst->rl, &statst->ring_params, &rec)) {
+	if (statst->ring_tuning == ring_tuning_apply) {
+	  fprintf(stderr, "Ring tuning: resizing rings to %u blocks of size %u with block timeout %u ms\n",
+		  rec.tp_block_nr, rec.tp_block_size, rec.tp_retire_blk_tov);
+	  for (int thread = 0; thread < statst->num_threads; thread++) {
+	    err = pthread_mutex_lock(&(statst->tstor[thread].bstreak_m));
+	    if (err != 0) {
+	      fprintf(stderr, "%s: stats func error acquiring bstreak mutex lock\n", strerror(err));
+	      exit(255);
+	    }
+	    statst->tstor[thread].resize_params = rec;
+	    statst->tstor[thread].resize_ring = true;
+	    err = pthread_mutex_unlock(&(statst->tstor[thread].bstreak_m));
+	    if (err != 0) {
+	      fprintf(stderr, "%s: stats func error releasing bstreak mutex lock\n", strerror(err));
+	      exit(255);
+	    }
+	  }
+	  statst->ring_params = rec;
+	} else if (memcmp(&rec, &recommended, sizeof(rec)) != 0) {
+	  fprintf(stderr, "Ring tuning: recommend %u blocks of size %u with block timeout %u ms (now %u blocks of size %u with block timeout %u ms)\n",
+		  rec.tp_block_nr, rec.tp_block_size, rec.tp_retire_blk_tov,
+		  statst->ring_params.tp_block_nr, statst->ring_params.tp_block_size, statst->ring_params.tp_retire_blk_tov);
+	}
+	recommended = rec;
+      } else {
+	recommended = statst->ring_params;
+	if ((usage.drops || usage.freezes) && reported_full == false) {
+	  fprintf(stderr, "Ring tuning: rings are full with the smallest blocks; use a larger --buffer\n");
+	  reported_full = true;
+	}
+      }
+      memset(&usage, 0, sizeof(usage));
+    }
+
+    /* The stats record for this second */
+    if (statst->stats_file) {
+      struct json_file_object record(statst->stats_file);
+      struct json_file_object stats(record, "stats");
+      stats.print_key_float("event_start", ts.tv_sec + (ts.tv_nsec / 1000000000.0));
+      stats.print_key_float("interval", time_d);
+      stats.print_key_uint("packets", statst->received_packets - packets_before);
+      stats.print_key_uint("bytes", statst->received_bytes - bytes_before);
+      stats.print_key_uint("socket_packets", socket_packets);
+      stats.print_key_uint("socket_drops", sdps);
+      stats.print_key_uint("socket_freezes", sfps);
+      stats.print_key_float("avg_rbuf", tot_rusage / statst->num_threads);
+      stats.print_key_float("worst_avg_rbuf", worst_rusage);
+      stats.print_key_float("worst_rbuf", worst_i_rusage);
+      stats.print_key_float("skew", skew);
+      struct json_file_array threads(stats, "threads");
+      for (int thread = 0; thread < statst->num_threads; thread++) {
+	const struct thread_stats *tst = &(statst->tstor[thread].last_stats);
+	struct json_file_object t(threads);
+	t.print_key_int("thread", thread);
+	t.print_key_uint("socket_packets", tst->socket.packets);
+	t.print_key_uint("socket_drops", tst->socket.drops);
+	t.print_key_uint("socket_freezes", tst->socket.freezes);
+	t.print_key_uint("blocks", tst->block_count);
+	if (statst->tstor[thread].xsk == NULL) {
+	  t.print_key_uint("block_size", tst->block_size);
+	  t.print_key_uint("block_timeout", tst->block_timeout);
+	}
+	t.print_key_float("avg_rbuf", tst->rusage);
+	t.print_key_float("worst_rbuf", tst->i_rusage);
+	t.print_key_uint("blocks_read", tst->blocks_read);
+	t.print_key_uint("blocks_timed_out", tst->blocks_timed_out);
+	struct json_file_array hist(t, "block_streak_hist");
+	for (uint32_t i = 0; tst->block_streak_hist && i <= tst->block_count; i++) {
+	  if (tst->block_streak_hist[i] > 0) {
+	    struct json_file_object h(hist);
+	    h.print_key_uint("blocks", i);
+	    h.print_key_float("seconds", tst->block_streak_hist[i]);
+	    h.close();
+	  }
+	}
+	hist.close();
+#ifdef PKT_PROC_LATENCY
+	struct thread_metrics *tm = metrics_thread(thread);
+	if (statst->latency_sampling && tm) {
+	  struct json_file_object latency(t, "latency");
+	  latency.print_key_uint("sampling", statst->latency_sampling);
+	  struct json_file_object stages(latency, "stages");
+	  for (unsigned int i = 0; i < num_latency_stages; i++) {
+	    latency_write_json(stages, latency_stage_name((enum latency_stage)i), tm->latency.stage[i]);
+	  }
+	  stages.close();
+	  struct json_file_object messages(latency, "messages");
+	  for (unsigned int i = 0; i < LATENCY_MAX_MESSAGE_TYPES; i++) {
+	    const char *name = pkt_proc_latency_message_name(i);
+	    if (name) {
+	      latency_write_json(messages, name, tm->latency.message[i]);
+	    }
+	  }
+	  messages.close();
+	  latency.close();
+	}
+#endif
+	t.close();
+      }
+      threads.close();
+      if (statst->ring_tuning != ring_tuning_off) {
+	struct json_file_object tuning(stats, "ring_tuning");
+	tuning.print_key_uint("blocks", recommended.tp_block_nr);
+	tuning.print_key_uint("block_size", recommended.tp_block_size);
+	tuning.print_key_uint("block_timeout", recommended.tp_retire_blk_tov);
+	tuning.close();
+      }
+      stats.close();
+      record.close();
+      fputc('\n', statst->stats_file);
+      fflush(statst->stats_file);
     }
 
     duration++;
@@ -404,7 +759,7 @@ void *stats_thread_func(void *statst_arg) {
  *  https://www.kernel.org/doc/Documentation/networking/packet_mmap.txt
  */
 
-int create_dedicated_socket(struct thread_storage *thread_stor, int fanout_arg) {
+int create_dedicated_socket(struct thread_storage *thread_stor, int fanout_arg, const struct sock_fprog *filter, const struct sock_fprog *fanout_prog) {
   int err;
   int sockfd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
   if (sockfd == -1) {
@@ -414,6 +769,18 @@ int create_dedicated_socket(struct thread_storage *thread_stor, int fanout_arg)
   /* Now store this socket file descriptor in the thread storage */
   thread_stor->sockfd = sockfd;
 
+  /*
+   * attach the socket filter (prefilter and snap length) before
+   * anything else, so that it applies to every packet in the ring
+   */
+  if (filter) {
+    err = setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, filter, sizeof(*filter));
+    if (err) {
+      fprintf(stderr, "%s: could not attach socket filter for thread %d\n", strerror(errno), thread_stor->tnum);
+      return -1;
+    }
+  }
+
   /*
    * set AF_PACKET version to V3, which is more performant, as it
    * reads in blocks of packets, not single packets
@@ -530,11 +897,26 @@ int create_dedicated_socket(struct thread_storage *thread_stor, int fanout_arg)
     return -1;
   }
 
+  /*
+   * the fanout program of the group (with PACKET_FANOUT_CBPF)
+   */
+  if (fanout_prog) {
+    err = setsockopt(sockfd, SOL_PACKET, PACKET_FANOUT_DATA, fanout_prog, sizeof(*fanout_prog));
+    if (err) {
+      perror("error: could not attach fanout program");
+      return -1;
+    }
+  }
+
   return 0;
 }
 
 
-int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
+/*
+ * wait_for_clean_start() returns when the main thread broadcasts the
+ * clean start condition
+ */
+void wait_for_clean_start(struct thread_storage *thread_stor) {
 
   int err;
   /* At this point this thread is ready to go
@@ -559,6 +941,93 @@ int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
     fprintf(stderr, "%s: error unlocking clean start mutex for thread %lu\n", strerror(err), thread_stor->tid);
     exit(255);
   }
+}
+
+/*
+ * af_packet_ring_resize() replaces the RX_RING of the socket of a
+ * thread with one that has the parameters req, or if the kernel
+ * refuses them, with one that has the previous parameters.  The
+ * packets that arrive while there is no ring are lost.  It is called
+ * by the thread that owns the socket, when it holds no blocks.
+ */
+void af_packet_ring_resize(struct thread_storage *thread_stor, const struct tpacket_req3 *req) {
+  int err;
+  int sockfd = thread_stor->sockfd;
+  struct tpacket_req3 params = *req;
+
+  /* the kernel only frees a ring that is not mapped */
+  munmap(thread_stor->mapped_buffer, thread_stor->ring_params.tp_block_size * thread_stor->ring_params.tp_block_nr);
+  struct tpacket_req3 no_ring;
+  memset(&no_ring, 0, sizeof(no_ring));
+  err = setsockopt(sockfd, SOL_PACKET, PACKET_RX_RING, (void *)&no_ring, sizeof(no_ring));
+  if (err == -1) {
+    fprintf(stderr, "%s: could not free RX_RING for thread %d\n", strerror(errno), thread_stor->tnum);
+    exit(255);
+  }
+  err = setsockopt(sockfd, SOL_PACKET, PACKET_RX_RING, (void *)&params, sizeof(params));
+  if (err == -1) {
+    fprintf(stderr, "%s: could not resize RX_RING for thread %d, keeping %u blocks of size %u\n",
+	    strerror(errno), thread_stor->tnum, thread_stor->ring_params.tp_block_nr, thread_stor->ring_params.tp_block_size);
+    params = thread_stor->ring_params;
+    err = setsockopt(sockfd, SOL_PACKET, PACKET_RX_RING, (void *)&params, sizeof(params));
+    if (err == -1) {
+      fprintf(stderr, "%s: could not restore RX_RING for thread %d\n", strerror(errno), thread_stor->tnum);
+      exit(255);
+    }
+  }
+
+  /*
+   * after privileges are dropped, RLIMIT_MEMLOCK may not allow a
+   * locked mapping; the pages of the ring belong to the kernel, so
+   * they stay resident either way
+   */
+  size_t ring_size = (size_t)params.tp_block_size * params.tp_block_nr;
+  uint8_t *mapped_buffer = (uint8_t *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, sockfd, 0);
+  if (mapped_buffer == MAP_FAILED) {
+    mapped_buffer = (uint8_t *)mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, sockfd, 0);
+  }
+  if (mapped_buffer == MAP_FAILED) {
+    fprintf(stderr, "%s: mmap failed for thread %d\n", strerror(errno), thread_stor->tnum);
+    exit(255);
+  }
+  struct tpacket_block_desc **block_header = (struct tpacket_block_desc **)realloc(thread_stor->block_header, params.tp_block_nr * sizeof(struct tpacket_block_desc *));
+  double *block_streak_hist = (double *)calloc(params.tp_block_nr + 1, sizeof(double));
+  if (block_header == NULL || block_streak_hist == NULL) {
+    fprintf(stderr, "error: could not allocate ring state for thread %d\n", thread_stor->tnum);
+    exit(255);
+  }
+  for (unsigned int i = 0; i < params.tp_block_nr; ++i) {
+    block_header[i] = (struct tpacket_block_desc *)(mapped_buffer + (i * params.tp_block_size));
+  }
+  thread_stor->mapped_buffer = mapped_buffer;
+  thread_stor->block_header = block_header;
+
+  /* the stats thread reads the histogram and ring parameters */
+  err = pthread_mutex_lock(&(thread_stor->bstreak_m));
+  if (err != 0) {
+    fprintf(stderr, "%s: error acquiring bstreak mutex lock\n", strerror(err));
+    exit(255);
+  }
+  free(thread_stor->block_streak_hist);
+  thread_stor->block_streak_hist = block_streak_hist;
+  thread_stor->block_count = params.tp_block_nr;
+  thread_stor->ring_params = params;
+  err = pthread_mutex_unlock(&(thread_stor->bstreak_m));
+  if (err != 0) {
+    fprintf(stderr, "%s: error releasing bstreak mutex lock\n", strerror(err));
+    exit(255);
+  }
+
+  if (thread_stor->statst->verbosity) {
+    fprintf(stderr, "Thread %d has a PACKET_RX_RING with %u blocks of size %u and block timeout %u ms\n",
+	    thread_stor->tnum, params.tp_block_nr, params.tp_block_size, params.tp_retire_blk_tov);
+  }
+}
+
+int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
+
+  int err;
+  wait_for_clean_start(thread_stor);
 
   /* get local copies from the thread_stor struct so we can skip
    * pointer dereferences each time we access one
@@ -633,6 +1102,8 @@ int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
 
   int pstreak = 0;      /* Tracks the number of times in a row (the streak) poll() has told us there is data */
   uint64_t bstreak = 0; /* The number of blocks in a row we've gotten without a poll() */
+  uint64_t blocks_read = 0;      /* The blocks processed since the stats were last updated */
+  uint64_t blocks_timed_out = 0; /* ...that the kernel returned because of the block timeout */
   int polret;           /* The return value from poll() */
   int haveflushed = 0;  /* Tracks whether we've opportunistically flushed yet or not */
   unsigned int cb = 0;  /* The current block pointer (index) */
@@ -672,6 +1143,11 @@ int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
       }
 
       block_streak_hist[bstreak] += time_d;
+      thread_stor->blocks_read += blocks_read;
+      thread_stor->blocks_timed_out += blocks_timed_out;
+      bool resize_ring = thread_stor->resize_ring;
+      struct tpacket_req3 resize_params = thread_stor->resize_params;
+      thread_stor->resize_ring = false;
 
       err = pthread_mutex_unlock(bstreak_m);
       if (err != 0) {
@@ -680,6 +1156,22 @@ int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
       }
 
       bstreak = 0;
+      blocks_read = 0;
+      blocks_timed_out = 0;
+
+      /* With --ring-tuning apply, the stats thread can ask for a new
+       * ring, which is set up now that there is nothing to process
+       */
+      if (resize_ring) {
+	af_packet_ring_resize(thread_stor, &resize_params);
+	block_header = thread_stor->block_header;
+	block_streak_hist = thread_stor->block_streak_hist;
+	thread_block_count = thread_stor->ring_params.tp_block_nr;
+	cb = 0;
+	pstreak = 0;
+	(void)time_elapsed(&ts);
+	continue;
+      }
 
       /* we have processed all previously received packets.  since we
        * may potentially wait during poll, let us flush the output
@@ -729,6 +1221,10 @@ int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
        * this block and returned it to us for processing.
        */
       bstreak++; /* We've gotten another block */
+      blocks_read++;
+      if (block_header[cb]->hdr.bh1.block_status & TP_STATUS_BLK_TMO) {
+	blocks_timed_out++;
+      }
 
       /* We found data, process it! */
       process_all_packets_in_block(block_header[cb], statst, pkt_processor);
@@ -751,6 +1247,107 @@ int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
 }
 
 
+/*
+ * The function af_xdp_capture() performs a packet capture from the
+ * AF_XDP socket of a thread, passing each batch of packets in its RX
+ * ring to the packet processor and then returning their frames to
+ * the kernel.  Its accounting follows that of
+ * af_packet_rx_ring_fanout_capture(), with a full batch of
+ * max_batch_size descriptors in place of a block.
+ */
+int af_xdp_capture(struct thread_storage *thread_stor) {
+
+  int err;
+  wait_for_clean_start(thread_stor);
+
+  struct af_xdp_socket *xsk = thread_stor->xsk;
+  struct stats_tracking *statst = thread_stor->statst;
+  double *block_streak_hist = thread_stor->block_streak_hist;
+  pthread_mutex_t *bstreak_m = &(thread_stor->bstreak_m);
+  struct pkt_proc *pkt_processor = thread_stor->pkt_processor;
+  uint32_t thread_block_count = thread_stor->block_count;
+
+  af_xdp_stats(xsk, NULL); // Discard bogus stats
+
+  fprintf(stderr, "Thread %d with thread id %lu started...\n", thread_stor->tnum, thread_stor->tid);
+
+  struct pollfd psockfd;
+  memset(&psockfd, 0, sizeof(psockfd));
+  psockfd.fd = af_xdp_socket_fd(xsk);
+  psockfd.events = POLLIN | POLLERR;
+  psockfd.revents = 0;
+
+  struct packet_descriptor batch[pkt_proc::max_batch_size];
+  uint64_t bstreak = 0; /* The number of full batches in a row we've gotten without a poll() */
+  int haveflushed = 0;  /* Tracks whether we've opportunistically flushed yet or not */
+  struct timespec ts;
+  (void)time_elapsed(&ts); /* init the struct for us */
+  double time_d; /* The time delta */
+  while (sig_close_workers == 0) {
+
+    uint64_t byte_count;
+    size_t num_pkts = af_xdp_socket_receive(xsk, batch, pkt_proc::max_batch_size, &byte_count);
+    if (num_pkts == 0) {
+      /* The RX ring is empty, so track the streak that just ended */
+      time_d = time_elapsed(&ts);
+
+      if (bstreak > thread_block_count) {
+        bstreak = thread_block_count;
+      }
+
+      err = pthread_mutex_lock(bstreak_m);
+      if (err != 0) {
+        fprintf(stderr, "%s: error acquiring bstreak mutex lock\n", strerror(err));
+        exit(255);
+      }
+
+      block_streak_hist[bstreak] += time_d;
+
+      err = pthread_mutex_unlock(bstreak_m);
+      if (err != 0) {
+        fprintf(stderr, "%s: error releasing bstreak mutex lock\n", strerror(err));
+        exit(255);
+      }
+
+      bstreak = 0;
+
+      /* flush the output once before waiting, as with AF_PACKET */
+      if (haveflushed == 0) {
+        pkt_processor->flush();
+        haveflushed = 1;
+        continue;
+      }
+
+      if (poll(&psockfd, 1, 1000) < 0) { /* Let poll wait up to a second */
+        perror("poll returned error");
+      }
+      continue;
+    }
+
+    if (thread_stor->snaplen) {
+      for (size_t i = 0; i < num_pkts; i++) {
+        if (batch[i].info.caplen > thread_stor->snaplen) {
+          batch[i].info.caplen = thread_stor->snaplen;   /* len keeps the length on the wire */
+        }
+      }
+    }
+    pkt_processor->apply_batch(batch, num_pkts);
+    af_xdp_socket_release(xsk, num_pkts);
+    haveflushed = 0;
+    if (num_pkts == pkt_proc::max_batch_size) {
+      bstreak++;
+    }
+
+    __sync_add_and_fetch(&(statst->received_packets), num_pkts);
+    __sync_add_and_fetch(&(statst->received_bytes), byte_count);
+
+  } /* end while (sig_close_workers == 0) */
+
+  fprintf(stderr, "Thread %d with thread id %lu exiting...\n", thread_stor->tnum, thread_stor->tid);
+  return 0;
+}
+
+
 void *packet_capture_thread_func(void *arg)  {
   struct thread_storage *thread_stor = (struct thread_storage *)arg;
 
@@ -761,18 +1358,46 @@ void *packet_capture_thread_func(void *arg)  {
   disable_all_signals();
 
   /* now process the packets */
-  if (af_packet_rx_ring_fanout_capture(thread_stor) < 0) {
+  int err;
+  if (thread_stor->xsk) {
+    err = af_xdp_capture(thread_stor);
+  } else {
+    err = af_packet_rx_ring_fanout_capture(thread_stor);
+  }
+  if (err < 0) {
     fprintf(stdout, "error: could not perform packet capture\n");
     exit(255);
   }
   return NULL;
 }
 
+/*
+ * fanout_type() returns the PACKET_FANOUT_* type of a fanout mode
+ */
+static int fanout_type(enum fanout_mode mode) {
+  switch (mode) {
+  case fanout_mode_lb:
+    return PACKET_FANOUT_LB;
+  case fanout_mode_cpu:
+    return PACKET_FANOUT_CPU;
+  case fanout_mode_qm:
+    return PACKET_FANOUT_QM;
+  case fanout_mode_rollover:
+    return PACKET_FANOUT_ROLLOVER;
+  case fanout_mode_bpf:
+    return PACKET_FANOUT_CBPF;
+  case fanout_mode_hash:
+  default:
+    return PACKET_FANOUT_HASH;
+  }
+}
+
 enum status bind_and_dispatch(struct mercury_config *cfg,
 			      struct output_file *out_ctx) {
   /* initialize the ring limits from the configuration */
   struct ring_limits rl;
   ring_limits_init(&rl, cfg->buffer_fraction);
+  rl.af_fanout_type = fanout_type(cfg->fanout_mode);
 
   int err;
   int num_threads = cfg->num_threads;
@@ -796,6 +1421,16 @@ enum status bind_and_dispatch(struct mercury_config *cfg,
   statst.t_start_c = &t_start_c;
   statst.t_start_m = &t_start_m;
   statst.verbosity = cfg->verbosity;
+  statst.ring_tuning = cfg->ring_tuning;
+  statst.rl = &rl;
+  statst.latency_sampling = cfg->latency_sampling;
+  if (cfg->stats_filename) {
+    statst.stats_file = fopen(cfg->stats_filename, "w");
+    if (statst.stats_file == NULL) {
+      fprintf(stderr, "%s: could not open stats file %s\n", strerror(errno), cfg->stats_filename);
+      return status_err;
+    }
+  }
 
   struct thread_storage *tstor;  // Holds the array of struct thread_storage, one for each thread
   tstor = (struct thread_storage *)malloc(num_threads * sizeof(struct thread_storage));
@@ -848,7 +1483,77 @@ enum status bind_and_dispatch(struct mercury_config *cfg,
   thread_ring_req.tp_frame_nr = (thread_ring_blocksize * thread_ring_blockcount) / rl.af_framesize;
   thread_ring_req.tp_retire_blk_tov = rl.af_blocktimeout;
   thread_ring_req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
-  
+  statst.ring_params = thread_ring_req;
+
+  /* With AF_XDP, the XDP program redirects the packets from each
+   * queue of the interface to the socket of the thread with the same
+   * number, in place of a fanout, and the UMEM of each socket gets
+   * the memory that its RX_RING would have had
+   */
+  struct af_xdp_program *xdp_prog = NULL;
+  uint32_t xdp_frames = AF_XDP_MIN_FRAMES;
+  if (cfg->capture_method == capture_method_af_xdp) {
+    if (cfg->prefilter) {
+      fprintf(stderr, "Notice: --prefilter does not apply to AF_XDP sockets\n");
+    }
+    if (cfg->ring_tuning != ring_tuning_off) {
+      fprintf(stderr, "Notice: --ring-tuning does not apply to AF_XDP sockets\n");
+      statst.ring_tuning = ring_tuning_off;
+    }
+    xdp_prog = af_xdp_program_new(cfg->capture_interface, num_threads, cfg->verbosity);
+    if (xdp_prog == NULL) {
+      return status_err;
+    }
+    while (xdp_frames < AF_XDP_MAX_FRAMES && (uint64_t)xdp_frames * 2 * AF_XDP_FRAME_SIZE <= thread_ring_size) {
+      xdp_frames *= 2;
+    }
+  }
+
+  /* The socket filter truncates packets to the snap length, and with
+   * --prefilter, drops those that the JSON output could not report;
+   * the protocol selection determines the patterns that it tests, so
+   * it is applied first
+   */
+  std::vector<struct sock_filter> filter_code;
+  struct sock_fprog filter;
+  struct sock_fprog *filter_ptr = NULL;
+  bool prefilter = cfg->prefilter && cfg->write_filename == NULL;
+  if (cfg->prefilter && cfg->write_filename) {
+    fprintf(stderr, "Notice: --prefilter only applies to JSON output\n");
+  }
+  if (xdp_prog == NULL && (prefilter || cfg->snaplen)) {
+    if (prefilter && proto_ident_config(cfg->packet_filter_cfg) != status_ok) {
+      fprintf(stderr, "error: could not initialize packet filter\n");
+      return status_err;
+    }
+    if (bpf_prefilter_compile(filter_code, cfg->snaplen, prefilter) == false) {
+      fprintf(stderr, "error: could not build socket filter\n");
+      return status_err;
+    }
+    filter.len = filter_code.size();
+    filter.filter = filter_code.data();
+    filter_ptr = &filter;
+    if (cfg->verbosity) {
+      fprintf(stderr, "socket filter has %zu instructions\n", filter_code.size());
+    }
+  }
+
+  /* With --fanout bpf, every socket in the fanout group gets the
+   * program that computes a symmetric flow hash
+   */
+  std::vector<struct sock_filter> fanout_code;
+  struct sock_fprog fanout_prog;
+  struct sock_fprog *fanout_prog_ptr = NULL;
+  if (xdp_prog == NULL && cfg->fanout_mode == fanout_mode_bpf) {
+    if (bpf_fanout_compile(fanout_code) == false) {
+      fprintf(stderr, "error: could not build fanout program\n");
+      return status_err;
+    }
+    fanout_prog.len = fanout_code.size();
+    fanout_prog.filter = fanout_code.data();
+    fanout_prog_ptr = &fanout_prog;
+  }
+
   /* Get all the thread storage ready and allocate the sockets */
   for (int thread = 0; thread < num_threads; thread++) {
     /* Init the thread storage for this thread */
@@ -883,20 +1588,41 @@ enum status bind_and_dispatch(struct mercury_config *cfg,
     tstor[thread].tnum = thread;
     tstor[thread].tid = 0;
     tstor[thread].sockfd = -1;
+    tstor[thread].xsk = NULL;
+    tstor[thread].snaplen = cfg->snaplen;
+    tstor[thread].blocks_read = 0;
+    tstor[thread].blocks_timed_out = 0;
+    tstor[thread].resize_ring = false;
+    memset(&(tstor[thread].last_stats), 0, sizeof(tstor[thread].last_stats));
     tstor[thread].if_name = cfg->capture_interface;
     tstor[thread].statst = &statst;
     tstor[thread].t_start_p = &t_start_p;
     tstor[thread].t_start_c = &t_start_c;
     tstor[thread].t_start_m = &t_start_m;
 
-    tstor[thread].block_streak_hist = (double *)calloc(thread_ring_blockcount + 1, sizeof(double));
+    if (xdp_prog) {
+      tstor[thread].block_count = xdp_frames / pkt_proc::max_batch_size;
+    } else {
+      tstor[thread].block_count = thread_ring_blockcount;
+    }
+    tstor[thread].block_streak_hist = (double *)calloc(tstor[thread].block_count + 1, sizeof(double));
     if (!(tstor[thread].block_streak_hist)) {
       perror("could not allocate memory for thread stats block streak histogram\n");
     }
 
     memcpy(&(tstor[thread].ring_params), &thread_ring_req, sizeof(thread_ring_req));
 
-    err = create_dedicated_socket(&(tstor[thread]), fanout_arg);
+    if (xdp_prog) {
+      tstor[thread].xsk = af_xdp_socket_new(xdp_prog, cfg->capture_interface, thread, xdp_frames, cfg->verbosity);
+      if (tstor[thread].xsk == NULL) {
+        fprintf(stderr, "error creating AF_XDP socket for thread %d (each thread needs its own queue on the interface)\n", thread);
+        exit(255);
+      }
+      tstor[thread].sockfd = af_xdp_socket_fd(tstor[thread].xsk);
+      continue;
+    }
+
+    err = create_dedicated_socket(&(tstor[thread]), fanout_arg, filter_ptr, fanout_prog_ptr);
 
     if (err != 0) {
       fprintf(stderr, "error creating dedicated socket for thread %d\n", thread);
@@ -924,6 +1650,7 @@ enum status bind_and_dispatch(struct mercury_config *cfg,
           printf("error: could not initialize frame handler\n");
           return status_err;
       }
+      metrics_attach(tstor[thread].pkt_processor, thread, cfg->latency_sampling);
   }
 
   /* Start up the threads */
@@ -979,13 +1706,22 @@ enum status bind_and_dispatch(struct mercury_config *cfg,
 
   /* free up resources */
   for (int thread = 0; thread < num_threads; thread++) {
-    free(tstor[thread].block_header);
-    munmap(tstor[thread].mapped_buffer, tstor[thread].ring_params.tp_block_size * tstor[thread].ring_params.tp_block_nr);
+    if (tstor[thread].xsk) {
+      af_xdp_socket_delete(tstor[thread].xsk);
+    } else {
+      free(tstor[thread].block_header);
+      munmap(tstor[thread].mapped_buffer, tstor[thread].ring_params.tp_block_size * tstor[thread].ring_params.tp_block_nr);
+      close(tstor[thread].sockfd);
+    }
     free(tstor[thread].block_streak_hist);
-    close(tstor[thread].sockfd);
+    free(tstor[thread].last_stats.block_streak_hist);
     delete tstor[thread].pkt_processor;
   }
   free(tstor);
+  af_xdp_program_delete(xdp_prog);
+  if (statst.stats_file) {
+    fclose(statst.stats_file);
+  }
 
   fprintf(stderr, "--\n"
 	  "%" PRIu64 " packets captured\n"
@@ -0,0 +1,474 @@
+/*
+ * af_xdp.c
+ *
+ * interface to Linux AF_XDP sockets, each with its own UMEM, and to
+ * the XDP program that redirects packets to them
+ *
+ * References:
+ *
+ *   https://www.kernel.org/doc/html/latest/networking/af_xdp.html
+ *   https://www.kernel.org/doc/html/latest/bpf/instruction-set.html
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "af_xdp.h"
+#include "pkt_proc.h"
+
+#ifdef HAVE_AF_XDP
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/*
+ * The completion ring is only used for transmission, but the kernel
+ * requires one for each UMEM, so it is kept small
+ */
+#define AF_XDP_COMPLETION_RING_SIZE 64
+
+static int bpf(enum bpf_cmd cmd, union bpf_attr *attr) {
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+struct af_xdp_program {
+    int map_fd;    /* XSKMAP from queue number to AF_XDP socket  */
+    int prog_fd;   /* XDP program                                */
+    int link_fd;   /* keeps the program attached while it's open */
+};
+
+struct af_xdp_program *af_xdp_program_new(const char *if_name, unsigned int num_queues, int verbosity) {
+
+    unsigned int ifindex = if_nametoindex(if_name);
+    if (ifindex == 0) {
+        fprintf(stderr, "error: could not get interface number for interface %s\n", if_name);
+        return NULL;
+    }
+
+    struct af_xdp_program *prog = (struct af_xdp_program *)malloc(sizeof(struct af_xdp_program));
+    if (prog == NULL) {
+        fprintf(stderr, "error: could not allocate XDP program\n");
+        return NULL;
+    }
+    prog->map_fd = prog->prog_fd = prog->link_fd = -1;
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(int);
+    attr.max_entries = num_queues;
+    strncpy(attr.map_name, "mercury_xsks", sizeof(attr.map_name) - 1);
+    prog->map_fd = bpf(BPF_MAP_CREATE, &attr);
+    if (prog->map_fd < 0) {
+        fprintf(stderr, "%s: could not create XSKMAP for XDP program\n", strerror(errno));
+        af_xdp_program_delete(prog);
+        return NULL;
+    }
+
+    /*
+     * The program is the equivalent of
+     *
+     *    int redirect(struct xdp_md *ctx) {
+     *        return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+     *    }
+     *
+     * assembled here so that neither a BPF compiler nor libbpf is
+     * needed.  The last argument of bpf_redirect_map() is the action
+     * taken when there is no socket for the queue.
+     */
+    struct bpf_insn insns[] = {
+        { BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1, (int16_t)offsetof(struct xdp_md, rx_queue_index), 0 },
+        { BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, prog->map_fd },
+        { 0, 0, 0, 0, 0 },  /* upper half of the 64-bit immediate above */
+        { BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS },
+        { BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map },
+        { BPF_JMP | BPF_EXIT, 0, 0, 0, 0 }
+    };
+    char log[4096];
+    log[0] = '\0';
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t)insns;
+    attr.insn_cnt = sizeof(insns) / sizeof(insns[0]);
+    attr.license = (uintptr_t)"Dual BSD/GPL";
+    attr.log_buf = (uintptr_t)log;
+    attr.log_size = sizeof(log);
+    attr.log_level = 1;
+    strncpy(attr.prog_name, "mercury_xsks", sizeof(attr.prog_name) - 1);
+    prog->prog_fd = bpf(BPF_PROG_LOAD, &attr);
+    if (prog->prog_fd < 0) {
+        fprintf(stderr, "%s: could not load XDP program\n%s", strerror(errno), log);
+        af_xdp_program_delete(prog);
+        return NULL;
+    }
+
+    /*
+     * attach the program with a BPF link, so that it is detached
+     * when the link is closed, including when the process exits
+     */
+    const struct { uint32_t flags; const char *name; } modes[] = {
+        { XDP_FLAGS_DRV_MODE, "native" },
+        { XDP_FLAGS_SKB_MODE, "generic" }
+    };
+    for (const auto &m : modes) {
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = prog->prog_fd;
+        attr.link_create.target_ifindex = ifindex;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = m.flags;
+        prog->link_fd = bpf(BPF_LINK_CREATE, &attr);
+        if (prog->link_fd >= 0) {
+            if (verbosity) {
+                fprintf(stderr, "attached XDP program to interface %s in %s mode\n", if_name, m.name);
+            }
+            return prog;
+        }
+        if (errno == EBUSY || errno == EEXIST) {
+            break;  /* another XDP program is attached */
+        }
+    }
+    fprintf(stderr, "%s: could not attach XDP program to interface %s\n", strerror(errno), if_name);
+    af_xdp_program_delete(prog);
+    return NULL;
+}
+
+void af_xdp_program_delete(struct af_xdp_program *prog) {
+    if (prog == NULL) {
+        return;
+    }
+    if (prog->link_fd >= 0) {
+        close(prog->link_fd);
+    }
+    if (prog->prog_fd >= 0) {
+        close(prog->prog_fd);
+    }
+    if (prog->map_fd >= 0) {
+        close(prog->map_fd);
+    }
+    free(prog);
+}
+
+/*
+ * struct xsk_ring is the user space view of one of the rings that an
+ * AF_XDP socket shares with the kernel; the producer and consumer
+ * indexes are free-running, and are reduced modulo the ring size
+ * with mask
+ */
+struct xsk_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *descs;
+    uint32_t mask;
+    void *map;
+    size_t map_len;
+};
+
+static bool xsk_ring_map(struct xsk_ring *r, int fd, const struct xdp_ring_offset *off,
+                         uint32_t entries, size_t desc_size, off_t pgoff) {
+    r->map_len = off->desc + entries * desc_size;
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (r->map == MAP_FAILED) {
+        r->map = NULL;
+        return false;
+    }
+    uint8_t *base = (uint8_t *)r->map;
+    r->producer = (uint32_t *)(base + off->producer);
+    r->consumer = (uint32_t *)(base + off->consumer);
+    r->flags = (uint32_t *)(base + off->flags);
+    r->descs = base + off->desc;
+    r->mask = entries - 1;
+    return true;
+}
+
+static void xsk_ring_unmap(struct xsk_ring *r) {
+    if (r->map) {
+        munmap(r->map, r->map_len);
+        r->map = NULL;
+    }
+}
+
+struct af_xdp_socket {
+    int fd;
+    unsigned int queue;
+    uint8_t *umem;
+    size_t umem_len;
+    struct xsk_ring fill;
+    struct xsk_ring completion;
+    struct xsk_ring rx;
+    uint64_t rx_packets;               /* written only by the receiving thread */
+    uint64_t last_rx_packets;          /* at the previous af_xdp_socket_stats() */
+    struct xdp_statistics last_stats;  /* at the previous af_xdp_socket_stats() */
+};
+
+struct af_xdp_socket *af_xdp_socket_new(struct af_xdp_program *prog,
+                                        const char *if_name,
+                                        unsigned int queue,
+                                        uint32_t num_frames,
+                                        int verbosity) {
+
+    unsigned int ifindex = if_nametoindex(if_name);
+    if (ifindex == 0) {
+        fprintf(stderr, "error: could not get interface number for interface %s\n", if_name);
+        return NULL;
+    }
+
+    struct af_xdp_socket *xsk = (struct af_xdp_socket *)calloc(1, sizeof(struct af_xdp_socket));
+    if (xsk == NULL) {
+        fprintf(stderr, "error: could not allocate AF_XDP socket for queue %u\n", queue);
+        return NULL;
+    }
+    xsk->queue = queue;
+    xsk->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (xsk->fd < 0) {
+        fprintf(stderr, "%s: could not create AF_XDP socket for queue %u\n", strerror(errno), queue);
+        af_xdp_socket_delete(xsk);
+        return NULL;
+    }
+
+    /*
+     * register the UMEM, and size its rings so that the fill ring
+     * and the RX ring can each hold all of its frames
+     */
+    xsk->umem_len = (size_t)num_frames * AF_XDP_FRAME_SIZE;
+    xsk->umem = (uint8_t *)mmap(NULL, xsk->umem_len, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (xsk->umem == MAP_FAILED) {
+        xsk->umem = NULL;
+        fprintf(stderr, "%s: could not allocate %zu byte UMEM for queue %u\n", strerror(errno), xsk->umem_len, queue);
+        af_xdp_socket_delete(xsk);
+        return NULL;
+    }
+    struct xdp_umem_reg umem_reg;
+    memset(&umem_reg, 0, sizeof(umem_reg));
+    umem_reg.addr = (uintptr_t)xsk->umem;
+    umem_reg.len = xsk->umem_len;
+    umem_reg.chunk_size = AF_XDP_FRAME_SIZE;
+    umem_reg.headroom = 0;
+    uint32_t completion_size = AF_XDP_COMPLETION_RING_SIZE;
+    if (setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg))
+        || setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_FILL_RING, &num_frames, sizeof(num_frames))
+        || setsockopt(xsk->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completion_size, sizeof(completion_size))
+        || setsockopt(xsk->fd, SOL_XDP, XDP_RX_RING, &num_frames, sizeof(num_frames))) {
+        fprintf(stderr, "%s: could not set up UMEM and rings for queue %u\n", strerror(errno), queue);
+        af_xdp_socket_delete(xsk);
+        return NULL;
+    }
+
+    struct xdp_mmap_offsets off;
+    socklen_t off_len = sizeof(off);
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &off_len)
+        || !xsk_ring_map(&xsk->fill, xsk->fd, &off.fr, num_frames, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING)
+        || !xsk_ring_map(&xsk->completion, xsk->fd, &off.cr, completion_size, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING)
+        || !xsk_ring_map(&xsk->rx, xsk->fd, &off.rx, num_frames, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING)) {
+        fprintf(stderr, "%s: could not map rings for queue %u\n", strerror(errno), queue);
+        af_xdp_socket_delete(xsk);
+        return NULL;
+    }
+
+    /*
+     * bind to the queue, in zero-copy mode if the driver supports it
+     */
+    struct sockaddr_xdp addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = ifindex;
+    addr.sxdp_queue_id = queue;
+    addr.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    if (bind(xsk->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        addr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+        if (bind(xsk->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+            fprintf(stderr, "%s: could not bind AF_XDP socket to queue %u of interface %s\n", strerror(errno), queue, if_name);
+            af_xdp_socket_delete(xsk);
+            return NULL;
+        }
+    }
+    if (verbosity) {
+        fprintf(stderr, "AF_XDP socket for queue %u of interface %s uses %s mode with %u frames\n",
+                queue, if_name, (addr.sxdp_flags & XDP_ZEROCOPY) ? "zero-copy" : "copy", num_frames);
+    }
+
+    /* give all of the frames to the kernel */
+    uint64_t *fill_addrs = (uint64_t *)xsk->fill.descs;
+    for (uint32_t i = 0; i < num_frames; i++) {
+        fill_addrs[i] = (uint64_t)i * AF_XDP_FRAME_SIZE;
+    }
+    __atomic_store_n(xsk->fill.producer, num_frames, __ATOMIC_RELEASE);
+
+    /* now the XDP program can redirect packets to this socket */
+    uint32_t key = queue;
+    int value = xsk->fd;
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = prog->map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&value;
+    attr.flags = BPF_ANY;
+    if (bpf(BPF_MAP_UPDATE_ELEM, &attr)) {
+        fprintf(stderr, "%s: could not add AF_XDP socket for queue %u to XSKMAP\n", strerror(errno), queue);
+        af_xdp_socket_delete(xsk);
+        return NULL;
+    }
+
+    return xsk;
+}
+
+void af_xdp_socket_delete(struct af_xdp_socket *xsk) {
+    if (xsk == NULL) {
+        return;
+    }
+    xsk_ring_unmap(&xsk->rx);
+    xsk_ring_unmap(&xsk->completion);
+    xsk_ring_unmap(&xsk->fill);
+    if (xsk->fd >= 0) {
+        close(xsk->fd);   /* also removes the socket from the XSKMAP */
+    }
+    if (xsk->umem) {
+        munmap(xsk->umem, xsk->umem_len);
+    }
+    free(xsk);
+}
+
+int af_xdp_socket_fd(const struct af_xdp_socket *xsk) {
+    return xsk->fd;
+}
+
+size_t af_xdp_socket_receive(struct af_xdp_socket *xsk,
+                             struct packet_descriptor *batch,
+                             size_t max,
+                             uint64_t *bytes) {
+
+    uint32_t cons = *xsk->rx.consumer;
+    uint32_t prod = __atomic_load_n(xsk->rx.producer, __ATOMIC_ACQUIRE);
+    size_t num_packets = prod - cons;
+    if (num_packets > max) {
+        num_packets = max;
+    }
+    if (num_packets == 0) {
+        return 0;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    const struct xdp_desc *descs = (const struct xdp_desc *)xsk->rx.descs;
+    uint64_t byte_count = 0;
+    for (size_t i = 0; i < num_packets; i++) {
+        const struct xdp_desc *d = &descs[(cons + i) & xsk->rx.mask];
+        batch[i].info.ts = ts;
+        batch[i].info.caplen = d->len;
+        batch[i].info.len = d->len;
+        batch[i].eth = xsk->umem + d->addr;
+        byte_count += d->len;
+    }
+    *bytes = byte_count;
+    __atomic_store_n(&xsk->rx_packets, xsk->rx_packets + num_packets, __ATOMIC_RELAXED);
+
+    return num_packets;
+}
+
+void af_xdp_socket_release(struct af_xdp_socket *xsk, size_t num_packets) {
+
+    /*
+     * each frame goes back onto the fill ring, which has room for all
+     * of the frames of the UMEM, so there is no need to check its
+     * consumer index
+     */
+    uint32_t rx_cons = *xsk->rx.consumer;
+    uint32_t fill_prod = *xsk->fill.producer;
+    const struct xdp_desc *descs = (const struct xdp_desc *)xsk->rx.descs;
+    uint64_t *fill_addrs = (uint64_t *)xsk->fill.descs;
+    for (size_t i = 0; i < num_packets; i++) {
+        uint64_t frame = descs[(rx_cons + i) & xsk->rx.mask].addr & ~(uint64_t)(AF_XDP_FRAME_SIZE - 1);
+        fill_addrs[(fill_prod + i) & xsk->fill.mask] = frame;
+    }
+    __atomic_store_n(xsk->fill.producer, fill_prod + num_packets, __ATOMIC_RELEASE);
+    __atomic_store_n(xsk->rx.consumer, rx_cons + num_packets, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(xsk->fill.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) {
+        recvfrom(xsk->fd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+}
+
+enum status af_xdp_socket_stats(struct af_xdp_socket *xsk,
+                                uint64_t *packets,
+                                uint64_t *drops,
+                                uint64_t *fill_ring_empty) {
+
+    struct xdp_statistics stats;
+    socklen_t len = sizeof(stats);
+    if (getsockopt(xsk->fd, SOL_XDP, XDP_STATISTICS, &stats, &len)) {
+        perror("error: could not get statistics for AF_XDP socket");
+        return status_err;
+    }
+    uint64_t rx_packets = __atomic_load_n(&xsk->rx_packets, __ATOMIC_RELAXED);
+
+    /*
+     * the kernel's counters are cumulative, unlike those of
+     * PACKET_STATISTICS, so the previous values are subtracted
+     */
+    *drops = (stats.rx_dropped - xsk->last_stats.rx_dropped)
+        + (stats.rx_ring_full - xsk->last_stats.rx_ring_full);
+    *packets = (rx_packets - xsk->last_rx_packets) + *drops;
+    *fill_ring_empty = stats.rx_fill_ring_empty_descs - xsk->last_stats.rx_fill_ring_empty_descs;
+
+    xsk->last_stats = stats;
+    xsk->last_rx_packets = rx_packets;
+
+    return status_ok;
+}
+
+#else /* HAVE_AF_XDP */
+
+/*
+ * AF_XDP is not available, so sockets cannot be created
+ */
+
+struct af_xdp_program *af_xdp_program_new(const char *, unsigned int, int) {
+    fprintf(stderr, "error: AF_XDP capture is unavailable; linux/if_xdp.h is missing or too old\n");
+    return NULL;
+}
+
+void af_xdp_program_delete(struct af_xdp_program *) { }
+
+struct af_xdp_socket *af_xdp_socket_new(struct af_xdp_program *, const char *, unsigned int, uint32_t, int) {
+    return NULL;
+}
+
+void af_xdp_socket_delete(struct af_xdp_socket *) { }
+
+int af_xdp_socket_fd(const struct af_xdp_socket *) {
+    return -1;
+}
+
+size_t af_xdp_socket_receive(struct af_xdp_socket *, struct packet_descriptor *, size_t, uint64_t *) {
+    return 0;
+}
+
+void af_xdp_socket_release(struct af_xdp_socket *, size_t) { }
+
+enum status af_xdp_socket_stats(struct af_xdp_socket *, uint64_t *, uint64_t *, uint64_t *) {
+    return status_err;
+}
+
+#endif /* HAVE_AF_XDP */
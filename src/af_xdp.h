@@ -0,0 +1,100 @@
+/*
+ * af_xdp.h
+ *
+ * interface to Linux AF_XDP sockets, each with its own UMEM, and to
+ * the XDP program that redirects packets to them
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#ifndef AF_XDP_H
+#define AF_XDP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mercury.h"
+
+struct packet_descriptor;  /* defined in pkt_proc.h */
+
+/*
+ * AF_XDP_FRAME_SIZE is the size of each frame in a UMEM; a packet
+ * must fit into a frame, after the XDP headroom, to be received
+ */
+#define AF_XDP_FRAME_SIZE       2048
+#define AF_XDP_MIN_FRAMES       4096
+#define AF_XDP_MAX_FRAMES (1 << 18)
+
+/*
+ * struct af_xdp_program is an XDP program attached to an interface,
+ * which redirects each packet received on queue i to the AF_XDP
+ * socket in entry i of its map, or passes the packet to the network
+ * stack if there is no such socket.
+ *
+ * af_xdp_program_new(if_name, num_queues, verbosity) loads and
+ * attaches the program, in the native mode of the driver if
+ * possible, and in generic mode otherwise, and returns NULL on
+ * failure.  The program stays attached until it is deleted with
+ * af_xdp_program_delete(), or the process exits.
+ */
+struct af_xdp_program;
+
+struct af_xdp_program *af_xdp_program_new(const char *if_name, unsigned int num_queues, int verbosity);
+
+void af_xdp_program_delete(struct af_xdp_program *prog);
+
+/*
+ * struct af_xdp_socket is an AF_XDP socket bound to one queue of an
+ * interface, with a UMEM of num_frames frames that is shared between
+ * its fill, completion, and RX rings.  All of the frames are placed
+ * on the fill ring at the start; each batch of received packets is
+ * read from the RX ring with af_xdp_socket_receive(), and then its
+ * frames are returned to the fill ring with af_xdp_socket_release().
+ *
+ * af_xdp_socket_new(prog, if_name, queue, num_frames, verbosity)
+ * creates a socket, which uses zero-copy mode if the driver supports
+ * it, and copy mode otherwise, and adds it to the map of prog; it
+ * returns NULL on failure.  The num_frames must be a power of two.
+ */
+struct af_xdp_socket;
+
+struct af_xdp_socket *af_xdp_socket_new(struct af_xdp_program *prog,
+                                        const char *if_name,
+                                        unsigned int queue,
+                                        uint32_t num_frames,
+                                        int verbosity);
+
+void af_xdp_socket_delete(struct af_xdp_socket *xsk);
+
+int af_xdp_socket_fd(const struct af_xdp_socket *xsk);
+
+/*
+ * af_xdp_socket_receive(xsk, batch, max, bytes) fills in batch with
+ * up to max packets from the RX ring, sets bytes to their total
+ * length, and returns the number of packets.  AF_XDP does not
+ * provide timestamps, so all of the packets in a batch have the
+ * time at which it was received.  The packet data stays valid until
+ * af_xdp_socket_release(xsk, num_packets) returns the frames of the
+ * batch to the kernel.
+ */
+size_t af_xdp_socket_receive(struct af_xdp_socket *xsk,
+                             struct packet_descriptor *batch,
+                             size_t max,
+                             uint64_t *bytes);
+
+void af_xdp_socket_release(struct af_xdp_socket *xsk, size_t num_packets);
+
+/*
+ * af_xdp_socket_stats(xsk, packets, drops, fill_ring_empty) sets its
+ * arguments to the number of packets that were received by the
+ * socket (including the dropped ones), dropped by it, and not
+ * received into the UMEM because the fill ring was empty, since the
+ * previous call, so that they match the counters reported by
+ * AF_PACKET's PACKET_STATISTICS.
+ */
+enum status af_xdp_socket_stats(struct af_xdp_socket *xsk,
+                                uint64_t *packets,
+                                uint64_t *drops,
+                                uint64_t *fill_ring_empty);
+
+#endif /* AF_XDP_H */
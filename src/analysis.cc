@@ -20,12 +20,17 @@
 #include "analysis.h"
 #include "utils.h"
 #include "tls.h"
+#include "public_suffix.h"
 
 #include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
 
 rapidjson::Document fp_db;
 
+struct public_suffix_list public_suffixes;
+
+struct os_analyzer os_analysis;
+
 #define MAX_FP_STR_LEN 4096
 #define MAX_SNI_LEN     257
 
@@ -106,7 +111,7 @@ void database_finalize() {
 #define DEFAULT_RESOURCE_DIR "/usr/local/share/mercury"
 #endif
 
-int analysis_init(int verbosity, const char *resource_dir) {
+int analysis_init(int verbosity, const char *resource_dir, enum asn_lookup_type asn_lookup) {
 
 //    if (pthread_mutex_init(&lock_fp_cache, NULL) != 0) {
 //       printf("\n mutex init has failed\n");
@@ -130,15 +135,33 @@ int analysis_init(int verbosity, const char *resource_dir) {
 
     unsigned int index = 0;
     while (resource_dir_list[index] != NULL) {
+        char table_file_name[PATH_MAX];
+        strncpy(table_file_name, resource_dir_list[index], PATH_MAX-1);
+        strncat(table_file_name, "/pyasn.bin", PATH_MAX-1);
         strncpy(resource_file_name, resource_dir_list[index], PATH_MAX-1);
         strncat(resource_file_name, "/pyasn.db", PATH_MAX-1);
-        int retcode = addr_init(resource_file_name);
+        int retcode = addr_init_from_table(table_file_name, resource_file_name, asn_lookup);
+        if (retcode == 0) {
+            if (verbosity > 0) {
+                fprintf(stderr, "using compiled ASN table '%s'\n", table_file_name);
+            }
+        } else {
+            retcode = addr_init(resource_file_name, asn_lookup);
+        }
 
         if (retcode == 0) {
             strncpy(resource_file_name, resource_dir_list[index], PATH_MAX-1);
             strncat(resource_file_name, "/fingerprint_db.json.gz", PATH_MAX-1);
             retcode = database_init(resource_file_name);
             if (retcode == 0) {
+                strncpy(resource_file_name, resource_dir_list[index], PATH_MAX-1);
+                strncat(resource_file_name, "/public_suffix_list.dat.gz", PATH_MAX-1);
+                if (public_suffixes.load(resource_file_name) != 0 && verbosity > 0) {
+                    fprintf(stderr, "warning: could not open file '%s'; domain names will be truncated to two labels\n", resource_file_name);
+                }
+                if (os_analysis.load(resource_dir_list[index]) != 0 && verbosity > 0) {
+                    fprintf(stderr, "warning: could not initialize OS identification with resource directory '%s'\n", resource_dir_list[index]);
+                }
                 if (verbosity > 0) {
                     fprintf(stderr, "initialized analysis module with resource directory %s\n", resource_dir_list[index]);
                 }
@@ -161,6 +184,7 @@ int analysis_finalize() {
 
     addr_finalize();
     database_finalize();
+    os_analysis.clear();
 //    cache_finalize();
 
     return 1;
@@ -234,31 +258,6 @@ std::string get_port_app(uint16_t dst_port) {
     return "unknown";
 }
 
-std::string get_domain_name(char* server_name) {
-    std::string r_server_name(server_name);
-    std::reverse(r_server_name.begin(), r_server_name.end());
-
-    size_t pos = 0;
-    uint8_t n = 2;
-    std::string token;
-    std::string out_domain;
-    std::stringstream domain;
-    while (((pos = r_server_name.find(".")) != std::string::npos) && (n > 0)) {
-        token = r_server_name.substr(0, pos);
-        domain << token;
-        if (n > 1) {
-            domain << ".";
-        }
-        r_server_name.erase(0, pos + 1);
-        n -= 1;
-    }
-
-    out_domain = domain.str();
-    std::reverse(out_domain.begin(), out_domain.end());
-
-    return out_domain;
-}
-
 // #include <iostream> // for debugging
 // #include "rapidjson/writer.h"
 // print out fp_db for debugging
@@ -267,7 +266,7 @@ std::string get_domain_name(char* server_name) {
 // fp_db.Accept(writer);
 // std::cerr << buffer.GetString() << std::endl;
 
-int perform_analysis(char **result, size_t max_bytes, char *fp_str, char *server_name, char *dst_ip, uint16_t dst_port) {
+int perform_analysis(char **result, size_t max_bytes, char *fp_str, char *server_name, char *domain_name, char *dst_ip, uint16_t dst_port) {
     rapidjson::Value::ConstMemberIterator matcher = fp_db.FindMember(fp_str);
     if (matcher == fp_db.MemberEnd()) {
 
@@ -278,7 +277,7 @@ int perform_analysis(char **result, size_t max_bytes, char *fp_str, char *server
     uint32_t asn_int = get_asn_info(dst_ip);
     std::string asn = std::to_string(asn_int);
     std::string port_app = get_port_app(dst_port);
-    std::string domain = get_domain_name(server_name);
+    std::string domain(domain_name);
     std::string server_name_str(server_name);
     std::string dst_ip_str(dst_ip);
 
@@ -400,17 +399,18 @@ int perform_analysis(char **result, size_t max_bytes, char *fp_str, char *server
 
     *result = (char*)calloc(max_bytes, sizeof(char));
     if (MALWARE_DB) {
-        snprintf(*result, max_bytes, "\"analysis\":{\"process\":\"%s\",\"score\":%Lf,\"malware\":%d,\"p_malware\":%Lf}", max_proc.c_str(), max_score, max_mal, malware_prob);
+        snprintf(*result, max_bytes, "\"analysis\":{\"process\":\"%s\",\"score\":%Lf,\"malware\":%d,\"p_malware\":%Lf", max_proc.c_str(), max_score, max_mal, malware_prob);
     } else {
-        snprintf(*result, max_bytes, "\"analysis\":{\"process\":\"%s\",\"score\":%Lf}", max_proc.c_str(), max_score);
+        snprintf(*result, max_bytes, "\"analysis\":{\"process\":\"%s\",\"score\":%Lf", max_proc.c_str(), max_score);
     }
 
     return 0;
 }
 
-void write_analysis_from_extractor_and_flow_key(struct buffer_stream &buf,
+bool write_analysis_from_extractor_and_flow_key(struct buffer_stream &buf,
                                                 const struct tls_client_hello &hello,
-                                                const struct key &key) {
+                                                const struct key &key,
+                                                bool output_domain) {
     char* results;
 
     int ret_value;
@@ -431,16 +431,26 @@ void write_analysis_from_extractor_and_flow_key(struct buffer_stream &buf,
     sn.strncpy(sn_str, MAX_SNI_LEN);
     // fprintf(stderr, "server_name: '%.*s'\tcopy: '%s'\n", (int)sn.length(), sn.data, sn_str);
 
-    ret_value = perform_analysis(&results, MAX_FP_STR_LEN, fp_str, sn_str, dst_ip_str, dst_port);
+    char domain_str[MAX_SNI_LEN] = { 0 };
+    struct datum domain = public_suffixes.registrable_domain(sn);
+    domain.strncpy(domain_str, MAX_SNI_LEN);
+
+    ret_value = perform_analysis(&results, MAX_FP_STR_LEN, fp_str, sn_str, domain_str, dst_ip_str, dst_port);
     if (ret_value == -1) {
-        return;
+        return false;
     }
     // fprintf(stderr, "analysis: %s\n", results);
 
     buf.write_char(',');
     buf.strncpy(results);
+    if (output_domain && domain.is_not_empty()) {
+        buf.write_char(',');
+        buf.json_string_escaped("domain", domain.data, domain.length());
+    }
+    buf.write_char('}');
 
     free(results);
 
+    return true;
 }
 
@@ -9,17 +9,35 @@
 #define ANALYSIS_H
 
 #include <stdio.h>
+#include <zlib.h>
+#include <vector>
 #include "packet.h"
 #include "addr.h"
 #include "buffer_stream.h"
+#include "os_analysis.h"
 
-int analysis_init(int verbosity, const char *resource_dir);
+extern struct os_analyzer os_analysis;
+
+int analysis_init(int verbosity, const char *resource_dir, enum asn_lookup_type asn_lookup);
 
 int analysis_finalize();
 
-void write_analysis_from_extractor_and_flow_key(struct buffer_stream &buf,
+/*
+ * write_analysis_from_extractor_and_flow_key() writes the analysis of
+ * hello into buf, and returns true if its fingerprint was found in
+ * the fingerprint database, and false otherwise
+ */
+bool write_analysis_from_extractor_and_flow_key(struct buffer_stream &buf,
                                                 const struct tls_client_hello &hello,
-                                                const struct key &key);
+                                                const struct key &key,
+                                                bool output_domain);
+
+/*
+ * gzgetline(f, v) reads the next line of the gzipped file f into v,
+ * without its newline, and returns 1, or returns 0 at the end of the
+ * file
+ */
+int gzgetline(gzFile f, std::vector<char>& v);
 
 
 #endif /* ANALYSIS_H */
@@ -0,0 +1,65 @@
+/*
+ * asn_table_compile.cc
+ *
+ * compile a pyasn.db text file into a binary ASN table that mercury
+ * maps into memory at startup, instead of parsing the text file and
+ * building the lookup tries
+ *
+ * usage: asn_table_compile [--dir-24-8] <pyasn.db> <pyasn.bin>
+ *
+ * With the --dir-24-8 option, the table includes a DIR-24-8 table for
+ * IPv4 lookups (about 64MB), for use with '--asn-lookup=dir-24-8'.
+ * Mercury looks for pyasn.bin next to pyasn.db in its resource
+ * directory, and ignores it if pyasn.db is newer.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "addr.h"
+#include "utils.h"
+
+int main(int argc, char *argv[]) {
+
+    bool include_dir_24_8 = false;
+    if (argc == 4 && strcmp(argv[1], "--dir-24-8") == 0) {
+        include_dir_24_8 = true;
+        argv++;
+        argc--;
+    }
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s [--dir-24-8] <pyasn.db> <pyasn.bin>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *text_file = argv[1];
+    const char *table_file = argv[2];
+
+    struct timer t;
+    timer_start(&t);
+    if (addr_init(text_file, asn_lookup_lctrie) != 0) {
+        fprintf(stderr, "error: could not load subnets from %s\n", text_file);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "text load time:  %.3f ms\n", timer_stop(&t) / 1000000.0);
+
+    int retcode = addr_write_table(table_file, include_dir_24_8);
+    addr_finalize();
+    if (retcode != 0) {
+        return EXIT_FAILURE;
+    }
+
+    // check that the table is usable, and report how long it takes
+    // to load
+    //
+    timer_start(&t);
+    if (addr_init_from_table(table_file, NULL, include_dir_24_8 ? asn_lookup_dir_24_8 : asn_lookup_lctrie) != 0) {
+        fprintf(stderr, "error: could not load %s\n", table_file);
+        return EXIT_FAILURE;
+    }
+    fprintf(stdout, "table load time: %.3f ms\n", timer_stop(&t) / 1000000.0);
+    addr_finalize();
+
+    return EXIT_SUCCESS;
+}
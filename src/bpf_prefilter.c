@@ -0,0 +1,446 @@
+/*
+ * bpf_prefilter.c
+ *
+ * classic BPF socket filters that select the packets that mercury
+ * might report, and truncate them to a snap length, in the kernel,
+ * and a fanout program that steers both directions of each flow to
+ * the same socket
+ *
+ * References:
+ *
+ *   https://www.kernel.org/doc/html/latest/networking/filter.html
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "bpf_prefilter.h"
+#include "mercury.h"
+#include "eth.h"
+#include "extractor.h"
+#include "udp.h"
+
+extern struct global_variables global_vars; /* defined in config.c */
+
+/*
+ * struct bpf_program_builder appends classic BPF instructions to a
+ * program, with conditional jumps to labels that are bound to
+ * instructions later on; since classic BPF only jumps forward, by at
+ * most 255 instructions, each label must be bound after the jumps to
+ * it, and close enough to them
+ */
+struct bpf_program_builder {
+    enum { next = -1 };   /* jump target: the next instruction */
+
+    std::vector<struct sock_filter> code;
+    std::vector<int> jt_label;
+    std::vector<int> jf_label;
+    std::vector<size_t> label_index;
+
+    int new_label() {
+        label_index.push_back(SIZE_MAX);
+        return label_index.size() - 1;
+    }
+
+    void bind(int label) {
+        label_index[label] = code.size();
+    }
+
+    void stmt(uint16_t op, uint32_t k) {
+        code.push_back(BPF_STMT(op, k));
+        jt_label.push_back(next);
+        jf_label.push_back(next);
+    }
+
+    void jump(uint16_t op, uint32_t k, int jt, int jf) {
+        code.push_back(BPF_JUMP(op, k, 0, 0));
+        jt_label.push_back(jt);
+        jf_label.push_back(jf);
+    }
+
+    void jump_always(int label) {
+        code.push_back(BPF_JUMP(BPF_JMP | BPF_JA, 0, 0, 0));
+        jt_label.push_back(label);
+        jf_label.push_back(next);
+    }
+
+    bool resolve_offset(size_t i, int label, uint8_t *offset) {
+        if (label == next) {
+            *offset = 0;
+            return true;
+        }
+        size_t target = label_index[label];
+        if (target == SIZE_MAX || target <= i || target - (i + 1) > UINT8_MAX) {
+            return false;
+        }
+        *offset = target - (i + 1);
+        return true;
+    }
+
+    /*
+     * resolve() sets the offsets of all of the conditional jumps, and
+     * returns false if a label was not bound, or was out of reach
+     */
+    bool resolve() {
+        for (size_t i = 0; i < code.size(); i++) {
+            if (code[i].code == (BPF_JMP | BPF_JA)) {
+                size_t target = label_index[jt_label[i]];
+                if (target == SIZE_MAX || target <= i) {
+                    return false;
+                }
+                code[i].k = target - (i + 1);
+                continue;
+            }
+            if (resolve_offset(i, jt_label[i], &code[i].jt) == false
+                || resolve_offset(i, jf_label[i], &code[i].jf) == false) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/*
+ * emit_pattern_tests(b, c, accept) appends the tests of the patterns
+ * of the classifier c against the eight bytes at offset X of the
+ * packet; each pattern is tested as two 32-bit words, and the program
+ * returns accept as soon as one of them matches, and zero if none
+ * does.  A load past the end of the packet returns zero, so packets
+ * with fewer than eight bytes at X are dropped, as classify() does.
+ */
+static void emit_pattern_tests(struct bpf_program_builder &b,
+                               const struct protocol_classifier &c,
+                               uint32_t accept) {
+
+    b.stmt(BPF_LD | BPF_B | BPF_IND, protocol_classifier::pattern_length - 1);
+    for (unsigned int i = 0; i < c.size(); i++) {
+        uint8_t mask[protocol_classifier::pattern_length];
+        uint8_t value[protocol_classifier::pattern_length];
+        c.get_pattern(i, mask, value);
+
+        int no_match = b.new_label();
+        for (unsigned int w = 0; w < protocol_classifier::pattern_length; w += 4) {
+            uint32_t m = (uint32_t)mask[w] << 24 | mask[w+1] << 16 | mask[w+2] << 8 | mask[w+3];
+            uint32_t v = (uint32_t)value[w] << 24 | value[w+1] << 16 | value[w+2] << 8 | value[w+3];
+            if (m == 0) {
+                continue;
+            }
+            b.stmt(BPF_LD | BPF_W | BPF_IND, w);
+            if (m != UINT32_MAX) {
+                b.stmt(BPF_ALU | BPF_AND | BPF_K, m);
+            }
+            b.jump(BPF_JMP | BPF_JEQ | BPF_K, v & m, b.next, no_match);
+        }
+        b.stmt(BPF_RET | BPF_K, accept);
+        b.bind(no_match);
+    }
+    b.stmt(BPF_RET | BPF_K, 0);
+}
+
+bool bpf_prefilter_compile(std::vector<struct sock_filter> &code, unsigned int snaplen, bool prefilter) {
+    struct bpf_program_builder b;
+    uint32_t accept = snaplen ? snaplen : UINT32_MAX;
+
+    if (prefilter == false) {
+        b.stmt(BPF_RET | BPF_K, accept);
+        code = b.code;
+        return true;
+    }
+
+    bool all_tcp = global_vars.output_tcp_initial_data;
+#ifdef USE_TCP_REASSEMBLY
+    all_tcp = true;   // continuation segments carry no pattern
+#endif
+    bool all_udp = global_vars.output_udp_initial_data;
+
+    int ret_accept = b.new_label();
+    int ret_drop = b.new_label();
+    int not_1ad = b.new_label();
+    int not_vlan = b.new_label();
+    int ipv4 = b.new_label();
+    int ipv6 = b.new_label();
+    int tcp = b.new_label();
+    int udp = b.new_label();
+
+    /*
+     * ethernet, with up to two VLAN tags; X is the length of the tags
+     */
+    b.stmt(BPF_LDX | BPF_IMM, 0);
+    b.stmt(BPF_LD | BPF_H | BPF_ABS, 12);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_1AD, b.next, not_1ad);
+    b.stmt(BPF_LDX | BPF_IMM, 4);
+    b.stmt(BPF_LD | BPF_H | BPF_ABS, 16);
+    b.bind(not_1ad);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_VLAN, b.next, not_vlan);
+    b.stmt(BPF_MISC | BPF_TXA, 0);
+    b.stmt(BPF_ALU | BPF_ADD | BPF_K, 4);
+    b.stmt(BPF_MISC | BPF_TAX, 0);
+    b.stmt(BPF_LD | BPF_H | BPF_IND, 12);
+    b.bind(not_vlan);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IP, ipv4, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IPV6, ipv6, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_MPLS, ret_accept, ret_drop);
+
+    /*
+     * IPv4: M[0] is the protocol, and X is set to the offset of the
+     * transport header, 4 * IHL bytes after the IP header
+     */
+    b.bind(ipv4);
+    b.stmt(BPF_LD | BPF_B | BPF_IND, 14 + 9);
+    b.stmt(BPF_ST, 0);
+    b.stmt(BPF_LD | BPF_B | BPF_IND, 14);
+    b.stmt(BPF_ALU | BPF_AND | BPF_K, 0x0f);
+    b.stmt(BPF_ALU | BPF_LSH | BPF_K, 2);
+    b.stmt(BPF_ALU | BPF_ADD | BPF_X, 0);
+    b.stmt(BPF_ALU | BPF_ADD | BPF_K, 14);
+    b.stmt(BPF_MISC | BPF_TAX, 0);
+    b.stmt(BPF_LD | BPF_MEM, 0);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, tcp, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, udp, ret_drop);
+
+    /*
+     * IPv6: the packets with extension headers are accepted
+     */
+    b.bind(ipv6);
+    b.stmt(BPF_LD | BPF_B | BPF_IND, 14 + 6);
+    b.stmt(BPF_ST, 0);
+    b.stmt(BPF_MISC | BPF_TXA, 0);
+    b.stmt(BPF_ALU | BPF_ADD | BPF_K, 14 + 40);
+    b.stmt(BPF_MISC | BPF_TAX, 0);
+    b.stmt(BPF_LD | BPF_MEM, 0);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, tcp, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, udp, b.next);
+    const uint8_t extension_headers[] = {
+        IPPROTO_HOPOPTS, IPPROTO_ROUTING, IPPROTO_FRAGMENT, IPPROTO_ESP, IPPROTO_AH, IPPROTO_DSTOPTS
+    };
+    for (uint8_t proto : extension_headers) {
+        b.jump(BPF_JMP | BPF_JEQ | BPF_K, proto, ret_accept, b.next);
+    }
+    b.bind(ret_drop);
+    b.stmt(BPF_RET | BPF_K, 0);
+    b.bind(ret_accept);
+    b.stmt(BPF_RET | BPF_K, accept);
+
+    /*
+     * TCP: X is set to the offset of the data, and the data is
+     * matched against the TCP patterns
+     */
+    b.bind(tcp);
+    if (all_tcp) {
+        b.stmt(BPF_RET | BPF_K, accept);
+    } else {
+        int not_syn = b.new_label();
+        b.stmt(BPF_LD | BPF_B | BPF_IND, 13);
+        b.jump(BPF_JMP | BPF_JSET | BPF_K, 0x02, b.next, not_syn);
+        b.stmt(BPF_RET | BPF_K, accept);
+        b.bind(not_syn);
+        b.stmt(BPF_LD | BPF_B | BPF_IND, 12);
+        b.stmt(BPF_ALU | BPF_RSH | BPF_K, 4);
+        b.stmt(BPF_ALU | BPF_LSH | BPF_K, 2);
+        b.stmt(BPF_ALU | BPF_ADD | BPF_X, 0);
+        b.stmt(BPF_MISC | BPF_TAX, 0);
+        emit_pattern_tests(b, tcp_msg_classifier, accept);
+    }
+
+    /*
+     * UDP: mDNS is selected by port, and the data after the eight
+     * byte header is matched against the UDP patterns
+     */
+    b.bind(udp);
+    if (all_udp) {
+        b.stmt(BPF_RET | BPF_K, accept);
+    } else {
+        if (select_mdns) {
+            int mdns = b.new_label();
+            int not_mdns = b.new_label();
+            b.stmt(BPF_LD | BPF_H | BPF_IND, 0);
+            b.jump(BPF_JMP | BPF_JEQ | BPF_K, 5353, mdns, b.next);
+            b.stmt(BPF_LD | BPF_H | BPF_IND, 2);
+            b.jump(BPF_JMP | BPF_JEQ | BPF_K, 5353, b.next, not_mdns);
+            b.bind(mdns);
+            b.stmt(BPF_RET | BPF_K, accept);
+            b.bind(not_mdns);
+        }
+        b.stmt(BPF_MISC | BPF_TXA, 0);
+        b.stmt(BPF_ALU | BPF_ADD | BPF_K, 8);
+        b.stmt(BPF_MISC | BPF_TAX, 0);
+        emit_pattern_tests(b, udp_msg_classifier, accept);
+    }
+
+    if (b.code.size() > BPF_MAXINSNS || b.resolve() == false) {
+        return false;
+    }
+    code = b.code;
+    return true;
+}
+
+/*
+ * emit_xor_into_hash(b) sets M[1] to M[1] ^ A, and restores X from M[0]
+ */
+static void emit_xor_into_hash(struct bpf_program_builder &b) {
+    b.stmt(BPF_LDX | BPF_MEM, 1);
+    b.stmt(BPF_ALU | BPF_XOR | BPF_X, 0);
+    b.stmt(BPF_ST, 1);
+    b.stmt(BPF_LDX | BPF_MEM, 0);
+}
+
+bool bpf_fanout_compile(std::vector<struct sock_filter> &code) {
+    struct bpf_program_builder b;
+
+    /*
+     * a fanout program runs before the link layer header is pushed
+     * back onto received packets, so the loads are relative to the
+     * network header (SKF_NET_OFF), and the ethertype is that of the
+     * skb, after the kernel has removed the outer VLAN tag; X is the
+     * offset of the IP header, past any inner tag or MPLS labels.
+     * The scratch memory holds that offset in M[0], the hash in M[1],
+     * and the transport protocol in M[3].
+     */
+    const uint32_t net = SKF_NET_OFF;
+    const unsigned int max_mpls_labels = 4;
+
+    int vlan = b.new_label();
+    int not_vlan = b.new_label();
+    int mpls = b.new_label();
+    int mpls_bottom = b.new_label();
+    int other = b.new_label();
+    int ipv4 = b.new_label();
+    int ipv6 = b.new_label();
+    int transport_ipv4 = b.new_label();
+    int transport_ipv6 = b.new_label();
+    int ports = b.new_label();
+    int mix = b.new_label();
+
+    b.stmt(BPF_LDX | BPF_IMM, 0);
+    b.stmt(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_VLAN, vlan, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_1AD, b.next, not_vlan);
+    b.bind(vlan);
+    b.stmt(BPF_LDX | BPF_IMM, 4);
+    b.stmt(BPF_LD | BPF_H | BPF_ABS, net + 2);
+    b.bind(not_vlan);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IP, ipv4, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_IPV6, ipv6, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_TYPE_MPLS, mpls, other);
+
+    /*
+     * MPLS: the IP version follows the label with the bottom of stack
+     * bit set, among the first max_mpls_labels
+     */
+    b.bind(mpls);
+    for (unsigned int i = 0; i < max_mpls_labels; i++) {
+        b.stmt(BPF_LD | BPF_B | BPF_IND, net + 2);
+        b.jump(BPF_JMP | BPF_JSET | BPF_K, MPLS_BOTTOM_OF_STACK >> 8, mpls_bottom, b.next);
+        b.stmt(BPF_MISC | BPF_TXA, 0);
+        b.stmt(BPF_ALU | BPF_ADD | BPF_K, MPLS_HDR_LEN);
+        b.stmt(BPF_MISC | BPF_TAX, 0);
+    }
+    b.jump_always(other);
+    b.bind(mpls_bottom);
+    b.stmt(BPF_MISC | BPF_TXA, 0);
+    b.stmt(BPF_ALU | BPF_ADD | BPF_K, MPLS_HDR_LEN);
+    b.stmt(BPF_MISC | BPF_TAX, 0);
+    b.stmt(BPF_LD | BPF_B | BPF_IND, net);
+    b.stmt(BPF_ALU | BPF_RSH | BPF_K, 4);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, 4, ipv4, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, 6, ipv6, other);
+
+    /*
+     * anything else keeps the hash that the kernel computed
+     */
+    b.bind(other);
+    b.stmt(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_RXHASH);
+    b.stmt(BPF_RET | BPF_A, 0);
+
+    /*
+     * IPv4: the addresses and protocol are hashed, and the ports too,
+     * unless the packet is a fragment
+     */
+    b.bind(ipv4);
+    b.stmt(BPF_MISC | BPF_TXA, 0);
+    b.stmt(BPF_ST, 0);
+    b.stmt(BPF_LD | BPF_W | BPF_IND, net + 12);
+    b.stmt(BPF_ST, 1);
+    b.stmt(BPF_LD | BPF_W | BPF_IND, net + 16);
+    emit_xor_into_hash(b);
+    b.stmt(BPF_LD | BPF_B | BPF_IND, net + 9);
+    b.stmt(BPF_ST, 3);
+    emit_xor_into_hash(b);
+    b.stmt(BPF_LD | BPF_H | BPF_IND, net + 6);
+    b.jump(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, mix, b.next);
+    b.stmt(BPF_LD | BPF_MEM, 3);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, transport_ipv4, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, transport_ipv4, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_SCTP, transport_ipv4, mix);
+    b.bind(transport_ipv4);
+    b.stmt(BPF_LD | BPF_B | BPF_IND, net);
+    b.stmt(BPF_ALU | BPF_AND | BPF_K, 0x0f);
+    b.stmt(BPF_ALU | BPF_LSH | BPF_K, 2);
+    b.stmt(BPF_ALU | BPF_ADD | BPF_X, 0);
+    b.stmt(BPF_MISC | BPF_TAX, 0);
+    b.jump_always(ports);
+
+    /*
+     * IPv6: the addresses and next header are hashed, and the ports
+     * too, if there are no extension headers
+     */
+    b.bind(ipv6);
+    b.stmt(BPF_MISC | BPF_TXA, 0);
+    b.stmt(BPF_ST, 0);
+    b.stmt(BPF_LD | BPF_W | BPF_IND, net + 8);
+    b.stmt(BPF_ST, 1);
+    for (uint32_t offset = 12; offset < 40; offset += 4) {
+        b.stmt(BPF_LD | BPF_W | BPF_IND, net + offset);
+        emit_xor_into_hash(b);
+    }
+    b.stmt(BPF_LD | BPF_B | BPF_IND, net + 6);
+    b.stmt(BPF_ST, 3);
+    emit_xor_into_hash(b);
+    b.stmt(BPF_LD | BPF_MEM, 3);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, transport_ipv6, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, transport_ipv6, b.next);
+    b.jump(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_SCTP, transport_ipv6, mix);
+    b.bind(transport_ipv6);
+    b.stmt(BPF_MISC | BPF_TXA, 0);
+    b.stmt(BPF_ALU | BPF_ADD | BPF_K, 40);
+    b.stmt(BPF_MISC | BPF_TAX, 0);
+
+    /*
+     * X is the offset of the transport header; the source and
+     * destination ports are combined with XOR, which does not depend
+     * on their order, as the addresses were
+     */
+    b.bind(ports);
+    b.stmt(BPF_LD | BPF_H | BPF_IND, net);
+    b.stmt(BPF_ST, 2);
+    b.stmt(BPF_LD | BPF_H | BPF_IND, net + 2);
+    b.stmt(BPF_LDX | BPF_MEM, 2);
+    b.stmt(BPF_ALU | BPF_XOR | BPF_X, 0);
+    b.stmt(BPF_LDX | BPF_MEM, 1);
+    b.stmt(BPF_ALU | BPF_XOR | BPF_X, 0);
+    b.stmt(BPF_ST, 1);
+
+    /*
+     * the bits of the hash are mixed, since the kernel uses the
+     * remainder of its division by the number of sockets
+     */
+    b.bind(mix);
+    b.stmt(BPF_LD | BPF_MEM, 1);
+    b.stmt(BPF_MISC | BPF_TAX, 0);
+    b.stmt(BPF_ALU | BPF_RSH | BPF_K, 16);
+    b.stmt(BPF_ALU | BPF_XOR | BPF_X, 0);
+    b.stmt(BPF_ALU | BPF_MUL | BPF_K, 0x45d9f3b);
+    b.stmt(BPF_MISC | BPF_TAX, 0);
+    b.stmt(BPF_ALU | BPF_RSH | BPF_K, 16);
+    b.stmt(BPF_ALU | BPF_XOR | BPF_X, 0);
+    b.stmt(BPF_RET | BPF_A, 0);
+
+    if (b.resolve() == false) {
+        return false;
+    }
+    code = b.code;
+    return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * bpf_prefilter.h
+ *
+ * classic BPF socket filters that select the packets that mercury
+ * might report, and truncate them to a snap length, in the kernel,
+ * and a fanout program that steers both directions of each flow to
+ * the same socket
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#ifndef BPF_PREFILTER_H
+#define BPF_PREFILTER_H
+
+#include <linux/filter.h>
+#include <vector>
+
+/*
+ * bpf_prefilter_compile(code, snaplen, prefilter) sets code to a
+ * classic BPF program that accepts at most snaplen bytes of each
+ * packet (or all of it, if snaplen is zero) and, if prefilter is
+ * true, drops the packets that the JSON packet processor could not
+ * report with the current protocol selection.  It returns false if
+ * the program could not be built.
+ *
+ * The prefilter is a conservative version of the checks that
+ * stateful_pkt_proc::write_json() makes, generated from the same
+ * pattern tables (tcp_msg_classifier and udp_msg_classifier), and
+ * from the options that select all TCP or UDP data; whenever a
+ * packet cannot be fully parsed by the filter (MPLS, IPv6 extension
+ * headers), it is accepted.  TCP SYN and SYN/ACK segments are always
+ * accepted, since they reset the state of their flow.  The tables
+ * are read when the program is built, so proto_ident_config() must
+ * be called first.
+ */
+bool bpf_prefilter_compile(std::vector<struct sock_filter> &code, unsigned int snaplen, bool prefilter);
+
+/*
+ * bpf_fanout_compile(code) sets code to a classic BPF program for
+ * PACKET_FANOUT_CBPF that returns a hash of the addresses, ports and
+ * protocol of each IPv4 and IPv6 packet, inside a VLAN tag or MPLS
+ * labels, which is the same for both directions of a flow, so that
+ * the packets of each flow go to the same socket.  The packets that
+ * are not IP keep the hash that the kernel computed.  It returns
+ * false if the program could not be built.
+ */
+bool bpf_fanout_compile(std::vector<struct sock_filter> &code);
+
+#endif /* BPF_PREFILTER_H */
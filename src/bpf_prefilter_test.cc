@@ -0,0 +1,422 @@
+/*
+ * bpf_prefilter_test.cc
+ *
+ * checks that the BPF prefilter accepts every packet that the JSON
+ * packet processor reports, and measures the fraction of packets
+ * that it drops, and checks that the BPF fanout program sends both
+ * directions of each flow to the same socket
+ *
+ * usage: bpf_prefilter_test <pcap file> [filter]
+ *
+ * The filter programs are run by a classic BPF interpreter that
+ * follows the semantics of the kernel's, on each packet in the pcap
+ * file, for the default protocol selection, for the selection given
+ * as filter (if any), and with --nonselected-tcp-data and
+ * --nonselected-udp-data.  All of the records that are written for
+ * the whole file must also be written when only the accepted packets
+ * are processed.  A snap length must be returned for each accepted
+ * packet.
+ *
+ * The fanout program is run on each IPv4 and IPv6 packet, and on a
+ * copy with its addresses and ports swapped, which must have the same
+ * hash; the skew of the division of the packets among four sockets is
+ * reported.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include "pkt_proc.h"
+#include "bpf_prefilter.h"
+#include "extractor.h"
+
+struct global_variables global_vars;   /* normally defined in config.c */
+
+struct packet {
+    struct timespec ts;
+    std::vector<uint8_t> data;
+};
+
+// read_pcap_file(filename, packets) reads all of the packets in a
+// pcap file (with microsecond or nanosecond timestamps) into packets
+//
+static bool read_pcap_file(const char *filename, std::vector<struct packet> &packets) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open file %s\n", filename);
+        return false;
+    }
+    uint32_t file_header[6];
+    if (fread(file_header, sizeof(file_header), 1, f) != 1
+        || (file_header[0] != 0xa1b2c3d4 && file_header[0] != 0xa1b23c4d)) {
+        fprintf(stderr, "error: %s is not a pcap file in host byte order\n", filename);
+        fclose(f);
+        return false;
+    }
+    long nsec_per_tick = file_header[0] == 0xa1b2c3d4 ? 1000 : 1;
+    uint32_t packet_header[4];
+    while (fread(packet_header, sizeof(packet_header), 1, f) == 1) {
+        struct packet p;
+        p.ts.tv_sec = packet_header[0];
+        p.ts.tv_nsec = packet_header[1] * nsec_per_tick;
+        p.data.resize(packet_header[2]);
+        if (fread(p.data.data(), 1, p.data.size(), f) != p.data.size()) {
+            break;
+        }
+        packets.push_back(p);
+    }
+    fclose(f);
+    return true;
+}
+
+// struct skb holds the packet data and metadata that BPF programs
+// can load: the offset of the network header (for loads relative to
+// SKF_NET_OFF), and the protocol and hash of the skb (for the
+// SKF_AD_PROTOCOL and SKF_AD_RXHASH ancillary loads)
+//
+struct skb {
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t network_offset;
+    uint16_t protocol;
+    uint32_t rxhash;
+};
+
+// bpf_run(code, skb, result) runs the classic BPF program code on the
+// packet skb, and sets result to the value that it returns; as in the
+// kernel, a load past the end of the packet returns zero.  It returns
+// false if the program uses an instruction that is not supported
+// here, or does not return.
+//
+static bool bpf_run(const std::vector<struct sock_filter> &code, const struct skb &skb, uint32_t *result) {
+    uint32_t a = 0, x = 0;
+    uint32_t mem[BPF_MEMWORDS] = { 0 };
+
+    for (size_t pc = 0; pc < code.size(); pc++) {
+        const struct sock_filter &insn = code[pc];
+        uint32_t k = insn.k;
+        switch (insn.code) {
+        case BPF_LD | BPF_W | BPF_ABS:
+        case BPF_LD | BPF_H | BPF_ABS:
+        case BPF_LD | BPF_B | BPF_ABS:
+        case BPF_LD | BPF_W | BPF_IND:
+        case BPF_LD | BPF_H | BPF_IND:
+        case BPF_LD | BPF_B | BPF_IND:
+            {
+                if (insn.code == (BPF_LD | BPF_W | BPF_ABS) && k == (uint32_t)(SKF_AD_OFF + SKF_AD_PROTOCOL)) {
+                    a = skb.protocol;
+                    break;
+                }
+                if (insn.code == (BPF_LD | BPF_W | BPF_ABS) && k == (uint32_t)(SKF_AD_OFF + SKF_AD_RXHASH)) {
+                    a = skb.rxhash;
+                    break;
+                }
+                int64_t offset = BPF_MODE(insn.code) == BPF_IND ? (int64_t)(int32_t)x + (int32_t)k : (int32_t)k;
+                if (offset < 0) {
+                    if (offset < SKF_NET_OFF || offset >= SKF_AD_OFF) {
+                        *result = 0;
+                        return true;
+                    }
+                    offset = offset - SKF_NET_OFF + skb.network_offset;
+                }
+                uint32_t size = BPF_SIZE(insn.code) == BPF_W ? 4 : BPF_SIZE(insn.code) == BPF_H ? 2 : 1;
+                if (offset + size > skb.len) {
+                    *result = 0;
+                    return true;
+                }
+                a = 0;
+                for (uint32_t i = 0; i < size; i++) {
+                    a = a << 8 | skb.data[offset + i];
+                }
+            }
+            break;
+        case BPF_LD | BPF_W | BPF_LEN:
+            a = skb.len;
+            break;
+        case BPF_LD | BPF_MEM:
+            a = mem[k];
+            break;
+        case BPF_LDX | BPF_IMM:
+            x = k;
+            break;
+        case BPF_LDX | BPF_MEM:
+            x = mem[k];
+            break;
+        case BPF_ST:
+            mem[k] = a;
+            break;
+        case BPF_ALU | BPF_ADD | BPF_K:
+            a += k;
+            break;
+        case BPF_ALU | BPF_ADD | BPF_X:
+            a += x;
+            break;
+        case BPF_ALU | BPF_AND | BPF_K:
+            a &= k;
+            break;
+        case BPF_ALU | BPF_XOR | BPF_X:
+            a ^= x;
+            break;
+        case BPF_ALU | BPF_MUL | BPF_K:
+            a *= k;
+            break;
+        case BPF_ALU | BPF_LSH | BPF_K:
+            a <<= k;
+            break;
+        case BPF_ALU | BPF_RSH | BPF_K:
+            a >>= k;
+            break;
+        case BPF_MISC | BPF_TAX:
+            x = a;
+            break;
+        case BPF_MISC | BPF_TXA:
+            a = x;
+            break;
+        case BPF_JMP | BPF_JA:
+            pc += k;
+            break;
+        case BPF_JMP | BPF_JEQ | BPF_K:
+            pc += (a == k) ? insn.jt : insn.jf;
+            break;
+        case BPF_JMP | BPF_JGT | BPF_K:
+            pc += (a > k) ? insn.jt : insn.jf;
+            break;
+        case BPF_JMP | BPF_JGE | BPF_K:
+            pc += (a >= k) ? insn.jt : insn.jf;
+            break;
+        case BPF_JMP | BPF_JSET | BPF_K:
+            pc += (a & k) ? insn.jt : insn.jf;
+            break;
+        case BPF_RET | BPF_K:
+            *result = k;
+            return true;
+        case BPF_RET | BPF_A:
+            *result = a;
+            return true;
+        default:
+            fprintf(stdout, "error: unsupported instruction %04x at %zu\n", insn.code, pc);
+            return false;
+        }
+    }
+    fprintf(stdout, "error: program does not return\n");
+    return false;
+}
+
+// records(packets, accepted) returns the JSON records written for
+// the packets for which accepted is true (or all of them, if it is
+// NULL), each with its line terminator
+//
+static std::multiset<std::string> records(std::vector<struct packet> &packets, const std::vector<bool> *accepted) {
+    std::multiset<std::string> output;
+    struct stateful_pkt_proc processor{NULL};
+    uint8_t buf[LLQ_MSG_SIZE];
+    for (size_t i = 0; i < packets.size(); i++) {
+        if (accepted && (*accepted)[i] == false) {
+            continue;
+        }
+        struct packet &p = packets[i];
+        size_t len = processor.write_json<pkt_proc_runtime_features>(buf, sizeof(buf), p.data.data(), p.data.size(), &p.ts);
+        if (len) {
+            output.insert(std::string((const char *)buf, len));
+        }
+    }
+    return output;
+}
+
+// check(name, packets) builds the prefilter for the current protocol
+// selection and output options, and checks it on packets; it returns
+// the number of failures
+//
+static unsigned int check(const char *name, std::vector<struct packet> &packets) {
+    const uint32_t snaplen = 1024;
+    std::vector<struct sock_filter> code;
+    if (bpf_prefilter_compile(code, snaplen, true) == false) {
+        fprintf(stdout, "%s: error: could not build prefilter\n", name);
+        return 1;
+    }
+
+    unsigned int failures = 0;
+    std::vector<bool> accepted(packets.size());
+    size_t num_accepted = 0;
+    for (size_t i = 0; i < packets.size(); i++) {
+        uint32_t result;
+        struct skb skb = { packets[i].data.data(), (uint32_t)packets[i].data.size(), sizeof(struct eth_hdr), 0, 0 };
+        if (bpf_run(code, skb, &result) == false) {
+            return 1;
+        }
+        if (result != 0 && result != snaplen) {
+            fprintf(stdout, "%s: error: packet %zu has snap length %u\n", name, i, result);
+            failures++;
+        }
+        accepted[i] = result != 0;
+        num_accepted += accepted[i];
+    }
+
+    std::multiset<std::string> all = records(packets, NULL);
+    std::multiset<std::string> filtered = records(packets, &accepted);
+    size_t missing = 0;
+    for (const auto &r : all) {
+        auto match = filtered.find(r);
+        if (match == filtered.end()) {
+            if (missing++ == 0) {
+                fprintf(stdout, "%s: error: record not written with prefilter: %s", name, r.c_str());
+            }
+        } else {
+            filtered.erase(match);
+        }
+    }
+    if (missing) {
+        fprintf(stdout, "%s: error: %zu records missing\n", name, missing);
+        failures++;
+    }
+    fprintf(stdout, "%-16s instructions: %zu\tpackets: %zu\taccepted: %zu (%.1f%%)\trecords: %zu\textra records: %zu\n",
+            name, code.size(), packets.size(), num_accepted,
+            packets.size() ? 100.0 * num_accepted / packets.size() : 0.0, all.size(), filtered.size());
+
+    return failures;
+}
+
+// skb_from_packet(p) returns the skb that a fanout program would see
+// for the received packet p, with its outer VLAN tag (if any) removed
+// into the metadata, as the kernel does
+//
+static struct skb skb_from_packet(const std::vector<uint8_t> &p) {
+    struct skb skb = { p.data(), (uint32_t)p.size(), sizeof(struct eth_hdr), 0, 0x1234 };
+    if (p.size() >= sizeof(struct eth_hdr)) {
+        skb.protocol = p[12] << 8 | p[13];
+        if ((skb.protocol == ETH_TYPE_VLAN || skb.protocol == ETH_TYPE_1AD) && p.size() >= sizeof(struct eth_hdr) + 4) {
+            skb.protocol = p[16] << 8 | p[17];
+            skb.network_offset += 4;
+        }
+    }
+    return skb;
+}
+
+// swap_flow_direction(p, net) swaps the source and destination
+// addresses, and ports (for TCP and UDP), of the IPv4 or IPv6 packet p
+// with its network header at offset net, and returns false if p is
+// not such a packet
+//
+static bool swap_flow_direction(std::vector<uint8_t> &p, size_t net, uint16_t protocol) {
+    size_t transport = 0;
+    uint8_t transport_proto = 0;
+    if (protocol == ETH_TYPE_IP && p.size() >= net + 20) {
+        std::swap_ranges(p.begin() + net + 12, p.begin() + net + 16, p.begin() + net + 16);
+        transport = net + (p[net] & 0x0f) * 4;
+        transport_proto = p[net + 9];
+        if ((p[net + 6] & 0x3f) || p[net + 7]) {
+            transport_proto = 0;    // fragment
+        }
+    } else if (protocol == ETH_TYPE_IPV6 && p.size() >= net + 40) {
+        std::swap_ranges(p.begin() + net + 8, p.begin() + net + 24, p.begin() + net + 24);
+        transport = net + 40;
+        transport_proto = p[net + 6];
+    } else {
+        return false;
+    }
+    if ((transport_proto == IPPROTO_TCP || transport_proto == IPPROTO_UDP) && p.size() >= transport + 4) {
+        std::swap_ranges(p.begin() + transport, p.begin() + transport + 2, p.begin() + transport + 2);
+    }
+    return true;
+}
+
+// check_fanout(packets) checks that the fanout program returns the
+// same hash for each IP packet and its reverse, and reports how evenly
+// it divides the packets among four sockets; it returns the number of
+// failures
+//
+static unsigned int check_fanout(std::vector<struct packet> &packets) {
+    std::vector<struct sock_filter> code;
+    if (bpf_fanout_compile(code) == false) {
+        fprintf(stdout, "fanout: error: could not build program\n");
+        return 1;
+    }
+
+    const unsigned int num_sockets = 4;
+    size_t count[num_sockets] = { 0 };
+    size_t num_ip = 0, asymmetric = 0;
+    for (auto &p : packets) {
+        uint32_t hash, reverse_hash;
+        struct skb skb = skb_from_packet(p.data);
+        if (bpf_run(code, skb, &hash) == false) {
+            return 1;
+        }
+        count[hash % num_sockets]++;
+
+        std::vector<uint8_t> reverse = p.data;
+        if (swap_flow_direction(reverse, skb.network_offset, skb.protocol) == false) {
+            continue;
+        }
+        num_ip++;
+        skb.data = reverse.data();
+        if (bpf_run(code, skb, &reverse_hash) == false) {
+            return 1;
+        }
+        if (hash != reverse_hash) {
+            asymmetric++;
+        }
+    }
+    size_t max_count = *std::max_element(count, count + num_sockets);
+    fprintf(stdout, "%-16s instructions: %zu\tpackets: %zu\tIP packets: %zu\tasymmetric: %zu\tskew: %.2f\n",
+            "fanout", code.size(), packets.size(), num_ip, asymmetric,
+            packets.size() ? (double)max_count * num_sockets / packets.size() : 1.0);
+
+    return asymmetric ? 1 : 0;
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s <pcap file> [filter]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<struct packet> packets;
+    if (read_pcap_file(argv[1], packets) == false) {
+        return EXIT_FAILURE;
+    }
+
+    unsigned int failures = 0;
+
+    // without a prefilter, the program only sets the snap length
+    //
+    std::vector<struct sock_filter> code;
+    struct skb empty = { NULL, 0, 0, 0, 0 };
+    uint32_t result = 0;
+    if (bpf_prefilter_compile(code, 0, false) == false
+        || bpf_run(code, empty, &result) == false || result != UINT32_MAX
+        || bpf_prefilter_compile(code, 256, false) == false
+        || bpf_run(code, empty, &result) == false || result != 256) {
+        fprintf(stdout, "error: snap length program returned %u\n", result);
+        failures++;
+    }
+
+    failures += check_fanout(packets);
+
+    failures += check("default", packets);
+
+    global_vars.output_tcp_initial_data = true;
+    global_vars.output_udp_initial_data = true;
+    failures += check("nonselected data", packets);
+    global_vars.output_tcp_initial_data = false;
+    global_vars.output_udp_initial_data = false;
+
+    // the protocol selection cannot be undone, so it is checked last
+    //
+    if (argc == 3) {
+        if (proto_ident_config(argv[2]) != status_ok) {
+            return EXIT_FAILURE;
+        }
+        failures += check(argv[2], packets);
+    }
+
+    fprintf(stdout, "correctness: %u failures\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
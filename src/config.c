@@ -67,6 +67,92 @@ enum status argument_parse_as_float(const char *arg, float *variable_to_set) {
     return status_err;
 }
 
+enum status argument_parse_as_asn_lookup(const char *arg, enum asn_lookup_type *variable_to_set) {
+    if (strcmp(arg, "lctrie") == 0) {
+        *variable_to_set = asn_lookup_lctrie;
+        return status_ok;
+    } else if (strcmp(arg, "dir-24-8") == 0) {
+        *variable_to_set = asn_lookup_dir_24_8;
+        return status_ok;
+    }
+    return status_err;
+}
+
+enum status argument_parse_as_prefetch_distance(const char *arg, unsigned int *variable_to_set) {
+    char *endptr = NULL;
+    unsigned long tmp = strtoul(arg, &endptr, 10);
+    if (arg[0] != 0 && *endptr == 0 && tmp <= MAX_PREFETCH_DISTANCE) {
+        *variable_to_set = tmp;
+        return status_ok;
+    }
+    return status_err;
+}
+
+enum status argument_parse_as_capture_method(const char *arg, enum capture_method *variable_to_set) {
+    if (strcmp(arg, "af-packet") == 0) {
+        *variable_to_set = capture_method_af_packet;
+        return status_ok;
+    } else if (strcmp(arg, "af-xdp") == 0) {
+        *variable_to_set = capture_method_af_xdp;
+        return status_ok;
+    }
+    return status_err;
+}
+
+enum status argument_parse_as_snaplen(const char *arg, unsigned int *variable_to_set) {
+    char *endptr = NULL;
+    unsigned long tmp = strtoul(arg, &endptr, 10);
+    if (arg[0] != 0 && *endptr == 0 && (tmp == 0 || (tmp >= MIN_SNAPLEN && tmp <= UINT32_MAX))) {
+        *variable_to_set = tmp;
+        return status_ok;
+    }
+    return status_err;
+}
+
+enum status argument_parse_as_fanout_mode(const char *arg, enum fanout_mode *variable_to_set) {
+    struct { const char *name; enum fanout_mode mode; } modes[] = {
+        { "hash",     fanout_mode_hash     },
+        { "lb",       fanout_mode_lb       },
+        { "cpu",      fanout_mode_cpu      },
+        { "qm",       fanout_mode_qm       },
+        { "rollover", fanout_mode_rollover },
+        { "bpf",      fanout_mode_bpf      },
+    };
+    for (const auto &m : modes) {
+        if (strcmp(arg, m.name) == 0) {
+            *variable_to_set = m.mode;
+            return status_ok;
+        }
+    }
+    return status_err;
+}
+
+enum status argument_parse_as_ring_tuning(const char *arg, enum ring_tuning *variable_to_set) {
+    if (strcmp(arg, "off") == 0) {
+        *variable_to_set = ring_tuning_off;
+        return status_ok;
+    }
+    if (strcmp(arg, "recommend") == 0) {
+        *variable_to_set = ring_tuning_recommend;
+        return status_ok;
+    }
+    if (strcmp(arg, "apply") == 0) {
+        *variable_to_set = ring_tuning_apply;
+        return status_ok;
+    }
+    return status_err;
+}
+
+enum status argument_parse_as_latency_sampling(const char *arg, unsigned int *variable_to_set) {
+    char *endptr = NULL;
+    unsigned long tmp = strtoul(arg, &endptr, 10);
+    if (arg[0] != 0 && *endptr == 0 && tmp <= UINT32_MAX) {
+        *variable_to_set = tmp;
+        return status_ok;
+    }
+    return status_err;
+}
+
 static enum status mercury_config_parse_line(struct mercury_config *cfg, char *line) {
     char *arg = NULL;
 
@@ -86,10 +172,42 @@ static enum status mercury_config_parse_line(struct mercury_config *cfg, char *l
         cfg->capture_interface = strdup(arg);
         return status_ok;
 
+    } else if ((arg = command_get_argument("capture-method=", line)) != NULL) {
+        return argument_parse_as_capture_method(arg, &cfg->capture_method);
+
+    } else if ((arg = command_get_argument("prefilter=", line)) != NULL) {
+        return argument_parse_as_boolean(arg, &cfg->prefilter);
+
+    } else if ((arg = command_get_argument("snaplen=", line)) != NULL) {
+        return argument_parse_as_snaplen(arg, &cfg->snaplen);
+
+    } else if ((arg = command_get_argument("fanout=", line)) != NULL) {
+        return argument_parse_as_fanout_mode(arg, &cfg->fanout_mode);
+
+    } else if ((arg = command_get_argument("stats-file=", line)) != NULL) {
+        cfg->stats_filename = strdup(arg);
+        return status_ok;
+
+    } else if ((arg = command_get_argument("ring-tuning=", line)) != NULL) {
+        return argument_parse_as_ring_tuning(arg, &cfg->ring_tuning);
+
+    } else if ((arg = command_get_argument("metrics=", line)) != NULL) {
+        cfg->metrics_address = strdup(arg);
+        return status_ok;
+
+    } else if ((arg = command_get_argument("latency-sampling=", line)) != NULL) {
+        return argument_parse_as_latency_sampling(arg, &cfg->latency_sampling);
+
     } else if ((arg = command_get_argument("resources=", line)) != NULL) {
         cfg->resources = strdup(arg);
         return status_ok;
 
+    } else if ((arg = command_get_argument("asn-lookup=", line)) != NULL) {
+        return argument_parse_as_asn_lookup(arg, &cfg->asn_lookup);
+
+    } else if ((arg = command_get_argument("prefetch-distance=", line)) != NULL) {
+        return argument_parse_as_prefetch_distance(arg, &cfg->prefetch_distance);
+
     } else if ((arg = command_get_argument("directory=", line)) != NULL) {
         cfg->working_dir = strdup(arg);
         return status_ok;
@@ -12,4 +12,48 @@
 enum status mercury_config_read_from_file(struct mercury_config *cfg,
                                           const char *filename);
 
+/*
+ * argument_parse_as_asn_lookup(arg, type) sets type to the ASN lookup
+ * type named by arg, which is either "lctrie" or "dir-24-8"
+ */
+enum status argument_parse_as_asn_lookup(const char *arg, enum asn_lookup_type *variable_to_set);
+
+/*
+ * argument_parse_as_prefetch_distance(arg, distance) sets distance to
+ * the number in arg, which must be at most MAX_PREFETCH_DISTANCE
+ */
+enum status argument_parse_as_prefetch_distance(const char *arg, unsigned int *variable_to_set);
+
+/*
+ * argument_parse_as_capture_method(arg, method) sets method to the
+ * capture method named by arg, which is either "af-packet" or "af-xdp"
+ */
+enum status argument_parse_as_capture_method(const char *arg, enum capture_method *variable_to_set);
+
+/*
+ * argument_parse_as_snaplen(arg, snaplen) sets snaplen to the number
+ * in arg, which must be zero (no limit) or at least MIN_SNAPLEN
+ */
+enum status argument_parse_as_snaplen(const char *arg, unsigned int *variable_to_set);
+
+/*
+ * argument_parse_as_fanout_mode(arg, mode) sets mode to the fanout
+ * mode named by arg, which is "hash", "lb", "cpu", "qm", "rollover",
+ * or "bpf"
+ */
+enum status argument_parse_as_fanout_mode(const char *arg, enum fanout_mode *variable_to_set);
+
+/*
+ * argument_parse_as_ring_tuning(arg, tuning) sets tuning to the ring
+ * tuning mode named by arg, which is "off", "recommend", or "apply"
+ */
+enum status argument_parse_as_ring_tuning(const char *arg, enum ring_tuning *variable_to_set);
+
+/*
+ * argument_parse_as_latency_sampling(arg, sampling) sets sampling to
+ * the number in arg, the number of packets per latency sample, which
+ * is zero if latency is not sampled
+ */
+enum status argument_parse_as_latency_sampling(const char *arg, unsigned int *variable_to_set);
+
 #endif /* CONFIG_H */
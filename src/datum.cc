@@ -6,6 +6,9 @@
  */
 
 #include "datum.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 void datum_init(struct datum *p,
                  const unsigned char *data,
@@ -117,6 +120,161 @@ enum status datum_read_and_skip_byte_string(struct datum *p,
     return status_err;
 }
 
+/*
+ * The delimiter searches below look for the first byte in [x, end)
+ * that equals any of N delimiter bytes.  The SSE2 and AVX2 versions
+ * compare 16 or 32 bytes at a time, and finish the bytes that do not
+ * fill a register with the next narrower version; they never read
+ * outside of [x, end).
+ */
+template <size_t N>
+static inline bool is_delim(unsigned char c, const unsigned char (&delim)[N]) {
+    bool match = false;
+    for (size_t i = 0; i < N; i++) {
+        match |= c == delim[i];
+    }
+    return match;
+}
+
+template <size_t N>
+static inline const unsigned char *find_any_scalar(const unsigned char *x,
+                                                   const unsigned char *end,
+                                                   const unsigned char (&delim)[N]) {
+    while (x < end && !is_delim(*x, delim)) {
+        x++;
+    }
+    return x;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+template <size_t N>
+__attribute__((target("sse2")))
+static inline const unsigned char *find_any_sse2(const unsigned char *x,
+                                                 const unsigned char *end,
+                                                 const unsigned char (&delim)[N]) {
+    __m128i d[N];
+    for (size_t i = 0; i < N; i++) {
+        d[i] = _mm_set1_epi8(delim[i]);
+    }
+    while (end - x >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)x);
+        __m128i eq = _mm_cmpeq_epi8(v, d[0]);
+        for (size_t i = 1; i < N; i++) {
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(v, d[i]));
+        }
+        unsigned int matches = _mm_movemask_epi8(eq);
+        if (matches) {
+            return x + __builtin_ctz(matches);
+        }
+        x += 16;
+    }
+    return find_any_scalar(x, end, delim);
+}
+
+template <size_t N>
+__attribute__((target("avx2")))
+static const unsigned char *find_any_avx2(const unsigned char *x,
+                                          const unsigned char *end,
+                                          const unsigned char (&delim)[N]) {
+    __m256i d[N];
+    for (size_t i = 0; i < N; i++) {
+        d[i] = _mm256_set1_epi8(delim[i]);
+    }
+    while (end - x >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)x);
+        __m256i eq = _mm256_cmpeq_epi8(v, d[0]);
+        for (size_t i = 1; i < N; i++) {
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(v, d[i]));
+        }
+        unsigned int matches = _mm256_movemask_epi8(eq);
+        if (matches) {
+            return x + __builtin_ctz(matches);
+        }
+        x += 32;
+    }
+    return find_any_sse2(x, end, delim);
+}
+
+static enum delim_search_impl best_delim_search_impl() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return delim_search_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return delim_search_sse2;
+    }
+    return delim_search_scalar;
+}
+
+#else
+
+static enum delim_search_impl best_delim_search_impl() {
+    return delim_search_scalar;
+}
+
+#endif
+
+// the implementation used by datum_find_any(), which is the scalar
+// one until the static initializers have run
+//
+static enum delim_search_impl delim_search = best_delim_search_impl();
+
+template <size_t N>
+static inline const unsigned char *find_any(const unsigned char *x,
+                                            const unsigned char *end,
+                                            const unsigned char (&delim)[N]) {
+    if (x >= end) {
+        return end;
+    }
+    switch (delim_search) {
+#if defined(__x86_64__) || defined(__i386__)
+    case delim_search_avx2:
+        return find_any_avx2(x, end, delim);
+    case delim_search_sse2:
+        return find_any_sse2(x, end, delim);
+#endif
+    default:
+        return find_any_scalar(x, end, delim);
+    }
+}
+
+const unsigned char *datum_find_any(const unsigned char *x,
+                                    const unsigned char *end,
+                                    unsigned char a) {
+    const unsigned char delim[1] = { a };
+    return find_any(x, end, delim);
+}
+
+const unsigned char *datum_find_any(const unsigned char *x,
+                                    const unsigned char *end,
+                                    unsigned char a,
+                                    unsigned char b) {
+    const unsigned char delim[2] = { a, b };
+    return find_any(x, end, delim);
+}
+
+const unsigned char *datum_find_any(const unsigned char *x,
+                                    const unsigned char *end,
+                                    unsigned char a,
+                                    unsigned char b,
+                                    unsigned char c) {
+    const unsigned char delim[3] = { a, b, c };
+    return find_any(x, end, delim);
+}
+
+bool delim_search_select(enum delim_search_impl impl) {
+    if (impl > best_delim_search_impl()) {
+        return false;
+    }
+    delim_search = impl;
+    return true;
+}
+
+enum delim_search_impl delim_search_selected() {
+    return delim_search;
+}
+
 /*
  * datum_find_delim(p, d, l) looks for the delimiter d with length l
  * in the parser p's data buffer, until it reaches the delimiter d or
@@ -129,23 +287,36 @@ int datum_find_delim(struct datum *p,
                       const unsigned char *delim,
                       size_t length) {
 
-    /* find delimiter, if present */
+    if (length == 0 || p->data >= p->data_end) {
+        return 0;
+    }
+
+    // skip to each occurrence of the first byte of the delimiter,
+    // then compare the rest of it; like the byte loop that this
+    // replaced, a byte that mismatches the delimiter is not compared
+    // against its first byte again
+    //
     const unsigned char *data = p->data;
-    const unsigned char *pattern = delim;
-    const unsigned char *pattern_end = delim + length;
-    while (pattern < pattern_end && data < p->data_end) {
-        mercury_debug("%s: data index: %lu\tpattern index: %lu\n", __func__, data - p->data, pattern - delim);
-        mercury_debug("%s: data: %02x, pattern: %02x\n", __func__, *data, *pattern);
-        if (*data != *pattern) {
-            pattern = delim - 1; /* reset pattern to the start of the delimeter string */
+    while (true) {
+        data = datum_find_any(data, p->data_end, delim[0]);
+        if (data == p->data_end) {
+            break;
+        }
+        size_t matched = 1;
+        data++;
+        while (matched < length && data < p->data_end && *data == delim[matched]) {
+            matched++;
+            data++;
+        }
+        if (matched == length) {
+            return data - p->data;
+        }
+        if (data == p->data_end) {
+            break;
         }
         data++;
-        pattern++;
-    }
-    if (pattern == pattern_end) {
-        return data - p->data;
     }
-    return - (data - p->data);
+    return - (p->data_end - p->data);
 }
 
 enum status datum_skip_upto_delim(struct datum *p,
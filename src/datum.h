@@ -34,6 +34,39 @@ inline uint8_t lowercase(uint8_t x) {
     return x;
 }
 
+/*
+ * datum_find_any(x, end, a[, b[, c]]) returns a pointer to the first
+ * byte in [x, end) that is equal to a (or b, or c), or end if there
+ * is none.  It compares as many bytes at a time as the CPU allows;
+ * the implementation is chosen at startup, and delim_search_select()
+ * can override that choice (e.g. to compare the implementations),
+ * returning false if the CPU does not support the one requested.
+ */
+const unsigned char *datum_find_any(const unsigned char *x,
+                                    const unsigned char *end,
+                                    unsigned char a);
+
+const unsigned char *datum_find_any(const unsigned char *x,
+                                    const unsigned char *end,
+                                    unsigned char a,
+                                    unsigned char b);
+
+const unsigned char *datum_find_any(const unsigned char *x,
+                                    const unsigned char *end,
+                                    unsigned char a,
+                                    unsigned char b,
+                                    unsigned char c);
+
+enum delim_search_impl {
+    delim_search_scalar = 0,
+    delim_search_sse2   = 1,
+    delim_search_avx2   = 2
+};
+
+bool delim_search_select(enum delim_search_impl impl);
+
+enum delim_search_impl delim_search_selected();
+
 struct datum {
     const unsigned char *data;          /* data being parsed/copied  */
     const unsigned char *data_end;      /* end of data buffer        */
@@ -70,50 +103,45 @@ struct datum {
         data_end = r.data + num_bytes;
         r.data += num_bytes;
     }
+    // the delimiter searches below include the byte at r.data_end,
+    // as the byte-by-byte loops that they replaced did; if there is
+    // no delimiter, r.data is left at r.data_end + 1
+    //
     void parse_up_to_delim(struct datum &r, uint8_t delim) {
         data = r.data;
-        while (r.data <= r.data_end) {
-            if (*r.data == delim) { // found delimeter
-                data_end = r.data;
-                return;
-            }
-            r.data++;
+        if (r.data <= r.data_end) {
+            r.data = datum_find_any(r.data, r.data_end + 1, delim);
         }
         data_end = r.data;
     }
     uint8_t parse_up_to_delimeters(struct datum &r, uint8_t delim1, uint8_t delim2) {
         data = r.data;
-        while (r.data <= r.data_end) {
-            if (*r.data == delim1) { // found first delimeter
-                data_end = r.data;
-                return delim1;
-            }
-            if (*r.data == delim2) { // found second delimeter
-                data_end = r.data;
-                return delim2;
-            }
-            r.data++;
+        if (r.data > r.data_end) {
+            return 0;
+        }
+        const unsigned char *end = r.data_end + 1;
+        r.data = datum_find_any(r.data, end, delim1, delim2);
+        if (r.data == end) {
+            return 0;
         }
-        return 0;
+        data_end = r.data;
+        return *r.data == delim1 ? delim1 : delim2;
     }
     uint8_t parse_up_to_delimeters(struct datum &r, uint8_t delim1, uint8_t delim2, uint8_t delim3) {
         data = r.data;
-        while (r.data <= r.data_end) {
-            if (*r.data == delim1) { // found first delimeter
-                data_end = r.data;
-                return delim1;
-            }
-            if (*r.data == delim2) { // found second delimeter
-                data_end = r.data;
-                return delim2;
-            }
-            if (*r.data == delim3) { // found third delimeter
-                data_end = r.data;
-                return delim2;
-            }
-            r.data++;
+        if (r.data > r.data_end) {
+            return 0;
+        }
+        const unsigned char *end = r.data_end + 1;
+        r.data = datum_find_any(r.data, end, delim1, delim2, delim3);
+        if (r.data == end) {
+            return 0;
+        }
+        data_end = r.data;
+        if (*r.data == delim1) {
+            return delim1;
         }
-        return 0;
+        return *r.data == delim2 ? delim2 : delim3;
     }
     void skip(size_t length) {
         data += length;
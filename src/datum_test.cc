@@ -0,0 +1,232 @@
+/*
+ * datum_test.cc
+ *
+ * checks the vectorized delimiter searches in datum.h and datum.cc
+ * (parse_up_to_delim(), parse_up_to_delimeters(), datum_find_delim()
+ * and datum_skip_upto_delim()) against the byte-by-byte loops that
+ * they replaced, with each implementation that the CPU supports, and
+ * benchmarks them
+ *
+ * usage: datum_test [iterations]
+ *
+ * The inputs are pseudorandom strings over small alphabets that
+ * contain the delimiters, at every alignment, so that delimiters are
+ * found at the start, the end and the middle of a register, in the
+ * byte at data_end, and not at all.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+#include "datum.h"
+#include "utils.h"
+
+/*
+ * the reference implementations are the loops that the searches
+ * replaced; the three-delimiter one returns delim3 when it finds
+ * delim3, rather than delim2 as the original loop did
+ */
+static void reference_parse_up_to_delim(struct datum &d, struct datum &r, uint8_t delim) {
+    d.data = r.data;
+    while (r.data <= r.data_end) {
+        if (*r.data == delim) {
+            d.data_end = r.data;
+            return;
+        }
+        r.data++;
+    }
+    d.data_end = r.data;
+}
+
+static uint8_t reference_parse_up_to_delimeters(struct datum &d, struct datum &r, uint8_t delim1, uint8_t delim2) {
+    d.data = r.data;
+    while (r.data <= r.data_end) {
+        if (*r.data == delim1) {
+            d.data_end = r.data;
+            return delim1;
+        }
+        if (*r.data == delim2) {
+            d.data_end = r.data;
+            return delim2;
+        }
+        r.data++;
+    }
+    return 0;
+}
+
+static uint8_t reference_parse_up_to_delimeters(struct datum &d, struct datum &r, uint8_t delim1, uint8_t delim2, uint8_t delim3) {
+    d.data = r.data;
+    while (r.data <= r.data_end) {
+        if (*r.data == delim1) {
+            d.data_end = r.data;
+            return delim1;
+        }
+        if (*r.data == delim2) {
+            d.data_end = r.data;
+            return delim2;
+        }
+        if (*r.data == delim3) {
+            d.data_end = r.data;
+            return delim3;
+        }
+        r.data++;
+    }
+    return 0;
+}
+
+static int reference_find_delim(struct datum *p, const unsigned char *delim, size_t length) {
+    const unsigned char *data = p->data;
+    const unsigned char *pattern = delim;
+    const unsigned char *pattern_end = delim + length;
+    while (pattern < pattern_end && data < p->data_end) {
+        if (*data != *pattern) {
+            pattern = delim - 1;
+        }
+        data++;
+        pattern++;
+    }
+    if (pattern == pattern_end) {
+        return data - p->data;
+    }
+    return - (data - p->data);
+}
+
+static const char *impl_name(enum delim_search_impl impl) {
+    switch (impl) {
+    case delim_search_avx2:
+        return "avx2";
+    case delim_search_sse2:
+        return "sse2";
+    default:
+        return "scalar";
+    }
+}
+
+static bool same(const struct datum &x, const struct datum &y) {
+    return x.data == y.data && x.data_end == y.data_end;
+}
+
+static unsigned int check(size_t iterations) {
+    const char alphabet[] = "\r\n: \"a,}";
+    const size_t max_length = 200;
+    const size_t max_offset = 64;
+    std::vector<uint8_t> buf(max_offset + max_length + 1);
+    std::mt19937_64 rng{0x5eed};
+    unsigned int failures = 0;
+
+    for (size_t n = 0; n < iterations; n++) {
+        size_t alphabet_size = 1 + rng() % (sizeof(alphabet) - 1);
+        for (auto &b : buf) {
+            b = alphabet[rng() % alphabet_size];
+        }
+        size_t offset = rng() % max_offset;
+        size_t length = rng() % max_length;
+        const uint8_t *start = &buf[offset];
+        const uint8_t *end = start + length;   // the byte at end is readable, as in a packet buffer
+        uint8_t d[4];
+        for (auto &x : d) {
+            x = alphabet[rng() % alphabet_size];
+        }
+
+        struct datum r1{start, end}, r2{start, end};
+        struct datum x1{nullptr, nullptr}, x2{nullptr, nullptr};
+        x1.parse_up_to_delim(r1, d[0]);
+        reference_parse_up_to_delim(x2, r2, d[0]);
+        failures += !same(x1, x2) || !same(r1, r2);
+
+        r1 = r2 = {start, end};
+        x1 = x2 = {nullptr, nullptr};
+        failures += x1.parse_up_to_delimeters(r1, d[0], d[1]) != reference_parse_up_to_delimeters(x2, r2, d[0], d[1]);
+        failures += !same(x1, x2) || !same(r1, r2);
+
+        r1 = r2 = {start, end};
+        x1 = x2 = {nullptr, nullptr};
+        failures += x1.parse_up_to_delimeters(r1, d[0], d[1], d[2]) != reference_parse_up_to_delimeters(x2, r2, d[0], d[1], d[2]);
+        failures += !same(x1, x2) || !same(r1, r2);
+
+        for (size_t delim_length = 1; delim_length <= sizeof(d); delim_length++) {
+            struct datum p{start, end};
+            int index = reference_find_delim(&p, d, delim_length);
+            failures += datum_find_delim(&p, d, delim_length) != index;
+
+            struct datum q{start, end};
+            enum status status = datum_skip_upto_delim(&q, d, delim_length);
+            if (index >= 0) {
+                failures += status != status_ok || q.data != start + index;
+            } else {
+                failures += status != status_err || q.data != start;
+            }
+        }
+    }
+    return failures;
+}
+
+template <typename T>
+static void benchmark(const char *name, T search, const std::vector<uint8_t> &buf, size_t repeat) {
+    int64_t found = 0;
+    struct timer t;
+    timer_start(&t);
+    for (size_t r = 0; r < repeat; r++) {
+        found += search(buf.data(), buf.data() + buf.size());
+    }
+    uint64_t ns = timer_stop(&t);
+    fprintf(stdout, "  %-16s bytes: %zu\tns/search: %.1f\tbytes/ns: %.2f\t(%ld)\n",
+            name, buf.size(), (double)ns / repeat, (double)buf.size() * repeat / ns, found);
+}
+
+static void benchmark_all(size_t length) {
+
+    // a header-like buffer with no delimiters, so that every search
+    // scans all of it
+    //
+    std::vector<uint8_t> buf(length);
+    for (size_t i = 0; i < length; i++) {
+        buf[i] = 'A' + i % 26;
+    }
+    const size_t repeat = (1 << 26) / length;
+    benchmark("find_any(1)", [](const uint8_t *x, const uint8_t *end) { return datum_find_any(x, end, '\r') - x; }, buf, repeat);
+    benchmark("find_any(2)", [](const uint8_t *x, const uint8_t *end) { return datum_find_any(x, end, '\n', ' ') - x; }, buf, repeat);
+    benchmark("find_any(3)", [](const uint8_t *x, const uint8_t *end) { return datum_find_any(x, end, '\"', ',', '}') - x; }, buf, repeat);
+    benchmark("find_delim(crlf)", [](const uint8_t *x, const uint8_t *end) {
+        const unsigned char crlf[2] = { '\r', '\n' };
+        struct datum p{x, end};
+        return datum_find_delim(&p, crlf, sizeof(crlf));
+    }, buf, repeat);
+    benchmark("reference(crlf)", [](const uint8_t *x, const uint8_t *end) {
+        const unsigned char crlf[2] = { '\r', '\n' };
+        struct datum p{x, end};
+        return reference_find_delim(&p, crlf, sizeof(crlf));
+    }, buf, repeat);
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t iterations = argc == 2 ? strtoul(argv[1], NULL, 10) : 1000000;
+
+    const enum delim_search_impl best = delim_search_selected();
+    unsigned int failures = 0;
+    for (auto impl : { delim_search_scalar, delim_search_sse2, delim_search_avx2 }) {
+        if (!delim_search_select(impl)) {
+            fprintf(stdout, "%s: not supported\n", impl_name(impl));
+            continue;
+        }
+        unsigned int f = check(iterations);
+        fprintf(stdout, "%s: correctness: %u failures in %zu inputs\n", impl_name(impl), f, iterations);
+        for (size_t length : { 64, 1500 }) {
+            benchmark_all(length);
+        }
+        failures += f;
+    }
+    delim_search_select(best);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
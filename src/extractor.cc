@@ -160,6 +160,16 @@ struct pi_container http_server = {
     HTTP_PORT
 };
 
+/* HTTP/2 connection preface matching value: "PRI * HT" */
+
+unsigned char http2_preface_mask[] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+unsigned char http2_preface_value[] = {
+    'P', 'R', 'I', ' ', '*', ' ', 'H', 'T'
+};
+
 /* SSH matching value: "SSH-2." */
 
 unsigned char ssh_mask[] = {
@@ -196,73 +206,97 @@ struct pi_container ssh_kex = {
     SSH_KEX
 };
 
-enum tcp_msg_type get_message_type(const uint8_t *tcp_data,
-                                   unsigned int len) {
+/*
+ * HTTP/2 frame header matching values (RFC 7540, Section 4.1), for
+ * the frames that may follow the connection preface in a later TCP
+ * segment: a length of less than 16384 (the default maximum frame
+ * size), and the reserved bit of the stream identifier clear
+ */
 
-    if (len < sizeof(tls_client_hello_mask)) {
-        return tcp_msg_type_unknown;
-    }
+/* HEADERS (0x1) or CONTINUATION (0x9) frame */
 
-    // debug_print_u8_array(tcp_data);
+unsigned char http2_headers_mask[] = {
+    0xff, 0xc0, 0x00,       // length
+    0xf7,                   // type
+    0x00,                   // flags
+    0x80, 0x00, 0x00        // stream identifier
+};
 
-    /* note: tcp_data will be 32-bit aligned as per the standard */
+unsigned char http2_headers_value[] = {
+    0x00, 0x00, 0x00,       // length
+    0x01,                   // type
+    0x00,                   // flags
+    0x00, 0x00, 0x00        // stream identifier
+};
 
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         tls_client_hello_mask,
-                                         tls_client_hello_value)) {
-        return tcp_msg_type_tls_client_hello;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         tls_server_hello_mask,
-                                         tls_server_hello_value)) {
-        return tcp_msg_type_tls_server_hello;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         tls_server_cert_mask,
-                                         tls_server_cert_value)) {
-        return tcp_msg_type_tls_certificate;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         http_client_mask,
-                                         http_client_value)) {
-        return tcp_msg_type_http_request;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         http_client_post_mask,
-                                         http_client_post_value)) {
-        return tcp_msg_type_http_request;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         http_client_connect_mask,
-                                         http_client_connect_value)) {
-        return tcp_msg_type_http_request;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         http_client_put_mask,
-                                         http_client_put_value)) {
-        return tcp_msg_type_http_request;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         http_client_head_mask,
-                                         http_client_head_value)) {
-        return tcp_msg_type_http_request;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         http_server_mask,
-                                         http_server_value)) {
-        return tcp_msg_type_http_response;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         ssh_mask,
-                                         ssh_value)) {
-        return tcp_msg_type_ssh;
-    }
-    if (u32_compare_masked_data_to_value(tcp_data,
-                                         ssh_kex_mask,
-                                         ssh_kex_value)) {
-        return tcp_msg_type_ssh_kex;
-    }
-    return tcp_msg_type_unknown;
+/* SETTINGS (0x4) frame, on stream zero, with or without ACK */
+
+unsigned char http2_settings_mask[] = {
+    0xff, 0xc0, 0x00,       // length
+    0xff,                   // type
+    0xfe,                   // flags
+    0xff, 0xff, 0xff        // stream identifier
+};
+
+unsigned char http2_settings_value[] = {
+    0x00, 0x00, 0x00,       // length
+    0x04,                   // type
+    0x00,                   // flags
+    0x00, 0x00, 0x00        // stream identifier
+};
+
+/* WINDOW_UPDATE (0x8) frame, whose length is always four */
+
+unsigned char http2_window_update_mask[] = {
+    0xff, 0xff, 0xff,       // length
+    0xff,                   // type
+    0xff,                   // flags
+    0x80, 0x00, 0x00        // stream identifier
+};
+
+unsigned char http2_window_update_value[] = {
+    0x00, 0x00, 0x04,       // length
+    0x08,                   // type
+    0x00,                   // flags
+    0x00, 0x00, 0x00        // stream identifier
+};
+
+/*
+ * tcp_msg_classifier holds the TCP patterns above, in the order in
+ * which they are checked; tcp_msg_classifier_init() rebuilds it from
+ * the mask and value arrays, so that it reflects any patterns that
+ * have been disabled by proto_ident_config()
+ */
+struct protocol_classifier tcp_msg_classifier;
+
+void tcp_msg_classifier_init() {
+    struct protocol_classifier c;
+    c.add(tls_client_hello_mask, tls_client_hello_value, tcp_msg_type_tls_client_hello);
+    c.add(tls_server_hello_mask, tls_server_hello_value, tcp_msg_type_tls_server_hello);
+    c.add(tls_server_cert_mask, tls_server_cert_value, tcp_msg_type_tls_certificate);
+    c.add(http_client_mask, http_client_value, tcp_msg_type_http_request);
+    c.add(http_client_post_mask, http_client_post_value, tcp_msg_type_http_request);
+    c.add(http_client_connect_mask, http_client_connect_value, tcp_msg_type_http_request);
+    c.add(http_client_put_mask, http_client_put_value, tcp_msg_type_http_request);
+    c.add(http_client_head_mask, http_client_head_value, tcp_msg_type_http_request);
+    c.add(http_server_mask, http_server_value, tcp_msg_type_http_response);
+    c.add(http2_preface_mask, http2_preface_value, tcp_msg_type_http2);
+    c.add(ssh_mask, ssh_value, tcp_msg_type_ssh);
+    c.add(ssh_kex_mask, ssh_kex_value, tcp_msg_type_ssh_kex);
+    c.add(http2_headers_mask, http2_headers_value, tcp_msg_type_http2_frame);
+    c.add(http2_settings_mask, http2_settings_value, tcp_msg_type_http2_frame);
+    c.add(http2_window_update_mask, http2_window_update_value, tcp_msg_type_http2_frame);
+    tcp_msg_classifier = c;    // replace the table in one assignment
+}
+
+static struct tcp_msg_classifier_initializer {
+    tcp_msg_classifier_initializer() { tcp_msg_classifier_init(); }
+} tcp_msg_classifier_initializer;
+
+enum tcp_msg_type get_message_type(const uint8_t *tcp_data,
+                                   unsigned int len) {
+
+    return (enum tcp_msg_type)tcp_msg_classifier.classify(tcp_data, len);
 }
 
 /*
@@ -651,6 +685,10 @@ enum status proto_ident_config(const char *config_string) {
         bzero(http_client_put_mask, sizeof(http_client_put_mask));
         bzero(http_client_head_mask, sizeof(http_client_head_mask));
         bzero(http_server_mask, sizeof(http_server_mask));
+        bzero(http2_preface_mask, sizeof(http2_preface_mask));
+        bzero(http2_headers_mask, sizeof(http2_headers_mask));
+        bzero(http2_settings_mask, sizeof(http2_settings_mask));
+        bzero(http2_window_update_mask, sizeof(http2_window_update_mask));
     }
     if (protocols["ssh"] == false) {
         bzero(ssh_kex_mask, sizeof(ssh_kex_mask));
@@ -677,6 +715,12 @@ enum status proto_ident_config(const char *config_string) {
     if (protocols["quic"] == false) {
         bzero(quic_mask, sizeof(quic_mask));
     }
+
+    // rebuild the classifiers, to drop the disabled patterns
+    //
+    tcp_msg_classifier_init();
+    udp_msg_classifier_init();
+
     return status_ok;
 }
 
@@ -39,4 +39,8 @@ enum status proto_ident_config(const char *config_string);
 enum tcp_msg_type get_message_type(const uint8_t *tcp_data,
                                    unsigned int len);
 
+void tcp_msg_classifier_init();
+
+extern struct protocol_classifier tcp_msg_classifier;   // defined in extractor.cc
+
 #endif /* EXTRACTOR_H */
@@ -2,21 +2,10 @@
  * http.c
  */
 
-#include <unordered_map>
-#include "asn1/bytestring.h"
 #include "http.h"
 #include "json_object.h"
 #include "match.h"
 
-inline void to_lower(std::basic_string<uint8_t> &str, struct datum d) {
-    if (d.is_not_readable()) {
-        return;
-    }
-    while (d.data < d.data_end) {
-        str.push_back(tolower(*d.data++));
-    }
-}
-
 void http_request::parse(struct datum &p) {
 
     /* parse request line */
@@ -33,7 +22,7 @@ void http_request::parse(struct datum &p) {
     return;
 }
 
-void http_headers::print_matching_names(struct json_object &o, std::unordered_map<std::basic_string<uint8_t>, std::string> &name_dict) const {
+void http_headers::print_matching_names(struct json_object &o, const http_header_matcher<const char *> &names) const {
     unsigned char crlf[2] = { '\r', '\n' };
     unsigned char csp[2] = { ':', ' ' };
 
@@ -51,14 +40,12 @@ void http_headers::print_matching_names(struct json_object &o, std::unordered_ma
         if (datum_skip_upto_delim(&p, csp, sizeof(csp)) == status_err) {
             return;
         }
-        keyword.data_end = p.data;
+        keyword.data_end = p.data - sizeof(csp);
         const char *header_name = NULL;
 
-        std::basic_string<uint8_t> name_lowercase;
-        to_lower(name_lowercase, keyword);
-        auto pair = name_dict.find(name_lowercase);
-        if (pair != name_dict.end()) {
-            header_name = (const char *)pair->second.c_str();
+        const char * const *match = names.find(keyword);
+        if (match) {
+            header_name = *match;
         }
         const uint8_t *value_start = p.data;
         if (datum_skip_upto_delim(&p, crlf, sizeof(crlf)) == status_err) {
@@ -71,7 +58,7 @@ void http_headers::print_matching_names(struct json_object &o, std::unordered_ma
     }
 }
 
-void http_headers::fingerprint(struct buffer_stream &buf, std::unordered_map<std::basic_string<uint8_t>, bool> &name_dict) const {
+void http_headers::fingerprint(struct buffer_stream &buf, const http_header_matcher<bool> &names) const {
     unsigned char crlf[2] = { '\r', '\n' };
     unsigned char csp[2] = { ':', ' ' };
 
@@ -86,16 +73,14 @@ void http_headers::fingerprint(struct buffer_stream &buf, std::unordered_map<std
         if (datum_skip_upto_delim(&p, csp, sizeof(csp)) == status_err) {
             return;
         }
-        name.data_end = p.data;
+        name.data_end = p.data - sizeof(csp);
         bool include_name = false;
         bool include_value = false;
 
-        std::basic_string<uint8_t> name_lowercase;
-        to_lower(name_lowercase, name);
-        auto pair = name_dict.find(name_lowercase);
-        if (pair != name_dict.end()) {
+        const bool *match = names.find(name);
+        if (match) {
             include_name = true;
-            include_value = pair->second;
+            include_value = *match;
         }
 
         if (datum_skip_upto_delim(&p, crlf, sizeof(crlf)) == status_err) {
@@ -109,7 +94,7 @@ void http_headers::fingerprint(struct buffer_stream &buf, std::unordered_map<std
                 buf.write_char(')');
             } else {
                 buf.write_char('(');
-                buf.raw_as_hex(name.data, name.data_end - name.data - 2); // write {name}
+                buf.raw_as_hex(name.data, name.data_end - name.data);     // write {name}
                 buf.write_char(')');
             }
         }
@@ -120,12 +105,12 @@ void http_request::write_json(struct json_object &record, bool output_metadata)
 
     // list of http header names to be printed out
     //
-    std::unordered_map<std::basic_string<uint8_t>, std::string> header_names_to_print = {
-        { { 'u', 's', 'e', 'r', '-', 'a', 'g', 'e', 'n', 't', ':', ' ' }, "user_agent" },
-        { { 'h', 'o', 's', 't', ':', ' ' }, "host"},
-        { { 'x', '-', 'f', 'o', 'r', 'w', 'a', 'r', 'd', 'e', 'd', '-', 'f', 'o', 'r', ':', ' ' }, "x_forwarded_for"},
-        { { 'v', 'i', 'a', ':', ' ' }, "via"},
-        { { 'u', 'p', 'g', 'r', 'a', 'd', 'e', ':', ' ' }, "upgrade"}
+    static const http_header_name<const char *> header_names_to_print[] = {
+        { "user-agent", "user_agent" },
+        { "host", "host"},
+        { "x-forwarded-for", "x_forwarded_for"},
+        { "via", "via"},
+        { "upgrade", "upgrade"}
     };
 
     if (this->is_not_empty()) {
@@ -142,16 +127,18 @@ void http_request::write_json(struct json_object &record, bool output_metadata)
             // all headers, and print the values corresponding to each
             // of the matching names
             //
-            headers.print_matching_names(http_request, header_names_to_print);
+            static const http_header_matcher<const char *> matcher{header_names_to_print};
+            headers.print_matching_names(http_request, matcher);
             //http_request.print_key_value("fingerprint", *this);
 
         } else {
 
             // output only the user-agent
-            std::unordered_map<std::basic_string<uint8_t>, std::string> ua_only = {
-                { { 'u', 's', 'e', 'r', '-', 'a', 'g', 'e', 'n', 't', ':', ' ' }, "user_agent" }
+            static const http_header_name<const char *> ua_only[] = {
+                { "user-agent", "user_agent" }
             };
-            headers.print_matching_names(http_request, ua_only);
+            static const http_header_matcher<const char *> matcher{ua_only};
+            headers.print_matching_names(http_request, matcher);
         }
         http_request.close();
         http.close();
@@ -179,11 +166,11 @@ void http_response::write_json(struct json_object &record) {
 
     // list of http header names to be printed out
     //
-    std::unordered_map<std::basic_string<uint8_t>, std::string> header_names_to_print = {
-        { { 'c', 'o', 'n', 't', 'e', 'n', 't', '-', 't', 'y', 'p', 'e', ':', ' ' }, "content_type"},
-        { { 'c', 'o', 'n', 't', 'e', 'n', 't', '-', 'l', 'e', 'n', 'g', 't', 'h', ':', ' ' }, "content_length"},
-        { { 's', 'e', 'r', 'v', 'e', 'r', ':', ' ' }, "server"},
-        { { 'v', 'i', 'a', ':', ' ' }, "via"}
+    static const http_header_name<const char *> header_names_to_print[] = {
+        { "content-type", "content_type"},
+        { "content-length", "content_length"},
+        { "server", "server"},
+        { "via", "via"}
     };
 
     struct json_object http{record, "http"};
@@ -197,7 +184,8 @@ void http_response::write_json(struct json_object &record) {
     // all headers, and print the values corresponding to each
     // of the matching names
     //
-    headers.print_matching_names(http_response, header_names_to_print);
+    static const http_header_matcher<const char *> matcher{header_names_to_print};
+    headers.print_matching_names(http_response, matcher);
     //http_response.print_key_value("fingerprint", *this);
 
     http_response.close();
@@ -219,26 +207,27 @@ void http_request::operator()(struct buffer_stream &b) const {
     b.raw_as_hex(protocol.data, protocol.data_end - protocol.data);
     b.write_char(')');
 
-    std::unordered_map<std::basic_string<uint8_t>, bool> http_static_keywords = {
-        { { 'a', 'c', 'c', 'e', 'p', 't', ':', ' ' }, true },
-        { { 'a', 'c', 'c', 'e', 'p', 't', '-', 'e', 'n', 'c', 'o', 'd', 'i', 'n', 'g', ':', ' '}, true },
-        { { 'c', 'o', 'n', 'n', 'e', 'c', 't', 'i', 'o', 'n', ':', ' ' }, true },
-        { { 'd', 'n', 't', ':', ' ' }, true },
-        { { 'd', 'p', 'r', ':', ' ' }, true },
-        { { 'u', 'p', 'g', 'r', 'a', 'd', 'e', '-', 'i', 'n', 's', 'e', 'c', 'u', 'r', 'e', '-', 'r', 'e', 'q', 'u', 'e', 's', 't', 's', ':', ' ' }, true },
-        { { 'x', '-', 'r', 'e', 'q', 'u', 'e', 's', 't', 'e', 'd', '-', 'w', 'i', 't', 'h', ':', ' ' }, true },
-        { { 'a', 'c', 'c', 'e', 'p', 't', '-', 'c', 'h', 'a', 'r', 's', 'e', 't', ':', ' ' }, false },
-        { { 'a', 'c', 'c', 'e', 'p', 't', '-', 'l', 'a', 'n', 'g', 'u', 'a', 'g', 'e', ':', ' ' }, false },
-        { { 'a', 'u', 't', 'h', 'o', 'r', 'i', 'z', 'a', 't', 'i', 'o', 'n', ':', ' ' }, false },
-        { { 'c', 'a', 'c', 'h', 'e', '-', 'c', 'o', 'n', 't', 'r', 'o', 'l', ':', ' ' }, false },
-        { { 'h', 'o', 's', 't', ':', ' ' }, false },
-        { { 'i', 'f', '-', 'm', 'o', 'd', 'i', 'f', 'i', 'e', 'd', '-', 's', 'i', 'n', 'c', 'e', ':', ' ' }, false },
-        { { 'k', 'e', 'e', 'p', '-', 'a', 'l', 'i', 'v', 'e', ':', ' ' }, false },
-        { { 'u', 's', 'e', 'r', '-', 'a', 'g', 'e', 'n', 't', ':', ' ' }, false },
-        { { 'x', '-', 'f', 'l', 'a', 's', 'h', '-', 'v', 'e', 'r', 's', 'i', 'o', 'n', ':', ' ' }, false },
-        { { 'x', '-', 'p', '2', 'p', '-', 'p', 'e', 'e', 'r', 'd', 'i', 's', 't', ':', ' ' }, false } 
+    static const http_header_name<bool> http_static_keywords[] = {
+        { "accept", true },
+        { "accept-encoding", true },
+        { "connection", true },
+        { "dnt", true },
+        { "dpr", true },
+        { "upgrade-insecure-requests", true },
+        { "x-requested-with", true },
+        { "accept-charset", false },
+        { "accept-language", false },
+        { "authorization", false },
+        { "cache-control", false },
+        { "host", false },
+        { "if-modified-since", false },
+        { "keep-alive", false },
+        { "user-agent", false },
+        { "x-flash-version", false },
+        { "x-p2p-peerdist", false } 
     };
-    headers.fingerprint(b, http_static_keywords);
+    static const http_header_matcher<bool> matcher{http_static_keywords};
+    headers.fingerprint(b, matcher);
     b.write_char('\"');
 }
 
@@ -259,57 +248,58 @@ void http_response::operator()(struct buffer_stream &buf) const {
     buf.raw_as_hex(status_reason.data, status_reason.data_end - status_reason.data);
     buf.write_char(')');
 
-    std::unordered_map<std::basic_string<uint8_t>, bool> http_static_keywords = {
-        { (uint8_t *)"access-control-allow-credentials: ", true },
-        { (uint8_t *)"access-control-allow-headers: ", true },
-        { (uint8_t *)"access-control-allow-methods: ", true },
-        { (uint8_t *)"access-control-expose-headers: ", true },
-        { (uint8_t *)"cache-control: ", true },
-        { (uint8_t *)"code: ", true },
-        { (uint8_t *)"connection: ", true },
-        { (uint8_t *)"content-language: ", true },
-        { (uint8_t *)"content-transfer-encoding: ", true },
-        { (uint8_t *)"p3p: ", true },
-        { (uint8_t *)"pragma: ", true },
-        { (uint8_t *)"reason: ", true },
-        { (uint8_t *)"server: ", true },
-        { (uint8_t *)"strict-transport-security: ", true },
-        { (uint8_t *)"version: ", true },
-        { (uint8_t *)"x-aspnetmvc-version: ", true },
-        { (uint8_t *)"x-aspnet-version: ", true },
-        { (uint8_t *)"x-cid: ", true },
-        { (uint8_t *)"x-ms-version: ", true },
-        { (uint8_t *)"x-xss-protection: ", true },
-        { (uint8_t *)"appex-activity-id: ", false },
-        { (uint8_t *)"cdnuuid: ", false },
-        { (uint8_t *)"cf-ray: ", false },
-        { (uint8_t *)"content-range: ", false },
-        { (uint8_t *)"content-type: ", false },
-        { (uint8_t *)"date: ", false },
-        { (uint8_t *)"etag: ", false },
-        { (uint8_t *)"expires: ", false },
-        { (uint8_t *)"flow_context: ", false },
-        { (uint8_t *)"ms-cv: ", false },
-        { (uint8_t *)"msregion: ", false },
-        { (uint8_t *)"ms-requestid: ", false },
-        { (uint8_t *)"request-id: ", false },
-        { (uint8_t *)"vary: ", false },
-        { (uint8_t *)"x-amz-cf-pop: ", false },
-        { (uint8_t *)"x-amz-request-id: ", false },
-        { (uint8_t *)"x-azure-ref-originshield: ", false },
-        { (uint8_t *)"x-cache: ", false },
-        { (uint8_t *)"x-cache-hits: ", false },
-        { (uint8_t *)"x-ccc: ", false },
-        { (uint8_t *)"x-diagnostic-s: ", false },
-        { (uint8_t *)"x-feserver: ", false },
-        { (uint8_t *)"x-hw: ", false },
-        { (uint8_t *)"x-msedge-ref: ", false },
-        { (uint8_t *)"x-ocsp-responder-id: ", false },
-        { (uint8_t *)"x-requestid: ", false },
-        { (uint8_t *)"x-served-by: ", false },
-        { (uint8_t *)"x-timer: ", false },
-        { (uint8_t *)"x-trace-context: ", false }
+    static const http_header_name<bool> http_static_keywords[] = {
+        { "access-control-allow-credentials", true },
+        { "access-control-allow-headers", true },
+        { "access-control-allow-methods", true },
+        { "access-control-expose-headers", true },
+        { "cache-control", true },
+        { "code", true },
+        { "connection", true },
+        { "content-language", true },
+        { "content-transfer-encoding", true },
+        { "p3p", true },
+        { "pragma", true },
+        { "reason", true },
+        { "server", true },
+        { "strict-transport-security", true },
+        { "version", true },
+        { "x-aspnetmvc-version", true },
+        { "x-aspnet-version", true },
+        { "x-cid", true },
+        { "x-ms-version", true },
+        { "x-xss-protection", true },
+        { "appex-activity-id", false },
+        { "cdnuuid", false },
+        { "cf-ray", false },
+        { "content-range", false },
+        { "content-type", false },
+        { "date", false },
+        { "etag", false },
+        { "expires", false },
+        { "flow_context", false },
+        { "ms-cv", false },
+        { "msregion", false },
+        { "ms-requestid", false },
+        { "request-id", false },
+        { "vary", false },
+        { "x-amz-cf-pop", false },
+        { "x-amz-request-id", false },
+        { "x-azure-ref-originshield", false },
+        { "x-cache", false },
+        { "x-cache-hits", false },
+        { "x-ccc", false },
+        { "x-diagnostic-s", false },
+        { "x-feserver", false },
+        { "x-hw", false },
+        { "x-msedge-ref", false },
+        { "x-ocsp-responder-id", false },
+        { "x-requestid", false },
+        { "x-served-by", false },
+        { "x-timer", false },
+        { "x-trace-context", false }
     };
-    headers.fingerprint(buf, http_static_keywords);
+    static const http_header_matcher<bool> matcher{http_static_keywords};
+    headers.fingerprint(buf, matcher);
     buf.write_char('\"');
 }
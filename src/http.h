@@ -8,6 +8,87 @@
 
 #include "extractor.h"
 
+/*
+ * http_header_name<T> associates a lowercase header name (without
+ * the ": " that follows it in a message) with a value of type T
+ */
+template <typename T>
+struct http_header_name {
+    const char *name;
+    T value;
+};
+
+/*
+ * http_header_matcher<T> looks up the names of the headers in a
+ * message in a fixed list of http_header_name<T> entries, without
+ * allocating memory and without copying the name.  The entries are
+ * indexed by the length of their names, so that find() compares the
+ * name only against the entries that have the same length, and
+ * lowercases each byte of the name as it compares it.
+ *
+ * The list must outlive the matcher; it is typically a static array
+ * next to a static matcher, so that the index is built only once.
+ */
+template <typename T>
+class http_header_matcher {
+public:
+    static const size_t max_names = 64;
+    static const size_t max_name_length = 63;
+
+    template <size_t N>
+    http_header_matcher(const http_header_name<T> (&list)[N]) : entries{}, first{} {
+        static_assert(N <= max_names, "too many header names");
+
+        // count the names of each length, then turn the counts into
+        // offsets into entries[] and place each name at its offset
+        //
+        uint8_t count[max_name_length + 1] = { 0 };
+        for (const auto &n : list) {
+            size_t length = strlen(n.name);
+            if (length <= max_name_length) {
+                count[length]++;
+            }
+        }
+        for (size_t length = 0; length <= max_name_length; length++) {
+            first[length + 1] = first[length] + count[length];
+        }
+        uint8_t next[max_name_length + 1];
+        memcpy(next, first, sizeof(next));
+        for (const auto &n : list) {
+            size_t length = strlen(n.name);
+            if (length <= max_name_length) {
+                entries[next[length]++] = &n;
+            }
+        }
+    }
+
+    /*
+     * find(name) returns a pointer to the value associated with name,
+     * compared case-insensitively, or nullptr if there is none
+     */
+    const T *find(const struct datum &name) const {
+        ssize_t length = name.length();
+        if (length < 0 || length > (ssize_t)max_name_length) {
+            return nullptr;
+        }
+        for (unsigned int i = first[length]; i < first[length + 1]; i++) {
+            const char *n = entries[i]->name;
+            ssize_t j = 0;
+            while (j < length && lowercase(name.data[j]) == (uint8_t)n[j]) {
+                j++;
+            }
+            if (j == length) {
+                return &entries[i]->value;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    const http_header_name<T> *entries[max_names];
+    uint8_t first[max_name_length + 2];   // entries[first[l]] up to entries[first[l+1]] have length l
+};
+
 struct http_headers : public datum {
     bool complete;
 
@@ -33,9 +114,9 @@ struct http_headers : public datum {
     void print_matching_name(struct json_object &o, const char *key, struct datum &name) const;
     void print_matching_names(struct json_object &o, const char *key, std::list<struct datum> &name) const;
     void print_matching_names(struct json_object &o, std::list<std::pair<struct datum, std::string>> &name_list) const;
-    void print_matching_names(struct json_object &o, std::unordered_map<std::basic_string<uint8_t>, std::string> &name_dict) const;
+    void print_matching_names(struct json_object &o, const http_header_matcher<const char *> &names) const;
 
-    void fingerprint(struct buffer_stream &buf, std::unordered_map<std::basic_string<uint8_t>, bool> &name_dict) const;
+    void fingerprint(struct buffer_stream &buf, const http_header_matcher<bool> &names) const;
 
 };
 
@@ -0,0 +1,370 @@
+/*
+ * http2.cc
+ *
+ * HTTP/2 connection prefaces, SETTINGS and HEADERS frames, and HPACK
+ * decoding
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include "http2.h"
+
+const uint8_t http2_preface[L_http2_preface] = {
+    'P', 'R', 'I', ' ', '*', ' ', 'H', 'T', 'T', 'P', '/', '2', '.', '0', '\r', '\n',
+    '\r', '\n', 'S', 'M', '\r', '\n', '\r', '\n'
+};
+
+/*
+ * the HPACK static table (RFC 7541, Appendix A)
+ */
+struct hpack_static_entry {
+    const char *name;
+    uint8_t name_length;
+    const char *value;
+    uint8_t value_length;
+};
+
+#define hpack_entry(name, value) { name, sizeof(name) - 1, value, sizeof(value) - 1 }
+
+static const struct hpack_static_entry hpack_static_table[hpack_decoder::num_static_entries] = {
+    hpack_entry(":authority", ""),
+    hpack_entry(":method", "GET"),
+    hpack_entry(":method", "POST"),
+    hpack_entry(":path", "/"),
+    hpack_entry(":path", "/index.html"),
+    hpack_entry(":scheme", "http"),
+    hpack_entry(":scheme", "https"),
+    hpack_entry(":status", "200"),
+    hpack_entry(":status", "204"),
+    hpack_entry(":status", "206"),
+    hpack_entry(":status", "304"),
+    hpack_entry(":status", "400"),
+    hpack_entry(":status", "404"),
+    hpack_entry(":status", "500"),
+    hpack_entry("accept-charset", ""),
+    hpack_entry("accept-encoding", "gzip, deflate"),
+    hpack_entry("accept-language", ""),
+    hpack_entry("accept-ranges", ""),
+    hpack_entry("accept", ""),
+    hpack_entry("access-control-allow-origin", ""),
+    hpack_entry("age", ""),
+    hpack_entry("allow", ""),
+    hpack_entry("authorization", ""),
+    hpack_entry("cache-control", ""),
+    hpack_entry("content-disposition", ""),
+    hpack_entry("content-encoding", ""),
+    hpack_entry("content-language", ""),
+    hpack_entry("content-length", ""),
+    hpack_entry("content-location", ""),
+    hpack_entry("content-range", ""),
+    hpack_entry("content-type", ""),
+    hpack_entry("cookie", ""),
+    hpack_entry("date", ""),
+    hpack_entry("etag", ""),
+    hpack_entry("expect", ""),
+    hpack_entry("expires", ""),
+    hpack_entry("from", ""),
+    hpack_entry("host", ""),
+    hpack_entry("if-match", ""),
+    hpack_entry("if-modified-since", ""),
+    hpack_entry("if-none-match", ""),
+    hpack_entry("if-range", ""),
+    hpack_entry("if-unmodified-since", ""),
+    hpack_entry("last-modified", ""),
+    hpack_entry("link", ""),
+    hpack_entry("location", ""),
+    hpack_entry("max-forwards", ""),
+    hpack_entry("proxy-authenticate", ""),
+    hpack_entry("proxy-authorization", ""),
+    hpack_entry("range", ""),
+    hpack_entry("referer", ""),
+    hpack_entry("refresh", ""),
+    hpack_entry("retry-after", ""),
+    hpack_entry("server", ""),
+    hpack_entry("set-cookie", ""),
+    hpack_entry("strict-transport-security", ""),
+    hpack_entry("transfer-encoding", ""),
+    hpack_entry("user-agent", ""),
+    hpack_entry("vary", ""),
+    hpack_entry("via", ""),
+    hpack_entry("www-authenticate", "")
+};
+
+/*
+ * The HPACK Huffman code (RFC 7541, Appendix B) is canonical: the
+ * codes of each length are consecutive, in the order of their
+ * symbols, and follow the shorter ones.  hpack_huffman_count[n] is the
+ * number of codes of length n, and hpack_huffman_symbol lists the
+ * symbols in the order of their codes; symbol 256 is EOS.
+ */
+static const uint8_t hpack_huffman_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+static const uint16_t hpack_huffman_symbol[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37, 45, 46, 47, 51,
+    52, 53, 54, 55, 56, 57, 61, 65, 95, 98, 100, 102, 103, 104, 108, 109,
+    110, 112, 114, 117, 58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89, 106, 107, 113, 118,
+    119, 120, 121, 122, 38, 42, 44, 59, 88, 90, 33, 34, 40, 41, 63, 39,
+    43, 124, 35, 62, 0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161, 167, 172, 176, 177,
+    179, 209, 216, 217, 227, 229, 230, 129, 132, 133, 134, 136, 146, 154, 156, 160,
+    163, 164, 169, 170, 173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150, 151, 152, 155, 157,
+    158, 165, 166, 168, 174, 175, 180, 182, 183, 188, 191, 197, 231, 239, 9, 142,
+    144, 145, 148, 159, 171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211,
+    212, 214, 221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254,
+    2, 3, 4, 5, 6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220, 249, 10, 13, 22,
+    256
+};
+
+static const unsigned int hpack_huffman_max_length = 30;
+
+bool hpack_decoder::decode_string(struct datum &d, struct datum &s) {
+    if (d.is_not_readable()) {
+        return false;
+    }
+    bool huffman = (*d.data & 0x80) != 0;
+    uint32_t length;
+    if (!decode_integer(d, 7, length) || length > (size_t)d.length()) {
+        return false;
+    }
+    const uint8_t *in = d.data;
+    const uint8_t *in_end = d.data + length;
+    d.skip(length);
+    if (!huffman) {
+        s.data = in;
+        s.data_end = in_end;
+        return true;
+    }
+
+    // decode one bit at a time: code holds the bits of the current
+    // symbol, and first is the first code of length len
+    //
+    uint8_t *out = buffer + buffer_used;
+    uint8_t *out_end = buffer + buffer_length;
+    uint32_t code = 0;
+    uint32_t first = 0;
+    unsigned int index = 0;
+    unsigned int len = 0;
+    for ( ; in < in_end; in++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            code |= (*in >> bit) & 1;
+            len++;
+            unsigned int count = hpack_huffman_count[len];
+            if (code < first + count) {
+                uint16_t symbol = hpack_huffman_symbol[index + code - first];
+                if (symbol == 256 || out == out_end) {
+                    return false;          // EOS, or out of space
+                }
+                *out++ = symbol;
+                code = first = index = len = 0;
+            } else {
+                if (len == hpack_huffman_max_length) {
+                    return false;
+                }
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+        }
+    }
+
+    // the last byte is padded with at most seven one bits
+    //
+    if (len > 7 || (code >> 1) != (1u << len) - 1) {
+        return false;
+    }
+    s.data = buffer + buffer_used;
+    s.data_end = out;
+    buffer_used = out - buffer;
+    return true;
+}
+
+bool hpack_decoder::lookup(uint32_t index, struct field &x) const {
+    if (index == 0) {
+        return false;
+    }
+    if (index <= num_static_entries) {
+        const struct hpack_static_entry &e = hpack_static_table[index - 1];
+        x.name.data = (const uint8_t *)e.name;
+        x.name.data_end = x.name.data + e.name_length;
+        x.value.data = (const uint8_t *)e.value;
+        x.value.data_end = x.value.data + e.value_length;
+        return true;
+    }
+    index -= num_static_entries + 1;   // zero is the newest entry
+    if (index >= num_entries) {
+        return false;
+    }
+    x = entries[(newest + max_dynamic_entries - index) % max_dynamic_entries];
+    return true;
+}
+
+void http2_settings::fingerprint(struct buffer_stream &buf) const {
+    buf.write_char('(');
+    for (unsigned int i = 0; i < num_settings; i++) {
+        buf.write_char('(');
+        buf.raw_as_hex(settings + i * setting_length, setting_length);
+        buf.write_char(')');
+    }
+    buf.write_char(')');
+    buf.write_char('(');
+    if (have_window_update) {
+        buf.raw_as_hex(window_update, sizeof(window_update));
+    }
+    buf.write_char(')');
+}
+
+void http2_settings::write_json(struct json_object &o) const {
+    if (have_settings) {
+        struct json_array a{o, "settings"};
+        for (unsigned int i = 0; i < num_settings; i++) {
+            const uint8_t *s = settings + i * setting_length;
+            struct json_object setting{a};
+            setting.print_key_uint("id", (s[0] << 8) | s[1]);
+            setting.print_key_uint("value", ((uint32_t)s[2] << 24) | (s[3] << 16) | (s[4] << 8) | s[5]);
+            setting.close();
+        }
+        a.close();
+    }
+    if (have_window_update) {
+        const uint8_t *w = window_update;
+        o.print_key_uint("window_update", ((uint32_t)w[0] << 24) | (w[1] << 16) | (w[2] << 8) | w[3]);
+    }
+}
+
+void http2_request::parse(struct datum &p) {
+    if (p.length() < L_http2_preface || memcmp(p.data, http2_preface, L_http2_preface) != 0) {
+        return;
+    }
+    p.skip(L_http2_preface);
+    parse_frames(p);
+}
+
+bool http2_request::parse_frames(struct datum &p) {
+    for (unsigned int i = 0; i < max_frames; i++) {
+        struct http2_frame frame;
+        if (i == 0 && (p.length() < L_http2_frame_header || p.data[3] > http2_frame_continuation || (p.data[5] & 0x80))) {
+            return false;
+        }
+        if (p.is_not_readable()) {
+            return true;
+        }
+        if (!frame.parse(p)) {
+            break;
+        }
+        switch (frame.type) {
+        case http2_frame_settings:
+            if (frame.stream_id == 0 && (frame.flags & http2_flag_ack) == 0 && !settings.have_settings) {
+                settings.parse_settings(frame.payload);
+            }
+            break;
+        case http2_frame_window_update:
+            if (frame.stream_id == 0 && !settings.have_window_update) {
+                settings.parse_window_update(frame.payload);
+            }
+            break;
+        case http2_frame_headers:
+            parse_headers(frame);
+            return true;
+        default:
+            ;
+        }
+    }
+    return true;
+}
+
+static inline bool name_is(const struct datum &name, const char *s, size_t length) {
+    return (size_t)name.length() == length && memcmp(name.data, s, length) == 0;
+}
+
+void http2_request::parse_headers(const struct http2_frame &frame) {
+
+    // remove the padding and the priority fields, if present; the
+    // padding is only removed if the frame is not truncated, since
+    // it is at the end of the frame
+    //
+    struct datum block = frame.payload;
+    if (frame.flags & http2_flag_padded) {
+        if (block.is_not_readable()) {
+            return;
+        }
+        size_t pad_length = *block.data;
+        block.skip(1);
+        if ((size_t)frame.payload.length() == frame.length) {
+            if ((size_t)block.length() < pad_length) {
+                return;
+            }
+            block.data_end -= pad_length;
+        }
+    }
+    if (frame.flags & http2_flag_priority) {
+        if (block.length() < 5) {
+            return;
+        }
+        block.skip(5);   // exclusive flag, stream dependency, and weight
+    }
+
+    // a truncated or malformed block still yields the fields that
+    // precede the point at which decoding stopped
+    //
+    have_headers = true;
+    decoder.decode(block, [this](const struct datum &name, const struct datum &value) {
+        if (name.is_not_empty() && *name.data == ':') {
+            if (num_pseudo_headers < max_pseudo_headers && name.length() > 1) {
+                pseudo_header_order[num_pseudo_headers++] = name.data[1];
+            }
+            if (name_is(name, ":method", 7)) {
+                method = value;
+            } else if (name_is(name, ":authority", 10)) {
+                authority = value;
+            } else if (name_is(name, ":scheme", 7)) {
+                scheme = value;
+            } else if (name_is(name, ":path", 5)) {
+                path = value;
+            }
+        } else if (name_is(name, "user-agent", 10)) {
+            user_agent = value;
+        }
+    });
+}
+
+void http2_request::write_fingerprint(struct buffer_stream &buf) const {
+    if (is_not_empty() == false) {
+        return;
+    }
+    settings.fingerprint(buf);
+    buf.write_char('(');
+    buf.raw_as_hex(pseudo_header_order, num_pseudo_headers);
+    buf.write_char(')');
+}
+
+void http2_request::operator()(struct buffer_stream &buf) const {
+    buf.write_char('\"');
+    write_fingerprint(buf);
+    buf.write_char('\"');
+}
+
+void http2_request::write_json(struct json_object &record, bool output_metadata) const {
+    struct json_object http2{record, "http2"};
+    if (have_headers) {
+        struct json_object request{http2, "request"};
+        if (output_metadata) {
+            request.print_key_json_string("method", method);
+            request.print_key_json_string("authority", authority);
+            request.print_key_json_string("scheme", scheme);
+            request.print_key_json_string("path", path);
+        }
+        request.print_key_json_string("user_agent", user_agent);
+        request.close();
+    }
+    if (output_metadata) {
+        settings.write_json(http2);
+    }
+    http2.close();
+}
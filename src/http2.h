@@ -0,0 +1,335 @@
+/*
+ * http2.h
+ *
+ * HTTP/2 connection prefaces, SETTINGS and HEADERS frames (RFC 7540),
+ * and a bounded HPACK decoder (RFC 7541)
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "datum.h"
+#include "json_object.h"
+
+/*
+ * An HTTP/2 client that knows that the server supports HTTP/2 (RFC
+ * 7540, Section 3.4), such as one that talks to a cleartext proxy,
+ * starts its connection with a 24-byte preface, followed by a
+ * SETTINGS frame, and usually by a WINDOW_UPDATE frame and by the
+ * HEADERS frame of its first request, which may be in a later
+ * packet.  Each frame starts with a nine-byte header:
+ *
+ *    +-----------------------------------------------+
+ *    |                 Length (24)                   |
+ *    +---------------+---------------+---------------+
+ *    |   Type (8)    |   Flags (8)   |
+ *    +-+-------------+---------------+-------------------------------+
+ *    |R|                 Stream Identifier (31)                      |
+ *    +=+=============================================================+
+ *    |                   Frame Payload (0...)                      ...
+ *    +---------------------------------------------------------------+
+ */
+
+#define L_http2_preface       24
+#define L_http2_frame_header   9
+
+extern const uint8_t http2_preface[L_http2_preface];   // "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+
+enum http2_frame_type : uint8_t {
+    http2_frame_data          = 0x0,
+    http2_frame_headers       = 0x1,
+    http2_frame_priority      = 0x2,
+    http2_frame_rst_stream    = 0x3,
+    http2_frame_settings      = 0x4,
+    http2_frame_push_promise  = 0x5,
+    http2_frame_ping          = 0x6,
+    http2_frame_goaway        = 0x7,
+    http2_frame_window_update = 0x8,
+    http2_frame_continuation  = 0x9
+};
+
+enum http2_frame_flag : uint8_t {
+    http2_flag_ack         = 0x01,   // SETTINGS and PING
+    http2_flag_end_stream  = 0x01,   // DATA and HEADERS
+    http2_flag_end_headers = 0x04,
+    http2_flag_padded      = 0x08,
+    http2_flag_priority    = 0x20
+};
+
+/*
+ * struct http2_frame holds a frame header and its payload, which is
+ * truncated if the frame does not fit in the data that is parsed
+ */
+struct http2_frame {
+    uint32_t length;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+    struct datum payload;
+
+    http2_frame() : length{0}, type{0}, flags{0}, stream_id{0}, payload{NULL, NULL} {}
+
+    // parse(d) reads a frame from d, and returns false if d does not
+    // hold a whole frame header
+    //
+    bool parse(struct datum &d) {
+        if (d.length() < L_http2_frame_header) {
+            return false;
+        }
+        const uint8_t *h = d.data;
+        length = (h[0] << 16) | (h[1] << 8) | h[2];
+        type = h[3];
+        flags = h[4];
+        stream_id = ((h[5] & 0x7f) << 24) | (h[6] << 16) | (h[7] << 8) | h[8];
+        d.skip(L_http2_frame_header);
+        payload.parse_soft_fail(d, length);
+        return true;
+    }
+};
+
+/*
+ * struct hpack_decoder decodes an HPACK header block without
+ * allocating memory.  Literal strings are referenced in place, and
+ * Huffman-coded ones are decoded into a fixed buffer that is part of
+ * the decoder, so the fields that it returns are valid as long as
+ * both the block and the decoder are.  The dynamic table holds
+ * references to the fields that the block has added to it, which is
+ * all that the first header block of a connection can refer to.
+ * Decoding stops, and decode() returns false, at the first field that
+ * is malformed, truncated, or does not fit in the buffer.  The table
+ * has room for as many entries as the largest table size allows, so
+ * an insertion only ever evicts older entries.
+ */
+struct hpack_decoder {
+    static const size_t buffer_length = 2048;
+    static const size_t max_table_size = 4096;  // SETTINGS_HEADER_TABLE_SIZE default
+    static const size_t entry_overhead = 32;    // RFC 7541, Section 4.1
+    static const size_t max_dynamic_entries = max_table_size / entry_overhead;
+    static const size_t num_static_entries = 61;
+
+    struct field {
+        struct datum name;
+        struct datum value;
+    };
+
+    hpack_decoder() : buffer_used{0}, num_entries{0}, newest{0}, table_size{0}, max_size{max_table_size} {}
+
+    /*
+     * decode(block, f) calls f(name, value) for each field in the
+     * header block, in order, and returns true if the whole block was
+     * decoded
+     */
+    template <typename F>
+    bool decode(struct datum block, F f) {
+        while (block.is_not_empty()) {
+            uint8_t b = *block.data;
+            struct field x;
+            if (b & 0x80) {                               // indexed field
+                uint32_t index;
+                if (!decode_integer(block, 7, index) || !lookup(index, x)) {
+                    return false;
+                }
+            } else if ((b & 0xe0) == 0x20) {              // dynamic table size update
+                uint32_t size;
+                if (!decode_integer(block, 5, size) || size > max_table_size) {
+                    return false;
+                }
+                max_size = size;
+                evict(0);
+                continue;
+            } else {                                      // literal field
+                bool indexing = (b & 0x40) != 0;
+                uint32_t index;
+                if (!decode_integer(block, indexing ? 6 : 4, index)) {
+                    return false;
+                }
+                if (index) {
+                    struct field indexed;
+                    if (!lookup(index, indexed)) {
+                        return false;
+                    }
+                    x.name = indexed.name;
+                } else if (!decode_string(block, x.name)) {
+                    return false;
+                }
+                if (!decode_string(block, x.value)) {
+                    return false;
+                }
+                if (indexing) {
+                    insert(x);
+                }
+            }
+            f(x.name, x.value);
+        }
+        return true;
+    }
+
+private:
+    uint8_t buffer[buffer_length];
+    size_t buffer_used;
+    struct field entries[max_dynamic_entries];    // a ring, newest at entries[newest]
+    size_t num_entries;
+    size_t newest;
+    size_t table_size;
+    size_t max_size;
+
+    static bool decode_integer(struct datum &d, unsigned int prefix_bits, uint32_t &value) {
+        if (d.is_not_readable()) {
+            return false;
+        }
+        const uint32_t max_prefix = (1 << prefix_bits) - 1;
+        value = *d.data++ & max_prefix;
+        if (value < max_prefix) {
+            return true;
+        }
+        for (unsigned int shift = 0; shift < 28 && d.is_not_empty(); shift += 7) {
+            uint8_t b = *d.data++;
+            value += (uint32_t)(b & 0x7f) << shift;
+            if ((b & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool decode_string(struct datum &d, struct datum &s);
+
+    bool lookup(uint32_t index, struct field &x) const;
+
+    void insert(const struct field &x) {
+        size_t size = x.name.length() + x.value.length() + entry_overhead;
+        if (size > max_size) {
+            num_entries = 0;           // an entry larger than the table empties it
+            table_size = 0;
+            return;
+        }
+        evict(size);                   // leaves room for an entry, since each is at least entry_overhead
+        newest = (newest + 1) % max_dynamic_entries;
+        entries[newest] = x;
+        num_entries++;
+        table_size += size;
+    }
+
+    // evict(size) removes the oldest entries until size more bytes fit
+    //
+    void evict(size_t size) {
+        while (num_entries && table_size + size > max_size) {
+            const struct field &oldest = entries[(newest + max_dynamic_entries - num_entries + 1) % max_dynamic_entries];
+            table_size -= oldest.name.length() + oldest.value.length() + entry_overhead;
+            num_entries--;
+        }
+    }
+};
+
+/*
+ * struct http2_settings holds the parameters of a SETTINGS frame, in
+ * the order in which they were sent, and the increment of the
+ * connection's first WINDOW_UPDATE frame; it holds copies, rather
+ * than references, so that it can be kept until the HEADERS frame of
+ * the connection arrives
+ */
+struct http2_settings {
+    static const unsigned int max_settings = 16;
+    static const size_t setting_length = 6;   // identifier (16) and value (32)
+
+    uint8_t settings[max_settings * setting_length];
+    uint8_t num_settings;
+    bool have_settings;
+    bool have_window_update;
+    uint8_t window_update[4];
+
+    void parse_settings(const struct datum &payload) {
+        size_t length = payload.length() - payload.length() % setting_length;
+        if (length > sizeof(settings)) {
+            length = sizeof(settings);
+        }
+        memcpy(settings, payload.data, length);
+        num_settings = length / setting_length;
+        have_settings = true;
+    }
+
+    void parse_window_update(const struct datum &payload) {
+        if (payload.length() == sizeof(window_update)) {
+            memcpy(window_update, payload.data, sizeof(window_update));
+            window_update[0] &= 0x7f;
+            have_window_update = true;
+        }
+    }
+
+    void fingerprint(struct buffer_stream &buf) const;
+
+    void write_json(struct json_object &o) const;
+};
+
+/*
+ * struct http2_connection is the state that mercury keeps for a
+ * connection whose preface arrived without the HEADERS frame that
+ * completes its fingerprint, until that frame arrives
+ */
+struct http2_connection {
+    static const unsigned int max_packets = 4;   // after the preface
+
+    struct http2_settings settings;
+    unsigned int packets;
+    struct timespec ts;                          // of the preface
+};
+
+/*
+ * struct http2_request holds the settings of an HTTP/2 client and the
+ * first HEADERS frame that it sends, which is decoded to find the
+ * order of its pseudo-header fields (:method, :authority, :scheme,
+ * :path), which varies between implementations, and the values of
+ * the fields that mercury reports
+ */
+struct http2_request {
+    static const unsigned int max_pseudo_headers = 8;
+    static const unsigned int max_frames = 16;
+
+    struct http2_settings settings;
+    bool have_headers;
+    uint8_t pseudo_header_order[max_pseudo_headers];   // the first letter of each name
+    uint8_t num_pseudo_headers;
+    struct datum method;
+    struct datum authority;
+    struct datum scheme;
+    struct datum path;
+    struct datum user_agent;
+    struct hpack_decoder decoder;
+
+    http2_request() : settings{}, have_headers{false}, pseudo_header_order{}, num_pseudo_headers{0},
+                      method{NULL, NULL}, authority{NULL, NULL}, scheme{NULL, NULL}, path{NULL, NULL}, user_agent{NULL, NULL}, decoder{} {}
+
+    /*
+     * parse(p) parses the connection preface at the start of p, and the
+     * frames that follow it, up to and including the first HEADERS
+     * frame
+     */
+    void parse(struct datum &p);
+
+    /*
+     * parse_frames(p) parses the frames in p, for a connection whose
+     * preface was in an earlier packet, up to and including the first
+     * HEADERS frame; it returns false if p does not start with a
+     * plausible frame
+     */
+    bool parse_frames(struct datum &p);
+
+    bool is_not_empty() const { return settings.have_settings || have_headers; }
+
+    void write_fingerprint(struct buffer_stream &buf) const;
+
+    void operator()(struct buffer_stream &buf) const;
+
+    void write_json(struct json_object &record, bool output_metadata) const;
+
+private:
+    void parse_headers(const struct http2_frame &frame);
+};
+
+#endif /* HTTP2_H */
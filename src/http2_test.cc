@@ -0,0 +1,230 @@
+/*
+ * http2_test.cc
+ *
+ * checks the HPACK decoder in http2.h against the examples in
+ * Appendix C of RFC 7541: the single fields of C.2, the requests of
+ * C.3 (without Huffman coding) and C.4 (with it), and the responses
+ * of C.6, whose dynamic table of 256 bytes makes the decoder evict
+ * entries
+ *
+ * usage: http2_test
+ *
+ * The header blocks of each example are decoded in order by a single
+ * decoder, so that the later ones refer to the entries that the
+ * earlier ones added to its dynamic table, and the fields of each
+ * block must match those listed in the RFC.  Each block is also
+ * decoded with its last byte missing, by a copy of the decoder, which
+ * must not return all of its fields.  After C.6, the dynamic table
+ * must hold only the three entries that the RFC lists, so a reference
+ * to a fourth one must fail.  Last, a block that adds one hundred
+ * small fields, which fit in the default table size of 4096 bytes,
+ * must leave all of them in the dynamic table.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "http2.h"
+
+struct header_block {
+    const char *hex;
+    std::vector<std::pair<const char *, const char *>> fields;
+};
+
+struct example {
+    const char *name;
+    std::vector<struct header_block> blocks;
+    const char *invalid_after;      // a block that must fail after the others, or NULL
+};
+
+// the examples of RFC 7541, Appendix C; C.6 starts with a dynamic
+// table size update to 256 bytes (0x3fe101), since the decoder starts
+// with the default size of 4096 bytes, which the RFC sets with
+// SETTINGS_HEADER_TABLE_SIZE
+//
+static const std::vector<struct example> examples = {
+    { "C.2.1", {
+        { "400a637573746f6d2d6b65790d637573746f6d2d686561646572",
+          { { "custom-key", "custom-header" } } },
+    }, NULL },
+    { "C.2.2", {
+        { "040c2f73616d706c652f70617468",
+          { { ":path", "/sample/path" } } },
+    }, NULL },
+    { "C.2.3", {
+        { "100870617373776f726406736563726574",
+          { { "password", "secret" } } },
+    }, NULL },
+    { "C.2.4", {
+        { "82",
+          { { ":method", "GET" } } },
+    }, NULL },
+    { "C.3", {
+        { "828684410f7777772e6578616d706c652e636f6d",
+          { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" } } },
+        { "828684be58086e6f2d6361636865",
+          { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" },
+            { "cache-control", "no-cache" } } },
+        { "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+          { { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" }, { ":authority", "www.example.com" },
+            { "custom-key", "custom-value" } } },
+    }, NULL },
+    { "C.4", {
+        { "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+          { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" } } },
+        { "828684be5886a8eb10649cbf",
+          { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" }, { ":authority", "www.example.com" },
+            { "cache-control", "no-cache" } } },
+        { "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+          { { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" }, { ":authority", "www.example.com" },
+            { "custom-key", "custom-value" } } },
+    }, NULL },
+    { "C.6", {
+        { "3fe101"
+          "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff6e919d29ad171863c78f0b97c8e9ae82ae43d3",
+          { { ":status", "302" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+            { "location", "https://www.example.com" } } },
+        { "4883640effc1c0bf",
+          { { ":status", "307" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:21 GMT" },
+            { "location", "https://www.example.com" } } },
+        { "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c003ed4ee5b1063d5007",
+          { { ":status", "200" }, { "cache-control", "private" }, { "date", "Mon, 21 Oct 2013 20:13:22 GMT" },
+            { "location", "https://www.example.com" }, { "content-encoding", "gzip" },
+            { "set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1" } } },
+    }, "c1" },
+};
+
+static std::vector<uint8_t> hex_to_bytes(const char *hex) {
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; hex[i] && hex[i+1]; i += 2) {
+        char byte[3] = { hex[i], hex[i+1], 0 };
+        bytes.push_back(strtoul(byte, NULL, 16));
+    }
+    return bytes;
+}
+
+// decode(decoder, block, fields) decodes block with decoder, appending
+// each of its fields to fields, and returns the result of decode()
+//
+static bool decode(struct hpack_decoder &decoder,
+                   const std::vector<uint8_t> &block,
+                   std::vector<std::pair<std::string, std::string>> &fields) {
+    struct datum d{block.data(), block.data() + block.size()};
+    return decoder.decode(d, [&fields](const struct datum &name, const struct datum &value) {
+        fields.push_back({ std::string{(const char *)name.data, (size_t)name.length()},
+                           std::string{(const char *)value.data, (size_t)value.length()} });
+    });
+}
+
+// check(e) decodes the header blocks of the example e in order, and
+// returns the number of blocks that were not decoded as the RFC
+// lists them
+//
+static unsigned int check(const struct example &e) {
+    unsigned int failures = 0;
+    struct hpack_decoder decoder;
+    std::vector<std::vector<uint8_t>> blocks;    // referenced by the dynamic table
+    blocks.reserve(e.blocks.size());
+    for (size_t i = 0; i < e.blocks.size(); i++) {
+        const struct header_block &expected = e.blocks[i];
+        blocks.push_back(hex_to_bytes(expected.hex));
+        const std::vector<uint8_t> &block = blocks.back();
+
+        // a truncated copy must fail, with a decoder in the same state
+        //
+        struct hpack_decoder truncated_decoder = decoder;
+        std::vector<uint8_t> truncated{block.begin(), block.end() - 1};
+        std::vector<std::pair<std::string, std::string>> truncated_fields;
+        if (decode(truncated_decoder, truncated, truncated_fields) && truncated_fields.size() == expected.fields.size()) {
+            fprintf(stderr, "error: %s block %zu: truncated block was decoded\n", e.name, i + 1);
+            failures++;
+        }
+
+        std::vector<std::pair<std::string, std::string>> fields;
+        bool ok = decode(decoder, block, fields) && fields.size() == expected.fields.size();
+        for (size_t j = 0; ok && j < fields.size(); j++) {
+            ok = fields[j].first == expected.fields[j].first && fields[j].second == expected.fields[j].second;
+        }
+        if (!ok) {
+            fprintf(stderr, "error: %s block %zu: decoded as", e.name, i + 1);
+            for (const auto &f : fields) {
+                fprintf(stderr, " \"%s: %s\"", f.first.c_str(), f.second.c_str());
+            }
+            fprintf(stderr, "\n");
+            failures++;
+        }
+    }
+    if (e.invalid_after) {
+        std::vector<uint8_t> block = hex_to_bytes(e.invalid_after);
+        std::vector<std::pair<std::string, std::string>> fields;
+        if (decode(decoder, block, fields)) {
+            fprintf(stderr, "error: %s: block %s was decoded\n", e.name, e.invalid_after);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+// check_many_entries() adds num_fields fields of 35 bytes to the
+// dynamic table, which fit in its default size, then checks the
+// references to the oldest and newest ones, and returns the number of
+// failures
+//
+static unsigned int check_many_entries() {
+    const unsigned int num_fields = 100;
+    std::vector<uint8_t> block;
+    for (unsigned int i = 0; i < num_fields; i++) {
+        uint8_t field[] = { 0x40, 0x01, 'k', 0x02, (uint8_t)('0' + i / 10), (uint8_t)('0' + i % 10) };
+        block.insert(block.end(), field, field + sizeof(field));
+    }
+    unsigned int failures = 0;
+    struct hpack_decoder decoder;
+    std::vector<std::pair<std::string, std::string>> fields;
+    if (!decode(decoder, block, fields) || fields.size() != num_fields) {
+        fprintf(stderr, "error: many entries: %zu of %u fields decoded\n", fields.size(), num_fields);
+        failures++;
+    }
+
+    // the oldest entry has index 62 + 99 = 161, an indexed field with
+    // the prefix 127 followed by 34, and the newest has index 62
+    //
+    const std::vector<std::pair<std::vector<uint8_t>, const char *>> references = {
+        { { 0xff, 0x22 }, "00" },
+        { { 0xbe }, "99" },
+    };
+    for (const auto &r : references) {
+        fields.clear();
+        if (!decode(decoder, r.first, fields) || fields.size() != 1
+            || fields[0].first != "k" || fields[0].second != r.second) {
+            fprintf(stderr, "error: many entries: field k: %s not found\n", r.second);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 1) {
+        fprintf(stderr, "usage: %s\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    unsigned int failures = 0;
+    for (const struct example &e : examples) {
+        unsigned int f = check(e);
+        fprintf(stdout, "%-6s blocks: %zu\tfailures: %u\n", e.name, e.blocks.size(), f);
+        failures += f;
+    }
+    unsigned int f = check_many_entries();
+    fprintf(stdout, "%-6s blocks: %u\tfailures: %u\n", "many", 3, f);
+    failures += f;
+    fprintf(stdout, "correctness: %u failures\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
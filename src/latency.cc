@@ -0,0 +1,125 @@
+/*
+ * latency.cc
+ *
+ * per-stage latency histograms for the packet path
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <unistd.h>
+#include <inttypes.h>
+#include "latency.h"
+
+const char *latency_stage_name(enum latency_stage stage) {
+    switch(stage) {
+    case latency_stage_eth_ip:   return "eth_ip";
+    case latency_stage_classify: return "classify";
+    case latency_stage_parse:    return "parse";
+    case latency_stage_json:     return "json";
+    case latency_stage_analysis: return "analysis";
+    case latency_stage_enqueue:  return "enqueue";
+    default:
+        ;
+    }
+    return "unknown";
+}
+
+static double monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// the time stamp counter is compared against the monotonic clock
+// over 20ms, which is accurate to much better than the 12.5% width
+// of the histogram buckets
+//
+static double measure_ticks_per_ns() {
+#if defined(__x86_64__) || defined(__i386__)
+    double ns_start = monotonic_ns();
+    uint64_t ticks_start = latency_timestamp();
+    usleep(20000);
+    double ns = monotonic_ns() - ns_start;
+    uint64_t ticks = latency_timestamp() - ticks_start;
+    if (ns <= 0 || ticks == 0) {
+        return 1.0;
+    }
+    return ticks / ns;
+#else
+    return 1.0;
+#endif
+}
+
+double latency_ticks_per_ns() {
+    static double ticks_per_ns = measure_ticks_per_ns();
+    return ticks_per_ns;
+}
+
+struct latency_summary latency_histogram_summary(const struct latency_histogram &h) {
+    struct latency_summary s = { 0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+    uint64_t count[LATENCY_BUCKETS];
+    for (unsigned int b = 0; b < LATENCY_BUCKETS; b++) {
+        count[b] = __atomic_load_n(&h.count[b], __ATOMIC_RELAXED);
+        s.count += count[b];
+    }
+    if (s.count == 0) {
+        return s;
+    }
+    uint64_t max = __atomic_load_n(&h.max, __ATOMIC_RELAXED);
+    double ticks_per_ns = latency_ticks_per_ns();
+
+    // each percentile is the upper limit of the bucket that holds it,
+    // which is within 12.5% of the exact value
+    //
+    struct {
+        double fraction;
+        double *value;
+    } percentiles[] = {
+        { 0.5,   &s.p50  },
+        { 0.9,   &s.p90  },
+        { 0.99,  &s.p99  },
+        { 0.999, &s.p999 }
+    };
+    uint64_t total = 0;
+    unsigned int p = 0;
+    for (unsigned int b = 0; b < LATENCY_BUCKETS && p < sizeof(percentiles)/sizeof(percentiles[0]); b++) {
+        total += count[b];
+        while (p < sizeof(percentiles)/sizeof(percentiles[0]) && total >= percentiles[p].fraction * s.count) {
+            uint64_t limit = latency_histogram::bucket_limit(b);
+            *percentiles[p].value = (limit < max ? limit : max) / ticks_per_ns;
+            p++;
+        }
+    }
+    s.max = max / ticks_per_ns;
+
+    return s;
+}
+
+static void latency_summary_write(FILE *f, const char *name, const struct latency_summary &s) {
+    fprintf(f, "  %-12s %12" PRIu64 " %10.0f %10.0f %10.0f %10.0f %10.0f\n",
+            name, s.count, s.p50, s.p90, s.p99, s.p999, s.max);
+}
+
+void latency_histograms_write(FILE *f,
+                              unsigned int thread,
+                              const struct latency_histograms &h,
+                              const char *(*message_name)(unsigned int)) {
+
+    fprintf(f, "latency (ns) of thread %u, for 1 of every %u packets\n", thread, h.sampling);
+    fprintf(f, "  %-12s %12s %10s %10s %10s %10s %10s\n", "stage", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (unsigned int i = 0; i < num_latency_stages; i++) {
+        latency_summary_write(f, latency_stage_name((enum latency_stage)i), latency_histogram_summary(h.stage[i]));
+    }
+    fprintf(f, "  %-12s %12s %10s %10s %10s %10s %10s\n", "message", "count", "p50", "p90", "p99", "p99.9", "max");
+    for (unsigned int i = 0; i < LATENCY_MAX_MESSAGE_TYPES; i++) {
+        const char *name = message_name(i);
+        if (name == NULL) {
+            continue;
+        }
+        struct latency_summary s = latency_histogram_summary(h.message[i]);
+        if (s.count) {
+            latency_summary_write(f, name, s);
+        }
+    }
+}
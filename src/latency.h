@@ -0,0 +1,228 @@
+/*
+ * latency.h
+ *
+ * per-stage latency histograms for the packet path, which are only
+ * compiled in when PKT_PROC_LATENCY is defined (make
+ * "OPTFLAGS=-DPKT_PROC_LATENCY"), and then only record the packets
+ * that are sampled at runtime
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/*
+ * enum latency_stage identifies a stage of the processing of a
+ * packet; the time between two marks is charged to the stage of the
+ * second one, so a stage can be visited more than once per packet
+ */
+enum latency_stage {
+    latency_stage_eth_ip   = 0,   // Ethernet, VLAN, MPLS, GRE and IP headers
+    latency_stage_classify = 1,   // TCP/UDP headers, flow tables, message type
+    latency_stage_parse    = 2,   // protocol message parsing (and QUIC decryption)
+    latency_stage_json     = 3,   // JSON record formatting
+    latency_stage_analysis = 4,   // fingerprint analysis
+    latency_stage_enqueue  = 5,   // output queue
+    num_latency_stages     = 6
+};
+
+const char *latency_stage_name(enum latency_stage stage);
+
+/*
+ * latency_timestamp() returns the time stamp counter on x86, and the
+ * monotonic clock in nanoseconds elsewhere; latency_ticks_per_ns()
+ * returns the rate of the former, which is measured on its first
+ * call, so that call should be made before any packets are processed
+ */
+inline uint64_t latency_timestamp() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+double latency_ticks_per_ns();
+
+/*
+ * struct latency_histogram is a log-linear histogram, in the style
+ * of HdrHistogram: values below 8 have their own buckets, and each
+ * power of two above that is divided into 8 buckets, so that each
+ * bucket holds values within 12.5% of each other.  Values of 2^40
+ * ticks and up share the last bucket.
+ *
+ * A histogram is written by one thread with record(), and can be
+ * read at any time by other threads, with relaxed atomic loads.
+ */
+#define LATENCY_SUB_BUCKET_BITS  3
+#define LATENCY_SUB_BUCKETS      (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_MAX_EXPONENT     40
+#define LATENCY_BUCKETS          ((LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS + 2) * LATENCY_SUB_BUCKETS)
+
+struct latency_histogram {
+    uint64_t count[LATENCY_BUCKETS];
+    uint64_t max;
+
+    static unsigned int bucket(uint64_t ticks) {
+        if (ticks < LATENCY_SUB_BUCKETS) {
+            return ticks;
+        }
+        unsigned int exponent = 63 - __builtin_clzll(ticks);
+        if (exponent > LATENCY_MAX_EXPONENT) {
+            return LATENCY_BUCKETS - 1;
+        }
+        unsigned int sub_bucket = (ticks >> (exponent - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+        return (exponent - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS + sub_bucket;
+    }
+
+    // bucket_limit(b) returns the largest value in the bucket b
+    //
+    static uint64_t bucket_limit(unsigned int b) {
+        if (b < LATENCY_SUB_BUCKETS) {
+            return b;
+        }
+        unsigned int exponent = b / LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKET_BITS - 1;
+        uint64_t sub_bucket = b % LATENCY_SUB_BUCKETS;
+        return ((LATENCY_SUB_BUCKETS + sub_bucket + 1) << (exponent - LATENCY_SUB_BUCKET_BITS)) - 1;
+    }
+
+    void record(uint64_t ticks) {
+        uint64_t &c = count[bucket(ticks)];
+        __atomic_store_n(&c, c + 1, __ATOMIC_RELAXED);
+        if (ticks > max) {
+            __atomic_store_n(&max, ticks, __ATOMIC_RELAXED);
+        }
+    }
+};
+
+/*
+ * struct latency_summary holds the number of values in a histogram,
+ * and the approximate percentiles and exact maximum of them, in
+ * nanoseconds
+ */
+struct latency_summary {
+    uint64_t count;
+    double p50;
+    double p90;
+    double p99;
+    double p999;
+    double max;
+};
+
+struct latency_summary latency_histogram_summary(const struct latency_histogram &h);
+
+/*
+ * struct latency_histograms holds the histograms of a worker thread:
+ * one for each stage, and one for the whole processing of the
+ * packets that had each kind of message, indexed by
+ * pkt_proc_record_type (see pkt_proc.h), with the packets that had
+ * no record in the last one
+ */
+#define LATENCY_MAX_MESSAGE_TYPES 16
+
+struct latency_histograms {
+    struct latency_histogram stage[num_latency_stages];
+    struct latency_histogram message[LATENCY_MAX_MESSAGE_TYPES];
+    unsigned int sampling;    // one of every sampling packets is recorded
+};
+
+/*
+ * latency_histograms_write(f, thread, h, message_name) writes a
+ * table of the summaries of the histograms h of a thread to f; the
+ * function message_name returns the name of each message type, or
+ * NULL for those that are not used
+ */
+void latency_histograms_write(FILE *f,
+                              unsigned int thread,
+                              const struct latency_histograms &h,
+                              const char *(*message_name)(unsigned int));
+
+/*
+ * struct latency_tracker times the processing of each sampled packet,
+ * and adds it to a set of latency_histograms.  The processing of a
+ * packet starts with begin(), which decides whether the packet is
+ * sampled, is divided into stages with mark(), and ends with end();
+ * for the packets that are not sampled, mark() and end() return after
+ * one test.  If PKT_PROC_LATENCY is not defined, all of these
+ * functions are empty.
+ */
+struct latency_tracker {
+
+#ifdef PKT_PROC_LATENCY
+
+    struct latency_histograms *histograms = nullptr;   // null unless enabled
+    unsigned int countdown = 0;
+    bool sampling = false;
+    unsigned int message = 0;
+    unsigned int stages_visited = 0;
+    uint64_t start = 0;
+    uint64_t last = 0;
+    uint64_t stage_ticks[num_latency_stages];
+
+    void set_histograms(struct latency_histograms *h) {
+        histograms = h;
+        countdown = 1;
+    }
+
+    void begin(unsigned int no_message) {
+        if (histograms && --countdown == 0) {
+            countdown = histograms->sampling;
+            sampling = true;
+            message = no_message;
+            stages_visited = 0;
+            start = last = latency_timestamp();
+        }
+    }
+
+    void mark(enum latency_stage stage) {
+        if (sampling) {
+            uint64_t now = latency_timestamp();
+            if ((stages_visited & (1 << stage)) == 0) {
+                stages_visited |= (1 << stage);
+                stage_ticks[stage] = 0;
+            }
+            stage_ticks[stage] += now - last;
+            last = now;
+        }
+    }
+
+    void set_message(unsigned int m) {
+        message = m;
+    }
+
+    void end() {
+        if (sampling) {
+            sampling = false;
+            for (unsigned int s = 0; s < num_latency_stages; s++) {
+                if (stages_visited & (1 << s)) {
+                    histograms->stage[s].record(stage_ticks[s]);
+                }
+            }
+            histograms->message[message].record(last - start);
+        }
+    }
+
+#else
+
+    void set_histograms(struct latency_histograms *) { }
+    void begin(unsigned int) { }
+    void mark(enum latency_stage) { }
+    void set_message(unsigned int) { }
+    void end() { }
+
+#endif /* PKT_PROC_LATENCY */
+
+};
+
+#endif /* LATENCY_H */
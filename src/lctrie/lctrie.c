@@ -11,6 +11,9 @@
 // A branch fill factor of 50%
 #define FILLFACT          50
 
+// number of lookups interleaved by lct_find_batch()
+#define LCT_BATCH         8
+
 static
 uint8_t compute_skip(lct_t *trie, uint32_t prefix, uint32_t first,
                          uint32_t num, uint32_t *newprefix) {
@@ -58,7 +61,7 @@ uint8_t compute_branch(lct_t *trie, uint32_t prefix, uint32_t first,
   do {
     bits++;
     if (num < ((FILLFACT * (1<<bits)) / 100) ||
-        newprefix + bits > sizeof(uint32_t))
+        newprefix + bits > 32)
       break;
     i = first;
     pat = 0;
@@ -235,10 +238,31 @@ void lct_free(lct_t *trie) {
   trie->bcount = 0;
 }
 
+// check the base at leaf index idx, and then its prefixes, for a
+// match against key
+static inline
+lct_subnet_t *lct_find_leaf(lct_t *trie, uint32_t idx, uint32_t key) {
+  uint32_t bitmask, prep;
+
+  /* Was this a hit? */
+  bitmask = trie->nets[trie->bases[idx]].addr ^ key;
+  if (EXTRACT(0, trie->nets[trie->bases[idx]].len, bitmask) == 0)
+    return &trie->nets[trie->bases[idx]];
+
+  /* If not, look in the prefix tree */
+  prep = trie->nets[trie->bases[idx]].prefix;
+  while (prep != IP_PREFIX_NIL) {
+    if (EXTRACT(0, trie->nets[prep].len, bitmask) == 0)
+      return &trie->nets[prep];
+    prep = trie->nets[prep].prefix;
+  }
+
+  return NULL;
+}
+
 lct_subnet_t *lct_find(lct_t *trie, uint32_t key) {
   lct_node_t *node;
   int pos, branch, idx;
-  uint32_t bitmask, prep;
 
   // idiot check
   if (!trie)
@@ -256,18 +280,54 @@ lct_subnet_t *lct_find(lct_t *trie, uint32_t key) {
     idx = node->index;
   }
 
-  /* Was this a hit? */
-  bitmask = trie->nets[trie->bases[idx]].addr ^ key;
-  if (EXTRACT(0, trie->nets[trie->bases[idx]].len, bitmask) == 0)
-    return &trie->nets[trie->bases[idx]];
+  return lct_find_leaf(trie, idx, key);
+}
 
-  /* If not, look in the prefix tree */
-  prep = trie->nets[trie->bases[idx]].prefix;
-  while (prep != IP_PREFIX_NIL) {
-    if (EXTRACT(0, trie->nets[prep].len, bitmask) == 0)
-      return &trie->nets[prep];
-    prep = trie->nets[prep].prefix;
+void lct_find_batch(lct_t *trie, const uint32_t *key,
+                    lct_subnet_t **result, size_t num) {
+  int pos[LCT_BATCH], branch[LCT_BATCH], idx[LCT_BATCH];
+
+  if (!trie) {
+    for (size_t i = 0; i < num; ++i)
+      result[i] = NULL;
+    return;
   }
 
-  return NULL;
+  // walk up to LCT_BATCH tries in lockstep, one level per pass, and
+  // prefetch the node that each walk will visit next, so that the
+  // cache misses of the different walks are overlapped
+  for (size_t first = 0; first < num; first += LCT_BATCH) {
+    size_t n = num - first < LCT_BATCH ? num - first : LCT_BATCH;
+    const uint32_t *k = key + first;
+    int active = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+      pos[i] = trie->root[0].skip;
+      branch[i] = trie->root[0].branch;
+      idx[i] = trie->root[0].index;
+      if (branch[i] != 0) {
+        __builtin_prefetch(&trie->root[idx[i] + EXTRACT(pos[i], branch[i], k[i])]);
+        active++;
+      }
+    }
+    while (active) {
+      active = 0;
+      for (size_t i = 0; i < n; ++i) {
+        if (branch[i] == 0)
+          continue;
+        lct_node_t *node = &trie->root[idx[i] + EXTRACT(pos[i], branch[i], k[i])];
+        pos[i] += branch[i] + node->skip;
+        branch[i] = node->branch;
+        idx[i] = node->index;
+        if (branch[i] != 0) {
+          __builtin_prefetch(&trie->root[idx[i] + EXTRACT(pos[i], branch[i], k[i])]);
+          active++;
+        } else {
+          __builtin_prefetch(&trie->nets[trie->bases[idx[i]]]);
+        }
+      }
+    }
+    for (size_t i = 0; i < n; ++i)
+      result[first + i] = lct_find_leaf(trie, idx[i], k[i]);
+  }
 }
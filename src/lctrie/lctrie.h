@@ -86,5 +86,11 @@ extern void lct_free(lct_t *trie);
 // key must be provided in host byte ordering
 extern lct_subnet_t *lct_find(lct_t *trie, uint32_t key);
 
+// batched trie search function
+// set result[i] to lct_find(trie, key[i]) for each of the num keys,
+// interleaving the trie walks so that their memory accesses overlap
+extern void lct_find_batch(lct_t *trie, const uint32_t *key,
+                           lct_subnet_t **result, size_t num);
+
 // end #ifndef guard
 #endif
@@ -0,0 +1,316 @@
+#include "lctrie6.h"
+
+#include <stdio.h>
+
+// see lctrie.c; a 16 bit root branch covers the /16 that nearly
+// every global unicast IPv6 allocation is made under
+#define ROOT_BRANCH       16
+
+// A branch fill factor of 50%
+#define FILLFACT          50
+
+// number of lookups interleaved by lct6_find_batch()
+#define LCT6_BATCH        8
+
+/* remove the first p bits from 128 bit string */
+#define REMOVE6(p, str)   ((p) ? ((lct_ip6_addr_t)(str))<<(p)>>(p) : (lct_ip6_addr_t)(str))
+
+static
+uint8_t compute_skip(lct6_t *trie, uint32_t prefix, uint32_t first,
+                     uint32_t num, uint32_t *newprefix) {
+  lct_ip6_addr_t low, high;
+  uint32_t i;
+
+  // there is no skip factor on the root node
+  if ((prefix == 0) && (first == 0)) {
+    return 0;
+  }
+
+  // Compute the new prefix
+  low = REMOVE6(prefix, trie->nets[trie->bases[first]].addr);
+  high = REMOVE6(prefix, trie->nets[trie->bases[first + num - 1]].addr);
+  i = prefix;
+  while (i < 128 && EXTRACT6(i, 1, low) == EXTRACT6(i, 1, high))
+    i++;
+  *newprefix = i;
+
+  return (*newprefix - prefix);
+}
+
+static
+uint8_t compute_branch(lct6_t *trie, uint32_t prefix, uint32_t first,
+                       uint32_t num, uint32_t newprefix) {
+  int i, pat, bits, count, patfound;
+
+  // always use a branch factor of 1 for two element arrays
+  if (num == 2) {
+    return 1;
+  }
+
+  if ((prefix == 0) && (first == 0)) {
+    return ROOT_BRANCH;
+  }
+
+  // Compute the number of bits that can be used for branching,
+  // starting the search at 2^b = 4 branches, and never extending the
+  // branch past the end of the key
+  bits = 1;
+  do {
+    bits++;
+    if (num < ((FILLFACT * (1<<bits)) / 100) ||
+        newprefix + bits > 128)
+      break;
+    i = first;
+    pat = 0;
+    count = 0;
+    while (pat < 1<<bits) {
+      patfound = 0;
+      while (i < first + num &&
+             pat == EXTRACT6(newprefix, bits, trie->nets[trie->bases[i]].addr)) {
+        i++;
+        patfound = 1;
+      }
+      if (patfound)
+        count++;
+      pat++;
+    }
+  } while (count >= ((FILLFACT * (1<<bits)) / 100));
+  return bits - 1;
+}
+
+static
+void build_inner(lct6_t *trie, uint32_t prefix, uint32_t first, uint32_t num, uint32_t pos) {
+  int k, p, idx, bits;
+  uint32_t bitpat, newprefix = 0, i;
+  uint8_t branch;
+
+  if (num == 1) {
+    trie->root[pos].branch = 0;
+    trie->root[pos].skip = 0;
+    trie->root[pos].index = first;
+  }
+  else {
+    // calculate the skip and branch for this node
+    trie->root[pos].skip = compute_skip(trie, prefix, first, num, &newprefix);
+    branch = trie->root[pos].branch = compute_branch(trie, prefix, first, num, newprefix);
+
+    // allocate our child nodes before we recurse over them
+    idx = trie->ncount;
+    trie->root[pos].index = idx;
+    trie->ncount += 1 << branch;
+
+    // Build the subtrees
+    p = first;
+    for (bitpat = 0; bitpat < (1 << branch); ++bitpat) {
+      k = 0;
+      while (p + k < first + num &&
+             EXTRACT6(newprefix, branch, trie->nets[trie->bases[p + k]].addr) == bitpat) {
+        ++k;
+      }
+
+      if (k == 0) {
+        // The leaf should have a pointer either to p-1 or p,
+        // whichever has the longest matching prefix
+        int match1 = 0, match2 = 0;
+
+        // Compute the longest prefix match for p - 1
+        if (p > first) {
+          int prep, len;
+          prep =  trie->nets[trie->bases[p - 1]].prefix;
+          while (prep != IP_PREFIX_NIL && match1 == 0) {
+            len = trie->nets[prep].len;
+            if (len > newprefix &&
+                EXTRACT6(newprefix, len - newprefix, trie->nets[trie->bases[p - 1]].addr) ==
+                EXTRACT6(128 - branch, len - newprefix, bitpat))
+              match1 = len;
+            else
+              prep = trie->nets[prep].prefix;
+          }
+        }
+
+        // Compute the longest prefix match for p
+        if (p < first + num) {
+          int prep, len;
+          prep =  trie->nets[trie->bases[p]].prefix;
+          while (prep != IP_PREFIX_NIL && match2 == 0) {
+            len = trie->nets[prep].len;
+            if (len > newprefix &&
+                EXTRACT6(newprefix, len - newprefix, trie->nets[trie->bases[p]].addr) ==
+                EXTRACT6(128 - branch, len - newprefix, bitpat))
+              match2 = len;
+            else
+              prep = trie->nets[prep].prefix;
+          }
+        }
+
+        if ((match1 > match2 && p > first) || p == first + num)
+          build_inner(trie, newprefix + branch, p - 1, 1, idx + bitpat);
+        else
+          build_inner(trie, newprefix + branch, p, 1, idx + bitpat);
+      } else if (k == 1 && trie->nets[trie->bases[p]].len - newprefix < branch) {
+        bits = branch - trie->nets[trie->bases[p]].len + newprefix;
+        for (i = bitpat; i < bitpat + (1 << bits); i++)
+          build_inner(trie, newprefix + branch, p, 1, idx + i);
+        bitpat += (1 << bits) - 1;
+      } else
+        build_inner(trie, newprefix + branch, p, k, idx + bitpat);
+      p += k;
+    }
+  }
+}
+
+int lct6_build(lct6_t *trie, lct_subnet6_t *subnets, uint32_t size) {
+  if (!trie || !subnets || !size)
+    return -1;
+
+  trie->nets = subnets;
+
+  trie->bases = (uint32_t *) malloc(size * sizeof(uint32_t));
+  if (!trie->bases) {
+    fprintf(stderr, "ERROR: failed to allocate trie bases index buffer\n");
+    return -1;
+  }
+
+  trie->bcount = 0;
+  trie->shortest = 128;  // max subnet prefix length (single address)
+  for (int i = 0; i < size; ++i) {
+    if (IP_BASE == subnets[i].type) {
+      trie->bases[trie->bcount++] = i;
+      if (subnets[i].len < trie->shortest)
+        trie->shortest = subnets[i].len;
+    }
+  }
+
+  // reallocate the base index buffer back down to the actual size.
+  trie->bases = (uint32_t *) realloc(trie->bases, trie->bcount * sizeof(uint32_t));
+
+  // the root branch alone needs 1 << ROOT_BRANCH nodes; the rest of
+  // the trie needs at most two nodes per base
+  trie->root = (lct_node_t *) malloc(((1 << ROOT_BRANCH) + 2 * size) * sizeof(lct_node_t));
+  if (!trie->root) {
+    free(trie->bases);
+    fprintf(stderr, "ERROR: failed to allocate trie node buffer\n");
+    return -1;
+  }
+
+  trie->ncount = 1; // we start with the root node allocated
+  build_inner(trie, 0, 0, trie->bcount, 0);
+
+  // shrink down the trie node array to its actual size
+  lct_node_t *tmp = (lct_node_t *) realloc(trie->root, trie->ncount * sizeof(lct_node_t));
+  if (tmp == NULL) {
+      free(trie->root);
+      return -1;   /* error: reallocation failed */
+  }
+  trie->root = tmp;
+
+  return 0;
+}
+
+void lct6_free(lct6_t *trie) {
+  if (!trie)
+    return;
+
+  // don't free the external subnet array.
+  // that's under outside control.
+  free(trie->bases);
+  trie->bases = NULL;
+  trie->root = NULL;
+  trie->ncount = 0;
+  trie->bcount = 0;
+}
+
+// check the base at leaf index idx, and then its prefixes, for a
+// match against key
+static inline
+lct_subnet6_t *lct6_find_leaf(lct6_t *trie, uint32_t idx, lct_ip6_addr_t key) {
+  lct_ip6_addr_t bitmask;
+  uint32_t prep;
+
+  /* Was this a hit? */
+  bitmask = trie->nets[trie->bases[idx]].addr ^ key;
+  if (EXTRACT6(0, trie->nets[trie->bases[idx]].len, bitmask) == 0)
+    return &trie->nets[trie->bases[idx]];
+
+  /* If not, look in the prefix tree */
+  prep = trie->nets[trie->bases[idx]].prefix;
+  while (prep != IP_PREFIX_NIL) {
+    if (EXTRACT6(0, trie->nets[prep].len, bitmask) == 0)
+      return &trie->nets[prep];
+    prep = trie->nets[prep].prefix;
+  }
+
+  return NULL;
+}
+
+lct_subnet6_t *lct6_find(lct6_t *trie, lct_ip6_addr_t key) {
+  lct_node_t *node;
+  int pos, branch, idx;
+
+  // idiot check
+  if (!trie || !trie->root)
+    return NULL;
+
+  // Traverse the trie
+  node = &trie->root[0];
+  pos = node->skip;
+  branch = node->branch;
+  idx = node->index;
+  while (branch != 0) {
+    node = &trie->root[idx + EXTRACT6(pos, branch, key)];
+    pos += branch + node->skip;
+    branch = node->branch;
+    idx = node->index;
+  }
+
+  return lct6_find_leaf(trie, idx, key);
+}
+
+void lct6_find_batch(lct6_t *trie, const lct_ip6_addr_t *key,
+                     lct_subnet6_t **result, size_t num) {
+  int pos[LCT6_BATCH], branch[LCT6_BATCH], idx[LCT6_BATCH];
+
+  if (!trie || !trie->root) {
+    for (size_t i = 0; i < num; ++i)
+      result[i] = NULL;
+    return;
+  }
+
+  // walk up to LCT6_BATCH tries in lockstep, one level per pass, and
+  // prefetch the node that each walk will visit next, so that the
+  // cache misses of the different walks are overlapped
+  for (size_t first = 0; first < num; first += LCT6_BATCH) {
+    size_t n = num - first < LCT6_BATCH ? num - first : LCT6_BATCH;
+    const lct_ip6_addr_t *k = key + first;
+    int active = 0;
+
+    for (size_t i = 0; i < n; ++i) {
+      pos[i] = trie->root[0].skip;
+      branch[i] = trie->root[0].branch;
+      idx[i] = trie->root[0].index;
+      if (branch[i] != 0) {
+        __builtin_prefetch(&trie->root[idx[i] + EXTRACT6(pos[i], branch[i], k[i])]);
+        active++;
+      }
+    }
+    while (active) {
+      active = 0;
+      for (size_t i = 0; i < n; ++i) {
+        if (branch[i] == 0)
+          continue;
+        lct_node_t *node = &trie->root[idx[i] + EXTRACT6(pos[i], branch[i], k[i])];
+        pos[i] += branch[i] + node->skip;
+        branch[i] = node->branch;
+        idx[i] = node->index;
+        if (branch[i] != 0) {
+          __builtin_prefetch(&trie->root[idx[i] + EXTRACT6(pos[i], branch[i], k[i])]);
+          active++;
+        } else {
+          __builtin_prefetch(&trie->nets[trie->bases[idx[i]]]);
+        }
+      }
+    }
+    for (size_t i = 0; i < n; ++i)
+      result[first + i] = lct6_find_leaf(trie, idx[i], k[i]);
+  }
+}
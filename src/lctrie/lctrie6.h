@@ -0,0 +1,48 @@
+#ifndef __LC_TRIE6_H__
+#define __LC_TRIE6_H__
+// begin #ifndef guard
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "lctrie.h"
+#include "lctrie_ip6.h"
+
+// IPv6 LC Trie
+//
+// This is the same level compressed trie as in lctrie.h, with the
+// same node layout and build algorithm, but with 128-bit keys.  The
+// trie nodes only hold bit positions and indexes, so the 128-bit key
+// width only affects the subnet array and the bit extraction, and
+// the lookup cost is still proportional to the (small) depth of the
+// trie, rather than to the prefix length.
+typedef struct lct6 {
+  uint32_t ncount;     // number of trie nodes
+  uint32_t bcount;     // number of trie base subnet leaves
+  uint8_t shortest;    // shortest base subnet length (just for stats)
+
+  uint32_t *bases;     // array of indexes in the base array to indexes
+                       // into the subnet info data array.
+  lct_subnet6_t *nets; // pointer to a sorted and prefixed array of subnets
+  lct_node_t *root;    // pointer to the root of the trie node tree
+} lct6_t;
+
+// lifecycle functions, with the same requirements as lct_build() and
+// lct_free()
+extern int lct6_build(lct6_t *trie, lct_subnet6_t *subnets, uint32_t size);
+extern void lct6_free(lct6_t *trie);
+
+// trie search function
+// return the IP subnet corresponding to the element,
+// otherwise return NULL if not found
+// key must be provided in host byte ordering (see lct_ip6_addr_from_bytes())
+extern lct_subnet6_t *lct6_find(lct6_t *trie, lct_ip6_addr_t key);
+
+// batched trie search function
+// set result[i] to lct6_find(trie, key[i]) for each of the num keys,
+// interleaving the trie walks so that their memory accesses overlap
+extern void lct6_find_batch(lct6_t *trie, const lct_ip6_addr_t *key,
+                            lct_subnet6_t **result, size_t num);
+
+// end #ifndef guard
+#endif
@@ -37,6 +37,45 @@ lct_subnet_set_from_string(lct_subnet_t *subnet, const char *subnet_string) {
   return -1;  /* error parsing subnet_string */
 }
 
+int
+lct_subnet6_set_from_string(lct_subnet6_t *subnet, const char *subnet_string) {
+  char addr_string[INET6_ADDRSTRLEN];
+  uint8_t addr[16];
+  uint32_t asn;
+  uint8_t mask_length;
+
+  const char *slash = strchr(subnet_string, '/');
+  if (slash == NULL || slash - subnet_string >= sizeof(addr_string)) {
+    return -1;
+  }
+  memcpy(addr_string, subnet_string, slash - subnet_string);
+  addr_string[slash - subnet_string] = '\0';
+  if (inet_pton(AF_INET6, addr_string, addr) != 1) {
+    return -1;
+  }
+
+  if (sscanf(slash, "/%hhu\t%u", &mask_length, &asn) == 2) {
+
+    if ((mask_length == 0) || (mask_length > 128)) {
+      fprintf(stderr, "ERROR: %u is not a valid prefix length\n", mask_length);
+      return -1;
+    }
+
+    subnet->addr = lct_ip6_addr_from_bytes(addr);
+    subnet->len = mask_length;
+    subnet->info.type = IP_SUBNET_BGP;
+    subnet->info.bgp.asn = asn;
+    return 0;
+  }
+  return -1;  /* error parsing subnet_string */
+}
+
+// returns nonzero if line holds no subnet entry
+static int
+is_blank_or_comment(const char *line) {
+  return line[0] == '\0' || line[0] == ';' || line[0] == '#';
+}
+
 int
 read_prefix_table(char *filename,
                   lct_subnet_t prefix[],
@@ -55,12 +94,23 @@ read_prefix_table(char *filename,
   // validate and parse each line of input
   while (-1 != getline(&line, &line_len, infile)) {
     // clip off the trailing newline character
-    line[strcspn(line, "\n")] = 0;
+    line[strcspn(line, "\r\n")] = 0;
+
+    // IPv6 entries are read by read_prefix_table6()
+    if (is_blank_or_comment(line) || strchr(line, ':') != NULL)
+      continue;
+
+    if (num >= prefix_size) {
+      fprintf(stderr, "error: more than %zu IPv4 subnets in %s\n", prefix_size, filename);
+      num = -1;
+      break;
+    }
 
     // set the prefix[num] to the subnet and ASN found in line 
     if (lct_subnet_set_from_string(&prefix[num], line) != 0) {
       fprintf(stderr, "error: could not parse subnet string '%s'\n", line);
-      return -1;
+      num = -1;
+      break;
     }
     
     num++;
@@ -72,6 +122,49 @@ read_prefix_table(char *filename,
   return num;
 }
 
+int
+read_prefix_table6(char *filename,
+                   lct_subnet6_t prefix[],
+                   size_t prefix_size) {
+  int num = 0;
+  FILE *infile;
+  char *line = NULL;
+  size_t line_len = 0;
+
+  // open the file for reading
+  if (!(infile = fopen(filename, "r"))) {
+    fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+    return -1;
+  }
+
+  // validate and parse each IPv6 line of input
+  while (-1 != getline(&line, &line_len, infile)) {
+    line[strcspn(line, "\r\n")] = 0;
+
+    if (is_blank_or_comment(line) || strchr(line, ':') == NULL)
+      continue;
+
+    if (num >= prefix_size) {
+      fprintf(stderr, "error: more than %zu IPv6 subnets in %s\n", prefix_size, filename);
+      num = -1;
+      break;
+    }
+
+    if (lct_subnet6_set_from_string(&prefix[num], line) != 0) {
+      fprintf(stderr, "error: could not parse subnet string '%s'\n", line);
+      num = -1;
+      break;
+    }
+
+    num++;
+  }
+
+  free(line);
+  fclose(infile);
+
+  return num;
+}
+
 int
 read_asn_table(char *filename,
                lct_bgp_asn_t prefix[],
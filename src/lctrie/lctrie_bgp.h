@@ -6,13 +6,15 @@
 #include <stdint.h>
 
 #include "lctrie_ip.h"
+#include "lctrie_ip6.h"
 
 typedef struct lct_bgp_asn {
   uint32_t num;
   char *desc;
 } lct_bgp_asn_t;
 
-// read the subnet to ASN file
+// read the IPv4 entries of the subnet to ASN file, skipping blank
+// lines, comments (lines starting with ';' or '#') and IPv6 entries
 // return number of entries read
 // return negative on failure
 extern int
@@ -20,6 +22,15 @@ read_prefix_table(char *filename,
                   lct_subnet_t prefix[],
                   size_t prefix_size);
 
+// read the IPv6 entries of the subnet to ASN file, skipping blank
+// lines, comments and IPv4 entries
+// return number of entries read
+// return negative on failure
+extern int
+read_prefix_table6(char *filename,
+                   lct_subnet6_t prefix[],
+                   size_t prefix_size);
+
 // read the ASN to description file
 // return number of entries read
 // return negative on failure
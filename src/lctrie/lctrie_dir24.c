@@ -0,0 +1,147 @@
+#include "lctrie_dir24.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TBL24_SIZE        (1 << 24)
+#define TBL8_GROUP        256
+
+// prefetch distance of lct_dir24_find_batch(), in lookups
+#define DIR24_PREFETCH    16
+
+static inline uint32_t subnet_leaf(const lct_subnet_t *subnet, uint32_t *nlarge) {
+  if (subnet->info.type != IP_SUBNET_BGP)
+    return 0;
+  if (subnet->info.bgp.asn > LCT_DIR24_ASN_MAX) {
+    ++*nlarge;
+    return 0;
+  }
+  return subnet->info.bgp.asn;
+}
+
+// return the index of a new tbl8 group filled with value, or
+// UINT32_MAX if one could not be allocated
+static uint32_t tbl8_alloc_group(lct_dir24_t *table, uint32_t value) {
+  if (table->tbl8_count == table->tbl8_alloc) {
+    uint32_t n = table->tbl8_alloc ? 2 * table->tbl8_alloc : 64;
+    if (n > LCT_DIR24_ASN_MAX / TBL8_GROUP)
+      return UINT32_MAX;
+    uint32_t *tmp = (uint32_t *) realloc(table->tbl8, (size_t)n * TBL8_GROUP * sizeof(uint32_t));
+    if (!tmp)
+      return UINT32_MAX;
+    table->tbl8 = tmp;
+    table->tbl8_alloc = n;
+  }
+  uint32_t *group = &table->tbl8[(size_t)table->tbl8_count * TBL8_GROUP];
+  for (int i = 0; i < TBL8_GROUP; ++i)
+    group[i] = value;
+
+  return table->tbl8_count++;
+}
+
+int lct_dir24_build(lct_dir24_t *table, const lct_subnet_t *subnets, uint32_t size) {
+  uint32_t count[33] = { 0 }, start[33];
+  uint32_t *order;
+  uint32_t nlarge = 0;
+
+  if (!table || !subnets || !size)
+    return -1;
+
+  memset(table, 0, sizeof(lct_dir24_t));
+  table->tbl24 = (uint32_t *) calloc(TBL24_SIZE, sizeof(uint32_t));
+  order = (uint32_t *) malloc(size * sizeof(uint32_t));
+  if (!table->tbl24 || !order) {
+    fprintf(stderr, "ERROR: failed to allocate DIR-24-8 table\n");
+    free(table->tbl24);
+    free(order);
+    table->tbl24 = NULL;
+    return -1;
+  }
+
+  // order the subnets by increasing prefix length with a counting
+  // sort, so that each subnet overwrites the shorter subnets that
+  // cover it, and so that all of the tbl24 ranges are written before
+  // any tbl8 group is created
+  for (uint32_t i = 0; i < size; ++i)
+    ++count[subnets[i].len > 32 ? 32 : subnets[i].len];
+  start[0] = 0;
+  for (int len = 1; len <= 32; ++len)
+    start[len] = start[len - 1] + count[len - 1];
+  for (uint32_t i = 0; i < size; ++i)
+    order[start[subnets[i].len > 32 ? 32 : subnets[i].len]++] = i;
+
+  for (uint32_t i = 0; i < size; ++i) {
+    const lct_subnet_t *s = &subnets[order[i]];
+    uint32_t leaf = subnet_leaf(s, &nlarge);
+
+    if (s->len <= 24) {
+      uint32_t first = s->len ? (s->addr >> 8) & ~((1u << (24 - s->len)) - 1) : 0;
+      uint32_t n = 1u << (24 - s->len);
+      for (uint32_t j = first; j < first + n; ++j)
+        table->tbl24[j] = leaf;
+    }
+    else {
+      uint32_t *entry = &table->tbl24[s->addr >> 8];
+      if (!(*entry & LCT_DIR24_TBL8)) {
+        uint32_t group = tbl8_alloc_group(table, *entry);
+        if (group == UINT32_MAX) {
+          fprintf(stderr, "ERROR: failed to allocate DIR-24-8 tbl8 group\n");
+          free(order);
+          lct_dir24_free(table);
+          return -1;
+        }
+        *entry = LCT_DIR24_TBL8 | group;
+      }
+      uint32_t *group = &table->tbl8[(size_t)(*entry & ~LCT_DIR24_TBL8) * TBL8_GROUP];
+      uint32_t first = (s->addr & 0xff) & ~((1u << (32 - s->len)) - 1);
+      uint32_t n = 1u << (32 - s->len);
+      for (uint32_t j = first; j < first + n; ++j)
+        group[j] = leaf;
+    }
+  }
+  free(order);
+
+  // shrink tbl8 down to its actual size
+  if (table->tbl8_count && table->tbl8_count < table->tbl8_alloc) {
+    uint32_t *tmp = (uint32_t *) realloc(table->tbl8, (size_t)table->tbl8_count * TBL8_GROUP * sizeof(uint32_t));
+    if (tmp) {
+      table->tbl8 = tmp;
+      table->tbl8_alloc = table->tbl8_count;
+    }
+  }
+
+  if (nlarge)
+    fprintf(stderr, "warning: %u subnets with ASNs over %u are stored as ASN 0\n", nlarge, LCT_DIR24_ASN_MAX);
+
+  return 0;
+}
+
+void lct_dir24_free(lct_dir24_t *table) {
+  if (!table)
+    return;
+
+  free(table->tbl24);
+  free(table->tbl8);
+  memset(table, 0, sizeof(lct_dir24_t));
+}
+
+size_t lct_dir24_memory(const lct_dir24_t *table) {
+  return (size_t)TBL24_SIZE * sizeof(uint32_t) +
+         (size_t)table->tbl8_alloc * TBL8_GROUP * sizeof(uint32_t);
+}
+
+void lct_dir24_find_batch(const lct_dir24_t *table, const uint32_t *key,
+                          uint32_t *result, size_t num) {
+  size_t i = 0;
+
+  // prefetch the tbl24 entry DIR24_PREFETCH lookups ahead of the
+  // current one; the independent loads of the lookups in between
+  // are then overlapped by the processor.  A tbl8 access is rare
+  // enough that it is not worth prefetching.
+  for (; i + DIR24_PREFETCH < num; ++i) {
+    __builtin_prefetch(&table->tbl24[key[i + DIR24_PREFETCH] >> 8]);
+    result[i] = lct_dir24_find(table, key[i]);
+  }
+  for (; i < num; ++i)
+    result[i] = lct_dir24_find(table, key[i]);
+}
@@ -0,0 +1,69 @@
+#ifndef __LC_TRIE_DIR24_H__
+#define __LC_TRIE_DIR24_H__
+// begin #ifndef guard
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "lctrie_ip.h"
+
+// DIR-24-8 IPv4 longest prefix match table
+//
+// An alternative to the LC Trie for IPv4 ASN lookups, following
+// Gupta, Lin and McKeown, "Routing Lookups in Hardware at Memory
+// Access Speeds" (INFOCOM 1998).  The first table, tbl24, has one
+// entry for each /24, and holds the result for every address in that
+// /24, unless a prefix longer than /24 covers part of it; in that
+// case the entry holds the index of a group of 256 entries in the
+// second table, tbl8, which is indexed by the last octet of the
+// address.  A lookup is thus one memory access for most addresses,
+// and two at most, regardless of the number of prefixes, at the cost
+// of a 64 MB tbl24.
+//
+// Each entry is a compact leaf that holds the ASN of the matching
+// subnet directly (or zero, if there is no BGP subnet that matches),
+// so no further memory accesses are needed to get the result.  The
+// top bit of a tbl24 entry marks it as a tbl8 group index, which
+// means that ASNs must fit in 31 bits; the ones that don't are in the
+// private use range (RFC 6996), and are stored as zero.
+typedef struct lct_dir24 {
+  uint32_t *tbl24;        // 1 << 24 entries
+  uint32_t *tbl8;         // tbl8_count groups of 256 entries
+  uint32_t tbl8_count;    // number of tbl8 groups in use
+  uint32_t tbl8_alloc;    // number of tbl8 groups allocated
+} lct_dir24_t;
+
+#define LCT_DIR24_TBL8        0x80000000 // entry is a tbl8 group index
+#define LCT_DIR24_ASN_MAX     0x7fffffff
+
+// build the table from the subnet array, which need not be sorted;
+// where subnets overlap, the longest one determines the result, and
+// subnets that are not BGP subnets (private, reserved, ...) map to
+// zero.  Unlike the trie, the table does not refer to the subnet
+// array once it has been built.
+extern int lct_dir24_build(lct_dir24_t *table, const lct_subnet_t *subnets, uint32_t size);
+extern void lct_dir24_free(lct_dir24_t *table);
+
+// memory used by the table, in bytes
+extern size_t lct_dir24_memory(const lct_dir24_t *table);
+
+// table search function
+// return the ASN of the longest matching subnet, or zero
+// key must be provided in host byte ordering
+static inline uint32_t lct_dir24_find(const lct_dir24_t *table, uint32_t key) {
+  uint32_t entry = table->tbl24[key >> 8];
+
+  if (entry & LCT_DIR24_TBL8)
+    entry = table->tbl8[((entry & ~LCT_DIR24_TBL8) << 8) | (key & 0xff)];
+
+  return entry;
+}
+
+// batched table search function
+// set result[i] to lct_dir24_find(table, key[i]) for each of the num
+// keys, prefetching the table entries ahead of their use
+extern void lct_dir24_find_batch(const lct_dir24_t *table, const uint32_t *key,
+                                 uint32_t *result, size_t num);
+
+// end #ifndef guard
+#endif
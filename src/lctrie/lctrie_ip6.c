@@ -0,0 +1,217 @@
+#include "lctrie_ip6.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+
+lct_ip6_addr_t lct_ip6_addr_from_bytes(const uint8_t *bytes) {
+  lct_ip6_addr_t addr = 0;
+
+  for (int i = 0; i < 16; ++i)
+    addr = (addr << 8) | bytes[i];
+
+  return addr;
+}
+
+void lct_ip6_addr_to_bytes(lct_ip6_addr_t addr, uint8_t *bytes) {
+  for (int i = 15; i >= 0; --i) {
+    bytes[i] = addr & 0xff;
+    addr >>= 8;
+  }
+}
+
+static void lct_ip6_addr_to_string(lct_ip6_addr_t addr, char *pstr, size_t pstr_size) {
+  uint8_t bytes[16];
+
+  lct_ip6_addr_to_bytes(addr, bytes);
+  if (!inet_ntop(AF_INET6, bytes, pstr, pstr_size))
+    fprintf(stderr, "ERROR: %s\n", strerror(errno));
+}
+
+int subnet6_cmp(const void *di, const void *dj) {
+  const lct_subnet6_t *i = (const lct_subnet6_t *) di;
+  const lct_subnet6_t *j = (const lct_subnet6_t *) dj;
+
+  if (i->addr < j->addr)
+    return -1;
+  else if (i->addr > j->addr)
+    return 1;
+  else if (i->len < j->len)
+    return -1;
+  else if (i->len > j->len)
+    return 1;
+  else
+    return 0;
+}
+
+int subnet6_isprefix(lct_subnet6_t *s, lct_subnet6_t *t) {
+  return s && t &&
+         (s->len == 0 || // EXTRACT6() can't handle 0 bits
+          (s->len <= t->len &&
+           EXTRACT6(0, s->len, s->addr) ==
+           EXTRACT6(0, s->len, t->addr)));
+}
+
+void subnet6_mask(lct_subnet6_t *subnets, size_t size) {
+  char pstr[INET6_ADDRSTRLEN], pstr2[INET6_ADDRSTRLEN];
+
+  for (int i = 0; i < size; ++i) {
+    lct_subnet6_t *p = &subnets[i];
+
+    lct_ip6_addr_t netmask = ~(lct_ip6_addr_t)0;
+    if (p->len == 0)
+      netmask = 0;
+    else if (p->len < 128)
+      netmask <<= (128 - p->len);
+
+    lct_ip6_addr_t newaddr = p->addr & netmask;
+    if (newaddr != p->addr) {
+      lct_ip6_addr_to_string(p->addr, pstr, sizeof(pstr));
+      lct_ip6_addr_to_string(newaddr, pstr2, sizeof(pstr2));
+
+      fprintf(stderr, "Subnet %s/%d has not been properly masked, should be %s/%d\n",
+              pstr, p->len, pstr2, p->len);
+
+      p->addr = newaddr;
+    }
+  }
+}
+
+size_t subnet6_dedup(lct_subnet6_t *subnets, size_t size) {
+  // remove duplicates, exactly as subnet_dedup() does
+  char pstr[INET6_ADDRSTRLEN];
+  size_t ndup = 0;
+
+  for (int i = 0, j = 1; j < size; ++i, ++j) {
+    if (!subnet6_cmp(&subnets[i], &subnets[j])) {
+      lct_ip6_addr_to_string(subnets[i].addr, pstr, sizeof(pstr));
+
+      printf("Subnet %s/%d type %d duplicates another of type %d\n",
+             pstr, subnets[i].len, subnets[i].info.type, subnets[j].info.type);
+
+      if ((j + 1) < size)
+        memmove(&subnets[j], &subnets[j + 1], (size - (j + 1)) * sizeof(lct_subnet6_t));
+      --size;
+      ++ndup;
+    }
+  }
+
+  if (ndup)
+    printf("%zu duplicates removed\n\n", ndup);
+
+  return ndup;
+}
+
+size_t subnet6_prefix(lct_subnet6_t *p, lct_ip6_stats_t *stats, size_t size) {
+  size_t npre = 0;
+  uint32_t prefix;
+
+  // see subnet_prefix() for a description of the passes through the
+  // array; the only difference here is that the subnet sizes are
+  // 128-bit quantities, and a /0 subnet (which cannot be represented)
+  // is never considered full
+  for (int i = 0; i < size; ++i) {
+    p[i].prefix = IP_PREFIX_NIL;
+  }
+
+  // go through and determine which subnets are prefixes of other subnets
+  for (int i = 0; i < size; ++i) {
+    int j = i + 1;
+    if ((j < size) && subnet6_isprefix(&p[i], &p[j])) {
+      p[j].prefix = i;
+      p[j].fullprefix = i;
+
+      for (int k = j + 1; k < size && subnet6_isprefix(&p[i], &p[k]); ++k) {
+        p[k].prefix = i;
+        p[k].fullprefix = i;
+      }
+
+      p[i].type = IP_PREFIX;
+      ++npre;
+    }
+    else {
+      p[i].type = IP_BASE;
+    }
+    stats[i].size = p[i].len ? ((lct_ip6_addr_t)1) << (128 - p[i].len) : 0;
+    stats[i].used = 0;
+  }
+
+  // walk through the sorted array forwards to add the bases to their prefixes
+  for (int i = 0; i < size; ++i) {
+    if (IP_PREFIX_NIL != p[i].prefix) {
+      stats[p[i].prefix].used += stats[i].size;
+    }
+  }
+
+  // go through the array yet again to find full prefixes
+  for (int i = 0; i < size; ++i ) {
+    if (stats[i].size != 0 && stats[i].used == stats[i].size)
+      p[i].type = IP_PREFIX_FULL;
+  }
+
+  // update the prefix pointer to the next non-full prefix or
+  // IP_PREFIX_NIL
+  for (int i = 0; i < size; ++i ) {
+    prefix = p[i].prefix;
+    if (prefix != IP_PREFIX_NIL && p[prefix].type == IP_PREFIX_FULL)
+      p[i].prefix = p[prefix].prefix;
+  }
+
+  return npre;
+}
+
+static void subnet6_set(lct_subnet6_t *subnet, const char *addr, uint8_t len) {
+  uint8_t bytes[16];
+
+  inet_pton(AF_INET6, addr, bytes);
+  subnet->addr = lct_ip6_addr_from_bytes(bytes);
+  subnet->len = len;
+}
+
+int init_special_subnets6(lct_subnet6_t *subnets, size_t size) {
+  if (size < 6) {
+    fprintf(stderr, "Need a prefix buffer of size 6 for special IPv6 ranges\n");
+    return -1;
+  }
+
+  // ::1/128             Loopback                   RFC 4291
+  // ::ffff:0:0/96       IPv4-mapped Address        RFC 4291
+  // 2001:db8::/32       Documentation              RFC 3849
+  // fc00::/7            Unique-Local               RFC 4193
+  // fe80::/10           Link-Scoped Unicast        RFC 4291
+  // ff00::/8            Multicast                  RFC 4291
+
+  int num = 0;
+
+  subnets[num].info.type = IP_SUBNET_LOOPBACK;
+  subnet6_set(&subnets[num], "::1", 128);
+  ++num;
+
+  subnets[num].info.type = IP_SUBNET_RESERVED;
+  subnets[num].info.rsv.desc = "RFC 4291 IPv4-mapped Address";
+  subnet6_set(&subnets[num], "::ffff:0:0", 96);
+  ++num;
+
+  subnets[num].info.type = IP_SUBNET_RESERVED;
+  subnets[num].info.rsv.desc = "RFC 3849 Documentation";
+  subnet6_set(&subnets[num], "2001:db8::", 32);
+  ++num;
+
+  subnets[num].info.type = IP_SUBNET_PRIVATE;
+  subnets[num].info.priv.net_class = 'u';
+  subnet6_set(&subnets[num], "fc00::", 7);
+  ++num;
+
+  subnets[num].info.type = IP_SUBNET_LINKLOCAL;
+  subnet6_set(&subnets[num], "fe80::", 10);
+  ++num;
+
+  subnets[num].info.type = IP_SUBNET_MULTICAST;
+  subnet6_set(&subnets[num], "ff00::", 8);
+  ++num;
+
+  return num;
+}
@@ -0,0 +1,53 @@
+#ifndef __LC_TRIE_IP6_H__
+#define __LC_TRIE_IP6_H__
+// begin #ifndef guard
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "lctrie_ip.h"
+
+// IPv6 addresses are handled as 128-bit unsigned integers in host
+// byte order, so that the same shift-based bit manipulation that the
+// IPv4 trie uses works unchanged; this requires a compiler that
+// supports unsigned __int128 (gcc and clang on 64-bit platforms).
+__extension__ typedef unsigned __int128 lct_ip6_addr_t;
+
+// Extract num bits from 128 bit string starting at pos bit; as with
+// EXTRACT(), num must be nonzero
+#define EXTRACT6(pos, num, str) (((lct_ip6_addr_t)(str))<<(pos)>>(128-(num)))
+
+// the IPv6 subnet structure, which mirrors lct_subnet_t
+typedef struct lct_subnet6 {
+  lct_ip6_addr_t addr;  // subnet address
+  uint8_t type;         // prefix type
+  uint8_t len;          // CIDR address prefix length
+  uint32_t prefix;      // index to our next highest prefix
+  uint32_t fullprefix;
+  lct_subnet_info_t info;
+} lct_subnet6_t;
+
+typedef struct lct_ip6_stats {
+  lct_ip6_addr_t size;  // size of the subnet
+  lct_ip6_addr_t used;  // size of the subprefixed address space
+} lct_ip6_stats_t;
+
+// convert a 16-byte address in network byte order into an
+// lct_ip6_addr_t in host byte order, and back
+extern lct_ip6_addr_t lct_ip6_addr_from_bytes(const uint8_t *bytes);
+extern void lct_ip6_addr_to_bytes(lct_ip6_addr_t addr, uint8_t *bytes);
+
+// fill in user array with special IPv6 subnets (loopback, link local,
+// unique local, multicast, and documentation) as per RFC 6890
+extern int init_special_subnets6(lct_subnet6_t *subnets, size_t size);
+
+// the following functions are the IPv6 counterparts of the subnet
+// functions declared in lctrie_ip.h, and have the same semantics
+extern int subnet6_cmp(const void *di, const void *dj);
+extern void subnet6_mask(lct_subnet6_t *subnets, size_t size);
+extern size_t subnet6_dedup(lct_subnet6_t *subnets, size_t size);
+extern size_t subnet6_prefix(lct_subnet6_t *subnets, lct_ip6_stats_t *stats, size_t size);
+extern int subnet6_isprefix(lct_subnet6_t *s, lct_subnet6_t *t);
+
+// end #ifndef guard
+#endif
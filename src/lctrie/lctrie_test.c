@@ -12,6 +12,7 @@
 #include "lctrie_ip.h"
 #include "lctrie_bgp.h"
 #include "lctrie.h"
+#include "lctrie_dir24.h"
 
 #define BGP_MAX_ENTRIES             4000000
 #define BGP_READ_FILE               1
@@ -23,6 +24,9 @@
 #define LCT_VERIFY_PREFIXES         1
 #define LCT_IP_DISPLAY_PREFIXES     0
 
+// number of random addresses used to compare the lookup structures
+#define LCT_BENCH_KEYS              (1 << 24)
+
 static unsigned long next = 1;
 
 int fastrand(void) {
@@ -30,6 +34,35 @@ int fastrand(void) {
   return((unsigned)(next/65536) % RAND_MAX);
 }
 
+// 32 bit xorshift generator, since fastrand() only covers half of
+// the IPv4 address space
+static uint32_t xorshift_state = 2463534242;
+
+uint32_t xorshift32(void) {
+  xorshift_state ^= xorshift_state << 13;
+  xorshift_state ^= xorshift_state >> 17;
+  xorshift_state ^= xorshift_state << 5;
+  return xorshift_state;
+}
+
+unsigned long elapsed_us(struct timeval *start) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  return 1000000 * (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec);
+}
+
+void print_bench(const char *name, unsigned long nlookup, unsigned long took_us, uint64_t checksum) {
+  printf("%-22s %'14lu lookups/sec  %6.1f ns/lookup  (checksum %lu)\n", name,
+         (unsigned long)(nlookup * 1000000.0 / took_us), took_us * 1000.0 / nlookup, (unsigned long)checksum);
+}
+
+// the ASN that a DIR-24-8 table would return for a trie result
+uint32_t subnet_asn(lct_subnet_t *subnet) {
+  if (!subnet || subnet->info.type != IP_SUBNET_BGP || subnet->info.bgp.asn > LCT_DIR24_ASN_MAX)
+    return 0;
+  return subnet->info.bgp.asn;
+}
+
 void print_subnet(lct_subnet_t *subnet) {
   char pstr[INET_ADDRSTRLEN];
   uint32_t prefix;
@@ -149,7 +182,7 @@ void print_subnet_stats(lct_subnet_t *subnet, lct_ip_stats_t *stats) {
 int main(int argc, char *argv[]) {
   int num = 0;
   int nprefixes = 0, nbases = 0, nfull = 0;
-  uint32_t prefix, localprefix;
+  uint32_t prefix;
   lct_subnet_t *p, *subnet = NULL;
   lct_t t;
 
@@ -278,8 +311,11 @@ int main(int argc, char *argv[]) {
          (100.0f * nbases) / (num), (100.0f * (num - nfull)) / num);
 
   // actually build the trie and get the trie node count for statistics printing
+  struct timeval start;
   memset(&t, 0, sizeof(lct_t));
+  gettimeofday(&start, NULL);
   lct_build(&t, p, num);
+  unsigned long lct_build_us = elapsed_us(&start);
   uint32_t node_bytes = t.ncount * sizeof(lct_node_t) + t.bcount * sizeof(uint32_t);
   printf("The resulting trie has %'u nodes using %u %s memory.\n", t.ncount,
          node_bytes / ((node_bytes > 1024) ? (node_bytes > 1024 * 1024) ? 1024 * 1024 : 1024 : 1),
@@ -340,50 +376,114 @@ int main(int argc, char *argv[]) {
   }
   printf("Finished printed trie subnet matches.\n\n");
 
-  printf("Performance testing, might take a while...\n");
-
-  // init zero stats and seed the RNG
-  unsigned int nlookup = 0, nhit = 0, nmiss = 0;
-  srand(time(NULL));  // not crypto secure, but we don't need that
+  printf("Building DIR-24-8 table...\n");
+  lct_dir24_t d;
+  gettimeofday(&start, NULL);
+  if (lct_dir24_build(&d, p, num) != 0) {
+    fprintf(stderr, "could not build DIR-24-8 table\n");
+    return EXIT_FAILURE;
+  }
+  unsigned long dir24_build_us = elapsed_us(&start);
 
-  // setup the start of our local range for the test
-  inet_pton(AF_INET, "192.168.0.0", (void *) &localprefix);
-  localprefix = ntohl(localprefix);
+  printf("\n%-22s %14s %14s\n", "structure", "build ms", "memory kB");
+  printf("%-22s %'14.1f %'14lu\n", "LC-trie", lct_build_us / 1000.0,
+         (unsigned long)(subnet_bytes + node_bytes) / 1024);
+  printf("%-22s %'14.1f %'14lu\n", "DIR-24-8", dir24_build_us / 1000.0,
+         (unsigned long)lct_dir24_memory(&d) / 1024);
+  printf("(the LC-trie memory includes the subnet descriptors, which it needs for lookups;\n"
+         " DIR-24-8 uses %'u tbl8 groups)\n\n", d.tbl8_count);
 
-  // start the stop clock
-  struct timeval start, now;
-  gettimeofday(&start, NULL);
-  for (int i = 0; i < 50000000; i++) {
+  printf("Performance testing, might take a while...\n");
 
-    // just grab a random number and check to match
-    prefix = fastrand();
+  // use the same random keys, which are mostly misses, and keys
+  // inside of random subnets, which are mostly hits, for each
+  // structure
+  uint32_t *keys = (uint32_t *) malloc(2 * LCT_BENCH_KEYS * sizeof(uint32_t));
+  uint32_t *asn = (uint32_t *) malloc(LCT_BENCH_KEYS * sizeof(uint32_t));
+  lct_subnet_t **found = (lct_subnet_t **) malloc(LCT_BENCH_KEYS * sizeof(lct_subnet_t *));
+  if (!keys || !asn || !found) {
+    fprintf(stderr, "could not allocate benchmark buffers\n");
+    return EXIT_FAILURE;
+  }
+  // touch the output buffers, so that page faults are not timed
+  memset(asn, 0, LCT_BENCH_KEYS * sizeof(uint32_t));
+  memset(found, 0, LCT_BENCH_KEYS * sizeof(lct_subnet_t *));
+  for (int i = 0; i < LCT_BENCH_KEYS; ++i) {
+    keys[i] = xorshift32();
+    lct_subnet_t *s = &p[xorshift32() % num];
+    keys[LCT_BENCH_KEYS + i] = s->addr | (s->len == 32 ? 0 : xorshift32() >> s->len);
+  }
 
-    // record the lookup, hit, and miss stats
-    ++nlookup;
-    subnet = lct_find(&t, prefix);
-    if (subnet) {
-      ++nhit;
-    }
-    else {
-      ++nmiss;
+  // verify that the structures agree
+  unsigned int nmismatch = 0;
+  for (int i = 0; i < 2 * LCT_BENCH_KEYS; ++i) {
+    uint32_t expected = subnet_asn(lct_find(&t, keys[i]));
+    if (lct_dir24_find(&d, keys[i]) != expected) {
+      if (nmismatch++ < 10)
+        printf("MISMATCH for key %08x: DIR-24-8 %u, LC-trie %u\n", keys[i], lct_dir24_find(&d, keys[i]), expected);
     }
+  }
+  printf("%'u mismatches between LC-trie and DIR-24-8 results in %'u lookups.\n\n", nmismatch, 2 * LCT_BENCH_KEYS);
+
+  const char *key_set[] = { "random", "in-table" };
+  for (int set = 0; set < 2; ++set) {
+    const uint32_t *k = &keys[set * LCT_BENCH_KEYS];
+    char name[64];
+    uint64_t checksum;
+    unsigned long took_us;
+
+    printf("%s addresses:\n", key_set[set]);
+
+    checksum = 0;
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < LCT_BENCH_KEYS; ++i)
+      found[i] = lct_find(&t, k[i]);
+    for (int i = 0; i < LCT_BENCH_KEYS; ++i)
+      checksum += subnet_asn(found[i]);
+    took_us = elapsed_us(&start);
+    snprintf(name, sizeof(name), "  lct_find");
+    print_bench(name, LCT_BENCH_KEYS, took_us, checksum);
+
+    checksum = 0;
+    gettimeofday(&start, NULL);
+    lct_find_batch(&t, k, found, LCT_BENCH_KEYS);
+    for (int i = 0; i < LCT_BENCH_KEYS; ++i)
+      checksum += subnet_asn(found[i]);
+    took_us = elapsed_us(&start);
+    snprintf(name, sizeof(name), "  lct_find_batch");
+    print_bench(name, LCT_BENCH_KEYS, took_us, checksum);
+
+    checksum = 0;
+    gettimeofday(&start, NULL);
+    for (int i = 0; i < LCT_BENCH_KEYS; ++i)
+      asn[i] = lct_dir24_find(&d, k[i]);
+    for (int i = 0; i < LCT_BENCH_KEYS; ++i)
+      checksum += asn[i];
+    took_us = elapsed_us(&start);
+    snprintf(name, sizeof(name), "  lct_dir24_find");
+    print_bench(name, LCT_BENCH_KEYS, took_us, checksum);
+
+    checksum = 0;
+    gettimeofday(&start, NULL);
+    lct_dir24_find_batch(&d, k, asn, LCT_BENCH_KEYS);
+    for (int i = 0; i < LCT_BENCH_KEYS; ++i)
+      checksum += asn[i];
+    took_us = elapsed_us(&start);
+    snprintf(name, sizeof(name), "  lct_dir24_find_batch");
+    print_bench(name, LCT_BENCH_KEYS, took_us, checksum);
+  }
+  printf("\n");
 
-    // get the current time
-  } 
-  gettimeofday(&now, NULL);
-  unsigned long took_ms = 1000 * (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1000;
-  // timer has millisecond accuracy
-
-  printf("Complete.\n");
-printf("%'u lookups with %'u hits and %'u misses in %ldms.\n", nlookup, nhit, nmiss,
-       took_ms);
-  printf("%'lu lookups/sec.\n\n", nlookup / took_ms * 1000);
+  free(keys);
+  free(asn);
+  free(found);
 
   printf("Pausing to allow for system analysis.\n");
   printf("Hit enter key to continue...\n");
   getc(stdin);
 
   // we're done with the subnets, stats, and trie;  dump them.
+  lct_dir24_free(&d);
   lct_free(&t);
   free(stats);
   free(p);
@@ -53,10 +53,8 @@ struct ll_queue {
         }
         //fprintf(stderr, "DEBUG: queue bucket used!\n");
 
-        // TODO: this is where we'd update an output drop counter
-        // but currently this spot in the code doesn't have access to
-        // any thread stats pointer or similar and I don't want
-        // to update a global variable in this location.
+        // the caller counts the dropped message, in the counters of
+        // its packet processor (pkt_proc_counters::queue_drops)
         return nullptr;
     }
     void write_buffer_to_queue() {
@@ -64,6 +62,23 @@ struct ll_queue {
     void increment_widx() {
         widx = (widx + 1) % LLQ_DEPTH;
     }
+
+    /*
+     * publish(first, count) marks the count messages starting at
+     * index first as used, after a single release barrier; this
+     * allows a batch of messages to be written with init_msg(),
+     * setting len, and increment_widx(), and then published together,
+     * instead of with one full barrier per send()
+     */
+    void publish(int first, unsigned int count) {
+        if (count == 0) {
+            return;
+        }
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        for (unsigned int i = 0; i < count; i++) {
+            msgs[(first + i) % LLQ_DEPTH].used = 1;
+        }
+    }
 };
 
 
@@ -26,6 +26,8 @@
 #include "license.h"
 #include "version.h"
 #include "rnd_pkt_drop.h"
+#include "pkt_proc.h"
+#include "metrics.h"
 
 #ifndef  MERCURY_SEMANTIC_VERSION
 #warning MERCURY_SEMANTIC_VERSION is not defined
@@ -49,10 +51,20 @@ char mercury_help[] =
     "   [-t or --threads] [num_threads | cpu] # set number of threads\n"
     "   [-u or --user] u                      # set UID and GID to those of user u\n"
     "   [-d or --directory] d                 # set working directory to d\n"
+    "   --capture-method [af-packet | af-xdp] # set kind of capture socket\n"
+    "   --prefilter                           # drop unselected packets in the kernel\n"
+    "   --snaplen n                           # capture at most n bytes per packet\n"
+    "   --fanout m                            # divide packets among threads by m\n"
+    "   --stats-file s                        # write JSON stats records to file s\n"
+    "   --ring-tuning [recommend | apply]     # tune ring blocks from their usage\n"
     "GENERAL OPTIONS\n"
     "   --config c                            # read configuration from file c\n"
     "   [-a or --analysis]                    # analyze fingerprints\n"
     "   --resources d                         # use resource directory d\n"
+    "   --asn-lookup [lctrie | dir-24-8]      # set IPv4 ASN lookup structure\n"
+    "   --prefetch-distance d                 # prefetch d packets ahead (0 disables)\n"
+    "   --metrics a                           # serve OpenMetrics counters on address a\n"
+    "   --latency-sampling n                  # time 1 of every n packets (see --help)\n"
     "   [-s or --select] filter               # select traffic by filter (see --help)\n"
     "   --nonselected-tcp-data                # tcp data for nonselected traffic\n"
     "   --nonselected-udp-data                # udp data for nonselected traffic\n"
@@ -77,6 +89,51 @@ char mercury_extended_help[] =
     "   is the available memory; USE b < 0.1 EXCEPT WHEN THERE ARE GIGABYTES OF SPARE\n"
     "   RAM to avoid OS failure due to memory starvation.\n"
     "\n"
+    "   \"--capture-method m\" selects the kind of socket used with [-c or --capture].\n"
+    "   If m is \"af-packet\" (the default), AF_PACKET TPACKETv3 sockets are used,\n"
+    "   with a fanout across the worker threads.  If m is \"af-xdp\", an XDP program\n"
+    "   is attached to the interface, which redirects the packets from queue i to\n"
+    "   the AF_XDP socket of worker thread i; the interface must have at least as\n"
+    "   many queues as there are threads (see ethtool -L), and zero-copy mode is\n"
+    "   used if the driver supports it.  The packets on any other queues are passed\n"
+    "   to the kernel.  AF_XDP provides no timestamps, so the time at which each\n"
+    "   batch of packets is read is used.\n"
+    "\n"
+    "   --prefilter attaches a BPF filter to each AF_PACKET socket, so that the\n"
+    "   packets that could not be reported with the current [-s or --select]\n"
+    "   filter are dropped in the kernel, before they are copied into the ring\n"
+    "   buffers.  It is generated from the same TCP and UDP patterns that are used\n"
+    "   in user space, and only applies to JSON output.\n"
+    "\n"
+    "   \"--snaplen n\" captures at most n bytes of each packet (0, the default,\n"
+    "   captures all of them); n must be at least 128.  Fingerprints and metadata\n"
+    "   are only reported for the messages that fit in the captured bytes.\n"
+    "\n"
+    "   \"--fanout m\" sets how the packets captured with AF_PACKET are divided\n"
+    "   among the worker threads: by the kernel's flow hash (\"hash\", the\n"
+    "   default), in turn (\"lb\"), by the CPU (\"cpu\") or the interface queue\n"
+    "   (\"qm\") on which they arrived, or to each thread until its ring is full\n"
+    "   (\"rollover\").  With \"bpf\", a BPF program computes a hash of the\n"
+    "   addresses, ports and protocol that is the same for both directions of a\n"
+    "   flow, inside VLAN tags and MPLS labels; the modes other than \"hash\" and\n"
+    "   \"bpf\" can send the two halves of a flow to different threads.  With [-v or\n"
+    "   --verbose], the skew of the packet counts of the threads is reported.\n"
+    "\n"
+    "   \"--stats-file s\" writes a JSON record to the file s every second, with the\n"
+    "   packet and byte counts, and for each worker thread, the packets, drops and\n"
+    "   freezes of its socket, its average and worst ring buffer usage, the number\n"
+    "   of blocks that it read and that the kernel returned because of the block\n"
+    "   timeout, and the histogram of the number of blocks that it read in a row\n"
+    "   (the time spent with each number of blocks waiting in its ring).\n"
+    "\n"
+    "   \"--ring-tuning m\" compares the ring usage, drops and freezes of each ten\n"
+    "   second interval against the block count and block timeout of the AF_PACKET\n"
+    "   rings, and recommends a change when the rings come close to full or stay\n"
+    "   nearly empty; the total ring memory set by [-b or --buffer] stays the same.\n"
+    "   If m is \"recommend\", each new recommendation is written to stderr and to\n"
+    "   the stats records.  If m is \"apply\", each worker thread resizes its ring\n"
+    "   as recommended, which loses the packets that arrive while it does so.\n"
+    "\n"
     "   \"[-f or --fingerprint] f\" writes a JSON record for each fingerprint observed,\n"
     "   which incorporates the flow key and the time of observation, into the file f.\n"
     "   With [-a or --analysis], fingerprints and destinations are analyzed and the\n"
@@ -96,7 +153,7 @@ char mercury_extended_help[] =
     "      dhcp          DHCP discover message\n"
     "      dns           DNS messages\n"
     "      tls           DTLS clientHello, serverHello, and certificates\n"
-    "      http          HTTP request and response\n"
+    "      http          HTTP request and response, and HTTP/2 request\n"
     "      ssh           SSH handshake and KEX\n"
     "      tcp           TCP headers\n"
     "      tcp.message   TCP initial message\n"
@@ -133,7 +190,34 @@ char mercury_extended_help[] =
     "\n"
     "   [-a or --analysis] performs analysis and reports results in the \"analysis\"\n"
     "   object in the JSON records.   This option only works with the option\n"
-    "   [-f or --fingerprint].\n"
+    "   [-f or --fingerprint].  The operating system of each source address is\n"
+    "   also identified from its TCP, TLS, and HTTP fingerprints, and reported\n"
+    "   in the \"os_analysis\" object.\n"
+    "\n"
+    "   \"--asn-lookup t\" selects the data structure used to look up the autonomous\n"
+    "   system numbers of IPv4 destinations during analysis.  If t is \"lctrie\"\n"
+    "   (the default), a level compressed trie is used; if t is \"dir-24-8\", a\n"
+    "   DIR-24-8 table is used, which is much faster, but uses 64MB or more of RAM.\n"
+    "\n"
+    "   \"--prefetch-distance d\" sets how many packets ahead, within each batch of\n"
+    "   packets, the flow table entries are prefetched (default: 4, maximum: 16).\n"
+    "   0 disables prefetching.\n"
+    "\n"
+    "   \"--metrics a\" serves the counters of each worker thread over HTTP, in the\n"
+    "   OpenMetrics text format, on the address a, which is a TCP port, an IPv4\n"
+    "   address and port (such as 0.0.0.0:9100), or the path of a UNIX socket;\n"
+    "   a bare port is bound to 127.0.0.1.  The counters include the packets and\n"
+    "   bytes processed, the socket packets, drops and freezes, the records written\n"
+    "   by type, the records lost to a full output queue, TCP and QUIC\n"
+    "   reassembly, the TCP verdict cache, analysis and QUIC key cache lookups,\n"
+    "   and the sizes of the flow tables.\n"
+    "\n"
+    "   \"--latency-sampling n\" times the processing of 1 of every n packets of the\n"
+    "   JSON output, by stage (headers, classification, parsing, JSON, analysis and\n"
+    "   output queue) and by kind of record, into a histogram for each worker\n"
+    "   thread.  The histograms are written to stderr on shutdown, and their\n"
+    "   percentiles are included in the \"--stats-file\" records.  This option\n"
+    "   requires mercury to be built with \"OPTFLAGS=-DPKT_PROC_LATENCY\".\n"
     "\n"
     "   \"[-l or --limit] l\" rotates output files so that each file has at most\n"
     "   l records or packets; filenames include a sequence number, date and time.\n"
@@ -200,11 +284,13 @@ int main(int argc, char *argv[]) {
     struct mercury_config cfg = mercury_config_init();
 
     while(1) {
-        enum opt { config=1, version=2, license=3, dns_json=4, certs_json=5, metadata=6, resources=7, tcp_init_data=8, udp_init_data=9 };
+        enum opt { config=1, version=2, license=3, dns_json=4, certs_json=5, metadata=6, resources=7, tcp_init_data=8, udp_init_data=9, asn_lookup=10, prefetch_distance=11, capture_method=12, prefilter=13, snaplen=14, fanout=15, stats_file=16, ring_tuning=17, metrics=18, latency_sampling=19 };
         int opt_idx = 0;
         static struct option long_opts[] = {
             { "config",      required_argument, NULL, config  },
             { "resources",   required_argument, NULL, resources },
+            { "asn-lookup",  required_argument, NULL, asn_lookup },
+            { "prefetch-distance", required_argument, NULL, prefetch_distance },
             { "version",     no_argument,       NULL, version },
             { "license",     no_argument,       NULL, license },
             { "dns-json",    no_argument,       NULL, dns_json },
@@ -216,6 +302,14 @@ int main(int argc, char *argv[]) {
             { "write",       required_argument, NULL, 'w' },
             { "directory",   required_argument, NULL, 'd' },
             { "capture",     required_argument, NULL, 'c' },
+            { "capture-method", required_argument, NULL, capture_method },
+            { "prefilter",   no_argument,       NULL, prefilter },
+            { "snaplen",     required_argument, NULL, snaplen },
+            { "fanout",      required_argument, NULL, fanout },
+            { "stats-file",  required_argument, NULL, stats_file },
+            { "ring-tuning", required_argument, NULL, ring_tuning },
+            { "metrics",     required_argument, NULL, metrics },
+            { "latency-sampling", required_argument, NULL, latency_sampling },
             { "fingerprint", required_argument, NULL, 'f' },
             { "analysis",    no_argument,       NULL, 'a' },
             { "threads",     required_argument, NULL, 't' },
@@ -246,6 +340,62 @@ int main(int argc, char *argv[]) {
                 usage(argv[0], "option resources requires directory argument", extended_help_off);
             }
             break;
+        case asn_lookup:
+            if (!option_is_valid(optarg) || argument_parse_as_asn_lookup(optarg, &cfg.asn_lookup) != status_ok) {
+                usage(argv[0], "option asn-lookup requires argument \"lctrie\" or \"dir-24-8\"", extended_help_off);
+            }
+            break;
+        case prefetch_distance:
+            if (!option_is_valid(optarg) || argument_parse_as_prefetch_distance(optarg, &cfg.prefetch_distance) != status_ok) {
+                usage(argv[0], "option prefetch-distance requires a numeric argument between 0 and 16", extended_help_off);
+            }
+            break;
+        case capture_method:
+            if (!option_is_valid(optarg) || argument_parse_as_capture_method(optarg, &cfg.capture_method) != status_ok) {
+                usage(argv[0], "option capture-method requires argument \"af-packet\" or \"af-xdp\"", extended_help_off);
+            }
+            break;
+        case prefilter:
+            if (optarg) {
+                usage(argv[0], "option prefilter does not use an argument", extended_help_off);
+            } else {
+                cfg.prefilter = true;
+            }
+            break;
+        case snaplen:
+            if (!option_is_valid(optarg) || argument_parse_as_snaplen(optarg, &cfg.snaplen) != status_ok) {
+                usage(argv[0], "option snaplen requires a numeric argument that is 0 or at least 128", extended_help_off);
+            }
+            break;
+        case fanout:
+            if (!option_is_valid(optarg) || argument_parse_as_fanout_mode(optarg, &cfg.fanout_mode) != status_ok) {
+                usage(argv[0], "option fanout requires argument \"hash\", \"lb\", \"cpu\", \"qm\", \"rollover\", or \"bpf\"", extended_help_off);
+            }
+            break;
+        case stats_file:
+            if (option_is_valid(optarg)) {
+                cfg.stats_filename = optarg;
+            } else {
+                usage(argv[0], "option stats-file requires filename argument", extended_help_off);
+            }
+            break;
+        case ring_tuning:
+            if (!option_is_valid(optarg) || argument_parse_as_ring_tuning(optarg, &cfg.ring_tuning) != status_ok) {
+                usage(argv[0], "option ring-tuning requires argument \"off\", \"recommend\", or \"apply\"", extended_help_off);
+            }
+            break;
+        case metrics:
+            if (option_is_valid(optarg)) {
+                cfg.metrics_address = optarg;
+            } else {
+                usage(argv[0], "option metrics requires a port, address:port, or socket path argument", extended_help_off);
+            }
+            break;
+        case latency_sampling:
+            if (!option_is_valid(optarg) || argument_parse_as_latency_sampling(optarg, &cfg.latency_sampling) != status_ok) {
+                usage(argv[0], "option latency-sampling requires a numeric argument", extended_help_off);
+            }
+            break;
         case version:
             mercury_version.print(stdout);
             return EXIT_SUCCESS;
@@ -478,7 +628,7 @@ int main(int argc, char *argv[]) {
     }
 
     if (cfg.analysis) {
-        if (analysis_init(cfg.verbosity, cfg.resources) == -1) {
+        if (analysis_init(cfg.verbosity, cfg.resources, cfg.asn_lookup) == -1) {
             return EXIT_FAILURE;  /* analysis engine could not be initialized */
         };
         global_vars.do_analysis = true;
@@ -495,6 +645,14 @@ int main(int argc, char *argv[]) {
         printf("Loop count: %d\n", cfg.loop_count);
     }
 
+    if (cfg.latency_sampling) {
+#ifdef PKT_PROC_LATENCY
+        latency_ticks_per_ns();   /* measure the time stamp counter before any packets arrive */
+#else
+        usage(argv[0], "option latency-sampling requires mercury to be built with OPTFLAGS=-DPKT_PROC_LATENCY", extended_help_off);
+#endif
+    }
+
     /* The option --adaptive works only with -w PCAP file option and -c capture interface */
     if (cfg.adaptive > 0) {
         if (cfg.write_filename == NULL || cfg.capture_interface == NULL) {
@@ -529,6 +687,14 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "error: unable to initialize output thread\n");
         return EXIT_FAILURE;
     }
+    struct metrics_server *metrics_srv = NULL;
+    if (cfg.metrics_address) {
+        metrics_srv = metrics_server_new(cfg.metrics_address, cfg.verbosity);
+        if (metrics_srv == NULL) {
+            fprintf(stderr, "error: unable to start metrics server\n");
+            return EXIT_FAILURE;
+        }
+    }
     if (cfg.capture_interface) {
 
         if (cfg.verbosity) {
@@ -545,6 +711,16 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    metrics_server_delete(metrics_srv);
+
+    if (cfg.latency_sampling) {
+        metrics_write_latency(stderr);
+    }
+
+    if (cfg.verbosity) {
+        tcp_verdict_cache_write_stats(stderr);
+    }
+
     if (cfg.analysis) {
         analysis_finalize();
     }
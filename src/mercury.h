@@ -44,6 +44,48 @@ enum status {
     status_err_no_more_data = 2
 };
 
+/*
+ * enum asn_lookup_type identifies the data structure used to look up
+ * the autonomous system numbers of IPv4 addresses (see addr.h)
+ */
+enum asn_lookup_type {
+    asn_lookup_lctrie    = 0,  /* level compressed trie                */
+    asn_lookup_dir_24_8  = 1   /* DIR-24-8 table; faster, 64MB or more */
+};
+
+/*
+ * enum capture_method identifies the kind of socket used to capture
+ * packets from an interface
+ */
+enum capture_method {
+    capture_method_af_packet = 0,  /* AF_PACKET with TPACKETv3 RX_RINGs     */
+    capture_method_af_xdp    = 1   /* AF_XDP with a UMEM for each queue     */
+};
+
+/*
+ * enum fanout_mode identifies how the packets captured with AF_PACKET
+ * are divided among the worker threads
+ */
+enum fanout_mode {
+    fanout_mode_hash     = 0,  /* kernel flow hash                      */
+    fanout_mode_lb       = 1,  /* round robin                           */
+    fanout_mode_cpu      = 2,  /* CPU on which the packet arrived       */
+    fanout_mode_qm       = 3,  /* receive queue of the interface        */
+    fanout_mode_rollover = 4,  /* fill each socket before the next one  */
+    fanout_mode_bpf      = 5   /* symmetric flow hash in a BPF program  */
+};
+
+/*
+ * enum ring_tuning identifies what is done with the block counts and
+ * block timeouts that are recommended for the AF_PACKET rings from
+ * their observed usage
+ */
+enum ring_tuning {
+    ring_tuning_off       = 0,  /* no recommendations                    */
+    ring_tuning_recommend = 1,  /* report recommendations               */
+    ring_tuning_apply     = 2   /* resize the rings as recommended      */
+};
+
 /*
  * struct mercury_config holds the configuration information for a run
  * of the program
@@ -70,9 +112,24 @@ struct mercury_config {
     int use_test_packet;            /* use test packet to write output file           */
     int adaptive;                   /* adaptively accept/skip packets for PCAP output */
     bool output_block;              /* use blocking output                            */
+    enum asn_lookup_type asn_lookup; /* IPv4 ASN lookup data structure                */
+    unsigned int prefetch_distance; /* packets between flow prefetch and processing  */
+    enum capture_method capture_method; /* kind of socket used for --capture     */
+    bool prefilter;                 /* drop unselected packets in the kernel         */
+    unsigned int snaplen;           /* bytes captured per packet, or 0 for all       */
+    enum fanout_mode fanout_mode;   /* division of packets among AF_PACKET sockets   */
+    char *stats_filename;           /* file for JSON stats records, if any           */
+    enum ring_tuning ring_tuning;   /* use of the ring size recommendations          */
+    char *metrics_address;          /* address of the OpenMetrics server, if any     */
+    unsigned int latency_sampling;  /* packets per latency sample, or 0 for none     */
 };
 
-#define mercury_config_init() { NULL, NULL, NULL, NULL, NULL, NULL, false, false, O_EXCL, (char *)"w", 0, 8, 1, 0, NULL, 1, 0, NULL, 0, 0, false }
+#define DEFAULT_PREFETCH_DISTANCE 4
+#define MAX_PREFETCH_DISTANCE     16
+
+#define MIN_SNAPLEN              128   /* room for the headers of a TCP SYN */
+
+#define mercury_config_init() { NULL, NULL, NULL, NULL, NULL, NULL, false, false, O_EXCL, (char *)"w", 0, 8, 1, 0, NULL, 1, 0, NULL, 0, 0, false, asn_lookup_lctrie, DEFAULT_PREFETCH_DISTANCE, capture_method_af_packet, false, 0, fanout_mode_hash, NULL, ring_tuning_off, NULL, 0 }
 
 /*
  * struct global_variables holds all of mercury's global variables.
@@ -0,0 +1,453 @@
+/*
+ * metrics.c
+ *
+ * per-thread counters, and an HTTP server that exports them in the
+ * OpenMetrics text format, for Prometheus and similar collectors
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+#include "signal_handling.h"
+
+#define METRICS_POLL_TIMEOUT     200  /* ms between checks of the stop flag */
+#define METRICS_REQUEST_TIMEOUT 1000  /* ms allowed for reading a request   */
+#define METRICS_MAX_REQUEST     4096
+
+/*
+ * the registry of the counters of all of the threads
+ */
+static pthread_mutex_t metrics_m = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<struct thread_metrics *> metrics_registry;
+
+struct thread_metrics *metrics_thread(unsigned int thread) {
+    struct thread_metrics *tm = NULL;
+
+    pthread_mutex_lock(&metrics_m);
+    if (thread >= metrics_registry.size()) {
+        metrics_registry.resize(thread + 1, NULL);
+    }
+    if (metrics_registry[thread] == NULL) {
+        void *p = NULL;
+        if (posix_memalign(&p, 64, sizeof(struct thread_metrics)) == 0) {
+            memset(p, 0, sizeof(struct thread_metrics));
+            metrics_registry[thread] = (struct thread_metrics *)p;
+        }
+    }
+    tm = metrics_registry[thread];
+    pthread_mutex_unlock(&metrics_m);
+
+    return tm;
+}
+
+void metrics_attach(struct pkt_proc *processor, unsigned int thread, unsigned int latency_sampling) {
+    struct thread_metrics *tm = metrics_thread(thread);
+    if (tm == NULL) {
+        return;
+    }
+    processor->set_counters(&tm->pkt_proc);
+#ifdef PKT_PROC_LATENCY
+    if (latency_sampling) {
+        tm->latency.sampling = latency_sampling;
+        processor->set_latency_histograms(&tm->latency);
+    }
+#else
+    (void)latency_sampling;
+#endif
+}
+
+void metrics_write_latency(FILE *f) {
+#ifdef PKT_PROC_LATENCY
+    std::vector<struct thread_metrics *> tm;
+    pthread_mutex_lock(&metrics_m);
+    tm = metrics_registry;
+    pthread_mutex_unlock(&metrics_m);
+
+    for (unsigned int t = 0; t < tm.size(); t++) {
+        if (tm[t] != NULL && tm[t]->latency.sampling) {
+            latency_histograms_write(f, t, tm[t]->latency, pkt_proc_latency_message_name);
+        }
+    }
+#else
+    (void)f;
+#endif
+}
+
+/*
+ * struct metrics_family writes the # TYPE and # HELP lines of a
+ * metric family, and its samples, which have a thread label and an
+ * optional second label
+ */
+struct metrics_family {
+    std::string &out;
+    const char *name;
+    bool counter;
+
+    metrics_family(std::string &o, const char *n, const char *type, const char *help) : out{o}, name{n}, counter{strcmp(type, "counter") == 0} {
+        append("# TYPE %s %s\n", name, type);
+        append("# HELP %s %s\n", name, help);
+    }
+
+    void sample(unsigned int thread, uint64_t value, const char *label=NULL, const char *label_value=NULL) {
+        append("%s%s{thread=\"%u\"", name, counter ? "_total" : "", thread);
+        if (label) {
+            append(",%s=\"%s\"", label, label_value);
+        }
+        append("} %" PRIu64 "\n", value);
+    }
+
+    void append(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char line[256];
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(line, sizeof(line), fmt, args);
+        va_end(args);
+        if (len > 0) {
+            out.append(line, (size_t)len < sizeof(line) ? len : sizeof(line) - 1);
+        }
+    }
+};
+
+/*
+ * metrics_write(out) appends the OpenMetrics exposition of the
+ * counters of all of the threads to out
+ */
+static void metrics_write(std::string &out) {
+    std::vector<struct thread_metrics *> tm;
+    pthread_mutex_lock(&metrics_m);
+    tm = metrics_registry;
+    pthread_mutex_unlock(&metrics_m);
+
+#define for_each_thread(t) for (unsigned int t = 0; t < tm.size(); t++) if (tm[t] != NULL)
+#define counter(t, field) pkt_proc_counter_read(tm[t]->field)
+
+    {
+        struct metrics_family f{out, "mercury_packets", "counter", "Packets processed."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.packets)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_bytes", "counter", "Bytes in the packets processed."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.bytes)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_socket_packets", "counter", "Packets received by the capture socket, including those dropped."};
+        for_each_thread(t) { f.sample(t, counter(t, capture.socket_packets)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_socket_drops", "counter", "Packets dropped by the capture socket."};
+        for_each_thread(t) { f.sample(t, counter(t, capture.socket_drops)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_socket_freezes", "counter", "Freezes of the capture socket queue."};
+        for_each_thread(t) { f.sample(t, counter(t, capture.socket_freezes)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_records", "counter", "JSON records written, by type."};
+        for_each_thread(t) {
+            for (unsigned int type = 0; type < num_record_types; type++) {
+                f.sample(t, counter(t, pkt_proc.records[type]), "type", pkt_proc_record_type_name((enum pkt_proc_record_type)type));
+            }
+        }
+    }
+    {
+        struct metrics_family f{out, "mercury_queue_drops", "counter", "JSON records lost because the output queue was full."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.queue_drops)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_reassembly_messages", "counter", "Messages held for TCP reassembly, and their outcomes."};
+        for_each_thread(t) {
+            f.sample(t, counter(t, pkt_proc.reassembly_started), "event", "started");
+            f.sample(t, counter(t, pkt_proc.reassembly_completed), "event", "completed");
+            f.sample(t, counter(t, pkt_proc.reassembly_expired), "event", "expired");
+        }
+    }
+    {
+        struct metrics_family f{out, "mercury_tcp_verdict_cache_lookups", "counter", "Lookups in the TCP verdict cache."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.tcp_verdict_lookups)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_tcp_verdict_cache_hits", "counter", "Lookups in the TCP verdict cache that found a finished flow."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.tcp_verdict_hits)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_tcp_verdict_cache_evictions", "counter", "Entries evicted from the TCP verdict cache."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.tcp_verdict_evictions)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_analysis_lookups", "counter", "Fingerprints looked up in the fingerprint database."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.analysis_lookups)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_analysis_hits", "counter", "Fingerprints found in the fingerprint database."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.analysis_hits)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_quic_key_cache_lookups", "counter", "Lookups of the keys of QUIC Initial packets."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.quic_key_lookups)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_quic_key_cache_hits", "counter", "Lookups of the keys of QUIC Initial packets that found them cached."};
+        for_each_thread(t) { f.sample(t, counter(t, pkt_proc.quic_key_hits)); }
+    }
+    {
+        struct metrics_family f{out, "mercury_quic_reassembly_messages", "counter", "ClientHellos split across QUIC Initial packets, and their outcomes."};
+        for_each_thread(t) {
+            f.sample(t, counter(t, pkt_proc.quic_reassembly_started), "event", "started");
+            f.sample(t, counter(t, pkt_proc.quic_reassembly_completed), "event", "completed");
+            f.sample(t, counter(t, pkt_proc.quic_reassembly_abandoned), "event", "abandoned");
+        }
+    }
+    {
+        struct metrics_family f{out, "mercury_flow_table_entries", "gauge", "Entries in the flow tables."};
+        for_each_thread(t) {
+            f.sample(t, counter(t, pkt_proc.ip_flows), "table", "ip");
+            f.sample(t, counter(t, pkt_proc.tcp_flows), "table", "tcp");
+            f.sample(t, counter(t, pkt_proc.tcp_segments), "table", "reassembly");
+        }
+    }
+    out.append("# EOF\n");
+
+#undef counter
+#undef for_each_thread
+}
+
+struct metrics_server {
+    int sockfd;
+    pthread_t thread;
+    int stop;
+    int verbosity;
+    char *unix_path;    /* removed on deletion, if not NULL */
+};
+
+static bool metrics_send_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+/*
+ * metrics_serve(server, fd) reads an HTTP request from the connection
+ * fd, up to the end of its headers, and answers it
+ */
+static void metrics_serve(struct metrics_server *server, int fd) {
+    char request[METRICS_MAX_REQUEST + 1];
+    size_t length = 0;
+
+    while (length < METRICS_MAX_REQUEST) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, METRICS_REQUEST_TIMEOUT) <= 0) {
+            return;
+        }
+        ssize_t n = recv(fd, request + length, METRICS_MAX_REQUEST - length, 0);
+        if (n <= 0) {
+            return;
+        }
+        length += n;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+    request[length] = '\0';
+
+    std::string body;
+    const char *status_line;
+    const char *content_type = "text/plain; charset=utf-8";
+    if (strncmp(request, "GET ", 4) != 0 && strncmp(request, "HEAD ", 5) != 0) {
+        status_line = "HTTP/1.1 405 Method Not Allowed";
+        body = "only GET is supported\n";
+    } else if (strncmp(request, "GET / ", 6) == 0 || strncmp(request, "GET /metrics ", 13) == 0
+               || strncmp(request, "HEAD / ", 7) == 0 || strncmp(request, "HEAD /metrics ", 14) == 0) {
+        status_line = "HTTP/1.1 200 OK";
+        content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+        metrics_write(body);
+    } else {
+        status_line = "HTTP/1.1 404 Not Found";
+        body = "metrics are at /metrics\n";
+    }
+    if (server->verbosity > 1) {
+        fprintf(stderr, "metrics: %.*s\n", (int)strcspn(request, "\r\n"), request);
+    }
+
+    char header[256];
+    int header_length = snprintf(header, sizeof(header),
+                                 "%s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+                                 status_line, content_type, body.length());
+    if (metrics_send_all(fd, header, header_length) && request[0] == 'G') {
+        metrics_send_all(fd, body.data(), body.length());
+    }
+}
+
+static void *metrics_server_thread_func(void *arg) {
+    struct metrics_server *server = (struct metrics_server *)arg;
+
+    disable_all_signals();
+
+    while (__atomic_load_n(&server->stop, __ATOMIC_ACQUIRE) == 0) {
+        struct pollfd pfd = { server->sockfd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, METRICS_POLL_TIMEOUT);
+        if (ready < 0 && errno != EINTR) {
+            fprintf(stderr, "%s: could not poll metrics socket\n", strerror(errno));
+            break;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        int fd = accept(server->sockfd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        metrics_serve(server, fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/*
+ * metrics_server_bind(server, address) creates the listening socket
+ * of server, and returns the socket or -1 on failure
+ */
+static int metrics_server_bind(struct metrics_server *server, const char *address) {
+    int fd;
+
+    if (address[0] == '/') {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(sun.sun_path)) {
+            fprintf(stderr, "error: metrics socket path %s is too long\n", address);
+            return -1;
+        }
+        strcpy(sun.sun_path, address);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            fprintf(stderr, "%s: could not create metrics socket\n", strerror(errno));
+            return -1;
+        }
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+            fprintf(stderr, "%s: could not bind metrics socket to %s\n", strerror(errno), address);
+            close(fd);
+            return -1;
+        }
+        server->unix_path = strdup(address);
+
+    } else {
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        const char *port = address;
+        const char *colon = strrchr(address, ':');
+        if (colon) {
+            char ip[INET_ADDRSTRLEN];
+            size_t ip_length = colon - address;
+            if (ip_length >= sizeof(ip)) {
+                fprintf(stderr, "error: invalid metrics address %s\n", address);
+                return -1;
+            }
+            memcpy(ip, address, ip_length);
+            ip[ip_length] = '\0';
+            if (inet_pton(AF_INET, ip, &sin.sin_addr) != 1) {
+                fprintf(stderr, "error: invalid metrics address %s\n", address);
+                return -1;
+            }
+            port = colon + 1;
+        }
+        char *end = NULL;
+        unsigned long p = strtoul(port, &end, 10);
+        if (*port == '\0' || *end != '\0' || p == 0 || p > 65535) {
+            fprintf(stderr, "error: invalid metrics port in %s\n", address);
+            return -1;
+        }
+        sin.sin_port = htons(p);
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            fprintf(stderr, "%s: could not create metrics socket\n", strerror(errno));
+            return -1;
+        }
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0) {
+            fprintf(stderr, "%s: could not bind metrics socket to %s\n", strerror(errno), address);
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, 16) != 0) {
+        fprintf(stderr, "%s: could not listen on metrics socket\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+struct metrics_server *metrics_server_new(const char *address, int verbosity) {
+    struct metrics_server *server = (struct metrics_server *)calloc(1, sizeof(struct metrics_server));
+    if (server == NULL) {
+        return NULL;
+    }
+    server->verbosity = verbosity;
+    server->sockfd = metrics_server_bind(server, address);
+    if (server->sockfd < 0) {
+        metrics_server_delete(server);
+        return NULL;
+    }
+    int err = pthread_create(&server->thread, NULL, metrics_server_thread_func, server);
+    if (err != 0) {
+        fprintf(stderr, "%s: could not start metrics thread\n", strerror(err));
+        close(server->sockfd);
+        server->sockfd = -1;
+        metrics_server_delete(server);
+        return NULL;
+    }
+    if (verbosity) {
+        fprintf(stderr, "serving metrics on %s\n", address);
+    }
+    return server;
+}
+
+void metrics_server_delete(struct metrics_server *server) {
+    if (server == NULL) {
+        return;
+    }
+    if (server->sockfd >= 0) {
+        __atomic_store_n(&server->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(server->thread, NULL);
+        close(server->sockfd);
+    }
+    if (server->unix_path) {
+        unlink(server->unix_path);
+        free(server->unix_path);
+    }
+    free(server);
+}
@@ -0,0 +1,78 @@
+/*
+ * metrics.h
+ *
+ * per-thread counters, and an HTTP server that exports them in the
+ * OpenMetrics text format, for Prometheus and similar collectors
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include "pkt_proc.h"
+
+/*
+ * struct capture_counters holds the socket counters of a capture
+ * thread, which the stats thread adds to once per second
+ */
+struct capture_counters {
+    uint64_t socket_packets;
+    uint64_t socket_drops;
+    uint64_t socket_freezes;
+};
+
+/*
+ * struct thread_metrics holds all of the counters of a thread; each
+ * group of counters has its own cache lines, since it is written by
+ * a different thread
+ */
+struct thread_metrics {
+    alignas(64) struct pkt_proc_counters pkt_proc;
+    alignas(64) struct capture_counters capture;
+#ifdef PKT_PROC_LATENCY
+    alignas(64) struct latency_histograms latency;
+#endif
+};
+
+/*
+ * metrics_thread(thread) returns the counters of the thread with the
+ * index thread, which are created, with all counters zero, on the
+ * first call for that index, and stay valid until the process exits.
+ * It returns NULL if they could not be allocated.
+ */
+struct thread_metrics *metrics_thread(unsigned int thread);
+
+/*
+ * metrics_attach(processor, thread, latency_sampling) makes the packet
+ * processor of a thread keep its counters in metrics_thread(thread),
+ * and, if latency_sampling is nonzero, record the latency of one of
+ * every latency_sampling packets in its histograms
+ */
+void metrics_attach(struct pkt_proc *processor, unsigned int thread, unsigned int latency_sampling);
+
+/*
+ * metrics_write_latency(f) writes the latency histograms of all of
+ * the threads that sampled any packets to f
+ */
+void metrics_write_latency(FILE *f);
+
+/*
+ * struct metrics_server answers each HTTP GET request with the
+ * counters of all of the threads, from a thread of its own.
+ *
+ * metrics_server_new(address, verbosity) starts a server listening
+ * on address, which is either the path of a UNIX socket, starting
+ * with '/', or a TCP port, optionally preceded by an IPv4 address
+ * and a colon (127.0.0.1 if omitted), and returns NULL on failure.
+ * metrics_server_delete() stops it.
+ */
+struct metrics_server;
+
+struct metrics_server *metrics_server_new(const char *address, int verbosity);
+
+void metrics_server_delete(struct metrics_server *server);
+
+#endif /* METRICS_H */
@@ -1,4 +1,4 @@
-// g++ -Wall driver_os_identifier.cc -o driver_os_identifier ../datum.cc -lz
+// g++ -Wall driver_os_identifier.cc ../match.c -o driver_os_identifier -L.. -lmerc -L../lctrie -llctrie -lz -lcrypto
 // ./driver_os_identifier mercury.json
 
 #include <iostream>
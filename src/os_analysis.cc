@@ -0,0 +1,366 @@
+/*
+ * os_analysis.cc
+ *
+ * operating system identification from the TCP, TLS, and HTTP
+ * fingerprints observed from each host
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <limits.h>
+#include <math.h>
+#include <arpa/inet.h>
+#include <fstream>
+#include <iterator>
+#include <zlib.h>
+
+#include "os_analysis.h"
+#include "analysis.h"
+
+#include "rapidjson/document.h"
+#include "rapidjson/istreamwrapper.h"
+
+static const char *fingerprint_type_name[os_analyzer::num_fingerprint_types] = { "tcp", "tls", "http" };
+
+static const char *fingerprint_db_file[os_analyzer::num_fingerprint_types] = {
+    "/fingerprint-db-tcp-os.json.gz",
+    "/fingerprint-db-tls-os.json.gz",
+    "/fingerprint-db-http-os.json.gz"
+};
+
+/*
+ * the model file os_detection_model.json holds the os_map, which
+ * assigns an index to each OS that appears in the fingerprint
+ * databases, and the labels, intercepts, and coefficients of the
+ * classifier; it is read into a temporary map from OS name to index,
+ * which is only needed while the fingerprint databases are read
+ */
+static std::unordered_map<std::string, uint16_t> os_map;
+
+int os_analyzer::load_model(const char *filename) {
+    std::ifstream ifs{filename};
+    if (!ifs.is_open()) {
+        return -1;
+    }
+    rapidjson::IStreamWrapper isw{ifs};
+    rapidjson::Document model;
+    model.ParseStream(isw);
+    if (model.HasParseError() || !model.IsObject()) {
+        return -1;
+    }
+    rapidjson::Value::ConstMemberIterator os_len_it = model.FindMember("os_len");
+    rapidjson::Value::ConstMemberIterator labels_it = model.FindMember("labels");
+    rapidjson::Value::ConstMemberIterator intercepts_it = model.FindMember("intercepts");
+    rapidjson::Value::ConstMemberIterator coefficients_it = model.FindMember("coefficients");
+    rapidjson::Value::ConstMemberIterator os_map_it = model.FindMember("os_map");
+    if (os_len_it == model.MemberEnd() || !os_len_it->value.IsUint() || os_len_it->value.GetUint() == 0
+        || labels_it == model.MemberEnd() || !labels_it->value.IsArray()
+        || intercepts_it == model.MemberEnd() || !intercepts_it->value.IsArray()
+        || coefficients_it == model.MemberEnd() || !coefficients_it->value.IsArray()
+        || os_map_it == model.MemberEnd() || !os_map_it->value.IsObject()) {
+        return -1;
+    }
+    unsigned int len = os_len_it->value.GetUint();
+    const rapidjson::Value &lbls = labels_it->value;
+    const rapidjson::Value &intc = intercepts_it->value;
+    const rapidjson::Value &cff = coefficients_it->value;
+    if (lbls.Size() == 0 || lbls.Size() > max_labels || intc.Size() != lbls.Size() || cff.Size() != lbls.Size()) {
+        return -1;
+    }
+
+    // the coefficients are stored transposed, with one row per
+    // feature, so that classify_host() can skip the features that are
+    // zero, which are most of them
+    //
+    const unsigned int num_labels = lbls.Size();
+    labels.clear();
+    intercepts.clear();
+    coefficients.assign(len * num_fingerprint_types * num_labels, 0.0);
+    os_map.clear();
+    for (rapidjson::SizeType i = 0; i < num_labels; i++) {
+        if (!lbls[i].IsString() || !intc[i].IsNumber() || !cff[i].IsArray() || cff[i].Size() != len * num_fingerprint_types) {
+            return -1;
+        }
+        labels.push_back(lbls[i].GetString());
+        intercepts.push_back(intc[i].GetDouble());
+        for (rapidjson::SizeType j = 0; j < cff[i].Size(); j++) {
+            if (!cff[i][j].IsNumber()) {
+                return -1;
+            }
+            coefficients[j * num_labels + i] = cff[i][j].GetDouble();
+        }
+    }
+    for (rapidjson::Value::ConstMemberIterator it = os_map_it->value.MemberBegin(); it != os_map_it->value.MemberEnd(); ++it) {
+        if (!it->value.IsUint() || it->value.GetUint() >= len) {
+            return -1;
+        }
+        os_map[it->name.GetString()] = it->value.GetUint();
+    }
+    os_len = len;
+    return 0;
+}
+
+int os_analyzer::load_fingerprint_db(const char *filename, enum os_fingerprint_type type) {
+    gzFile in_file = gzopen(filename, "r");
+    if (in_file == NULL) {
+        return -1;
+    }
+    std::vector<char> line;
+    while (gzgetline(in_file, line)) {
+        std::string line_str(line.begin(), line.end());
+        rapidjson::Document fp;
+        fp.Parse(line_str.c_str());
+        if (fp.HasParseError() || !fp.IsObject()) {
+            continue;
+        }
+        rapidjson::Value::ConstMemberIterator str_repr = fp.FindMember("str_repr");
+        rapidjson::Value::ConstMemberIterator os_info = fp.FindMember("os_info");
+        if (str_repr == fp.MemberEnd() || !str_repr->value.IsString()
+            || os_info == fp.MemberEnd() || !os_info->value.IsObject()) {
+            continue;
+        }
+
+        // keep only the OSes that the classifier knows about
+        //
+        sparse_vector prevalences;
+        for (rapidjson::Value::ConstMemberIterator it = os_info->value.MemberBegin(); it != os_info->value.MemberEnd(); ++it) {
+            auto os = os_map.find(it->name.GetString());
+            if (os != os_map.end() && it->value.IsNumber()) {
+                prevalences.push_back({ (uint16_t)(type * os_len + os->second), (float)it->value.GetDouble() });
+            }
+        }
+        if (!prevalences.empty()) {
+            fp_db[type][std::string(str_repr->value.GetString(), str_repr->value.GetStringLength())] = prevalences;
+        }
+    }
+    gzclose(in_file);
+
+    return 0;
+}
+
+int os_analyzer::load(const char *resource_dir, unsigned int max_hosts) {
+    clear();
+
+    char resource_file_name[PATH_MAX];
+    strncpy(resource_file_name, resource_dir, PATH_MAX-1);
+    strncat(resource_file_name, "/os_detection_model.json", PATH_MAX-1);
+    if (load_model(resource_file_name) != 0) {
+        fprintf(stderr, "warning: could not read OS classifier model from file '%s'\n", resource_file_name);
+        clear();
+        return -1;
+    }
+    for (unsigned int type = 0; type < num_fingerprint_types; type++) {
+        strncpy(resource_file_name, resource_dir, PATH_MAX-1);
+        strncat(resource_file_name, fingerprint_db_file[type], PATH_MAX-1);
+        if (load_fingerprint_db(resource_file_name, (enum os_fingerprint_type)type) != 0) {
+            fprintf(stderr, "warning: could not open file '%s'\n", resource_file_name);
+            clear();
+            return -1;
+        }
+    }
+    os_map.clear();
+    max_hosts_per_shard = (max_hosts + num_shards - 1) / num_shards;
+
+    return 0;
+}
+
+void os_analyzer::clear() {
+    for (auto &s : shards) {
+        std::lock_guard<std::mutex> guard{s.lock};
+        s.table.clear();
+        s.hosts.clear();
+    }
+    for (auto &db : fp_db) {
+        db.clear();
+    }
+    labels.clear();
+    intercepts.clear();
+    coefficients.clear();
+    os_map.clear();
+    os_len = 0;
+}
+
+/*
+ * classify_host(h) normalizes each segment of the features of h, so
+ * that it sums to one, and applies the multinomial logistic
+ * regression model to the result
+ */
+void os_analyzer::classify_host(host &h) const {
+    double sum[num_fingerprint_types] = { 0.0 };
+    for (const auto &f : h.features) {
+        sum[f.first / os_len] += f.second;
+    }
+
+    const unsigned int num_labels = labels.size();
+    double scores[max_labels];
+    for (unsigned int l = 0; l < num_labels; l++) {
+        scores[l] = intercepts[l];
+    }
+    for (const auto &f : h.features) {
+        const double x = f.second / sum[f.first / os_len];
+        const double *c = &coefficients[f.first * num_labels];
+        for (unsigned int l = 0; l < num_labels; l++) {
+            scores[l] += c[l] * x;
+        }
+    }
+
+    // softmax, relative to the largest score so that exp() cannot overflow
+    //
+    unsigned int label_idx = 0;
+    for (unsigned int l = 1; l < num_labels; l++) {
+        if (scores[l] > scores[label_idx]) {
+            label_idx = l;
+        }
+    }
+    double score_sum = 0.0;
+    for (unsigned int l = 0; l < num_labels; l++) {
+        score_sum += exp(scores[l] - scores[label_idx]);
+    }
+
+    h.label = label_idx;
+    h.probability = 1.0 / score_sum;
+    h.classified = true;
+    h.changed = false;
+}
+
+void os_analyzer::set_result(const host &h, struct os_result *result) const {
+    result->os_name = labels[h.label].c_str();
+    result->probability = h.probability;
+}
+
+bool os_analyzer::update(const host_address &addr, enum os_fingerprint_type type,
+                         const char *fp, size_t fp_len, unsigned int sec, struct os_result *result) {
+    if (!is_loaded() || (unsigned int)type >= num_fingerprint_types) {
+        return false;
+    }
+    auto match = fp_db[type].find(std::string(fp, fp_len));
+    if (match == fp_db[type].end()) {
+        return result ? classify(addr, result) : false;
+    }
+
+    shard &s = shard_for(addr);
+    std::lock_guard<std::mutex> guard{s.lock};
+
+    // expire the least recently seen host, if it has timed out
+    //
+    if (!s.hosts.empty() && sec - s.hosts.back().last_seen > host_timeout) {
+        s.table.erase(s.hosts.back().addr);
+        s.hosts.pop_back();
+    }
+
+    std::list<host>::iterator h;
+    auto it = s.table.find(addr);
+    if (it != s.table.end()) {
+        h = it->second;
+        s.hosts.splice(s.hosts.begin(), s.hosts, h);
+    } else {
+        if (s.table.size() >= max_hosts_per_shard) {
+            // reuse the least recently seen host, so that a full table
+            // causes no allocation
+            //
+            h = std::prev(s.hosts.end());
+            s.table.erase(h->addr);
+            s.hosts.splice(s.hosts.begin(), s.hosts, h);
+            h->features.clear();
+        } else {
+            s.hosts.emplace_front();
+            h = s.hosts.begin();
+        }
+        h->addr = addr;
+        h->classified = false;
+        s.table[addr] = h;
+    }
+
+    for (const auto &os : match->second) {
+        auto f = h->features.begin();
+        while (f != h->features.end() && f->first != os.first) {
+            ++f;
+        }
+        if (f == h->features.end()) {
+            h->features.push_back(os);
+        } else {
+            f->second += os.second;
+        }
+    }
+    h->last_seen = sec;
+    h->changed = true;
+
+    if (result == nullptr) {
+        return false;
+    }
+    if (!h->classified || sec - h->last_classified >= classify_interval) {
+        classify_host(*h);
+        h->last_classified = sec;
+    }
+    set_result(*h, result);
+    return true;
+}
+
+bool os_analyzer::classify(const host_address &addr, struct os_result *result) {
+    if (!is_loaded()) {
+        return false;
+    }
+    shard &s = shard_for(addr);
+    std::lock_guard<std::mutex> guard{s.lock};
+    auto it = s.table.find(addr);
+    if (it == s.table.end()) {
+        return false;
+    }
+    host &h = *it->second;
+    if (h.changed) {
+        classify_host(h);
+        h.last_classified = h.last_seen;
+    }
+    set_result(h, result);
+    return true;
+}
+
+void os_analyzer::write_all(FILE *f) {
+    if (!is_loaded()) {
+        return;
+    }
+    for (auto &s : shards) {
+        std::lock_guard<std::mutex> guard{s.lock};
+        for (host &h : s.hosts) {
+            if (h.changed) {
+                classify_host(h);
+                h.last_classified = h.last_seen;
+            }
+            char addr_str[INET6_ADDRSTRLEN];
+            static const uint8_t ipv4_mapped_prefix[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+            if (memcmp(h.addr.bytes, ipv4_mapped_prefix, sizeof(ipv4_mapped_prefix)) == 0) {
+                inet_ntop(AF_INET, h.addr.bytes + sizeof(ipv4_mapped_prefix), addr_str, sizeof(addr_str));
+            } else {
+                inet_ntop(AF_INET6, h.addr.bytes, addr_str, sizeof(addr_str));
+            }
+            fprintf(f, "{\"src_ip\":\"%s\",\"os\":\"%s\",\"score\":%f,\"last_seen\":%u",
+                    addr_str, labels[h.label].c_str(), h.probability, h.last_seen);
+            bool seen[num_fingerprint_types] = { false };
+            for (const auto &x : h.features) {
+                seen[x.first / os_len] = true;
+            }
+            const char *comma = "";
+            fprintf(f, ",\"fingerprint_types\":[");
+            for (unsigned int type = 0; type < num_fingerprint_types; type++) {
+                if (seen[type]) {
+                    fprintf(f, "%s\"%s\"", comma, fingerprint_type_name[type]);
+                    comma = ",";
+                }
+            }
+            fprintf(f, "]}\n");
+        }
+    }
+}
+
+os_analyzer::host_address os_analyzer::address_from_ipv4(uint32_t addr) {
+    host_address a = {{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff }};
+    memcpy(a.bytes + 12, &addr, sizeof(addr));
+    return a;
+}
+
+os_analyzer::host_address os_analyzer::address_from_ipv6(const uint8_t *addr) {
+    host_address a;
+    memcpy(a.bytes, addr, sizeof(a.bytes));
+    return a;
+}
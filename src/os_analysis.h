@@ -0,0 +1,174 @@
+/*
+ * os_analysis.h
+ *
+ * operating system identification from the TCP, TLS, and HTTP
+ * fingerprints observed from each host
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#ifndef OS_ANALYSIS_H
+#define OS_ANALYSIS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+enum os_fingerprint_type {
+    os_fingerprint_tcp  = 0,
+    os_fingerprint_tls  = 1,
+    os_fingerprint_http = 2
+};
+
+struct os_result {
+    const char *os_name;
+    double probability;
+};
+
+/*
+ * struct os_analyzer identifies the operating system of each source
+ * host from the fingerprints that it sends.  Each TCP, TLS, or HTTP
+ * fingerprint that appears in the OS fingerprint databases adds that
+ * fingerprint's OS prevalences into the host's feature vector, which
+ * has one segment per fingerprint type, and a multinomial logistic
+ * regression model classifies the vector, after each segment is
+ * normalized.  Since a host's fingerprints only ever involve a few
+ * of the OSes in the model, its feature vector is stored sparsely.
+ *
+ * The host table is bounded: it holds at most max_hosts hosts, each
+ * of which expires host_timeout seconds after its last fingerprint,
+ * and the least recently seen host is evicted when the table is full,
+ * so that scanning traffic cannot make it grow.  Hosts are only added
+ * when they send a fingerprint that is in a database.  The table is
+ * split into shards, each with its own lock and least recently seen
+ * list, so that packet processing threads rarely contend.
+ *
+ * A host's classification is cached, and is recomputed only when its
+ * features have changed, at most once every classify_interval
+ * seconds during update(); classify() and write_all() reclassify on
+ * demand.
+ */
+struct os_analyzer {
+
+    static const unsigned int num_fingerprint_types = 3;
+    static const unsigned int num_shards = 16;
+    static const unsigned int max_labels = 256;
+    static const unsigned int default_max_hosts = 16384;
+    static const unsigned int host_timeout = 60 * 60;     // seconds
+    static const unsigned int classify_interval = 10;     // seconds
+
+    struct host_address {
+        uint8_t bytes[16];   // IPv6, or IPv4-mapped IPv6, address
+
+        bool operator==(const host_address &rhs) const {
+            return memcmp(bytes, rhs.bytes, sizeof(bytes)) == 0;
+        }
+    };
+
+    struct host_address_hash {
+        size_t operator()(const host_address &a) const {
+            uint64_t x, y;
+            memcpy(&x, a.bytes, sizeof(x));
+            memcpy(&y, a.bytes + sizeof(x), sizeof(y));
+            x ^= y * 0x9e3779b97f4a7c15ULL;  // mix, as in the MurmurHash3 finalizer
+            x ^= x >> 33;
+            x *= 0xff51afd7ed558ccdULL;
+            x ^= x >> 33;
+            x *= 0xc4ceb9fe1a85ec53ULL;
+            x ^= x >> 33;
+            return x;
+        }
+    };
+
+    typedef std::vector<std::pair<uint16_t, float>> sparse_vector;   // (index, value) pairs
+
+    struct host {
+        host_address addr;
+        unsigned int last_seen;
+        unsigned int last_classified;
+        bool changed;
+        bool classified;
+        uint16_t label;
+        float probability;
+        sparse_vector features;   // index is type * os_len + os
+    };
+
+    struct shard {
+        std::mutex lock;
+        std::list<host> hosts;   // most recently seen first
+        std::unordered_map<host_address, std::list<host>::iterator, host_address_hash> table;
+    };
+
+    // the OS fingerprint databases map each fingerprint string to the
+    // (feature index, prevalence) pairs of the OSes in its os_info
+    // object
+    //
+    std::unordered_map<std::string, sparse_vector> fp_db[num_fingerprint_types];
+
+    // classifier parameters
+    //
+    unsigned int os_len;               // number of OSes in the os_map
+    std::vector<std::string> labels;
+    std::vector<double> intercepts;
+    std::vector<double> coefficients;  // os_len * num_fingerprint_types rows of labels.size()
+
+    unsigned int max_hosts_per_shard;
+    shard shards[num_shards];
+
+    os_analyzer() : os_len{0}, max_hosts_per_shard{0} { }
+
+    /*
+     * load(resource_dir, max_hosts) reads the OS fingerprint databases
+     * and the classifier model from the directory resource_dir, and
+     * returns 0 on success, and -1 otherwise
+     */
+    int load(const char *resource_dir, unsigned int max_hosts=default_max_hosts);
+
+    bool is_loaded() const { return os_len != 0; }
+
+    /*
+     * update(addr, type, fp, fp_len, sec, result) adds the fingerprint
+     * fp of the given type, observed from addr at time sec, into that
+     * host's features; if result is not NULL, the host's current
+     * classification is written into it.  It returns true if a result
+     * was written.
+     */
+    bool update(const host_address &addr, enum os_fingerprint_type type,
+                const char *fp, size_t fp_len, unsigned int sec, struct os_result *result);
+
+    /*
+     * classify(addr, result) writes the current classification of
+     * the host addr into result, and returns true, if that host is in
+     * the table
+     */
+    bool classify(const host_address &addr, struct os_result *result);
+
+    /*
+     * write_all(f) writes the classification of each host in the
+     * table to f, as one JSON object per line
+     */
+    void write_all(FILE *f);
+
+    void clear();
+
+    static host_address address_from_ipv4(uint32_t addr);   // network byte order
+    static host_address address_from_ipv6(const uint8_t *addr);
+
+private:
+    int load_model(const char *filename);
+    int load_fingerprint_db(const char *filename, enum os_fingerprint_type type);
+    void classify_host(host &h) const;
+    void set_result(const host &h, struct os_result *result) const;
+    shard &shard_for(const host_address &addr) {
+        return shards[(host_address_hash{}(addr) >> 56) % num_shards];
+    }
+};
+
+#endif /* OS_ANALYSIS_H */
@@ -0,0 +1,820 @@
+/*
+ * parser_bench.cc
+ *
+ * benchmarks the protocol parsers on their own, over payloads that are
+ * extracted from a corpus of pcap files
+ *
+ * usage: parser_bench [--repeat n] [--json] [--protocol p] [--pathological path]... corpus...
+ *
+ * Each corpus or pathological argument is a pcap file, or a directory
+ * whose .pcap and .mcap files are used.  The TCP and UDP payloads of
+ * the packets are classified as mercury does, and those of each
+ * protocol are kept: TLS client hellos, QUIC initial packets, HTTP
+ * requests, DNS packets, DHCP discovers, SSH KEX_INIT messages, and
+ * the X.509 certificates in TLS certificate messages.  The payloads
+ * of the pathological files (such as the AFL corpus in test/afl_data)
+ * are kept apart from the others, and the prefixes of each payload of
+ * the corpus that end in its first quarter, half and three quarters
+ * are added to them, so that truncated messages are measured too.
+ *
+ * For each protocol and set of payloads, three operations are timed:
+ * parse, which parses each payload as mercury does, but writes
+ * nothing; fingerprint, which writes the fingerprints of the messages
+ * that have already been parsed (DNS and X.509 have none); and json,
+ * which parses each payload and writes the JSON record of it, with
+ * --metadata (and --certs-json, for X.509).  Each operation is run
+ * over all of the payloads once to warm up the caches, and then
+ * repeat times (default: 7), each of which takes at least 10ms; the
+ * ns/payload and MB/s are those of the median run, and the heap
+ * allocations (with operator new or by OpenSSL) per payload are
+ * averaged over all of the runs.  QUIC is measured twice: as
+ * quic_initial, with the keys derived for every packet, as for new
+ * connections, and as quic_retransmit, with the keys cached, as for
+ * the retransmissions of a connection's Initial packets.  With --json, the
+ * results are written as one JSON object per line, for regression
+ * tracking; otherwise, as a table.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <new>
+#include <string>
+#include <vector>
+#include <openssl/crypto.h>
+#include "extractor.h"
+#include "eth.h"
+#include "udp.h"
+#include "tcpip.h"
+#include "tls.h"
+#include "quic.h"
+#include "http.h"
+#include "dns.h"
+#include "dhcp.h"
+#include "ssh.h"
+#include "utils.h"
+
+struct global_variables global_vars;   /* normally defined in config.c */
+
+// the heap allocations made with operator new and by OpenSSL are
+// counted, so that the allocations of each operation are reported
+//
+static uint64_t allocations;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+// operator delete is not inlined, since GCC warns about the free() of
+// memory from operator new where it is
+//
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    free(p);
+}
+
+static void *counting_malloc(size_t num, const char *, int) {
+    allocations++;
+    return malloc(num);
+}
+
+static void *counting_realloc(void *addr, size_t num, const char *, int) {
+    allocations++;
+    return realloc(addr, num);
+}
+
+static void counting_free(void *addr, const char *, int) {
+    free(addr);
+}
+
+// read_pcap_file(filename, packets) reads all of the packets in a
+// pcap file (with microsecond or nanosecond timestamps) into packets
+//
+static bool read_pcap_file(const char *filename, std::vector<std::vector<uint8_t>> &packets) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open file %s\n", filename);
+        return false;
+    }
+    uint32_t file_header[6];
+    if (fread(file_header, sizeof(file_header), 1, f) != 1
+        || (file_header[0] != 0xa1b2c3d4 && file_header[0] != 0xa1b23c4d)) {
+        fprintf(stderr, "error: %s is not a pcap file in host byte order\n", filename);
+        fclose(f);
+        return false;
+    }
+    uint32_t packet_header[4];
+    while (fread(packet_header, sizeof(packet_header), 1, f) == 1) {
+        std::vector<uint8_t> p(packet_header[2]);
+        if (fread(p.data(), 1, p.size(), f) != p.size()) {
+            break;
+        }
+        packets.push_back(p);
+    }
+    fclose(f);
+    return true;
+}
+
+// read_corpus(path, packets) reads the pcap file path, or the .pcap
+// and .mcap files in the directory path, in name order
+//
+static bool read_corpus(const char *path, std::vector<std::vector<uint8_t>> &packets) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "error: could not open %s\n", path);
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return read_pcap_file(path, packets);
+    }
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "error: could not open directory %s\n", path);
+        return false;
+    }
+    std::vector<std::string> names;
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        std::string name = d->d_name;
+        size_t dot = name.rfind('.');
+        if (dot != std::string::npos && (name.substr(dot) == ".pcap" || name.substr(dot) == ".mcap")) {
+            names.push_back(std::string(path) + "/" + name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (const auto &n : names) {
+        if (read_pcap_file(n.c_str(), packets) == false) {
+            return false;
+        }
+    }
+    return true;
+}
+
+enum protocol {
+    protocol_tls_client_hello = 0,
+    protocol_quic_initial     = 1,
+    protocol_http_request     = 2,
+    protocol_dns              = 3,
+    protocol_dhcp_discover    = 4,
+    protocol_ssh_kex_init     = 5,
+    protocol_x509_cert        = 6,
+    num_protocols             = 7
+};
+
+typedef std::vector<std::vector<uint8_t>> payload_set;
+
+// add_certificates(certs, d) adds the certificates in the TCP payload
+// d, which holds a TLS server hello and/or certificate message, to
+// certs, finding them as tcp_data_write_json() does; each one is added
+// as a certificate list that holds only it (see x509_cert_parser)
+//
+static void add_certificates(payload_set &certs, const struct datum &d) {
+    struct datum pkt = d;
+    struct tls_record rec;
+    struct tls_handshake handshake;
+    struct tls_server_certificate certificate;
+    rec.parse(pkt);
+    handshake.parse(rec.fragment);
+    if (handshake.msg_type == handshake_type::server_hello) {
+        if (rec.is_not_empty()) {
+            struct tls_handshake h;
+            h.parse(rec.fragment);
+            certificate.parse(h.body);
+        }
+    } else if (handshake.msg_type == handshake_type::certificate) {
+        certificate.parse(handshake.body);
+    }
+    struct tls_record rec2;
+    rec2.parse(pkt);
+    struct tls_handshake handshake2;
+    handshake2.parse(rec2.fragment);
+    if (handshake2.msg_type == handshake_type::certificate) {
+        certificate.parse(handshake2.body);
+    }
+
+    struct datum list = certificate.certificate_list;
+    while (list.is_not_empty()) {
+        size_t length;
+        if (list.read_uint(&length, L_CertificateLength) == false || length == 0) {
+            return;
+        }
+        if (length > (size_t)list.length()) {
+            length = list.length();   // truncated, as is common
+        }
+        std::vector<uint8_t> cert = { (uint8_t)(length >> 16), (uint8_t)(length >> 8), (uint8_t)length };
+        cert.insert(cert.end(), list.data, list.data + length);
+        certs.push_back(cert);
+        list.skip(length);
+    }
+}
+
+// extract_payloads(packets, payloads) adds the payloads of each
+// protocol in the packets to payloads[protocol]
+//
+static void extract_payloads(const std::vector<std::vector<uint8_t>> &packets, payload_set payloads[num_protocols]) {
+    for (const auto &packet : packets) {
+        struct key k;
+        struct datum pkt{packet.data(), packet.data() + packet.size()};
+        size_t transport_proto = 0;
+        size_t ethertype = 0;
+        datum_process_eth(&pkt, &ethertype);
+        switch(ethertype) {
+        case ETH_TYPE_IP:
+            datum_process_ipv4(&pkt, &transport_proto, &k);
+            break;
+        case ETH_TYPE_IPV6:
+            datum_process_ipv6(&pkt, &transport_proto, &k);
+            break;
+        default:
+            ;
+        }
+        if (transport_proto == 6) {
+            struct tcp_packet tcp_pkt;
+            tcp_pkt.parse(pkt);
+            if (tcp_pkt.header == nullptr || pkt.is_not_empty() == false) {
+                continue;
+            }
+            std::vector<uint8_t> payload(pkt.data, pkt.data_end);
+            switch (get_message_type(pkt.data, pkt.length())) {
+            case tcp_msg_type_tls_client_hello:
+                payloads[protocol_tls_client_hello].push_back(payload);
+                break;
+            case tcp_msg_type_http_request:
+                payloads[protocol_http_request].push_back(payload);
+                break;
+            case tcp_msg_type_ssh_kex:
+                payloads[protocol_ssh_kex_init].push_back(payload);
+                break;
+            case tcp_msg_type_tls_server_hello:
+            case tcp_msg_type_tls_certificate:
+                add_certificates(payloads[protocol_x509_cert], pkt);
+                break;
+            default:
+                ;
+            }
+        } else if (transport_proto == 17) {
+            struct udp_packet udp_pkt;
+            udp_pkt.parse(pkt);
+            if (pkt.is_not_empty() == false) {
+                continue;
+            }
+            enum udp_msg_type msg_type = udp_get_message_type(pkt.data, pkt.length());
+            if (msg_type == udp_msg_type_unknown) {
+                msg_type = udp_pkt.estimate_msg_type_from_ports();
+            }
+            std::vector<uint8_t> payload(pkt.data, pkt.data_end);
+            switch (msg_type) {
+            case udp_msg_type_quic:
+                payloads[protocol_quic_initial].push_back(payload);
+                break;
+            case udp_msg_type_dns:
+                payloads[protocol_dns].push_back(payload);
+                break;
+            case udp_msg_type_dhcp:
+                payloads[protocol_dhcp_discover].push_back(payload);
+                break;
+            default:
+                ;
+            }
+        }
+    }
+}
+
+// add_truncations(payloads, truncated) adds the prefixes of each of
+// the payloads that end in its first quarter, half and three quarters
+// to truncated
+//
+static void add_truncations(const payload_set &payloads, payload_set &truncated) {
+    for (const auto &p : payloads) {
+        for (size_t quarter = 1; quarter < 4; quarter++) {
+            size_t length = p.size() * quarter / 4;
+            if (length > 0) {
+                truncated.push_back(std::vector<uint8_t>(p.begin(), p.begin() + length));
+            }
+        }
+    }
+}
+
+/*
+ * Each parser type P below runs one protocol's parser as
+ * stateful_pkt_proc does.  P::message holds a parsed message;
+ * P::parse(m, d) parses the payload d into m, and returns true if m
+ * is not empty; P::write_fingerprint(m, buf) writes the fingerprint
+ * of m, if P::has_fingerprint; and P::write_json(d, buf) parses the
+ * payload d and writes its JSON record, with metadata.
+ */
+
+struct tls_client_hello_parser {
+    typedef struct tls_client_hello message;
+    static const bool has_fingerprint = true;
+
+    static bool parse(message &hello, struct datum d) {
+        struct tls_record rec;
+        rec.parse(d);
+        struct tls_handshake handshake;
+        handshake.parse(rec.fragment);
+        hello.parse(handshake.body);
+        return hello.is_not_empty();
+    }
+
+    static void write_fingerprint(const message &hello, struct buffer_stream &buf) {
+        hello(buf);
+    }
+
+    static void write_json(struct datum d, struct buffer_stream &buf) {
+        message hello;
+        if (parse(hello, d)) {
+            struct json_object record{&buf};
+            struct json_object fps{record, "fingerprints"};
+            fps.print_key_value("tls", hello);
+            fps.close();
+            hello.write_json(record, true);
+            record.close();
+        }
+    }
+};
+
+// the client hello of a QUIC initial packet is found by a
+// quic_crypto_reassembler, as in stateful_pkt_proc, and parsed from a
+// copy of it, which the message keeps, since the reassembler only
+// keeps it until the next packet; the keys are cached as in stateful_pkt_proc, unless
+// cache_size is zero, so that they are derived for every packet, as
+// for a new connection, while with the cache, the passes after the
+// warm-up measure retransmitted packets
+//
+template <size_t cache_size>
+struct quic_initial_parser {
+    struct message {
+        unsigned char client_hello[quic_crypto_reassembler::max_message_length];
+        struct tls_client_hello hello;
+    };
+    static const bool has_fingerprint = true;
+
+    static struct quic_crypto_engine &engine() {
+        static struct quic_crypto_engine e{cache_size};
+        return e;
+    }
+
+    static struct quic_crypto_reassembler &reassembler() {
+        static struct quic_crypto_reassembler r;
+        return r;
+    }
+
+    static bool parse(message &m, struct datum d) {
+        struct quic_initial_packet quic_pkt{d};
+        if (quic_pkt.is_not_empty() == false) {
+            return false;
+        }
+        struct quic_initial_packet_crypto quic_pkt_crypto{quic_pkt, engine()};
+        quic_pkt_crypto.decrypt(quic_pkt.data.data, quic_pkt.data.length());
+        if (quic_pkt_crypto.is_not_empty() == false) {
+            return false;
+        }
+        struct datum client_hello = reassembler().client_hello(quic_pkt, quic_pkt_crypto, 0);
+        if (client_hello.is_not_empty() == false) {
+            return false;
+        }
+        memcpy(m.client_hello, client_hello.data, client_hello.length());
+        struct datum hello_copy{m.client_hello, m.client_hello + client_hello.length()};
+        m.hello.parse(hello_copy);
+        return m.hello.is_not_empty();
+    }
+
+    static void write_fingerprint(const message &m, struct buffer_stream &buf) {
+        m.hello(buf);
+    }
+
+    static void write_json(struct datum d, struct buffer_stream &buf) {
+        struct quic_initial_packet quic_pkt{d};
+        if (quic_pkt.is_not_empty()) {
+            struct json_object record{&buf};
+            struct quic_initial_packet_crypto quic_pkt_crypto{quic_pkt, engine()};
+            quic_pkt_crypto.decrypt(quic_pkt.data.data, quic_pkt.data.length());
+            if (quic_pkt_crypto.is_not_empty()) {
+                struct datum client_hello = reassembler().client_hello(quic_pkt, quic_pkt_crypto, 0);
+                struct tls_client_hello hello;
+                hello.parse(client_hello);
+                if (hello.is_not_empty()) {
+                    struct json_object fps{record, "fingerprints"};
+                    fps.print_key_value("quic", hello);
+                    fps.close();
+                    hello.write_json(record, true);
+                }
+            }
+            struct json_object json_quic{record, "quic"};
+            quic_pkt.write_json(json_quic);
+            json_quic.close();
+            record.close();
+        }
+    }
+};
+
+struct http_request_parser {
+    typedef struct http_request message;
+    static const bool has_fingerprint = true;
+
+    static bool parse(message &request, struct datum d) {
+        request.parse(d);
+        return request.is_not_empty();
+    }
+
+    static void write_fingerprint(const message &request, struct buffer_stream &buf) {
+        request(buf);
+    }
+
+    static void write_json(struct datum d, struct buffer_stream &buf) {
+        message request;
+        if (parse(request, d)) {
+            struct json_object record{&buf};
+            struct json_object fps{record, "fingerprints"};
+            fps.print_key_value("http", request);
+            fps.close();
+            record.print_key_string("complete", request.headers.complete ? "yes" : "no");
+            request.write_json(record, true);
+            record.close();
+        }
+    }
+};
+
+struct dns_parser {
+    typedef struct dns_packet message;
+    static const bool has_fingerprint = false;
+
+    static bool parse(message &dns_pkt, struct datum d) {
+        dns_pkt.parse(d);
+        return dns_pkt.is_not_empty();
+    }
+
+    static void write_fingerprint(const message &, struct buffer_stream &) { }
+
+    static void write_json(struct datum d, struct buffer_stream &buf) {
+        message dns_pkt;
+        if (parse(dns_pkt, d)) {
+            struct json_object record{&buf};
+            struct json_object json_dns{record, "dns"};
+            dns_pkt.write_json(json_dns);
+            json_dns.close();
+            record.close();
+        }
+    }
+};
+
+struct dhcp_discover_parser {
+    typedef struct dhcp_discover message;
+    static const bool has_fingerprint = true;
+
+    static bool parse(message &dhcp_disco, struct datum d) {
+        dhcp_disco.parse(d);
+        return dhcp_disco.is_not_empty();
+    }
+
+    static void write_fingerprint(const message &dhcp_disco, struct buffer_stream &buf) {
+        dhcp_disco(buf);
+    }
+
+    static void write_json(struct datum d, struct buffer_stream &buf) {
+        message dhcp_disco;
+        if (parse(dhcp_disco, d)) {
+            struct json_object record{&buf};
+            struct json_object fps{record, "fingerprints"};
+            fps.print_key_value("dhcp", dhcp_disco);
+            fps.close();
+            dhcp_disco.write_json(record);
+            record.close();
+        }
+    }
+};
+
+struct ssh_kex_init_parser {
+    typedef struct ssh_kex_init message;
+    static const bool has_fingerprint = true;
+
+    static bool parse(message &kex_init, struct datum d) {
+        struct ssh_binary_packet ssh_pkt;
+        ssh_pkt.parse(d);
+        kex_init.parse(ssh_pkt.payload);
+        return kex_init.is_not_empty();
+    }
+
+    static void write_fingerprint(const message &kex_init, struct buffer_stream &buf) {
+        kex_init(buf);
+    }
+
+    static void write_json(struct datum d, struct buffer_stream &buf) {
+        message kex_init;
+        if (parse(kex_init, d)) {
+            struct json_object record{&buf};
+            struct json_object fps{record, "fingerprints"};
+            fps.print_key_value("ssh_kex", kex_init);
+            fps.close();
+            kex_init.write_json(record, true);
+            record.close();
+        }
+    }
+};
+
+// the X.509 parser can only be included in tls.cc, so the certificates
+// are parsed through tls_server_certificate, from payloads that are
+// certificate lists of one certificate each
+//
+struct x509_cert_parser {
+    typedef struct tls_server_certificate message;
+    static const bool has_fingerprint = false;
+
+    static bool parse(message &certificate, struct datum d) {
+        certificate.certificate_list = d;
+        return certificate.parse_certs() > 0;
+    }
+
+    static void write_fingerprint(const message &, struct buffer_stream &) { }
+
+    static void write_json(struct datum d, struct buffer_stream &buf) {
+        message certificate;
+        certificate.certificate_list = d;
+        struct json_object record{&buf};
+        struct json_array server_certs{record, "certs"};
+        certificate.write_json(server_certs, true);
+        server_certs.close();
+        record.close();
+    }
+};
+
+enum operation {
+    operation_parse       = 0,
+    operation_fingerprint = 1,
+    operation_json        = 2,
+    num_operations        = 3
+};
+
+const char *operation_name[num_operations] = { "parse", "fingerprint", "json" };
+
+struct result {
+    uint64_t payloads;          // per run
+    uint64_t bytes;
+    uint64_t parsed;            // payloads that held a message
+    uint64_t iterations;        // passes over the payloads per run
+    uint64_t median_ns;         // of a pass
+    uint64_t min_ns;
+    double allocations;         // per payload
+};
+
+static volatile uint64_t sink;   // keeps the results of the passes live
+
+// measure(pass, repeat, r) times the function pass, which makes one
+// pass over all of the payloads, as described at the top of this file
+//
+template <typename F>
+static void measure(F pass, unsigned int repeat, struct result &r) {
+    const uint64_t min_run_ns = 10000000;
+    struct timer t;
+    timer_start(&t);
+    pass();                                    // warm-up
+    uint64_t ns = timer_stop(&t);
+    r.iterations = ns ? min_run_ns / ns + 1 : min_run_ns;
+
+    std::vector<uint64_t> run_ns;
+    uint64_t allocations_before = allocations;
+    for (unsigned int i = 0; i < repeat; i++) {
+        timer_start(&t);
+        for (uint64_t j = 0; j < r.iterations; j++) {
+            pass();
+        }
+        run_ns.push_back(timer_stop(&t) / r.iterations);
+    }
+    if (r.payloads) {
+        r.allocations = (double)(allocations - allocations_before) / (r.payloads * r.iterations * repeat);
+    }
+    std::sort(run_ns.begin(), run_ns.end());
+    r.median_ns = run_ns[run_ns.size() / 2];
+    r.min_ns = run_ns[0];
+}
+
+// benchmark<P>(payloads, op, repeat) returns the result of the
+// operation op of the parser P over the payloads
+//
+template <typename P>
+static struct result benchmark(const payload_set &payloads, enum operation op, unsigned int repeat) {
+    struct result r;
+    memset(&r, 0, sizeof(r));
+    std::vector<struct datum> data;
+    for (const auto &p : payloads) {
+        data.push_back(datum{p.data(), p.data() + p.size()});
+    }
+
+    // parse all of the payloads up front, for the fingerprint
+    // operation and the parsed count; the messages are not moved
+    // after they are parsed, since some hold pointers into themselves
+    //
+    std::vector<typename P::message> messages(data.size());
+    std::vector<const typename P::message *> parsed;
+    uint64_t parsed_bytes = 0;
+    for (size_t i = 0; i < data.size(); i++) {
+        if (P::parse(messages[i], data[i])) {
+            parsed.push_back(&messages[i]);
+            parsed_bytes += data[i].length();
+        }
+    }
+    r.parsed = parsed.size();
+
+    static char buffer[65536];
+    switch (op) {
+    case operation_parse:
+        r.payloads = data.size();
+        for (const auto &d : data) {
+            r.bytes += d.length();
+        }
+        measure([&data]() {
+            uint64_t count = 0;
+            for (const auto &d : data) {
+                typename P::message m;
+                count += P::parse(m, d);
+            }
+            sink = count;
+        }, repeat, r);
+        break;
+    case operation_fingerprint:
+        r.payloads = parsed.size();
+        r.bytes = parsed_bytes;
+        measure([&parsed]() {
+            uint64_t length = 0;
+            for (const auto *m : parsed) {
+                struct buffer_stream buf{buffer, sizeof(buffer)};
+                P::write_fingerprint(*m, buf);
+                length += buf.length();
+            }
+            sink = length;
+        }, repeat, r);
+        break;
+    case operation_json:
+        r.payloads = data.size();
+        for (const auto &d : data) {
+            r.bytes += d.length();
+        }
+        measure([&data]() {
+            uint64_t length = 0;
+            for (const auto &d : data) {
+                struct buffer_stream buf{buffer, sizeof(buffer)};
+                P::write_json(d, buf);
+                length += buf.length();
+            }
+            sink = length;
+        }, repeat, r);
+        break;
+    default:
+        ;
+    }
+    return r;
+}
+
+struct protocol_benchmark {
+    const char *name;
+    enum protocol payloads;
+    bool has_fingerprint;
+    struct result (*run)(const payload_set &payloads, enum operation op, unsigned int repeat);
+};
+
+typedef quic_initial_parser<0> quic_initial_uncached_parser;
+typedef quic_initial_parser<quic_crypto_engine::default_cache_size> quic_initial_cached_parser;
+
+static const struct protocol_benchmark protocols[] = {
+    { "tls_client_hello", protocol_tls_client_hello, tls_client_hello_parser::has_fingerprint,      benchmark<tls_client_hello_parser>      },
+    { "quic_initial",     protocol_quic_initial,     quic_initial_uncached_parser::has_fingerprint, benchmark<quic_initial_uncached_parser> },
+    { "quic_retransmit",  protocol_quic_initial,     quic_initial_cached_parser::has_fingerprint,   benchmark<quic_initial_cached_parser>   },
+    { "http_request",     protocol_http_request,     http_request_parser::has_fingerprint,          benchmark<http_request_parser>          },
+    { "dns",              protocol_dns,              dns_parser::has_fingerprint,                   benchmark<dns_parser>                   },
+    { "dhcp_discover",    protocol_dhcp_discover,    dhcp_discover_parser::has_fingerprint,         benchmark<dhcp_discover_parser>         },
+    { "ssh_kex_init",     protocol_ssh_kex_init,     ssh_kex_init_parser::has_fingerprint,          benchmark<ssh_kex_init_parser>          },
+    { "x509_cert",        protocol_x509_cert,        x509_cert_parser::has_fingerprint,             benchmark<x509_cert_parser>             },
+};
+
+static void usage(const char *progname) {
+    fprintf(stderr, "usage: %s [--repeat n] [--json] [--protocol p] [--pathological path]... corpus...\n", progname);
+    fprintf(stderr, "protocols:");
+    for (const auto &p : protocols) {
+        fprintf(stderr, " %s", p.name);
+    }
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+
+    CRYPTO_set_mem_functions(counting_malloc, counting_realloc, counting_free);
+
+    unsigned int repeat = 7;
+    bool json = false;
+    const char *only = NULL;
+    std::vector<const char *> corpus;
+    std::vector<const char *> pathological;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--protocol") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (strcmp(argv[i], "--pathological") == 0 && i + 1 < argc) {
+            pathological.push_back(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        } else {
+            corpus.push_back(argv[i]);
+        }
+    }
+    if (corpus.size() == 0) {
+        usage(argv[0]);
+    }
+    if (only && std::none_of(std::begin(protocols), std::end(protocols), [only](const struct protocol_benchmark &p) { return strcmp(p.name, only) == 0; })) {
+        usage(argv[0]);
+    }
+    if (repeat == 0) {
+        repeat = 1;
+    }
+
+    std::vector<std::vector<uint8_t>> packets;
+    for (const char *c : corpus) {
+        if (read_corpus(c, packets) == false) {
+            return EXIT_FAILURE;
+        }
+    }
+    std::vector<std::vector<uint8_t>> pathological_packets;
+    for (const char *c : pathological) {
+        if (read_corpus(c, pathological_packets) == false) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (proto_ident_config(NULL) != status_ok) {
+        fprintf(stderr, "error: could not configure protocol identification\n");
+        return EXIT_FAILURE;
+    }
+
+    // the payloads of the corpus are set 0, and the pathological ones
+    // (including the truncated payloads of the corpus) are set 1
+    //
+    const char *set_name[2] = { "corpus", "pathological" };
+    payload_set payloads[2][num_protocols];
+    extract_payloads(packets, payloads[0]);
+    extract_payloads(pathological_packets, payloads[1]);
+    for (unsigned int p = 0; p < num_protocols; p++) {
+        add_truncations(payloads[0][p], payloads[1][p]);
+    }
+
+    if (json == false) {
+        fprintf(stdout, "corpus: %zu packets, pathological: %zu packets, repeat: %u\n",
+                packets.size(), pathological_packets.size(), repeat);
+        fprintf(stdout, "%-18s %-13s %-12s %9s %9s %10s %10s %10s %8s\n",
+                "protocol", "payloads", "operation", "count", "parsed", "ns/payload", "min ns", "MB/s", "allocs");
+    }
+
+    for (const auto &proto : protocols) {
+        if (only && strcmp(only, proto.name) != 0) {
+            continue;
+        }
+        for (unsigned int set = 0; set < 2; set++) {
+            const payload_set &proto_payloads = payloads[set][proto.payloads];
+            if (proto_payloads.size() == 0) {
+                continue;
+            }
+            for (unsigned int op = 0; op < num_operations; op++) {
+                if (op == operation_fingerprint && proto.has_fingerprint == false) {
+                    continue;
+                }
+                struct result r = proto.run(proto_payloads, (enum operation)op, repeat);
+                if (r.payloads == 0) {
+                    continue;
+                }
+                double ns_per_payload = (double)r.median_ns / r.payloads;
+                double min_ns_per_payload = (double)r.min_ns / r.payloads;
+                double bytes_per_sec = r.median_ns ? r.bytes * 1e9 / r.median_ns : 0.0;
+                if (json) {
+                    fprintf(stdout, "{\"bench\":\"parser\",\"protocol\":\"%s\",\"payloads\":\"%s\",\"operation\":\"%s\",\"repeat\":%u,"
+                            "\"count\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"parsed\":%" PRIu64 ",\"iterations\":%" PRIu64 ","
+                            "\"ns_per_payload\":%.1f,\"min_ns_per_payload\":%.1f,\"bytes_per_sec\":%.0f,"
+                            "\"allocations_per_payload\":%.2f}\n",
+                            proto.name, set_name[set], operation_name[op], repeat,
+                            r.payloads, r.bytes, r.parsed, r.iterations,
+                            ns_per_payload, min_ns_per_payload, bytes_per_sec, r.allocations);
+                } else {
+                    fprintf(stdout, "%-18s %-13s %-12s %9" PRIu64 " %9" PRIu64 " %10.1f %10.1f %10.1f %8.2f\n",
+                            proto.name, set_name[set], operation_name[op],
+                            r.payloads, r.parsed, ns_per_payload, min_ns_per_payload, bytes_per_sec / 1e6, r.allocations);
+                }
+                fflush(stdout);
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
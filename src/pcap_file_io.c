@@ -448,26 +448,51 @@ void packet_info_init_from_pkthdr(struct packet_info *pi,
     pi->ts.tv_nsec = pkthdr->ts.tv_usec * 1000;
 } 
 
+/*
+ * pcap_file_dispatch_pkt_processor() reads packets into a batch
+ * buffer, one after another, and passes them to the packet processor
+ * with apply_batch() whenever the batch is full, or there is not
+ * enough room left in the buffer for another packet of length BUFLEN
+ */
+#define BATCH_BUFLEN (4 * BUFLEN)
+
 enum status pcap_file_dispatch_pkt_processor(struct pcap_file *f,
                                              struct pkt_proc *pkt_processor,
                                              int loop_count) {
     enum status status = status_ok;
     struct pcap_pkthdr pkthdr;
-    uint8_t packet_data[BUFLEN];
     unsigned long total_length = sizeof(struct pcap_file_hdr); // file header is already written
     unsigned long num_packets = 0;
-    struct packet_info pi;
+    struct packet_descriptor batch[pkt_proc::max_batch_size];
+    size_t batch_size = 0;
+    size_t batch_offset = 0;
+
+    uint8_t *batch_data = (uint8_t *)malloc(BATCH_BUFLEN);
+    if (batch_data == NULL) {
+        fprintf(stderr, "error: could not allocate packet batch buffer\n");
+        return status_err;
+    }
 
     for (int i=0; i < loop_count && sig_close_flag == 0; i++) {
         do {
+            uint8_t *packet_data = batch_data + batch_offset;
             status = pcap_file_read_packet(f, &pkthdr, packet_data);
             if (status == status_ok) {
-                packet_info_init_from_pkthdr(&pi, &pkthdr);
-                // process the packet that was read
-                pkt_processor->apply(&pi, packet_data);
+                packet_info_init_from_pkthdr(&batch[batch_size].info, &pkthdr);
+                batch[batch_size].eth = packet_data;
+                batch_size++;
+                batch_offset += pkthdr.caplen;
                 num_packets++;
                 total_length += pkthdr.caplen + sizeof(struct pcap_packet_hdr);
             }
+            if (batch_size == pkt_proc::max_batch_size
+                || batch_offset > BATCH_BUFLEN - BUFLEN
+                || (batch_size && (status != status_ok || sig_close_flag))) {
+                // process the packets that were read
+                pkt_processor->apply_batch(batch, batch_size);
+                batch_size = 0;
+                batch_offset = 0;
+            }
         } while (status == status_ok && sig_close_flag == 0);
         
         if (i < loop_count - 1) {
@@ -478,6 +503,7 @@ enum status pcap_file_dispatch_pkt_processor(struct pcap_file *f,
             }
         }
     }
+    free(batch_data);
 
     pkt_processor->finalize();  // clear out buffers
 
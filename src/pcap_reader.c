@@ -7,6 +7,7 @@
 #include "output.h"
 #include "pkt_proc.h"
 #include "utils.h"
+#include "metrics.h"
 
 #define BILLION 1000000000L
 
@@ -24,6 +25,7 @@ enum status pcap_reader_thread_context_init_from_config(struct pcap_reader_threa
         printf("error: could not initialize frame handler\n");
         return status_err;
     }
+    metrics_attach(tc->pkt_processor, tnum, cfg->latency_sampling);
 
     // if cfg->use_test_packet is on, read_filename will be NULL
     if (cfg->read_filename != NULL) {
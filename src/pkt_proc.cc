@@ -6,6 +6,8 @@
  */
 
 #include <string.h>
+#include <inttypes.h>
+#include <atomic>
 #include "pcap_file_io.h"
 #include "rnd_pkt_drop.h"
 #include "pkt_proc.h"
@@ -20,6 +22,7 @@
 #include "dns.h"
 #include "tls.h"
 #include "http.h"
+#include "http2.h"
 #include "wireguard.h"
 #include "ssh.h"
 #include "dhcp.h"
@@ -40,6 +43,60 @@
  */
 unsigned int packet_filter_threshold = 7;
 
+/*
+ * struct pkt_proc_features<F> provides the output options for the
+ * set F of pkt_proc_feature flags; they are compile time constants,
+ * unless F is pkt_proc_runtime_features
+ */
+template <unsigned int F>
+struct pkt_proc_features {
+    static constexpr bool runtime = (F & pkt_proc_runtime_features) != 0;
+
+    static bool metadata()         { return runtime ? global_vars.metadata_output         : (F & pkt_proc_metadata) != 0; }
+    static bool dns_json()         { return runtime ? global_vars.dns_json_output         : (F & pkt_proc_dns_json) != 0; }
+    static bool certs_json()       { return runtime ? global_vars.certs_json_output       : (F & pkt_proc_certs_json) != 0; }
+    static bool analysis()         { return runtime ? global_vars.do_analysis             : (F & pkt_proc_analysis) != 0; }
+    static bool tcp_initial_data() { return runtime ? global_vars.output_tcp_initial_data : (F & pkt_proc_tcp_initial_data) != 0; }
+    static bool udp_initial_data() { return runtime ? global_vars.output_udp_initial_data : (F & pkt_proc_udp_initial_data) != 0; }
+    static bool tcp_syn()          { return runtime ? select_tcp_syn                      : (F & pkt_proc_tcp_syn) != 0; }
+
+    static struct tcp_reassembler *reassembler(struct stateful_pkt_proc &p) {
+        if (runtime) {
+            return p.reassembler_ptr;
+        }
+        return (F & pkt_proc_reassembly) ? &p.reassembler : nullptr;
+    }
+};
+
+unsigned int pkt_proc_features_from_config() {
+    unsigned int f = 0;
+#ifdef USE_TCP_REASSEMBLY
+    f |= pkt_proc_reassembly;
+#endif
+    if (global_vars.metadata_output) {
+        f |= pkt_proc_metadata;
+    }
+    if (global_vars.dns_json_output) {
+        f |= pkt_proc_dns_json;
+    }
+    if (global_vars.certs_json_output) {
+        f |= pkt_proc_certs_json;
+    }
+    if (global_vars.do_analysis) {
+        f |= pkt_proc_analysis;
+    }
+    if (global_vars.output_tcp_initial_data) {
+        f |= pkt_proc_tcp_initial_data;
+    }
+    if (global_vars.output_udp_initial_data) {
+        f |= pkt_proc_udp_initial_data;
+    }
+    if (select_tcp_syn) {
+        f |= pkt_proc_tcp_syn;
+    }
+    return f;
+}
+
 struct pkt_proc *pkt_proc_new_from_config(struct mercury_config *cfg,
                                           int tnum,
                                           struct ll_queue *llq) {
@@ -79,7 +136,27 @@ struct pkt_proc *pkt_proc_new_from_config(struct mercury_config *cfg,
              * write fingerprints into output file
              */
 
-            return new pkt_proc_json_writer_llq(llq, cfg->packet_filter_cfg, cfg->output_block);
+            // the protocol selection sets select_tcp_syn, so it is
+            // applied before the features are determined
+            //
+            if (proto_ident_config(cfg->packet_filter_cfg) != status_ok) {
+                throw "could not initialize packet filter";
+            }
+            const char *filter = cfg->packet_filter_cfg;
+            bool block = cfg->output_block;
+            unsigned int prefetch = cfg->prefetch_distance;
+            switch (pkt_proc_features_from_config()) {
+            case pkt_proc_default_features:
+                return new pkt_proc_json_writer_llq<pkt_proc_default_features>(llq, filter, block, prefetch);
+            case pkt_proc_metadata_features:
+                return new pkt_proc_json_writer_llq<pkt_proc_metadata_features>(llq, filter, block, prefetch);
+            case pkt_proc_analysis_features:
+                return new pkt_proc_json_writer_llq<pkt_proc_analysis_features>(llq, filter, block, prefetch);
+            case pkt_proc_analysis_metadata_features:
+                return new pkt_proc_json_writer_llq<pkt_proc_analysis_metadata_features>(llq, filter, block, prefetch);
+            default:
+                return new pkt_proc_json_writer_llq<pkt_proc_runtime_features>(llq, filter, block, prefetch);
+            }
 
         }
         // note: we no longer have a 'packet dumper' option
@@ -119,18 +196,193 @@ void write_flow_key(struct json_object &o, const struct key &k) {
     // o.b->snprintf(",\"flowhash\":\"%016lx\"", std::hash<struct key>{}(k));
 }
 
+// write_os_analysis() adds the fingerprint fp, of the given type,
+// into the OS identification features of the source host of the flow
+// k, and writes that host's current OS classification into record
+//
+#define MAX_OS_FP_STR_LEN 4096
+
+template <typename T>
+static void write_os_analysis(struct json_object &record,
+                              enum os_fingerprint_type type,
+                              T &fp,
+                              const struct key &k,
+                              struct timespec *ts) {
+
+    char fp_str[MAX_OS_FP_STR_LEN];
+    struct buffer_stream fp_buf{fp_str, sizeof(fp_str)};
+    fp(fp_buf);
+    if (fp_buf.trunc || fp_buf.length() < 2) {
+        return;
+    }
+    struct os_analyzer::host_address addr;
+    if (k.ip_vers == 6) {
+        addr = os_analyzer::address_from_ipv6((const uint8_t *)&k.addr.ipv6.src);
+    } else {
+        addr = os_analyzer::address_from_ipv4(k.addr.ipv4.src);
+    }
+    struct os_result result;
+    if (os_analysis.update(addr, type, fp_str + 1, fp_buf.length() - 2, ts->tv_sec, &result)) {   // skip quotes
+        struct json_object os{record, "os_analysis"};
+        os.print_key_json_string("os", (const uint8_t *)result.os_name, strlen(result.os_name));
+        os.print_key_float("score", result.probability);
+        os.close();
+    }
+}
+
+// write_http2_record() writes the record of an HTTP/2 connection,
+// whose preface and first request may have been in different packets
+//
+static void write_http2_record(struct buffer_stream &buf,
+                               const struct http2_request &request,
+                               const struct key &k,
+                               struct timespec *ts,
+                               bool output_metadata) {
+    struct json_object record{&buf};
+    struct json_object fps{record, "fingerprints"};
+    fps.print_key_value("http2", request);
+    fps.close();
+    request.write_json(record, output_metadata);
+    write_flow_key(record, k);
+    record.print_key_timestamp("event_start", ts);
+    record.close();
+}
+
+// write_pending_http2_record() writes the record of an HTTP/2
+// connection whose first request did not arrive before its state was
+// expired or evicted, with the settings and time of its preface
+//
+static void write_pending_http2_record(struct buffer_stream &buf,
+                                       const struct http2_connection &c,
+                                       const struct key &k,
+                                       bool output_metadata) {
+    struct http2_request request;
+    request.settings = c.settings;
+    struct timespec ts = c.ts;
+    write_http2_record(buf, request, k, &ts, output_metadata);
+}
+
+bool stateful_pkt_proc::write_expired_http2_record(struct buffer_stream &buf,
+                                                   unsigned int sec,
+                                                   bool output_metadata) {
+    if (http2_connections == nullptr) {
+        return false;
+    }
+    auto *expired = http2_connections->reap(sec);
+    if (expired == nullptr) {
+        return false;
+    }
+    write_pending_http2_record(buf, expired->context, expired->k, output_metadata);
+    http2_connections->remove(expired->k);
+    return true;
+}
+
+// the counters of the TCP verdict caches of the packet processors
+// that have been deleted
+//
+static std::atomic<uint64_t> tcp_verdict_lookups{0};
+static std::atomic<uint64_t> tcp_verdict_hits{0};
+static std::atomic<uint64_t> tcp_verdict_evictions{0};
+
+stateful_pkt_proc::~stateful_pkt_proc() {
+    delete quic_crypto;
+    delete quic_reassembler;
+    delete http2_connections;
+    delete tls_clients;
+    tcp_verdict_lookups += tcp_verdicts.lookups;
+    tcp_verdict_hits += tcp_verdicts.hits;
+    tcp_verdict_evictions += tcp_verdicts.evictions;
+}
+
+void tcp_verdict_cache_write_stats(FILE *f) {
+    uint64_t lookups = tcp_verdict_lookups;
+    uint64_t hits = tcp_verdict_hits;
+    if (lookups == 0) {
+        return;    // no TCP packets were inspected
+    }
+    fprintf(f, "tcp verdict cache: %" PRIu64 " lookups, %" PRIu64 " hits (%.1f%%), %" PRIu64 " evictions\n",
+            lookups, hits, lookups ? 100.0 * hits / lookups : 0.0, (uint64_t)tcp_verdict_evictions);
+}
+
+const char *pkt_proc_record_type_name(enum pkt_proc_record_type type) {
+    switch(type) {
+    case record_type_tcp:         return "tcp";
+    case record_type_tls:         return "tls";
+    case record_type_tls_server:  return "tls_server";
+    case record_type_http:        return "http";
+    case record_type_http_server: return "http_server";
+    case record_type_ssh:         return "ssh";
+    case record_type_ssh_kex:     return "ssh_kex";
+    case record_type_tcp_data:    return "tcp_data";
+    case record_type_quic:        return "quic";
+    case record_type_wireguard:   return "wireguard";
+    case record_type_dns:         return "dns";
+    case record_type_dtls:        return "dtls";
+    case record_type_dhcp:        return "dhcp";
+    case record_type_udp_data:    return "udp_data";
+    case record_type_http2:       return "http2";
+    default:
+        ;
+    }
+    return "unknown";
+}
+
+const char *pkt_proc_latency_message_name(unsigned int message) {
+    if (message < num_record_types) {
+        return pkt_proc_record_type_name((enum pkt_proc_record_type)message);
+    }
+    if (message == latency_no_record) {
+        return "none";
+    }
+    return NULL;
+}
+
+static enum pkt_proc_record_type record_type_from_tcp_msg_type(enum tcp_msg_type msg_type) {
+    switch(msg_type) {
+    case tcp_msg_type_http_request:     return record_type_http;
+    case tcp_msg_type_http_response:    return record_type_http_server;
+    case tcp_msg_type_http2:            return record_type_http2;
+    case tcp_msg_type_tls_client_hello: return record_type_tls;
+    case tcp_msg_type_tls_server_hello:
+    case tcp_msg_type_tls_certificate:  return record_type_tls_server;
+    case tcp_msg_type_ssh:              return record_type_ssh;
+    case tcp_msg_type_ssh_kex:          return record_type_ssh_kex;
+    case tcp_msg_type_http2_frame:
+    case tcp_msg_type_unknown:
+    default:
+        ;
+    }
+    return record_type_tcp_data;
+}
+
+static enum pkt_proc_record_type record_type_from_udp_msg_type(enum udp_msg_type msg_type) {
+    switch(msg_type) {
+    case udp_msg_type_quic:               return record_type_quic;
+    case udp_msg_type_wireguard:          return record_type_wireguard;
+    case udp_msg_type_dns:                return record_type_dns;
+    case udp_msg_type_dtls_client_hello:  return record_type_dtls;
+    case udp_msg_type_dhcp:               return record_type_dhcp;
+    default:
+        ;
+    }
+    return record_type_udp_data;
+}
+
 static constexpr bool report_GRE = false;
 
+template <unsigned int F>
 size_t stateful_pkt_proc::write_json(void *buffer,
                                      size_t buffer_size,
                                      uint8_t *packet,
                                      size_t length,
-                                     struct timespec *ts,
-                                     struct tcp_reassembler *reassembler) {
+                                     struct timespec *ts) {
 
+    using features = pkt_proc_features<F>;
+    struct tcp_reassembler *reassembler = features::reassembler(*this);
     struct buffer_stream buf{(char *)buffer, buffer_size};
     struct key k;
     struct datum pkt{packet, packet+length};
+    enum pkt_proc_record_type record_type = record_type_tcp;
     size_t transport_proto = 0;
     size_t ethertype = 0;
     datum_process_eth(&pkt, &ethertype);
@@ -159,23 +411,31 @@ size_t stateful_pkt_proc::write_json(void *buffer,
         }
 
     }
+    latency.mark(latency_stage_eth_ip);
+
     if (transport_proto == 6) {
         struct tcp_packet tcp_pkt;
         tcp_pkt.parse(pkt);
         if (tcp_pkt.header == nullptr) {
+            latency.mark(latency_stage_classify);
             return 0;  // incomplete tcp header; can't process packet
         }
         tcp_pkt.set_key(k);
+        latency.mark(latency_stage_classify);
         if (tcp_pkt.is_SYN()) {
             tcp_flow_table.syn_packet(k, ts->tv_sec, ntohl(tcp_pkt.header->seq));
-            if (select_tcp_syn) {
+            tcp_verdicts.remove(k);
+            if (features::tcp_syn()) {
                 struct json_object record{&buf};
                 struct json_object fps{record, "fingerprints"};
                 fps.print_key_value("tcp", tcp_pkt);
                 fps.close();
-                if (global_vars.metadata_output) {
+                if (features::metadata()) {
                     tcp_pkt.write_json(fps);
                 }
+                if (features::analysis() && os_analysis.is_loaded()) {
+                    write_os_analysis(record, os_fingerprint_tcp, tcp_pkt, k, ts);
+                }
                 // note: we could check for non-empty data field
                 write_flow_key(record, k);
                 record.print_key_timestamp("event_start", ts);
@@ -184,14 +444,15 @@ size_t stateful_pkt_proc::write_json(void *buffer,
 
         } else if (tcp_pkt.is_SYN_ACK()) {
             tcp_flow_table.syn_packet(k, ts->tv_sec, ntohl(tcp_pkt.header->seq));
+            tcp_verdicts.remove(k);
 
 #ifdef REPORT_SYN_ACK
-            if (select_tcp_syn) {
+            if (features::tcp_syn()) {
                 struct json_object record{&buf};
                 struct json_object fps{record, "fingerprints"};
                 fps.print_key_value("tcp_server", tcp_pkt);
                 fps.close();
-                if (global_vars.metadata_output) {
+                if (features::metadata()) {
                     tcp_pkt.write_json(fps);
                 }
                 write_flow_key(record, k);
@@ -202,8 +463,26 @@ size_t stateful_pkt_proc::write_json(void *buffer,
             }
 #endif
 
+            // the prefilter accepts every SYN/ACK, so that they can carry
+            // the records of expired HTTP/2 connections when the packets
+            // without records are dropped
+            //
+            if (buf.length() == 0 && write_expired_http2_record(buf, ts->tv_sec, features::metadata())) {
+                record_type = record_type_http2;
+            }
+
         } else {
 
+            // skip packets in flows that are past their initial messages
+            //
+            if (tcp_verdicts.is_done(k, ts->tv_sec)) {
+                if (TCP_IS_FIN(tcp_pkt.header->flags) || TCP_IS_RST(tcp_pkt.header->flags)) {
+                    tcp_verdicts.remove(k);
+                }
+                latency.mark(latency_stage_classify);
+                return 0;
+            }
+
             // fprintf(stderr, "ip_flow_table.table.size(): %zu\n", ip_flow_table.table.size());
             // fprintf(stderr, "reassembler->segment_table.size(): %zu\n", reassembler->segment_table.size());
 
@@ -212,23 +491,25 @@ size_t stateful_pkt_proc::write_json(void *buffer,
                 if (data_buf) {
                     //fprintf(stderr, "REASSEMBLED TCP PACKET (length: %u)\n", data_buf->index);
                     struct datum reassembled_tcp_data = data_buf->reassembled_segment();
-                    tcp_data_write_json(buf, reassembled_tcp_data, k, tcp_pkt, ts, reassembler);
+                    tcp_data_write_json<F>(buf, reassembled_tcp_data, k, tcp_pkt, ts, reassembler, record_type);
                     reassembler->remove_segment(k);
+                    pkt_proc_counter_add(counters->reassembly_completed, 1);
                 } else {
                     const uint8_t *tmp = pkt.data;
-                    tcp_data_write_json(buf, pkt, k, tcp_pkt, ts, reassembler);
+                    tcp_data_write_json<F>(buf, pkt, k, tcp_pkt, ts, reassembler, record_type);
                     if (pkt.data == tmp) {
                         auto segment = reassembler->reap(ts->tv_sec);
                         if (segment != reassembler->segment_table.end()) {
                             //fprintf(stderr, "EXPIRED PARTIAL TCP PACKET (length: %u)\n", segment->second.index);
                             struct datum reassembled_tcp_data = segment->second.reassembled_segment();
-                            tcp_data_write_json(buf, reassembled_tcp_data, segment->first, tcp_pkt, ts, nullptr);
+                            tcp_data_write_json<F>(buf, reassembled_tcp_data, segment->first, tcp_pkt, ts, nullptr, record_type);
                             reassembler->remove_segment(segment);
+                            pkt_proc_counter_add(counters->reassembly_expired, 1);
                         }
                     }
                 }
             } else {
-                tcp_data_write_json(buf, pkt, k, tcp_pkt, ts, nullptr);  // process packet without tcp reassembly
+                tcp_data_write_json<F>(buf, pkt, k, tcp_pkt, ts, nullptr, record_type);  // process packet without tcp reassembly
             }
         }
 
@@ -237,30 +518,47 @@ size_t stateful_pkt_proc::write_json(void *buffer,
         udp_pkt.parse(pkt);
         udp_pkt.set_key(k);
         bool is_new = false;
-        if (global_vars.output_udp_initial_data && pkt.is_not_empty()) {
+        if (features::udp_initial_data() && pkt.is_not_empty()) {
             is_new = ip_flow_table.flow_is_new(k, ts->tv_sec);
         }
         enum udp_msg_type msg_type = udp_get_message_type(pkt.data, pkt.length());
         if (msg_type == udp_msg_type_unknown) {
             msg_type = udp_pkt.estimate_msg_type_from_ports();
         }
+        record_type = record_type_from_udp_msg_type(msg_type);
+        latency.mark(latency_stage_classify);
         switch(msg_type) {
         case udp_msg_type_quic:
             {
                 struct quic_initial_packet quic_pkt{pkt};
                 if (quic_pkt.is_not_empty()) {
                     struct json_object json_record{&buf};
-                    struct quic_initial_packet_crypto quic_pkt_crypto{quic_pkt};
+                    if (quic_crypto == nullptr) {
+                        quic_crypto = new quic_crypto_engine;
+                    }
+                    uint64_t quic_key_lookups = quic_crypto->lookups;
+                    uint64_t quic_key_hits = quic_crypto->hits;
+                    struct quic_initial_packet_crypto quic_pkt_crypto{quic_pkt, *quic_crypto};
+                    pkt_proc_counter_add(counters->quic_key_lookups, quic_crypto->lookups - quic_key_lookups);
+                    pkt_proc_counter_add(counters->quic_key_hits, quic_crypto->hits - quic_key_hits);
                     quic_pkt_crypto.decrypt(quic_pkt.data.data, quic_pkt.data.length());
+                    latency.mark(latency_stage_parse);
                     if (quic_pkt_crypto.is_not_empty()) {
+                        if (quic_reassembler == nullptr) {
+                            quic_reassembler = new quic_crypto_reassembler;
+                        }
+                        struct datum client_hello = quic_reassembler->client_hello(quic_pkt, quic_pkt_crypto, ts->tv_sec);
+                        pkt_proc_counter_set(counters->quic_reassembly_started, quic_reassembler->started);
+                        pkt_proc_counter_set(counters->quic_reassembly_completed, quic_reassembler->completed);
+                        pkt_proc_counter_set(counters->quic_reassembly_abandoned, quic_reassembler->abandoned);
                         struct tls_client_hello hello;
-                        struct datum quic_plaintext(quic_pkt_crypto.plaintext+8, quic_pkt_crypto.plaintext+quic_pkt_crypto.plaintext_len);
-                        hello.parse(quic_plaintext);
+                        hello.parse(client_hello);
+                        latency.mark(latency_stage_parse);
                         if (hello.is_not_empty()) {
                             struct json_object fps{json_record, "fingerprints"};
                             fps.print_key_value("quic", hello);
                             fps.close();
-                            hello.write_json(json_record, global_vars.metadata_output);
+                            hello.write_json(json_record, features::metadata());
                         }
                     }
                     struct json_object json_quic{json_record, "quic"};
@@ -276,6 +574,7 @@ size_t stateful_pkt_proc::write_json(void *buffer,
             {
                 wireguard_handshake_init wg;
                 wg.parse(pkt);
+                latency.mark(latency_stage_parse);
                 if (wg.is_valid()) {
                     struct json_object record{&buf};
                     wg.write_json(record);
@@ -287,8 +586,9 @@ size_t stateful_pkt_proc::write_json(void *buffer,
             break;
         case udp_msg_type_dns:
             {
-                if (global_vars.dns_json_output) {
+                if (features::dns_json()) {
                     struct dns_packet dns_pkt{pkt};
+                    latency.mark(latency_stage_parse);
                     if (dns_pkt.is_not_empty()) {
                         struct json_object json_record{&buf};
                         struct json_object json_dns{json_record, "dns"};
@@ -318,12 +618,13 @@ size_t stateful_pkt_proc::write_json(void *buffer,
                 if (handshake.msg_type == handshake_type::client_hello) {
                     struct tls_client_hello hello;
                     hello.parse(handshake.body);
+                    latency.mark(latency_stage_parse);
                     if (hello.is_not_empty()) {
                         struct json_object record{&buf};
                         struct json_object fps{record, "fingerprints"};
                         fps.print_key_value("dtls", hello);
                         fps.close();
-                        hello.write_json(record, global_vars.metadata_output);
+                        hello.write_json(record, features::metadata());
                         write_flow_key(record, k);
                         record.print_key_timestamp("event_start", ts);
                         record.close();
@@ -335,12 +636,13 @@ size_t stateful_pkt_proc::write_json(void *buffer,
             {
                 struct dhcp_discover dhcp_disco;
                 dhcp_disco.parse(pkt);
+                latency.mark(latency_stage_parse);
                 if (dhcp_disco.is_not_empty()) {
                     struct json_object record{&buf};
                     struct json_object fps{record, "fingerprints"};
                     fps.print_key_value("dhcp", dhcp_disco);
                     fps.close();
-                    if (global_vars.metadata_output) {
+                    if (features::metadata()) {
                         dhcp_disco.write_json(record);
                     }
                     write_flow_key(record, k);
@@ -369,28 +671,43 @@ size_t stateful_pkt_proc::write_json(void *buffer,
 
     if (buf.length() != 0 && buf.trunc == 0) {
         buf.strncpy("\n");
+        pkt_proc_counter_add(counters->records[record_type], 1);
+        latency.mark(latency_stage_json);
+        latency.set_message(record_type);
         return buf.length();
     }
+    latency.mark(latency_stage_json);
     return 0;
 }
 
 // tcp_data_write_json() parses TCP data and writes metadata into
 // a buffer stream, if any is found
 //
+template <unsigned int F>
 void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
                                             struct datum &pkt,
                                             const struct key &k,
                                             struct tcp_packet &tcp_pkt,
                                             struct timespec *ts,
-                                            struct tcp_reassembler *reassembler) {
+                                            struct tcp_reassembler *reassembler,
+                                            enum pkt_proc_record_type &record_type) {
+
+    using features = pkt_proc_features<F>;
 
     if (pkt.is_not_empty() == false) {
         return;
     }
     enum tcp_msg_type msg_type = get_message_type(pkt.data, pkt.length());
+    size_t initial_length = buf.length();
+    latency.mark(latency_stage_classify);
+
+    // flow_is_done is set to false for messages that can be followed
+    // by others that mercury reports in the same direction of the flow
+    //
+    bool flow_is_done = true;
 
     bool is_new = false;
-    if (global_vars.output_tcp_initial_data) {
+    if (features::tcp_initial_data()) {
         is_new = tcp_flow_table.is_first_data_packet(k, ts->tv_sec, ntohl(tcp_pkt.header->seq));
     }
 
@@ -399,17 +716,50 @@ void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
         {
             struct http_request request;
             request.parse(pkt);
+            latency.mark(latency_stage_parse);
             if (request.is_not_empty()) {
                 struct json_object record{&buf};
                 struct json_object fps{record, "fingerprints"};
                 fps.print_key_value("http", request);
                 fps.close();
                 record.print_key_string("complete", request.headers.complete ? "yes" : "no");
-                request.write_json(record, global_vars.metadata_output);
+                request.write_json(record, features::metadata());
+                if (features::analysis() && os_analysis.is_loaded()) {
+                    write_os_analysis(record, os_fingerprint_http, request, k, ts);
+                }
                 write_flow_key(record, k);
                 record.print_key_timestamp("event_start", ts);
                 record.close();
             }
+            tcp_verdicts.mark_inspect(k, ts->tv_sec);   // persistent connections carry more requests
+            flow_is_done = false;
+        }
+        break;
+    case tcp_msg_type_http2:
+        {
+            // if the first request is not in this packet, keep the
+            // settings until it arrives, and write the pending record
+            // of any connection whose state this one displaces
+            //
+            struct http2_request request;
+            request.parse(pkt);
+            latency.mark(latency_stage_parse);
+            if (request.have_headers) {
+                write_http2_record(buf, request, k, ts, features::metadata());
+            } else {
+                if (http2_connections == nullptr) {
+                    http2_connections = new tcp_context_table<struct http2_connection>{4096, 10};
+                }
+                auto *evicted = http2_connections->occupant(k, ts->tv_sec);
+                if (evicted) {
+                    write_pending_http2_record(buf, evicted->context, evicted->k, features::metadata());
+                }
+                struct http2_connection *c = http2_connections->insert(k, ts->tv_sec);
+                c->settings = request.settings;
+                c->ts = *ts;
+                tcp_verdicts.mark_inspect(k, ts->tv_sec);
+                flow_is_done = false;
+            }
         }
         break;
     case tcp_msg_type_tls_client_hello:
@@ -421,26 +771,50 @@ void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
             if (handshake.additional_bytes_needed && reassembler) {
                 // fprintf(stderr, "tls.handshake.client_hello (%zu)\n", handshake.additional_bytes_needed);
                 if (reassembler->copy_packet(k, ts->tv_sec, tcp_pkt.header, tcp_pkt.data_length, handshake.additional_bytes_needed)) {
+                    pkt_proc_counter_add(counters->reassembly_started, 1);
+                    latency.mark(latency_stage_parse);
                     return;
                 }
             }
             struct tls_client_hello hello;
             hello.parse(handshake.body);
+            latency.mark(latency_stage_parse);
             if (hello.is_not_empty()) {
                 struct json_object record{&buf};
                 struct json_object fps{record, "fingerprints"};
                 fps.print_key_value("tls", hello);
                 fps.close();
-                hello.write_json(record, global_vars.metadata_output);
+                hello.write_json(record, features::metadata());
                 /*
                  * output analysis (if it's configured)
                  */
-                if (global_vars.do_analysis) {
-                    write_analysis_from_extractor_and_flow_key(buf, hello, k);
+                if (features::analysis()) {
+                    latency.mark(latency_stage_json);
+                    pkt_proc_counter_add(counters->analysis_lookups, 1);
+                    if (write_analysis_from_extractor_and_flow_key(buf, hello, k, features::metadata())) {
+                        pkt_proc_counter_add(counters->analysis_hits, 1);
+                    }
+                    if (os_analysis.is_loaded()) {
+                        write_os_analysis(record, os_fingerprint_tls, hello, k, ts);
+                    }
+                    latency.mark(latency_stage_analysis);
                 }
                 write_flow_key(record, k);
                 record.print_key_timestamp("event_start", ts);
                 record.close();
+
+                // remember the fingerprint and server name for the
+                // record of the server's response, whose key is the
+                // reverse of this one
+                //
+                if (tls_clients == nullptr) {
+                    tls_clients = new tcp_context_table<struct tls_client_context>{2048, 10};
+                }
+                struct key server_key = k;
+                server_key.reverse();
+                if (tls_clients->insert(server_key, ts->tv_sec)->set(hello) == false) {
+                    tls_clients->remove(server_key);
+                }
             }
         }
         break;
@@ -474,17 +848,31 @@ void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
             if (handshake2.msg_type == handshake_type::certificate) {
                 certificate.parse(handshake2.body);
             }
+            latency.mark(latency_stage_parse);
 
             if (certificate.additional_bytes_needed && reassembler) {
                 // fprintf(stderr, "tls.handshake.certificate (%zu)\n", certificate.additional_bytes_needed);
                 if (reassembler->copy_packet(k, ts->tv_sec, tcp_pkt.header, tcp_pkt.data_length, certificate.additional_bytes_needed)) {
+                    pkt_proc_counter_add(counters->reassembly_started, 1);
+                    latency.mark(latency_stage_parse);
                     return;
                 }
             }
 
             bool have_hello = hello.is_not_empty();
             bool have_certificate = certificate.is_not_empty();
+            flow_is_done = have_certificate;   // otherwise, the certificate might be next
             if (have_hello || have_certificate) {
+
+                // the records of the server's response are joined with the
+                // client_hello that it answers, if that was seen, up to
+                // the one that has the certificate
+                //
+                const struct tls_client_context *client = nullptr;
+                if (tls_clients) {
+                    client = tls_clients->find(k, ts->tv_sec);
+                }
+
                 struct json_object record{&buf};
 
                 // output fingerprint
@@ -496,15 +884,24 @@ void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
 
                 // output certificate (always) and server_hello (if configured to)
                 //
-                if ((global_vars.metadata_output && have_hello) || have_certificate) {
+                if ((features::metadata() && have_hello) || have_certificate || client) {
                     struct json_object tls{record, "tls"};
+                    if (client) {
+                        client->write_json(tls);
+                    }
                     struct json_object tls_server{tls, "server"};
                     if (have_certificate) {
                         struct json_array server_certs{tls_server, "certs"};
-                        certificate.write_json(server_certs, global_vars.certs_json_output);
+                        certificate.write_json(server_certs, features::certs_json());
                         server_certs.close();
                     }
-                    if (global_vars.metadata_output && have_hello) {
+                    if (client && have_hello) {
+                        hello.write_selected_parameters(tls_server);
+                    }
+                    if (client && have_certificate) {
+                        certificate.write_leaf_summary(tls_server);
+                    }
+                    if (features::metadata() && have_hello) {
                         hello.write_json(tls_server);
                     }
                     tls_server.close();
@@ -513,6 +910,9 @@ void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
                 write_flow_key(record, k);
                 record.print_key_timestamp("event_start", ts);
                 record.close();
+                if (client && flow_is_done) {
+                    tls_clients->remove(k);
+                }
             }
         }
         break;
@@ -520,30 +920,35 @@ void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
         {
             struct http_response response;
             response.parse(pkt);
+            latency.mark(latency_stage_parse);
             if (response.is_not_empty()) {
                 struct json_object record{&buf};
                 struct json_object fps{record, "fingerprints"};
                 fps.print_key_value("http_server", response);
                 fps.close();
                 record.print_key_string("complete", response.headers.complete ? "yes" : "no");
-                if (global_vars.metadata_output) {
+                if (features::metadata()) {
                     response.write_json(record);
                 }
                 write_flow_key(record, k);
                 record.print_key_timestamp("event_start", ts);
                 record.close();
             }
+            tcp_verdicts.mark_inspect(k, ts->tv_sec);
+            flow_is_done = false;
         }
         break;
     case tcp_msg_type_ssh:
         {
             struct ssh_init_packet init_packet;
             init_packet.parse(pkt);
+            latency.mark(latency_stage_parse);
             struct json_object record{&buf};
             struct json_object fps{record, "fingerprints"};
             fps.print_key_value("ssh", init_packet);
             fps.close();
-            init_packet.write_json(record, global_vars.metadata_output);
+            init_packet.write_json(record, features::metadata());
+            flow_is_done = false;   // the KEX_INIT message is next
 #ifdef SSHM
             if (pkt.is_not_empty()) {
                 pkt.accept('\n');
@@ -552,7 +957,7 @@ void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
                 bin_pkt.parse(pkt);
                 struct ssh_kex_init kex_init;
                 kex_init.parse(bin_pkt.payload);
-                kex_init.write_json(record, global_vars.metadata_output);
+                kex_init.write_json(record, features::metadata());
             }
 #endif
             write_flow_key(record, k);
@@ -567,25 +972,54 @@ void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
             if (ssh_pkt.additional_bytes_needed && reassembler) {
                 // fprintf(stderr, "ssh.binary_packet (%zu)\n", ssh_pkt.additional_bytes_needed);
                 if (reassembler->copy_packet(k, ts->tv_sec, tcp_pkt.header, tcp_pkt.data_length, ssh_pkt.additional_bytes_needed)) {
+                    pkt_proc_counter_add(counters->reassembly_started, 1);
+                    latency.mark(latency_stage_parse);
                     return;
                 }
             }
             struct ssh_kex_init kex_init;
             kex_init.parse(ssh_pkt.payload);
+            latency.mark(latency_stage_parse);
             if (kex_init.is_not_empty()) {
                 struct json_object record{&buf};
                 struct json_object fps{record, "fingerprints"};
                 fps.print_key_value("ssh_kex", kex_init);
                 fps.close();
-                kex_init.write_json(record, global_vars.metadata_output);
+                kex_init.write_json(record, features::metadata());
                 write_flow_key(record, k);
                 record.print_key_timestamp("event_start", ts);
                 record.close();
             }
         }
         break;
+    case tcp_msg_type_http2_frame:
     case tcp_msg_type_unknown:
 
+        // the first request of an HTTP/2 connection whose preface was
+        // in an earlier packet; the frame patterns only let the
+        // prefilter accept that packet, and are otherwise unknown data
+        //
+        if (http2_connections) {
+            struct http2_connection *c = http2_connections->find(k, ts->tv_sec);
+            if (c) {
+                struct http2_request request;
+                request.settings = c->settings;
+                struct datum frames = pkt;
+                bool is_http2 = request.parse_frames(frames);
+                latency.mark(latency_stage_parse);
+                if (!is_http2 || request.have_headers || ++c->packets == http2_connection::max_packets) {
+                    write_http2_record(buf, request, k, ts, features::metadata());
+                    http2_connections->remove(k);
+                    msg_type = tcp_msg_type_http2;
+                } else {
+                    c->settings = request.settings;
+                    tcp_verdicts.mark_inspect(k, ts->tv_sec);
+                    flow_is_done = false;
+                }
+                break;
+            }
+        }
+
         if (is_new) {
             // if this packet is a TLS record, ignore it
             if (tls_record::is_valid(pkt)) {
@@ -604,5 +1038,30 @@ void stateful_pkt_proc::tcp_data_write_json(struct buffer_stream &buf,
         break;
     }
 
+    // a packet that has no record of its own carries that of an HTTP/2
+    // connection whose state has expired, if there is one
+    //
+    if (buf.length() == 0 && write_expired_http2_record(buf, ts->tv_sec, features::metadata())) {
+        msg_type = tcp_msg_type_http2;
+    }
+
+    if (buf.length() != initial_length) {
+        record_type = record_type_from_tcp_msg_type(msg_type);
+    }
+
+    // the returns above, which wait for reassembly, leave the verdict
+    // unchanged, as does a partially reassembled message
+    //
+    if (flow_is_done && (reassembler == nullptr || reassembler->has_segment(k) == false)) {
+        tcp_verdicts.mark_done(k, ts->tv_sec);
+    }
 }
 
+// instantiate the processors for the feature sets that
+// pkt_proc_new_from_config() selects
+//
+template size_t stateful_pkt_proc::write_json<pkt_proc_runtime_features>(void *, size_t, uint8_t *, size_t, struct timespec *);
+template size_t stateful_pkt_proc::write_json<pkt_proc_default_features>(void *, size_t, uint8_t *, size_t, struct timespec *);
+template size_t stateful_pkt_proc::write_json<pkt_proc_metadata_features>(void *, size_t, uint8_t *, size_t, struct timespec *);
+template size_t stateful_pkt_proc::write_json<pkt_proc_analysis_features>(void *, size_t, uint8_t *, size_t, struct timespec *);
+template size_t stateful_pkt_proc::write_json<pkt_proc_analysis_metadata_features>(void *, size_t, uint8_t *, size_t, struct timespec *);
@@ -16,6 +16,8 @@
 #include "packet.h"
 #include "rnd_pkt_drop.h"
 #include "llq.h"
+#include "eth.h"
+#include "latency.h"
 
 extern struct global_variables global_vars; /* defined in config.c */
 
@@ -33,19 +35,169 @@ struct pkt_proc_stats {
     size_t packets_written;
 };
 
+/*
+ * enum pkt_proc_record_type identifies the kind of a JSON record, by
+ * the message that it reports
+ */
+enum pkt_proc_record_type {
+    record_type_tcp         = 0,   // TCP SYN
+    record_type_tls         = 1,   // TLS client hello
+    record_type_tls_server  = 2,   // TLS server hello and certificates
+    record_type_http        = 3,   // HTTP request
+    record_type_http_server = 4,   // HTTP response
+    record_type_ssh         = 5,
+    record_type_ssh_kex     = 6,
+    record_type_tcp_data    = 7,   // --nonselected-tcp-data
+    record_type_quic        = 8,
+    record_type_wireguard   = 9,
+    record_type_dns         = 10,
+    record_type_dtls        = 11,
+    record_type_dhcp        = 12,
+    record_type_udp_data    = 13,  // --nonselected-udp-data
+    record_type_http2       = 14,  // HTTP/2 connection preface and request
+    num_record_types        = 15
+};
+
+const char *pkt_proc_record_type_name(enum pkt_proc_record_type type);
+
+/*
+ * the latency histograms of each message type are indexed by
+ * pkt_proc_record_type, and those of packets without a record by
+ * latency_no_record; pkt_proc_latency_message_name() returns the
+ * name of each index, or NULL for the unused ones
+ */
+static const unsigned int latency_no_record = num_record_types;
+
+static_assert(latency_no_record < LATENCY_MAX_MESSAGE_TYPES, "too many record types for the latency histograms");
+
+const char *pkt_proc_latency_message_name(unsigned int message);
+
+/*
+ * struct pkt_proc_counters holds the counters of a packet processor,
+ * which is used by a single thread.  That thread updates them with
+ * pkt_proc_counter_add() and pkt_proc_counter_set(), which are plain
+ * loads and stores, so that other threads can read them at any time
+ * with pkt_proc_counter_read(), without any locked instructions or
+ * shared cache lines on the packet path.  The flow table sizes and
+ * TCP verdict cache counters are copied into them once per batch,
+ * with stateful_pkt_proc::update_counters().
+ */
+struct pkt_proc_counters {
+    uint64_t packets;                    // packets processed
+    uint64_t bytes;
+    uint64_t records[num_record_types];  // JSON records written
+    uint64_t queue_drops;                // JSON records lost to a full output queue
+    uint64_t reassembly_started;         // messages held for TCP reassembly
+    uint64_t reassembly_completed;
+    uint64_t reassembly_expired;
+    uint64_t tcp_verdict_lookups;
+    uint64_t tcp_verdict_hits;
+    uint64_t tcp_verdict_evictions;
+    uint64_t analysis_lookups;           // fingerprints looked up with --analysis
+    uint64_t analysis_hits;              // ...that are in the fingerprint database
+    uint64_t quic_key_lookups;           // QUIC Initial keys looked up in the cache
+    uint64_t quic_key_hits;              // ...that did not need to be derived
+    uint64_t quic_reassembly_started;    // ClientHellos split across QUIC Initial packets
+    uint64_t quic_reassembly_completed;
+    uint64_t quic_reassembly_abandoned;
+    uint64_t ip_flows;                   // entries in the flow tables
+    uint64_t tcp_flows;
+    uint64_t tcp_segments;
+};
+
+inline void pkt_proc_counter_add(uint64_t &counter, uint64_t x) {
+    __atomic_store_n(&counter, counter + x, __ATOMIC_RELAXED);
+}
+
+inline void pkt_proc_counter_set(uint64_t &counter, uint64_t x) {
+    __atomic_store_n(&counter, x, __ATOMIC_RELAXED);
+}
+
+inline uint64_t pkt_proc_counter_read(const uint64_t &counter) {
+    return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+/*
+ * enum pkt_proc_feature holds flags for the output options that
+ * affect packet processing, which are otherwise read from global_vars
+ * and select_tcp_syn on each packet.  The JSON writer is a template
+ * on a set of these flags, so that each instantiation has no checks
+ * for the options in its set; the set pkt_proc_runtime_features
+ * instead checks all of the options at runtime, and is used for the
+ * combinations of options that do not have their own instantiation.
+ */
+enum pkt_proc_feature : unsigned int {
+    pkt_proc_metadata         = 1 << 0,   // global_vars.metadata_output
+    pkt_proc_dns_json         = 1 << 1,   // global_vars.dns_json_output
+    pkt_proc_certs_json       = 1 << 2,   // global_vars.certs_json_output
+    pkt_proc_analysis         = 1 << 3,   // global_vars.do_analysis
+    pkt_proc_tcp_initial_data = 1 << 4,   // global_vars.output_tcp_initial_data
+    pkt_proc_udp_initial_data = 1 << 5,   // global_vars.output_udp_initial_data
+    pkt_proc_tcp_syn          = 1 << 6,   // select_tcp_syn
+    pkt_proc_reassembly       = 1 << 7,   // USE_TCP_REASSEMBLY
+    pkt_proc_runtime_features = 1U << 31
+};
+
+/*
+ * the sets of features that have their own instantiation of the
+ * JSON writer; the other sets use pkt_proc_runtime_features
+ */
+#ifdef USE_TCP_REASSEMBLY
+static const unsigned int pkt_proc_default_features = pkt_proc_tcp_syn | pkt_proc_reassembly;
+#else
+static const unsigned int pkt_proc_default_features = pkt_proc_tcp_syn;
+#endif
+static const unsigned int pkt_proc_metadata_features = pkt_proc_default_features | pkt_proc_metadata;
+static const unsigned int pkt_proc_analysis_features = pkt_proc_default_features | pkt_proc_analysis;
+static const unsigned int pkt_proc_analysis_metadata_features = pkt_proc_analysis_features | pkt_proc_metadata;
+
+/*
+ * pkt_proc_features_from_config() returns the set of pkt_proc_feature
+ * flags for the current configuration, which must be called after
+ * proto_ident_config()
+ */
+unsigned int pkt_proc_features_from_config();
+
+/*
+ * tcp_verdict_cache_write_stats(f) writes the number of lookups in,
+ * and hits on, the TCP verdict caches of all of the packet processors
+ * that have been deleted so far to f, if there were any lookups
+ */
+void tcp_verdict_cache_write_stats(FILE *f);
+
+struct quic_crypto_engine;       // see quic.h
+struct quic_crypto_reassembler;
+struct http2_connection;         // see http2.h
+struct tls_client_context;       // see tls.h
+
 struct stateful_pkt_proc {
     struct packet_filter pf;
     struct flow_table ip_flow_table;
     struct flow_table_tcp tcp_flow_table;
+    struct tcp_verdict_cache tcp_verdicts;
     struct tcp_reassembler reassembler;
     struct tcp_reassembler *reassembler_ptr;
+    struct pkt_proc_counters local_counters;
+    struct pkt_proc_counters *counters;   // local_counters, or those set by pkt_proc::set_counters()
+    struct latency_tracker latency;       // see pkt_proc::set_latency_histograms()
+    struct quic_crypto_engine *quic_crypto;   // created on the first QUIC packet
+    struct quic_crypto_reassembler *quic_reassembler;   // ...that is decrypted
+    struct tcp_context_table<struct http2_connection> *http2_connections;   // created on the first HTTP/2 preface
+    struct tcp_context_table<struct tls_client_context> *tls_clients;       // ...and TLS client_hello
 
     explicit stateful_pkt_proc(const char *filter) :
         pf{},
         ip_flow_table{65536},
         tcp_flow_table{65536},
+        tcp_verdicts{65536},
         reassembler{65536},
-        reassembler_ptr{&reassembler}
+        reassembler_ptr{&reassembler},
+        local_counters{},
+        counters{&local_counters},
+        quic_crypto{nullptr},
+        quic_reassembler{nullptr},
+        http2_connections{nullptr},
+        tls_clients{nullptr}
     {
         if (packet_filter_init(&pf, filter) == status_err) {
             throw "could not initialize packet filter";
@@ -59,9 +211,26 @@ struct stateful_pkt_proc {
 
     }
 
+    // the destructor deletes the lazily created tables above, so a
+    // processor cannot be copied
+    //
+    ~stateful_pkt_proc();
+    stateful_pkt_proc(const stateful_pkt_proc &) = delete;
+    stateful_pkt_proc &operator=(const stateful_pkt_proc &) = delete;
+
     void finalize() {
         reassembler.count_all();
         tcp_flow_table.count_all();
+        tcp_verdicts.count_all();
+    }
+
+    void update_counters() {
+        pkt_proc_counter_set(counters->tcp_verdict_lookups, tcp_verdicts.lookups);
+        pkt_proc_counter_set(counters->tcp_verdict_hits, tcp_verdicts.hits);
+        pkt_proc_counter_set(counters->tcp_verdict_evictions, tcp_verdicts.evictions);
+        pkt_proc_counter_set(counters->ip_flows, ip_flow_table.table.size());
+        pkt_proc_counter_set(counters->tcp_flows, tcp_flow_table.table.size());
+        pkt_proc_counter_set(counters->tcp_segments, reassembler.segment_table.size());
     }
 
     size_t write_json(void *buffer,
@@ -69,39 +238,157 @@ struct stateful_pkt_proc {
                       uint8_t *packet,
                       size_t length,
                       struct timespec *ts) {
-        return write_json(buffer, buffer_size, packet, length, ts, reassembler_ptr);
+        return write_json<pkt_proc_runtime_features>(buffer, buffer_size, packet, length, ts);
     }
 
+    /*
+     * write_json<F>() processes a packet with the set F of
+     * pkt_proc_feature flags; it is instantiated in pkt_proc.cc for
+     * pkt_proc_runtime_features and the sets that
+     * pkt_proc_new_from_config() selects
+     */
+    template <unsigned int F>
     size_t write_json(void *buffer,
-                              size_t buffer_size,
-                              uint8_t *packet,
-                              size_t length,
-                              struct timespec *ts,
-                              struct tcp_reassembler *reassembler);
+                      size_t buffer_size,
+                      uint8_t *packet,
+                      size_t length,
+                      struct timespec *ts);
 
+    /*
+     * prefetch_flow(packet, length) reads the flow key of a TCP
+     * packet, and prefetches its entry in the TCP verdict cache,
+     * which write_json() looks up for every TCP packet other than a
+     * SYN, so that a batch of packets can be processed with the
+     * lookups for later packets overlapping the processing of
+     * earlier ones.  Only the common encapsulations (Ethernet, with
+     * at most one VLAN tag, and IPv4 or IPv6 without extension
+     * headers) are read; other packets are not prefetched.  It is
+     * always inlined, for the reason given at
+     * tcp_verdict_cache::prefetch().
+     */
+    __attribute__((always_inline)) void prefetch_flow(const uint8_t *packet, size_t length) {
+
+        // the flow key is read from fixed offsets, and is the same as the
+        // one that write_json() builds for a TCP packet
+        //
+        const size_t eth_hdr_len = 14;
+        const size_t vlan_hdr_len = 4;
+        const size_t ipv6_hdr_len = 40;
+        const uint8_t *end = packet + length;
+        const uint8_t *p = packet + eth_hdr_len;
+        if (p > end) {
+            return;
+        }
+        uint16_t ethertype = (p[-2] << 8) | p[-1];
+        if (ethertype == ETH_TYPE_VLAN) {
+            p += vlan_hdr_len;
+            if (p > end) {
+                return;
+            }
+            ethertype = (p[-2] << 8) | p[-1];
+        }
+
+        struct key k;
+        const uint8_t *tcp;
+        if (ethertype == ETH_TYPE_IP) {
+            if (p + 20 > end || (p[0] >> 4) != 4 || (p[0] & 0x0f) < 5 || p[9] != 6) {
+                return;
+            }
+            memcpy(&k.addr.ipv4.src, p + 12, sizeof(k.addr.ipv4.src));
+            memcpy(&k.addr.ipv4.dst, p + 16, sizeof(k.addr.ipv4.dst));
+            k.ip_vers = 4;
+            tcp = p + (p[0] & 0x0f) * 4;
+        } else if (ethertype == ETH_TYPE_IPV6) {
+            if (p + ipv6_hdr_len > end || (p[0] >> 4) != 6 || p[6] != 6) {
+                return;
+            }
+            memcpy(&k.addr.ipv6.src, p + 8, sizeof(k.addr.ipv6.src));
+            memcpy(&k.addr.ipv6.dst, p + 24, sizeof(k.addr.ipv6.dst));
+            k.ip_vers = 6;
+            tcp = p + ipv6_hdr_len;
+        } else {
+            return;
+        }
+        if (tcp + 4 > end) {
+            return;
+        }
+        k.protocol = 6;
+        k.src_port = (tcp[0] << 8) | tcp[1];
+        k.dst_port = (tcp[2] << 8) | tcp[3];
+        tcp_verdicts.prefetch(k);
+    }
+
+    /*
+     * tcp_data_write_json<F>() writes the record for the message in
+     * the TCP data pkt, if any, into buf, and sets record_type to its type
+     */
+    template <unsigned int F>
     void tcp_data_write_json(struct buffer_stream &buf,
                              struct datum &pkt,
                              const struct key &k,
                              struct tcp_packet &tcp_pkt,
                              struct timespec *ts,
-                             struct tcp_reassembler *reassembler);
+                             struct tcp_reassembler *reassembler,
+                             enum pkt_proc_record_type &record_type);
+
+    /*
+     * write_expired_http2_record(buf, sec, output_metadata) writes the
+     * record of the next HTTP/2 connection whose state has expired
+     * into buf, if reap() finds one, and returns true if it did
+     */
+    bool write_expired_http2_record(struct buffer_stream &buf, unsigned int sec, bool output_metadata);
 
 };
 
 
+/*
+ * struct packet_descriptor identifies a packet in a batch that is
+ * passed to pkt_proc::apply_batch()
+ */
+struct packet_descriptor {
+    struct packet_info info;
+    uint8_t *eth;
+};
+
 /*
  * struct pkt_proc is a packet processor; this abstract class defines
  * the interface to packet processing that can be used by packet
  * capture or packet file readers.
+ *
+ * apply_batch(pkts, num_pkts) processes num_pkts packets, which is
+ * at most max_batch_size, in order; its default implementation calls
+ * apply() for each of them, and processors can override it to work
+ * across the whole batch.
+ *
+ * set_counters(c) makes the processor keep its counters in c, where
+ * other threads can read them (see metrics.h), instead of in its own
+ * copy.
+ *
+ * set_latency_histograms(h) makes the processor record the latency of
+ * one of every h->sampling packets in h, if it was compiled with
+ * PKT_PROC_LATENCY (see latency.h); only the JSON writers do so.
  */
 
 struct pkt_proc {
+    static const size_t max_batch_size = 64;
+
     virtual void apply(struct packet_info *pi, uint8_t *eth) = 0;
+    virtual void apply_batch(struct packet_descriptor *pkts, size_t num_pkts) {
+        for (size_t i = 0; i < num_pkts; i++) {
+            apply(&pkts[i].info, pkts[i].eth);
+        }
+    }
     virtual void flush() = 0;
     virtual void finalize() = 0;
+    virtual void set_counters(struct pkt_proc_counters *c) {
+        counters = c;
+    }
+    virtual void set_latency_histograms(struct latency_histograms *) { }
     virtual ~pkt_proc() {};
     size_t bytes_written = 0;
     size_t packets_written = 0;
+    struct pkt_proc_counters own_counters{};
+    struct pkt_proc_counters *counters = &own_counters;
 };
 
 
@@ -120,10 +407,12 @@ struct pkt_proc_pcap_writer_llq : public pkt_proc {
     void apply(struct packet_info *pi, uint8_t *eth) override {
         extern int rnd_pkt_drop_percent_accept;  /* defined in rnd_pkt_drop.c */
 
+        pkt_proc_counter_add(counters->packets, 1);
+        pkt_proc_counter_add(counters->bytes, pi->len);
         if (rnd_pkt_drop_percent_accept && drop_this_packet()) {
             return;  /* random packet drop configured, and this packet got selected to be discarded */
         }
-        pcap_queue_write(llq, eth, pi->len, pi->ts.tv_sec, pi->ts.tv_nsec / 1000, block);
+        pcap_queue_write(llq, eth, pi->caplen, pi->ts.tv_sec, pi->ts.tv_nsec / 1000, block);
     }
 
     void finalize() override { }
@@ -157,10 +446,12 @@ struct pkt_proc_pcap_writer : public pkt_proc {
     void apply(struct packet_info *pi, uint8_t *eth) override {
         extern int rnd_pkt_drop_percent_accept;  /* defined in rnd_pkt_drop.c */
 
+        pkt_proc_counter_add(counters->packets, 1);
+        pkt_proc_counter_add(counters->bytes, pi->len);
         if (rnd_pkt_drop_percent_accept && drop_this_packet()) {
             return;  /* random packet drop configured, and this packet got selected to be discarded */
         }
-        pcap_file_write_packet_direct(&pcap_file, eth, pi->len, pi->ts.tv_sec, pi->ts.tv_nsec / 1000);
+        pcap_file_write_packet_direct(&pcap_file, eth, pi->caplen, pi->ts.tv_sec, pi->ts.tv_nsec / 1000);
     }
 
     void finalize() override { }
@@ -194,19 +485,27 @@ struct pkt_proc_filter_pcap_writer : public pkt_proc {
 
     void apply(struct packet_info *pi, uint8_t *eth) override {
         uint8_t *packet = eth;
-        unsigned int length = pi->len;
+        unsigned int length = pi->caplen;
 
         extern int rnd_pkt_drop_percent_accept;  /* defined in rnd_pkt_drop.c */
 
+        pkt_proc_counter_add(counters->packets, 1);
+        pkt_proc_counter_add(counters->bytes, pi->len);
         if (rnd_pkt_drop_percent_accept && drop_this_packet()) {
             return;  /* random packet drop configured, and this packet got selected to be discarded */
         }
 
         uint8_t buf[LLQ_MSG_SIZE];
         if (processor.write_json(buf, LLQ_MSG_SIZE, packet, length, &pi->ts) != 0) {
-            pcap_file_write_packet_direct(&pcap_file, eth, pi->len, pi->ts.tv_sec, pi->ts.tv_nsec / 1000);
+            pcap_file_write_packet_direct(&pcap_file, eth, pi->caplen, pi->ts.tv_sec, pi->ts.tv_nsec / 1000);
         }
+        processor.update_counters();
+
+    }
 
+    void set_counters(struct pkt_proc_counters *c) override {
+        counters = c;
+        processor.counters = c;
     }
 
     void finalize() override { }
@@ -226,11 +525,14 @@ struct pkt_proc_filter_pcap_writer : public pkt_proc {
  * struct pkt_proc_json_writer_llq represents a packet processing object
  * that writes out a JSON representation of fingerprints, metadata,
  * flow keys, and event time to a queue that is then written to a file
- * by a dedicated output thread.
+ * by a dedicated output thread.  F is the set of pkt_proc_feature
+ * flags that it processes packets with.
  */
+template <unsigned int F>
 struct pkt_proc_json_writer_llq : public pkt_proc {
     struct ll_queue *llq;
     bool block;
+    unsigned int prefetch_distance;
     struct stateful_pkt_proc processor;
 
     /*
@@ -242,23 +544,113 @@ struct pkt_proc_json_writer_llq : public pkt_proc {
      * max_records is nonzero, then it defines the maximum number of
      * records (lines) per file; after that limit is reached, file
      * rotation will take place.
+     *
+     * prefetch_distance is the number of packets in a batch between
+     * the one whose flow table entry is prefetched and the one
+     * being processed; the packet data itself is prefetched twice as
+     * far ahead.  Zero disables prefetching.
      */
-    explicit pkt_proc_json_writer_llq(struct ll_queue *llq_ptr, const char *filter, bool blocking) :
+    explicit pkt_proc_json_writer_llq(struct ll_queue *llq_ptr,
+                                      const char *filter,
+                                      bool blocking,
+                                      unsigned int prefetch=DEFAULT_PREFETCH_DISTANCE) :
         block{blocking},
+        prefetch_distance{prefetch},
         processor{filter}
     {
         llq = llq_ptr;
     }
 
     void apply(struct packet_info *pi, uint8_t *eth) override {
+        pkt_proc_counter_add(counters->packets, 1);
+        pkt_proc_counter_add(counters->bytes, pi->len);
+        processor.latency.begin(latency_no_record);
         struct llq_msg *msg = llq->init_msg(block, pi->ts.tv_sec, pi->ts.tv_nsec);
+        processor.latency.mark(latency_stage_enqueue);
         if (msg) {
-            size_t write_len = processor.write_json(msg->buf, LLQ_MSG_SIZE, eth, pi->len, &(msg->ts));
+            size_t write_len = processor.template write_json<F>(msg->buf, LLQ_MSG_SIZE, eth, pi->caplen, &(msg->ts));
             if (write_len > 0) {
                 msg->send(write_len);
                 llq->increment_widx();
             }
+        } else {
+            pkt_proc_counter_add(counters->queue_drops, 1);
         }
+        processor.latency.mark(latency_stage_enqueue);
+        processor.latency.end();
+        processor.update_counters();
+    }
+
+    // apply_batch() processes the batch in a pipeline: the data of
+    // packet i + 2d is prefetched, the flow key of packet i + d is
+    // read and its verdict cache bucket is prefetched, and packet i
+    // is processed, where d is the prefetch distance; the records for
+    // the whole batch are written into the queue and then published
+    // with a single memory barrier
+    //
+    void apply_batch(struct packet_descriptor *pkts, size_t num_pkts) override {
+        static_assert(max_batch_size <= LLQ_DEPTH, "a batch must fit in the queue");
+
+        size_t d = prefetch_distance;
+        if (d) {
+            for (size_t i = 0; i < 2 * d && i < num_pkts; i++) {
+                prefetch_packet(pkts[i]);
+            }
+            for (size_t i = 0; i < d && i < num_pkts; i++) {
+                processor.prefetch_flow(pkts[i].eth, pkts[i].info.caplen);
+            }
+        }
+
+        int first = llq->widx;
+        unsigned int num_msgs = 0;
+        uint64_t bytes = 0;
+        uint64_t queue_drops = 0;
+        for (size_t i = 0; i < num_pkts; i++) {
+            if (d) {
+                if (i + 2 * d < num_pkts) {
+                    prefetch_packet(pkts[i + 2 * d]);
+                }
+                if (i + d < num_pkts) {
+                    processor.prefetch_flow(pkts[i + d].eth, pkts[i + d].info.caplen);
+                }
+            }
+            struct packet_info *pi = &pkts[i].info;
+            bytes += pi->len;
+            processor.latency.begin(latency_no_record);
+            struct llq_msg *msg = llq->init_msg(block, pi->ts.tv_sec, pi->ts.tv_nsec);
+            processor.latency.mark(latency_stage_enqueue);
+            if (msg) {
+                size_t write_len = processor.template write_json<F>(msg->buf, LLQ_MSG_SIZE, pkts[i].eth, pi->caplen, &(msg->ts));
+                if (write_len > 0) {
+                    msg->len = write_len;
+                    llq->increment_widx();
+                    num_msgs++;
+                }
+            } else {
+                queue_drops++;
+            }
+            processor.latency.mark(latency_stage_enqueue);
+            processor.latency.end();
+        }
+        llq->publish(first, num_msgs);
+        pkt_proc_counter_add(counters->packets, num_pkts);
+        pkt_proc_counter_add(counters->bytes, bytes);
+        pkt_proc_counter_add(counters->queue_drops, queue_drops);
+        processor.update_counters();
+    }
+
+    static void prefetch_packet(const struct packet_descriptor &p) {
+        __builtin_prefetch(p.eth);
+        __builtin_prefetch(p.eth + 64);   // the end of an IPv6 and TCP header
+    }
+
+    void set_counters(struct pkt_proc_counters *c) override {
+        counters = c;
+        processor.counters = c;
+    }
+
+    void set_latency_histograms(struct latency_histograms *h) override {
+        processor.latency.set_histograms(h);
     }
 
     void finalize() override {
@@ -288,18 +680,26 @@ struct pkt_proc_filter_pcap_writer_llq : public pkt_proc {
 
     void apply(struct packet_info *pi, uint8_t *eth) override {
         uint8_t *packet = eth;
-        unsigned int length = pi->len;
+        unsigned int length = pi->caplen;
 
         extern int rnd_pkt_drop_percent_accept;  /* defined in rnd_pkt_drop.c */
 
+        pkt_proc_counter_add(counters->packets, 1);
+        pkt_proc_counter_add(counters->bytes, pi->len);
         if (rnd_pkt_drop_percent_accept && drop_this_packet()) {
             return;  /* random packet drop configured, and this packet got selected to be discarded */
         }
 
         uint8_t buf[LLQ_MSG_SIZE];
         if (processor.write_json(buf, LLQ_MSG_SIZE, packet, length, &pi->ts) != 0) {
-            pcap_queue_write(llq, eth, pi->len, pi->ts.tv_sec, pi->ts.tv_nsec / 1000, block);
+            pcap_queue_write(llq, eth, pi->caplen, pi->ts.tv_sec, pi->ts.tv_nsec / 1000, block);
         }
+        processor.update_counters();
+    }
+
+    void set_counters(struct pkt_proc_counters *c) override {
+        counters = c;
+        processor.counters = c;
     }
 
     void finalize() override { }
@@ -318,7 +718,7 @@ struct pkt_proc_dumper : public pkt_proc {
     pkt_proc_dumper() {}
 
     void apply(struct packet_info *pi, uint8_t *eth) override {
-        packet_fprintf(stdout, eth, pi->len, pi->ts.tv_sec, pi->ts.tv_nsec / 1000);
+        packet_fprintf(stdout, eth, pi->caplen, pi->ts.tv_sec, pi->ts.tv_nsec / 1000);
     }
 
     void finalize() override { }
@@ -0,0 +1,444 @@
+/*
+ * pkt_proc_bench.cc
+ *
+ * benchmarks the throughput of the packet processors over a corpus of
+ * pcap files, which are replayed from memory
+ *
+ * usage: pkt_proc_bench [--repeat n] [--json] [--resources d] [--variant v] corpus...
+ *
+ * Each corpus argument is a pcap file, or a directory whose .pcap and
+ * .mcap files are used.  All of the packets are read into memory, and
+ * then each variant processes the whole corpus once to warm up the
+ * caches, and then repeat times (default: 5), which are timed, with a
+ * new packet processor for each pass, in batches of
+ * pkt_proc::max_batch_size packets, as a capture thread does; the
+ * output queue is drained after each batch, as the output thread
+ * would.  The variants are the JSON writer with the default options,
+ * --metadata, --certs-json, --analysis, --analysis and --metadata,
+ * with and without TCP reassembly, and the filter PCAP writer.
+ *
+ * The --analysis variants are skipped, with a warning, if their
+ * resources cannot be loaded from the directory d (or the default
+ * resource directories).
+ *
+ * Each variant is run in a child process, so that the resources
+ * loaded for --analysis do not affect the other variants.  A forked
+ * child inherits the peak resident set size of its parent, so the
+ * child resets it (through /proc/self/clear_refs) before it starts,
+ * and reports the peak that it reaches (VmHWM), which includes the
+ * corpus; if that is not possible, ru_maxrss is reported instead.
+ * The rates and ns/packet are those of the median pass.  With
+ * --json, the results are written as one JSON object per line, for
+ * regression tracking; otherwise, as a table.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "pkt_proc.h"
+#include "analysis.h"
+#include "utils.h"
+
+struct global_variables global_vars;   /* normally defined in config.c */
+
+struct packet {
+    struct timespec ts;
+    std::vector<uint8_t> data;
+};
+
+// read_pcap_file(filename, packets) reads all of the packets in a
+// pcap file (with microsecond or nanosecond timestamps) into packets
+//
+static bool read_pcap_file(const char *filename, std::vector<struct packet> &packets) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open file %s\n", filename);
+        return false;
+    }
+    uint32_t file_header[6];
+    if (fread(file_header, sizeof(file_header), 1, f) != 1
+        || (file_header[0] != 0xa1b2c3d4 && file_header[0] != 0xa1b23c4d)) {
+        fprintf(stderr, "error: %s is not a pcap file in host byte order\n", filename);
+        fclose(f);
+        return false;
+    }
+    long nsec_per_tick = file_header[0] == 0xa1b2c3d4 ? 1000 : 1;
+    uint32_t packet_header[4];
+    while (fread(packet_header, sizeof(packet_header), 1, f) == 1) {
+        struct packet p;
+        p.ts.tv_sec = packet_header[0];
+        p.ts.tv_nsec = packet_header[1] * nsec_per_tick;
+        p.data.resize(packet_header[2]);
+        if (fread(p.data.data(), 1, p.data.size(), f) != p.data.size()) {
+            break;
+        }
+        packets.push_back(p);
+    }
+    fclose(f);
+    return true;
+}
+
+// read_corpus(path, packets, files) reads the pcap file path, or the
+// .pcap and .mcap files in the directory path, in name order
+//
+static bool read_corpus(const char *path, std::vector<struct packet> &packets, std::vector<std::string> &files) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "error: could not open %s\n", path);
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        files.push_back(path);
+        return read_pcap_file(path, packets);
+    }
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "error: could not open directory %s\n", path);
+        return false;
+    }
+    std::vector<std::string> names;
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        std::string name = d->d_name;
+        size_t dot = name.rfind('.');
+        if (dot != std::string::npos && (name.substr(dot) == ".pcap" || name.substr(dot) == ".mcap")) {
+            names.push_back(std::string(path) + "/" + name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (const auto &n : names) {
+        files.push_back(n);
+        if (read_pcap_file(n.c_str(), packets) == false) {
+            return false;
+        }
+    }
+    return true;
+}
+
+enum reassembly_option {
+    reassembly_build_default,   // as selected by USE_TCP_REASSEMBLY
+    reassembly_on,
+    reassembly_off
+};
+
+struct variant {
+    const char *name;
+    bool pcap_output;           // filter PCAP writer, instead of JSON writer
+    bool metadata;
+    bool certs_json;
+    bool analysis;
+    enum reassembly_option reassembly;
+};
+
+static const struct variant variants[] = {
+    { "json",                   false, false, false, false, reassembly_build_default },
+    { "json-metadata",          false, true,  false, false, reassembly_build_default },
+    { "json-certs-json",        false, false, true,  false, reassembly_build_default },
+    { "json-analysis",          false, false, false, true,  reassembly_build_default },
+    { "json-analysis-metadata", false, true,  false, true,  reassembly_build_default },
+    { "json-reassembly",        false, false, false, false, reassembly_on            },
+    { "json-no-reassembly",     false, false, false, false, reassembly_off           },
+    { "filter-pcap",            true,  false, false, false, reassembly_build_default },
+};
+
+struct result {
+    bool ok;
+    bool skipped;               // the resources for --analysis are missing
+    uint64_t packets;           // per pass
+    uint64_t bytes;
+    uint64_t records;
+    uint64_t median_ns;         // of a pass
+    uint64_t min_ns;
+    long peak_rss_kb;
+};
+
+// new_processor(v, llq, cfg) returns a packet processor for the
+// variant v, as mercury would create it, except that the reassembly
+// options that differ from the build's default use the JSON writer
+// with the runtime feature checks and the reassembler set explicitly
+//
+static struct pkt_proc *new_processor(const struct variant &v, struct ll_queue *llq, struct mercury_config &cfg) {
+    if (v.reassembly != reassembly_build_default) {
+        auto *p = new pkt_proc_json_writer_llq<pkt_proc_runtime_features>(llq, NULL, false);
+        p->processor.reassembler_ptr = v.reassembly == reassembly_on ? &p->processor.reassembler : nullptr;
+        return p;
+    }
+    return pkt_proc_new_from_config(&cfg, 0, llq);
+}
+
+// drain(llq) removes all of the messages from the queue, as the
+// output thread does, and returns their number
+//
+static uint64_t drain(struct ll_queue *llq) {
+    uint64_t count = 0;
+    while (__atomic_load_n(&llq->msgs[llq->ridx].used, __ATOMIC_ACQUIRE)) {
+        llq->msgs[llq->ridx].used = 0;
+        llq->ridx = (llq->ridx + 1) % LLQ_DEPTH;
+        count++;
+    }
+    return count;
+}
+
+// reset_peak_rss() sets the peak resident set size of this process
+// to its current size, and returns false if it could not (it needs
+// Linux 4.0 or later)
+//
+static bool reset_peak_rss() {
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (f == NULL) {
+        return false;
+    }
+    bool ok = fputs("5", f) >= 0;
+    return fclose(f) == 0 && ok;
+}
+
+// peak_rss_kb() returns the peak resident set size of this process,
+// in kilobytes, as reported by /proc/self/status, or -1
+//
+static long peak_rss_kb() {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL) {
+        return -1;
+    }
+    long kb = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+// run(v, packets, repeat, resources) processes the packets with the
+// variant v; it is called in a child process, since it sets the
+// global output options
+//
+static struct result run(const struct variant &v, std::vector<struct packet> &packets, unsigned int repeat, const char *resources) {
+    struct result r;
+    memset(&r, 0, sizeof(r));
+    bool peak_was_reset = reset_peak_rss();
+
+    if (proto_ident_config(NULL) != status_ok) {
+        fprintf(stderr, "error: could not configure protocol identification\n");
+        return r;
+    }
+    global_vars.metadata_output = v.metadata;
+    global_vars.certs_json_output = v.certs_json;
+    global_vars.do_analysis = v.analysis;
+    if (v.analysis && analysis_init(0, resources, asn_lookup_lctrie) != 0) {
+        fprintf(stderr, "warning: could not initialize analysis (see --resources); skipping %s\n", v.name);
+        r.skipped = true;
+        return r;
+    }
+
+    struct mercury_config cfg = mercury_config_init();
+    if (v.pcap_output) {
+        cfg.write_filename = (char *)"bench.pcap";   // not opened; the queue is drained instead
+        cfg.filter = true;
+    }
+
+    struct ll_queue *llq = (struct ll_queue *)calloc(1, sizeof(struct ll_queue));
+    if (llq == NULL) {
+        fprintf(stderr, "error: could not allocate output queue\n");
+        return r;
+    }
+
+    std::vector<struct packet_descriptor> batch(pkt_proc::max_batch_size);
+    std::vector<uint64_t> pass_ns;
+    for (unsigned int pass = 0; pass <= repeat; pass++) {   // pass 0 is the warm-up
+        struct pkt_proc *processor = new_processor(v, llq, cfg);
+        if (processor == NULL) {
+            fprintf(stderr, "error: could not create packet processor for %s\n", v.name);
+            free(llq);
+            return r;
+        }
+        uint64_t records = 0;
+        struct timer t;
+        timer_start(&t);
+        for (size_t i = 0; i < packets.size(); i += pkt_proc::max_batch_size) {
+            size_t n = std::min(packets.size() - i, pkt_proc::max_batch_size);
+            for (size_t j = 0; j < n; j++) {
+                struct packet &p = packets[i + j];
+                batch[j].info.ts = p.ts;
+                batch[j].info.caplen = p.data.size();
+                batch[j].info.len = p.data.size();
+                batch[j].eth = p.data.data();
+            }
+            processor->apply_batch(batch.data(), n);
+            records += drain(llq);
+        }
+        uint64_t ns = timer_stop(&t);
+        if (pass > 0) {
+            pass_ns.push_back(ns);
+        }
+        r.records = records;
+        delete processor;
+    }
+    free(llq);
+
+    r.packets = packets.size();
+    for (const auto &p : packets) {
+        r.bytes += p.data.size();
+    }
+    std::sort(pass_ns.begin(), pass_ns.end());
+    r.median_ns = pass_ns[pass_ns.size() / 2];
+    r.min_ns = pass_ns[0];
+    r.peak_rss_kb = peak_was_reset ? peak_rss_kb() : -1;
+    if (r.peak_rss_kb < 0) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        r.peak_rss_kb = ru.ru_maxrss;
+    }
+    r.ok = true;
+
+    return r;
+}
+
+// run_in_child(v, ...) calls run() in a child process, and returns
+// its result through a pipe
+//
+static struct result run_in_child(const struct variant &v, std::vector<struct packet> &packets, unsigned int repeat, const char *resources) {
+    struct result r;
+    memset(&r, 0, sizeof(r));
+
+    int fd[2];
+    if (pipe(fd) != 0) {
+        perror("could not create pipe");
+        return r;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("could not fork");
+        close(fd[0]);
+        close(fd[1]);
+        return r;
+    }
+    if (pid == 0) {
+        close(fd[0]);
+        r = run(v, packets, repeat, resources);
+        ssize_t unused = write(fd[1], &r, sizeof(r));
+        (void)unused;
+        _exit(0);
+    }
+    close(fd[1]);
+    if (read(fd[0], &r, sizeof(r)) != sizeof(r)) {
+        memset(&r, 0, sizeof(r));
+    }
+    close(fd[0]);
+    waitpid(pid, NULL, 0);
+
+    return r;
+}
+
+static void usage(const char *progname) {
+    fprintf(stderr, "usage: %s [--repeat n] [--json] [--resources d] [--variant v] corpus...\n", progname);
+    fprintf(stderr, "variants:");
+    for (const auto &v : variants) {
+        fprintf(stderr, " %s", v.name);
+    }
+    fprintf(stderr, "\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+
+    unsigned int repeat = 5;
+    bool json = false;
+    const char *resources = NULL;
+    const char *only = NULL;
+    std::vector<const char *> corpus;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (strcmp(argv[i], "--resources") == 0 && i + 1 < argc) {
+            resources = argv[++i];
+        } else if (strcmp(argv[i], "--variant") == 0 && i + 1 < argc) {
+            only = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        } else {
+            corpus.push_back(argv[i]);
+        }
+    }
+    if (corpus.size() == 0) {
+        usage(argv[0]);
+    }
+    if (only && std::none_of(std::begin(variants), std::end(variants), [only](const struct variant &v) { return strcmp(v.name, only) == 0; })) {
+        usage(argv[0]);
+    }
+    if (repeat == 0) {
+        repeat = 1;
+    }
+
+    std::vector<struct packet> packets;
+    std::vector<std::string> files;
+    for (const char *c : corpus) {
+        if (read_corpus(c, packets, files) == false) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (packets.size() == 0) {
+        fprintf(stderr, "error: no packets in corpus\n");
+        return EXIT_FAILURE;
+    }
+
+    if (json == false) {
+        fprintf(stdout, "corpus: %zu files, %zu packets, repeat: %u\n", files.size(), packets.size(), repeat);
+        fprintf(stdout, "%-24s %12s %12s %12s %10s %10s %10s\n",
+                "variant", "packets/s", "MB/s", "records/s", "ns/packet", "min ns/pkt", "peak RSS KB");
+    }
+
+    unsigned int failures = 0;
+    for (const auto &v : variants) {
+        if (only && strcmp(only, v.name) != 0) {
+            continue;
+        }
+        struct result r = run_in_child(v, packets, repeat, resources);
+        if (!r.ok) {
+            if (!r.skipped) {
+                failures++;
+            }
+            continue;
+        }
+        double seconds = r.median_ns / 1e9;
+        double packets_per_sec = r.packets / seconds;
+        double bytes_per_sec = r.bytes / seconds;
+        double records_per_sec = r.records / seconds;
+        double ns_per_packet = (double)r.median_ns / r.packets;
+        double min_ns_per_packet = (double)r.min_ns / r.packets;
+        if (json) {
+            fprintf(stdout, "{\"bench\":\"pkt_proc\",\"variant\":\"%s\",\"files\":%zu,\"repeat\":%u,"
+                    "\"packets\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"records\":%" PRIu64 ","
+                    "\"packets_per_sec\":%.0f,\"bytes_per_sec\":%.0f,\"records_per_sec\":%.0f,"
+                    "\"ns_per_packet\":%.1f,\"min_ns_per_packet\":%.1f,\"peak_rss_kb\":%ld}\n",
+                    v.name, files.size(), repeat, r.packets, r.bytes, r.records,
+                    packets_per_sec, bytes_per_sec, records_per_sec,
+                    ns_per_packet, min_ns_per_packet, r.peak_rss_kb);
+        } else {
+            fprintf(stdout, "%-24s %12.0f %12.1f %12.0f %10.1f %10.1f %10ld\n",
+                    v.name, packets_per_sec, bytes_per_sec / 1e6, records_per_sec,
+                    ns_per_packet, min_ns_per_packet, r.peak_rss_kb);
+        }
+        fflush(stdout);
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
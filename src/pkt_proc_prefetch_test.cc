@@ -0,0 +1,309 @@
+/*
+ * pkt_proc_prefetch_test.cc
+ *
+ * benchmarks the prefetching of packet data and flow table entries in
+ * pkt_proc_json_writer_llq::apply_batch(), for a range of prefetch
+ * distances, with the hardware counters of perf_event_open(2)
+ *
+ * usage: pkt_proc_prefetch_test [flows] [rounds]
+ *
+ * The traffic is synthetic: a SYN for each of the flows (default:
+ * 60000), then rounds (default: 4) in which each flow sends a data
+ * packet, in a different random order in each round, so that the
+ * flow table lookups rarely hit the cache.  As in a TPACKETv3 block,
+ * the packets are packed one after another, each in a frame whose
+ * length is between 96 and 1536 bytes, and before each batch is
+ * processed, its frames are filled in, as a NIC that writes into the
+ * cache would do; that is not measured, and neither are the SYNs.
+ * The records written must be the same for each distance.
+ *
+ * The counters are for user space only; if they cannot be opened
+ * (e.g. in a container, or with kernel.perf_event_paranoid > 2),
+ * only the times are reported.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "pkt_proc.h"
+#include "utils.h"
+
+struct global_variables global_vars;   /* normally defined in config.c */
+
+/*
+ * struct perf_counter is a hardware counter of the calling thread,
+ * in user space; it is not valid if it could not be opened
+ */
+struct perf_counter {
+    int fd;
+
+    perf_counter(uint32_t type, uint64_t config) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~perf_counter() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool is_valid() const { return fd >= 0; }
+
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    uint64_t stop() {
+        uint64_t count = 0;
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+                count = 0;
+            }
+        }
+        return count;
+    }
+};
+
+static const size_t min_frame_size = 96;     // fits the data packets
+static const size_t max_frame_size = 1536;
+static const size_t payload_len = 32;
+
+/*
+ * write_packet(p, sa, da, sp, dp, seq, flags) writes an Ethernet,
+ * IPv4, and TCP packet into p, with a TLS application data payload
+ * unless it is a SYN, and returns its length
+ */
+static size_t write_packet(uint8_t *p, uint32_t sa, uint32_t da, uint16_t sp, uint16_t dp, uint32_t seq, uint8_t flags) {
+    bool syn = flags & 0x02;
+    size_t data_len = syn ? 0 : payload_len;
+    size_t ip_len = 20 + 20 + data_len;
+
+    memset(p, 0, 14 + 20 + 20 + payload_len);
+    p[12] = 0x08;                      // ethertype: IPv4
+    uint8_t *ip = p + 14;
+    ip[0] = 0x45;
+    ip[2] = ip_len >> 8;
+    ip[3] = ip_len & 0xff;
+    ip[8] = 64;                        // ttl
+    ip[9] = 6;                         // protocol: TCP
+    memcpy(ip + 12, &sa, sizeof(sa));
+    memcpy(ip + 16, &da, sizeof(da));
+    uint8_t *tcp = ip + 20;
+    tcp[0] = sp >> 8;
+    tcp[1] = sp & 0xff;
+    tcp[2] = dp >> 8;
+    tcp[3] = dp & 0xff;
+    uint32_t s = htonl(seq);
+    memcpy(tcp + 4, &s, sizeof(s));
+    tcp[12] = 0x50;                    // data offset: 5 words
+    tcp[13] = flags;
+    tcp[14] = 0xff;                    // window
+    if (!syn) {
+        uint8_t *data = tcp + 20;
+        const uint8_t tls_app_data[] = { 0x17, 0x03, 0x03, 0x00, payload_len - 5 };
+        memcpy(data, tls_app_data, sizeof(tls_app_data));
+        for (size_t i = sizeof(tls_app_data); i < data_len; i++) {
+            data[i] = seq + i;
+        }
+    }
+    return 14 + ip_len;
+}
+
+struct traffic {
+    std::vector<uint8_t> buffer;
+    std::vector<struct packet_descriptor> syns;
+    std::vector<struct packet_descriptor> data;
+    std::vector<size_t> frame_len;     // for data[]
+};
+
+static void make_traffic(struct traffic &t, size_t num_flows, size_t rounds) {
+    std::mt19937_64 rng{0x5eed};
+    struct flow { uint32_t sa, da; uint16_t sp, dp; uint32_t seq; };
+    std::vector<struct flow> flows(num_flows);
+    for (auto &f : flows) {
+        f = { (uint32_t)rng(), (uint32_t)rng(), (uint16_t)(1024 + rng() % 60000), 443, (uint32_t)rng() };
+    }
+
+    t.buffer.resize(num_flows * (rounds + 1) * max_frame_size);
+    uint8_t *p = t.buffer.data();
+    struct packet_descriptor d;
+    d.info.ts.tv_sec = 1000;
+    d.info.ts.tv_nsec = 0;
+    for (auto &f : flows) {
+        d.info.len = d.info.caplen = write_packet(p, f.sa, f.da, f.sp, f.dp, f.seq, 0x02);
+        d.eth = p;
+        t.syns.push_back(d);
+        p += 64;
+    }
+    std::vector<size_t> order(num_flows);
+    for (size_t i = 0; i < num_flows; i++) {
+        order[i] = i;
+    }
+    for (size_t r = 0; r < rounds; r++) {
+        std::shuffle(order.begin(), order.end(), rng);
+        for (size_t i : order) {
+            struct flow &f = flows[i];
+            d.info.len = d.info.caplen = write_packet(p, f.sa, f.da, f.sp, f.dp, f.seq + 1 + r * payload_len, 0x18);
+            d.eth = p;
+            t.data.push_back(d);
+            size_t frame_len = (min_frame_size + rng() % (max_frame_size - min_frame_size)) & ~(size_t)15;
+            t.frame_len.push_back(frame_len);
+            p += frame_len;
+        }
+    }
+}
+
+struct result {
+    uint64_t ns;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t l1d_misses;
+    uint64_t llc_misses;
+    size_t records;
+    size_t bytes;
+};
+
+struct counters {
+    struct perf_counter cycles{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES};
+    struct perf_counter instructions{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS};
+    struct perf_counter l1d_misses{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                   | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                   | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+    struct perf_counter llc_misses{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES};
+    struct timer timer;
+
+    void start() {
+        cycles.start();
+        instructions.start();
+        l1d_misses.start();
+        llc_misses.start();
+        timer_start(&timer);
+    }
+
+    void stop(struct result &r) {
+        r.ns += timer_stop(&timer);
+        r.llc_misses += llc_misses.stop();
+        r.l1d_misses += l1d_misses.stop();
+        r.instructions += instructions.stop();
+        r.cycles += cycles.stop();
+    }
+};
+
+// dispatch(w, llq, pkts, frame_len, r, c) fills in the frames of each
+// batch of pkts, if frame_len is not NULL, processes that batch,
+// measuring it with c if c is not NULL, and then consumes the records
+// that were written into the queue
+//
+static void dispatch(struct pkt_proc &w, struct ll_queue &llq, std::vector<struct packet_descriptor> &pkts,
+                     const std::vector<size_t> *frame_len, struct result &r, struct counters *c) {
+    for (size_t i = 0; i < pkts.size(); i += pkt_proc::max_batch_size) {
+        size_t n = std::min(pkt_proc::max_batch_size, pkts.size() - i);
+        for (size_t j = i; frame_len && j < i + n; j++) {
+            memset(pkts[j].eth + pkts[j].info.len, (uint8_t)j, (*frame_len)[j] - pkts[j].info.len);
+        }
+        int first = llq.widx;
+        if (c) {
+            c->start();
+        }
+        w.apply_batch(&pkts[i], n);
+        if (c) {
+            c->stop(r);
+        }
+        for (int j = first; j != llq.widx; j = (j + 1) % LLQ_DEPTH) {
+            r.records++;
+            r.bytes += llq.msgs[j].len;
+            llq.msgs[j].used = 0;
+        }
+    }
+}
+
+static struct result run(unsigned int distance, struct traffic &t, struct ll_queue &llq) {
+    struct result r;
+    memset(&r, 0, sizeof(r));
+
+    pkt_proc_json_writer_llq<pkt_proc_default_features> writer{&llq, NULL, false, distance};
+    dispatch(writer, llq, t.syns, NULL, r, NULL);
+
+    struct counters c;
+    dispatch(writer, llq, t.data, &t.frame_len, r, &c);
+
+    return r;
+}
+
+static void print_counter(const char *name, uint64_t count, size_t num_packets, bool valid) {
+    if (valid) {
+        fprintf(stdout, "\t%s: %.2f", name, (double)count / num_packets);
+    } else {
+        fprintf(stdout, "\t%s: n/a", name);
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc > 3) {
+        fprintf(stderr, "usage: %s [flows] [rounds]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    size_t num_flows = argc > 1 ? strtoul(argv[1], NULL, 10) : 60000;
+    size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 4;
+    if (num_flows == 0 || rounds == 0) {
+        fprintf(stderr, "error: flows and rounds must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    struct traffic t;
+    make_traffic(t, num_flows, rounds);
+
+    struct ll_queue *llq = new struct ll_queue;
+    memset(llq, 0, sizeof(*llq));
+
+    bool counters_valid = perf_counter{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES}.is_valid();
+    if (!counters_valid) {
+        fprintf(stderr, "warning: hardware counters are not available; reporting times only\n");
+    }
+
+    fprintf(stdout, "flows: %zu\tdata packets: %zu\n", num_flows, t.data.size());
+    unsigned int failures = 0;
+    struct result baseline = run(0, t, *llq);   // touches the whole packet buffer
+    const unsigned int distances[] = { 0, 1, 2, 4, 8, 16 };
+    for (unsigned int d : distances) {
+        struct result r = run(d, t, *llq);
+        if (r.records != baseline.records || r.bytes != baseline.bytes) {
+            fprintf(stdout, "error: output with distance %u differs\n", d);
+            failures++;
+        }
+        size_t n = t.data.size();
+        fprintf(stdout, "distance: %2u\tns/packet: %.1f", d, (double)r.ns / n);
+        print_counter("cycles/packet", r.cycles, n, counters_valid);
+        print_counter("instructions/packet", r.instructions, n, counters_valid);
+        print_counter("L1D misses/packet", r.l1d_misses, n, counters_valid);
+        print_counter("LLC misses/packet", r.llc_misses, n, counters_valid);
+        fprintf(stdout, "\n");
+    }
+    fprintf(stdout, "correctness: %u failures\n", failures);
+
+    delete llq;
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
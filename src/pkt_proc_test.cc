@@ -0,0 +1,140 @@
+/*
+ * pkt_proc_test.cc
+ *
+ * checks and benchmarks the packet processors that are specialized
+ * for a set of output options (stateful_pkt_proc::write_json<F>)
+ * against the one that checks those options at runtime
+ *
+ * usage: pkt_proc_test <pcap file> [repeat]
+ *
+ * The packets in the pcap file are read into memory, then processed
+ * repeat times (default: 20) by each processor, with a new processor
+ * for each pass; the default output options and --metadata are
+ * tested.  The JSON output of each specialized processor must be
+ * identical to that of the runtime processor.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "pkt_proc.h"
+#include "utils.h"
+
+struct global_variables global_vars;   /* normally defined in config.c */
+
+struct packet {
+    struct timespec ts;
+    std::vector<uint8_t> data;
+};
+
+// read_pcap_file(filename, packets) reads all of the packets in a
+// pcap file (with microsecond or nanosecond timestamps) into packets
+//
+static bool read_pcap_file(const char *filename, std::vector<struct packet> &packets) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open file %s\n", filename);
+        return false;
+    }
+    uint32_t file_header[6];
+    if (fread(file_header, sizeof(file_header), 1, f) != 1
+        || (file_header[0] != 0xa1b2c3d4 && file_header[0] != 0xa1b23c4d)) {
+        fprintf(stderr, "error: %s is not a pcap file in host byte order\n", filename);
+        fclose(f);
+        return false;
+    }
+    long nsec_per_tick = file_header[0] == 0xa1b2c3d4 ? 1000 : 1;
+    uint32_t packet_header[4];
+    while (fread(packet_header, sizeof(packet_header), 1, f) == 1) {
+        struct packet p;
+        p.ts.tv_sec = packet_header[0];
+        p.ts.tv_nsec = packet_header[1] * nsec_per_tick;
+        p.data.resize(packet_header[2]);
+        if (fread(p.data.data(), 1, p.data.size(), f) != p.data.size()) {
+            break;
+        }
+        packets.push_back(p);
+    }
+    fclose(f);
+    return true;
+}
+
+// run(name, packets, repeat, output) processes the packets with
+// stateful_pkt_proc::write_json<F>(), writes the JSON output from the
+// first pass into output, and reports the time per packet
+//
+template <unsigned int F>
+static void run(const char *name, std::vector<struct packet> &packets, unsigned int repeat, std::string &output) {
+    uint8_t buf[LLQ_MSG_SIZE];
+    uint64_t ns = 0;
+    size_t records = 0;
+    output.clear();
+    for (unsigned int r = 0; r < repeat; r++) {
+        struct stateful_pkt_proc processor{NULL};
+        struct timer t;
+        timer_start(&t);
+        for (auto &p : packets) {
+            size_t len = processor.write_json<F>(buf, sizeof(buf), p.data.data(), p.data.size(), &p.ts);
+            if (len) {
+                records++;
+                if (r == 0) {
+                    output.append((const char *)buf, len);
+                }
+            }
+        }
+        ns += timer_stop(&t);
+    }
+    fprintf(stdout, "%-24s packets: %zu\trecords: %zu\tns/packet: %.1f\n",
+            name, packets.size() * repeat, records, (double)ns / (packets.size() * repeat));
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "usage: %s <pcap file> [repeat]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    unsigned int repeat = argc == 3 ? atoi(argv[2]) : 20;
+    if (repeat == 0) {
+        repeat = 1;
+    }
+
+    std::vector<struct packet> packets;
+    if (read_pcap_file(argv[1], packets) == false) {
+        return EXIT_FAILURE;
+    }
+
+    // each specialized processor only applies to the options that it
+    // was instantiated for, which are checked here
+    //
+    if (pkt_proc_features_from_config() != pkt_proc_default_features) {
+        fprintf(stderr, "error: unexpected feature set %x\n", pkt_proc_features_from_config());
+        return EXIT_FAILURE;
+    }
+
+    unsigned int failures = 0;
+    std::string runtime_output, specialized_output;
+
+    run<pkt_proc_runtime_features>("default (runtime)", packets, repeat, runtime_output);
+    run<pkt_proc_default_features>("default (specialized)", packets, repeat, specialized_output);
+    if (runtime_output != specialized_output) {
+        fprintf(stdout, "error: default outputs differ\n");
+        failures++;
+    }
+
+    global_vars.metadata_output = true;
+    run<pkt_proc_runtime_features>("metadata (runtime)", packets, repeat, runtime_output);
+    run<pkt_proc_metadata_features>("metadata (specialized)", packets, repeat, specialized_output);
+    if (runtime_output != specialized_output) {
+        fprintf(stdout, "error: metadata outputs differ\n");
+        failures++;
+    }
+
+    fprintf(stdout, "correctness: %u failures\n", failures);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -15,6 +15,11 @@
 #define PROTO_IDENTIFY_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 enum tcp_msg_type {
     tcp_msg_type_unknown = 0,
@@ -24,7 +29,9 @@ enum tcp_msg_type {
     tcp_msg_type_tls_server_hello,
     tcp_msg_type_tls_certificate,
     tcp_msg_type_ssh,
-    tcp_msg_type_ssh_kex
+    tcp_msg_type_ssh_kex,
+    tcp_msg_type_http2,
+    tcp_msg_type_http2_frame
 };
 
 enum udp_msg_type {
@@ -74,4 +81,138 @@ const struct pi_container *proto_identify_tcp(const uint8_t *tcp_data,
 const struct pi_container *proto_identify_udp(const uint8_t *udp_data,
                                               unsigned int len);
 
+/**
+ * \brief Single-pass message classifier
+ *
+ * struct protocol_classifier holds a table of (mask, value, type)
+ * patterns that apply to the first eight bytes of a TCP or UDP
+ * payload; a payload matches a pattern if (data & mask) == value.
+ * classify() loads the first eight bytes into a vector register,
+ * tests it against all of the patterns at once, and returns the type
+ * of the first pattern that matches, in the order in which they were
+ * added, or zero (the unknown type) if none does, without branching
+ * on the payload.  With AVX2, four patterns are tested per
+ * instruction; with SSE2 or SSE4.1, two are.
+ *
+ * Patterns that cannot match anything, like those that
+ * proto_ident_config() disables by zeroing their masks, are not
+ * added to the table.
+ */
+struct protocol_classifier {
+    static const unsigned int max_patterns = 16;
+    static const size_t pattern_length = 8;
+
+    protocol_classifier() : num_patterns{0} {
+        clear();
+    }
+
+    void clear() {
+        for (unsigned int i = 0; i < max_patterns; i++) {
+            mask[i] = 0;
+            value[i] = UINT64_MAX;    // cannot match
+            type[i] = 0;
+        }
+        type[max_patterns] = 0;
+        num_patterns = 0;
+    }
+
+    /*
+     * add(m, v, t) appends the pattern with the eight-byte mask m and
+     * value v, which identifies messages of type t; it returns false
+     * if the table is full
+     */
+    bool add(const uint8_t *m, const uint8_t *v, unsigned int t) {
+        uint64_t m64, v64;
+        memcpy(&m64, m, sizeof(m64));
+        memcpy(&v64, v, sizeof(v64));
+        if ((v64 & ~m64) != 0) {
+            return true;          // pattern can never match
+        }
+        if (num_patterns == max_patterns) {
+            return false;
+        }
+        mask[num_patterns] = m64;
+        value[num_patterns] = v64;
+        type[num_patterns] = t;
+        num_patterns++;
+        return true;
+    }
+
+    unsigned int classify(const uint8_t *data, size_t len) const {
+        if (len < pattern_length) {
+            return 0;
+        }
+        uint64_t d;
+        memcpy(&d, data, sizeof(d));
+
+        // matches has one bit per pattern, or with SSE, two adjacent
+        // bits per pattern; the bit past the last pattern is set, so
+        // that no match selects type[max_patterns], which is zero
+        //
+#if defined(__AVX2__)
+        uint64_t matches = 1ULL << max_patterns;
+        __m256i x = _mm256_set1_epi64x(d);
+        for (unsigned int i = 0; i < max_patterns; i += 4) {
+            __m256i m = _mm256_loadu_si256((const __m256i *)&mask[i]);
+            __m256i v = _mm256_loadu_si256((const __m256i *)&value[i]);
+            __m256i eq = _mm256_cmpeq_epi64(_mm256_and_si256(x, m), v);
+            matches |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << i;
+        }
+        unsigned int index = __builtin_ctzll(matches);
+#elif defined(__SSE2__)
+        static_assert(max_patterns == 16, "the byte masks below cover 16 patterns");
+        __m128i x = _mm_set1_epi64x(d);
+        __m128i eq[max_patterns / 2];
+        for (unsigned int i = 0; i < max_patterns; i += 2) {
+            __m128i m = _mm_loadu_si128((const __m128i *)&mask[i]);
+            __m128i v = _mm_loadu_si128((const __m128i *)&value[i]);
+#if defined(__SSE4_1__)
+            eq[i / 2] = _mm_cmpeq_epi64(_mm_and_si128(x, m), v);
+#else
+            // SSE2 has no 64-bit comparison, so a lane matches if both
+            // of its 32-bit halves do
+            //
+            __m128i eq32 = _mm_cmpeq_epi32(_mm_and_si128(x, m), v);
+            eq[i / 2] = _mm_and_si128(eq32, _mm_shuffle_epi32(eq32, _MM_SHUFFLE(2, 3, 0, 1)));
+#endif
+        }
+        // narrow each 64-bit result to two bytes, so that two byte
+        // masks cover all of the patterns
+        //
+        __m128i lo = _mm_packs_epi16(_mm_packs_epi32(eq[0], eq[1]), _mm_packs_epi32(eq[2], eq[3]));
+        __m128i hi = _mm_packs_epi16(_mm_packs_epi32(eq[4], eq[5]), _mm_packs_epi32(eq[6], eq[7]));
+        uint64_t matches = (uint64_t)(uint32_t)_mm_movemask_epi8(lo)
+            | (uint64_t)(uint32_t)_mm_movemask_epi8(hi) << 16
+            | 1ULL << (2 * max_patterns);
+        unsigned int index = __builtin_ctzll(matches) / 2;
+#else
+        uint64_t matches = 1ULL << max_patterns;
+        for (unsigned int i = 0; i < num_patterns; i++) {
+            matches |= (uint64_t)((d & mask[i]) == value[i]) << i;
+        }
+        unsigned int index = __builtin_ctzll(matches);
+#endif
+        return type[index];
+    }
+
+    /*
+     * size() is the number of patterns in the table, and
+     * get_pattern(i, m, v) copies the mask and value of pattern i
+     * into m and v, so that other matchers (like the BPF prefilter)
+     * can be built from the same table
+     */
+    unsigned int size() const { return num_patterns; }
+
+    void get_pattern(unsigned int i, uint8_t m[pattern_length], uint8_t v[pattern_length]) const {
+        memcpy(m, &mask[i], pattern_length);
+        memcpy(v, &value[i], pattern_length);
+    }
+
+private:
+    alignas(32) uint64_t mask[max_patterns];
+    alignas(32) uint64_t value[max_patterns];
+    uint8_t type[max_patterns + 1];
+    unsigned int num_patterns;
+};
+
 #endif /* PROTO_IDENTIFY_H */
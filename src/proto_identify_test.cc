@@ -0,0 +1,251 @@
+/*
+ * proto_identify_test.cc
+ *
+ * checks and benchmarks the single-pass TCP and UDP message
+ * classifiers (get_message_type() and udp_get_message_type()) against
+ * the sequential mask and value comparisons that they replaced
+ *
+ * usage: proto_identify_test [filter]
+ *
+ * The optional filter is a protocol selection string, as used with
+ * the --select option (e.g. "tls,dns"); the checks are run with the
+ * default configuration and then with that filter.
+ *
+ * The payloads are a mix of messages that the classifiers select
+ * (TLS, HTTP, SSH, DNS, DHCP, QUIC, ...) and, more commonly, ones
+ * that they do not (TLS application data, HTTP bodies, RTP, random
+ * bytes, ...), in a fixed pseudorandom order.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include <vector>
+#include "extractor.h"
+#include "udp.h"
+#include "match.h"
+#include "utils.h"
+
+// the pattern arrays in extractor.cc and udp.cc
+//
+extern unsigned char tls_client_hello_mask[8], tls_client_hello_value[8];
+extern unsigned char tls_server_hello_value[8], tls_server_cert_value[8];
+extern unsigned char http_client_mask[8], http_client_value[8];
+extern unsigned char http_client_post_mask[8], http_client_post_value[8];
+extern unsigned char http_client_connect_mask[8], http_client_connect_value[8];
+extern unsigned char http_client_put_mask[8], http_client_put_value[8];
+extern unsigned char http_client_head_mask[8], http_client_head_value[8];
+extern unsigned char http_server_mask[8], http_server_value[8];
+extern unsigned char http2_preface_mask[8], http2_preface_value[8];
+extern unsigned char http2_headers_mask[8], http2_headers_value[8];
+extern unsigned char http2_settings_mask[8], http2_settings_value[8];
+extern unsigned char http2_window_update_mask[8], http2_window_update_value[8];
+extern unsigned char ssh_mask[8], ssh_value[8];
+extern unsigned char ssh_kex_mask[8], ssh_kex_value[8];
+extern unsigned char dhcp_client_mask[8], dhcp_client_value[8];
+extern unsigned char dtls_client_hello_mask[16], dtls_client_hello_value[16];
+extern unsigned char dtls_server_hello_mask[16], dtls_server_hello_value[16];
+extern unsigned char dns_server_mask[8], dns_server_value[8];
+extern unsigned char dns_client_mask[8], dns_client_value[8];
+extern unsigned char wireguard_mask[8], wireguard_value[8];
+extern unsigned char quic_mask[8], quic_value[8];
+
+/*
+ * reference_tcp_message_type() and reference_udp_message_type() are
+ * the sequential implementations that the classifiers replaced
+ */
+static enum tcp_msg_type reference_tcp_message_type(const uint8_t *d, unsigned int len) {
+    if (len < 8) {
+        return tcp_msg_type_unknown;
+    }
+    struct { const unsigned char *mask; const unsigned char *value; enum tcp_msg_type type; } patterns[] = {
+        { tls_client_hello_mask,    tls_client_hello_value,    tcp_msg_type_tls_client_hello },
+        { tls_client_hello_mask,    tls_server_hello_value,    tcp_msg_type_tls_server_hello },
+        { tls_client_hello_mask,    tls_server_cert_value,     tcp_msg_type_tls_certificate },
+        { http_client_mask,         http_client_value,         tcp_msg_type_http_request },
+        { http_client_post_mask,    http_client_post_value,    tcp_msg_type_http_request },
+        { http_client_connect_mask, http_client_connect_value, tcp_msg_type_http_request },
+        { http_client_put_mask,     http_client_put_value,     tcp_msg_type_http_request },
+        { http_client_head_mask,    http_client_head_value,    tcp_msg_type_http_request },
+        { http_server_mask,         http_server_value,         tcp_msg_type_http_response },
+        { http2_preface_mask,       http2_preface_value,       tcp_msg_type_http2 },
+        { ssh_mask,                 ssh_value,                 tcp_msg_type_ssh },
+        { ssh_kex_mask,             ssh_kex_value,             tcp_msg_type_ssh_kex },
+        { http2_headers_mask,       http2_headers_value,       tcp_msg_type_http2_frame },
+        { http2_settings_mask,      http2_settings_value,      tcp_msg_type_http2_frame },
+        { http2_window_update_mask, http2_window_update_value, tcp_msg_type_http2_frame },
+    };
+    for (const auto &p : patterns) {
+        if (u32_compare_masked_data_to_value(d, p.mask, p.value)) {
+            return p.type;
+        }
+    }
+    return tcp_msg_type_unknown;
+}
+
+static enum udp_msg_type reference_udp_message_type(const uint8_t *d, unsigned int len) {
+    if (len < 8) {
+        return udp_msg_type_unknown;
+    }
+    if (u32_compare_masked_data_to_value(d, dhcp_client_mask, dhcp_client_value)) {
+        return udp_msg_type_dhcp;
+    }
+    if (u32_compare_masked_data_to_value(d, dtls_client_hello_mask, dtls_client_hello_value)) {
+        return udp_msg_type_dtls_client_hello;
+    }
+    struct { const unsigned char *mask; const unsigned char *value; enum udp_msg_type type; } patterns[] = {
+        { dtls_server_hello_mask, dtls_server_hello_value, udp_msg_type_dtls_server_hello },
+        { dns_server_mask,        dns_server_value,        udp_msg_type_dns },
+        { dns_client_mask,        dns_client_value,        udp_msg_type_dns },
+        { wireguard_mask,         wireguard_value,         udp_msg_type_wireguard },
+        { quic_mask,              quic_value,              udp_msg_type_quic },
+    };
+    for (const auto &p : patterns) {
+        if (u64_compare_masked_data_to_value(d, p.mask, p.value)) {
+            return p.type;
+        }
+    }
+    return udp_msg_type_unknown;
+}
+
+static const size_t payload_len = 32;
+
+struct payload_template {
+    const char *prefix;
+    size_t prefix_len;
+    unsigned int weight;
+};
+
+#define payload(s, w) { s, sizeof(s) - 1, w }
+
+// TCP payloads; about a quarter of them are selected
+//
+static const struct payload_template tcp_templates[] = {
+    payload("\x16\x03\x01\x02\x00\x01\x00\x01\xfc\x03\x03", 8),    // TLS client hello
+    payload("\x16\x03\x03\x00\x5d\x02\x00\x00\x59\x03\x03", 4),    // TLS server hello
+    payload("\x16\x03\x03\x0b\x0c\x0b\x00\x0b\x08\x00\x0b", 2),    // TLS certificate
+    payload("GET /index.html HTTP/1.1\r\n", 5),
+    payload("POST /api HTTP/1.1\r\n", 2),
+    payload("HTTP/1.1 200 OK\r\n", 4),
+    payload("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 1),
+    payload("SSH-2.0-OpenSSH_8.2p1\r\n", 1),
+    payload("\x00\x00\x05\xdc\x08\x14\x8e\x3c", 1),                // SSH KEX
+    payload("\x00\x00\x1a\x01\x05\x00\x00\x00\x01", 1),            // HTTP/2 HEADERS
+    payload("\x17\x03\x03\x40\x18", 60),                           // TLS application data
+    payload("\x15\x03\x03\x00\x1a", 2),                            // TLS alert
+    payload("<!DOCTYPE html><html><head>", 8),                     // HTTP body
+    payload("\x00\x00\x00\x85\xfe\x53\x4d\x42", 3),                // SMB2
+    payload("", 20),                                               // random
+};
+
+// UDP payloads; about a fifth of them are selected
+//
+static const struct payload_template udp_templates[] = {
+    payload("\x3a\x7b\x01\x00\x00\x01\x00\x00\x00\x00", 8),        // DNS query
+    payload("\x3a\x7b\x81\x80\x00\x01\x00\x02\x00\x00", 8),        // DNS response
+    payload("\x01\x01\x06\x00\x5c\x1a\x4f\x21", 1),                // DHCP
+    payload("\xc3\xff\x00\x00\x1d\x08", 3),                        // QUIC initial
+    payload("\x01\x00\x00\x00\x3f\x5a\x9c\x11", 1),                // WireGuard
+    payload("\x16\xfe\xfd\x00\x00\x00\x00\x00\x00\x00\x00\x00\xb2\x01", 1),  // DTLS client hello
+    payload("\x80\x00\x1c\x2d\x00\x0a\x5b\x40", 50),               // RTP
+    payload("\x23\x02\x06\xe8\x00\x00\x03\x2c", 5),                // NTP
+    payload("\x40\x5a\x4b\x7c\x33\x10\x8f\x01", 10),               // QUIC short header
+    payload("", 20),                                               // random
+};
+
+static std::vector<uint8_t> make_payloads(const struct payload_template *t, size_t num_templates, size_t num) {
+    std::mt19937_64 rng{0x5eed};
+    unsigned int total_weight = 0;
+    for (size_t i = 0; i < num_templates; i++) {
+        total_weight += t[i].weight;
+    }
+    std::vector<uint8_t> payloads(num * payload_len);
+    for (size_t n = 0; n < num; n++) {
+        unsigned int w = rng() % total_weight;
+        size_t i = 0;
+        while (w >= t[i].weight) {
+            w -= t[i].weight;
+            i++;
+        }
+        uint8_t *p = &payloads[n * payload_len];
+        for (size_t j = 0; j < payload_len; j++) {
+            p[j] = rng();
+        }
+        memcpy(p, t[i].prefix, t[i].prefix_len);
+    }
+    return payloads;
+}
+
+template <typename T>
+static uint64_t benchmark(const char *name, T classify, const std::vector<uint8_t> &payloads, size_t repeat) {
+    size_t num = payloads.size() / payload_len;
+    uint64_t selected = 0;
+    struct timer t;
+    timer_start(&t);
+    for (size_t r = 0; r < repeat; r++) {
+        for (size_t n = 0; n < num; n++) {
+            selected += classify(&payloads[n * payload_len], payload_len) != 0;
+        }
+    }
+    uint64_t ns = timer_stop(&t);
+    fprintf(stdout, "%-14s payloads: %zu\tselected: %lu\tns/payload: %.2f\n",
+            name, num * repeat, selected, (double)ns / (num * repeat));
+    return selected;
+}
+
+static unsigned int check_and_benchmark(const std::vector<uint8_t> &tcp, const std::vector<uint8_t> &udp) {
+    unsigned int failures = 0;
+    for (size_t n = 0; n < tcp.size() / payload_len; n++) {
+        const uint8_t *p = &tcp[n * payload_len];
+        for (size_t len = 0; len <= payload_len; len += 4) {
+            if (get_message_type(p, len) != reference_tcp_message_type(p, len)) {
+                failures++;
+            }
+        }
+    }
+    for (size_t n = 0; n < udp.size() / payload_len; n++) {
+        const uint8_t *p = &udp[n * payload_len];
+        for (size_t len = 0; len <= payload_len; len += 4) {
+            if (udp_get_message_type(p, len) != reference_udp_message_type(p, len)) {
+                failures++;
+            }
+        }
+    }
+    fprintf(stdout, "correctness: %u failures\n", failures);
+
+    const size_t repeat = 20;
+    benchmark("tcp reference", reference_tcp_message_type, tcp, repeat);
+    benchmark("tcp", get_message_type, tcp, repeat);
+    benchmark("udp reference", reference_udp_message_type, udp, repeat);
+    benchmark("udp", udp_get_message_type, udp, repeat);
+
+    return failures;
+}
+
+int main(int argc, char *argv[]) {
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [filter]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const size_t num_payloads = 1 << 20;
+    std::vector<uint8_t> tcp = make_payloads(tcp_templates, sizeof(tcp_templates) / sizeof(tcp_templates[0]), num_payloads);
+    std::vector<uint8_t> udp = make_payloads(udp_templates, sizeof(udp_templates) / sizeof(udp_templates[0]), num_payloads);
+
+    fprintf(stdout, "default configuration\n");
+    unsigned int failures = check_and_benchmark(tcp, udp);
+
+    if (argc == 2) {
+        if (proto_ident_config(argv[1]) != status_ok) {
+            return EXIT_FAILURE;
+        }
+        fprintf(stdout, "\nconfiguration \"%s\"\n", argv[1]);
+        failures += check_and_benchmark(tcp, udp);
+    }
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,274 @@
+/*
+ * public_suffix.cc
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <string.h>
+#include <ctype.h>
+#include <zlib.h>
+#include <map>
+#include <vector>
+#include <string>
+#include "public_suffix.h"
+
+/*
+ * struct psl_build_node is a temporary trie node, used only while
+ * the rules are being read in
+ */
+struct psl_build_node {
+    std::map<std::string, size_t> children;
+    uint8_t flags;
+
+    psl_build_node() : children{}, flags{0} {}
+};
+
+/*
+ * punycode_encode(label, out) appends the punycode encoding (RFC
+ * 3492) of the UTF-8 label to out, and returns false if label is not
+ * valid UTF-8
+ */
+static bool punycode_encode(const std::string &label, std::string &out) {
+    const uint32_t base = 36, tmin = 1, tmax = 26, skew = 38, damp = 700;
+
+    // decode UTF-8 into code points
+    //
+    std::vector<uint32_t> cp;
+    for (size_t i = 0; i < label.length(); ) {
+        uint8_t c = label[i];
+        uint32_t x;
+        size_t extra;
+        if (c < 0x80) {
+            x = c; extra = 0;
+        } else if ((c & 0xe0) == 0xc0) {
+            x = c & 0x1f; extra = 1;
+        } else if ((c & 0xf0) == 0xe0) {
+            x = c & 0x0f; extra = 2;
+        } else if ((c & 0xf8) == 0xf0) {
+            x = c & 0x07; extra = 3;
+        } else {
+            return false;
+        }
+        if (i + extra >= label.length()) {
+            return false;
+        }
+        for (size_t j = 1; j <= extra; j++) {
+            uint8_t cc = label[i + j];
+            if ((cc & 0xc0) != 0x80) {
+                return false;
+            }
+            x = (x << 6) | (cc & 0x3f);
+        }
+        cp.push_back(x);
+        i += extra + 1;
+    }
+
+    auto digit = [](uint32_t d) { return (char)(d < 26 ? 'a' + d : '0' + d - 26); };
+    auto adapt = [&](uint32_t delta, uint32_t numpoints, bool first) {
+        delta = first ? delta / damp : delta / 2;
+        delta += delta / numpoints;
+        uint32_t k = 0;
+        while (delta > ((base - tmin) * tmax) / 2) {
+            delta /= base - tmin;
+            k += base;
+        }
+        return k + (base - tmin + 1) * delta / (delta + skew);
+    };
+
+    uint32_t h = 0;
+    for (uint32_t c : cp) {
+        if (c < 0x80) {
+            out.push_back(c);
+            h++;
+        }
+    }
+    uint32_t b = h;
+    if (b > 0) {
+        out.push_back('-');
+    }
+    uint32_t n = 0x80, delta = 0, bias = 72;
+    while (h < cp.size()) {
+        uint32_t m = UINT32_MAX;
+        for (uint32_t c : cp) {
+            if (c >= n && c < m) {
+                m = c;
+            }
+        }
+        delta += (m - n) * (h + 1);
+        n = m;
+        for (uint32_t c : cp) {
+            if (c < n) {
+                delta++;
+            }
+            if (c == n) {
+                uint32_t q = delta;
+                for (uint32_t k = base; ; k += base) {
+                    uint32_t t = k <= bias ? tmin : (k >= bias + tmax ? tmax : k - bias);
+                    if (q < t) {
+                        break;
+                    }
+                    out.push_back(digit(t + (q - t) % (base - t)));
+                    q = (q - t) / (base - t);
+                }
+                out.push_back(digit(q));
+                bias = adapt(delta, h + 1, h == b);
+                delta = 0;
+                h++;
+            }
+        }
+        delta++;
+        n++;
+    }
+    return true;
+}
+
+/*
+ * psl_rule_to_ascii(rule, len, out) writes the rule into out, with
+ * each internationalized label converted to its A-label
+ * ("xn--...") form, and returns false if that is not possible
+ */
+static bool psl_rule_to_ascii(const char *rule, size_t len, std::string &out) {
+    const char *rule_end = rule + len;
+    while (rule < rule_end) {
+        const char *label_end = (const char *)memchr(rule, '.', rule_end - rule);
+        if (label_end == NULL) {
+            label_end = rule_end;
+        }
+        std::string label{rule, (size_t)(label_end - rule)};
+        bool is_ascii = true;
+        for (char c : label) {
+            if ((uint8_t)c >= 0x80) {
+                is_ascii = false;
+                break;
+            }
+        }
+        if (is_ascii) {
+            out.append(label);
+        } else {
+            out.append("xn--");
+            if (punycode_encode(label, out) == false) {
+                return false;
+            }
+        }
+        if (label_end < rule_end) {
+            out.push_back('.');
+        }
+        rule = label_end + 1;
+    }
+    return true;
+}
+
+/*
+ * psl_add_rule(tree, rule, len) inserts a single PSL rule into the
+ * temporary trie, label by label starting from the rightmost one
+ */
+static bool psl_add_rule(std::vector<struct psl_build_node> &tree, const char *rule, size_t len) {
+    uint8_t flag = public_suffix_list::flag_rule;
+    if (len > 0 && rule[0] == '!') {
+        flag = public_suffix_list::flag_exception;
+        rule++;
+        len--;
+    }
+    size_t n = 0;
+    const char *label_end = rule + len;
+    while (label_end > rule) {
+        const char *label = label_end;
+        while (label > rule && label[-1] != '.') {
+            label--;
+        }
+        size_t label_len = label_end - label;
+        if (label_len == 0 || label_len > UINT8_MAX) {
+            return false;
+        }
+        if (label_len == 1 && *label == '*') {
+            if (label != rule) {
+                return false;   // wildcard must be the leftmost label
+            }
+            tree[n].flags |= public_suffix_list::flag_wildcard;
+            return true;
+        }
+        std::string l{label, label_len};
+        auto it = tree[n].children.find(l);
+        if (it == tree[n].children.end()) {
+            tree.push_back(psl_build_node{});
+            it = tree[n].children.insert({l, tree.size() - 1}).first;
+        }
+        n = it->second;
+        if (label == rule) {
+            break;
+        }
+        label_end = label - 1;
+    }
+    tree[n].flags |= flag;
+    return true;
+}
+
+int public_suffix_list::load(const char *filename) {
+
+    gzFile in_file = gzopen(filename, "r");
+    if (in_file == NULL) {
+        return -1;
+    }
+
+    std::vector<struct psl_build_node> tree(1);
+    char line[1024];
+    while (gzgets(in_file, line, sizeof(line)) != NULL) {
+
+        // each rule is the first whitespace-delimited token on a line
+        //
+        size_t len = 0;
+        while (line[len] != '\0' && !isspace((unsigned char)line[len])) {
+            line[len] = tolower((unsigned char)line[len]);
+            len++;
+        }
+        if (len == 0 || (len >= 2 && line[0] == '/' && line[1] == '/')) {
+            continue;  // blank line or comment
+        }
+        std::string rule;
+        if (psl_rule_to_ascii(line, len, rule) == false || psl_add_rule(tree, rule.data(), rule.length()) == false) {
+            fprintf(stderr, "warning: ignoring unsupported public suffix rule '%.*s'\n", (int)len, line);
+        }
+    }
+    gzclose(in_file);
+
+    // compile the temporary trie into the flat node array, and
+    // insert an edge for each node (other than the root) into the
+    // hash table, which is sized to a power of two that is at least
+    // twice the number of nodes
+    //
+    nodes.clear();
+    label_pool.clear();
+    nodes.push_back({0, 0, tree[0].flags, 0});
+    std::vector<size_t> build_index{0};   // build_index[i] is the tree node for nodes[i]
+    for (size_t i = 0; i < nodes.size(); i++) {
+        for (const auto &child : tree[build_index[i]].children) {
+            uint32_t offset = label_pool.size();
+            label_pool.insert(label_pool.end(), child.first.begin(), child.first.end());
+            nodes.push_back({offset, (uint8_t)child.first.length(), tree[child.second].flags, (uint32_t)i});
+            build_index.push_back(child.second);
+        }
+    }
+    nodes.shrink_to_fit();
+    label_pool.shrink_to_fit();
+
+    size_t edges_size = 1;
+    while (edges_size < 2 * nodes.size()) {
+        edges_size *= 2;
+    }
+    edges.assign(edges_size, 0);
+    edge_mask = edges_size - 1;
+    for (uint32_t i = 1; i < nodes.size(); i++) {
+        uint32_t h = hash_init;
+        for (size_t j = nodes[i].label_len; j > 0; j--) {
+            h = hash_update(h, label_pool[nodes[i].label + j - 1]);
+        }
+        uint32_t slot = edge_slot(nodes[i].parent, h) & edge_mask;
+        while (edges[slot] != 0) {
+            slot = (slot + 1) & edge_mask;
+        }
+        edges[slot] = i;
+    }
+
+    return 0;
+}
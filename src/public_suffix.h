@@ -0,0 +1,188 @@
+/*
+ * public_suffix.h
+ *
+ * registrable domain extraction using the Public Suffix List
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#ifndef PUBLIC_SUFFIX_H
+#define PUBLIC_SUFFIX_H
+
+#include <stdint.h>
+#include <vector>
+#include "datum.h"
+
+/*
+ * struct public_suffix_list holds a compiled, reversed-label trie
+ * over the rules in the Public Suffix List (PSL) file
+ * public_suffix_list.dat.gz (see https://publicsuffix.org/list/).
+ * The trie is built once, when the list is loaded; after that, the
+ * lookup function registrable_domain() performs no allocation, and
+ * processes the labels of its input in a single right-to-left pass.
+ *
+ * All nodes live in a single array, with node 0 as the root, and the
+ * labels are stored in a single character pool.  The edges of the
+ * trie are kept in one open-addressed hash table, keyed on the
+ * parent node and the (lowercase) label, so that each label costs
+ * one hash computation, which is folded into the scan for the '.'
+ * that delimits it, and usually one probe.  Each node carries flags
+ * that indicate whether the path from the root to that node is a
+ * normal rule ("co.uk"), an exception rule ("!www.ck"), or whether a
+ * wildcard rule ("*.ck") hangs off of it.  Internationalized rules
+ * are converted to their punycode (A-label) form when the list is
+ * loaded, since that is what appears in a server name.
+ *
+ * If no list has been loaded, or no rule matches, the implicit
+ * default rule "*" applies, so that the registrable domain is the
+ * last two labels of the name, as in the previous implementation.
+ */
+
+struct public_suffix_list {
+
+    struct node {
+        uint32_t label;         // offset of label in label_pool
+        uint8_t  label_len;     // length of label
+        uint8_t  flags;         // see below
+        uint32_t parent;        // index of parent in nodes
+    };
+
+    static const uint8_t flag_rule      = 0x01;  // normal rule ends here
+    static const uint8_t flag_exception = 0x02;  // exception rule ends here
+    static const uint8_t flag_wildcard  = 0x04;  // wildcard rule below this node
+
+    std::vector<struct node> nodes;
+    std::vector<char> label_pool;
+    std::vector<uint32_t> edges;     // hash table of node indices; 0 means empty
+    uint32_t edge_mask;
+
+    public_suffix_list() : nodes{}, label_pool{}, edges(1, 0), edge_mask{0} {
+        nodes.push_back({0, 0, 0, 0});  // root node
+    }
+
+    /*
+     * load(filename) reads the (gzipped) PSL file filename and builds
+     * the trie, replacing any previously loaded rules.  It returns 0
+     * on success, and -1 otherwise.
+     */
+    int load(const char *filename);
+
+    size_t num_nodes() const { return nodes.size(); }
+
+    size_t memory_usage() const {
+        return nodes.size() * sizeof(struct node) + label_pool.size() + edges.size() * sizeof(uint32_t);
+    }
+
+    /*
+     * registrable_domain(name) returns the registrable domain of the
+     * DNS name in the datum name (that is, the public suffix plus the
+     * label to its left), as a datum that points into name.  If name
+     * is itself a public suffix, then all of name is returned, which
+     * matches what the python analysis code does.  A trailing dot is
+     * ignored, and labels are matched case-insensitively.
+     */
+    struct datum registrable_domain(const struct datum &name) const {
+        if (name.is_not_readable()) {
+            return name;
+        }
+        const uint8_t *begin = name.data;
+        const uint8_t *end = name.data_end;
+        if (end[-1] == '.') {
+            end--;                               // ignore trailing dot
+        }
+        const uint8_t *suffix = NULL;            // start of public suffix
+        const uint8_t *label_end = end;
+        uint32_t n = 0;                          // current node (root)
+        while (true) {
+            const uint8_t *label = label_end;
+            uint32_t h = hash_init;
+            while (label > begin && label[-1] != '.') {
+                label--;
+                h = hash_update(h, lowercase(*label));
+            }
+            if (suffix == NULL) {
+                suffix = label;                  // default rule "*"
+            }
+            if (nodes[n].flags & flag_wildcard) {
+                suffix = label;
+            }
+            uint32_t c = find_child(n, h, label, label_end - label);
+            if (c == 0) {
+                break;
+            }
+            if (nodes[c].flags & flag_exception) {
+                suffix = label_end + 1;          // exception rules take priority
+                break;
+            }
+            if (nodes[c].flags & flag_rule) {
+                suffix = label;
+            }
+            if (label == begin) {
+                break;
+            }
+            n = c;
+            label_end = label - 1;               // skip over '.'
+        }
+
+        if (suffix == begin) {
+            return datum{begin, end};            // name is a public suffix
+        }
+        const uint8_t *domain = suffix - 1;      // skip over '.'
+        while (domain > begin && domain[-1] != '.') {
+            domain--;
+        }
+        return datum{domain, end};
+    }
+
+    /*
+     * the label hash is computed over the lowercase characters of a
+     * label in reverse order, since that is the order in which
+     * registrable_domain() scans them
+     */
+    static const uint32_t hash_init = 2166136261;
+
+    static uint32_t hash_update(uint32_t h, uint8_t c) {
+        return (h ^ c) * 16777619;
+    }
+
+    static uint32_t edge_slot(uint32_t parent, uint32_t label_hash) {
+        uint32_t x = label_hash ^ (parent * 0x9e3779b1);
+        return x ^ (x >> 15);
+    }
+
+private:
+
+    /*
+     * find_child(n, h, label, len) returns the index of the child of
+     * node n that matches label, whose hash is h, or zero if there is
+     * none; zero is never a child, since it is the root
+     */
+    uint32_t find_child(uint32_t n, uint32_t h, const uint8_t *label, size_t len) const {
+        uint32_t slot = edge_slot(n, h) & edge_mask;
+        while (true) {
+            uint32_t c = edges[slot];
+            if (c == 0) {
+                return 0;
+            }
+            const struct node &x = nodes[c];
+            if (x.parent == n && x.label_len == len && label_is_equal(x, label)) {
+                return c;
+            }
+            slot = (slot + 1) & edge_mask;
+        }
+    }
+
+    bool label_is_equal(const struct node &x, const uint8_t *label) const {
+        const uint8_t *s = (const uint8_t *)&label_pool[x.label];
+        for (size_t i = 0; i < x.label_len; i++) {
+            if (s[i] != lowercase(label[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+};
+
+#endif /* PUBLIC_SUFFIX_H */
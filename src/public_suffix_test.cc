@@ -0,0 +1,163 @@
+/*
+ * public_suffix_test.cc
+ *
+ * correctness checks and a lookup benchmark for struct
+ * public_suffix_list
+ *
+ * usage: public_suffix_test <public_suffix_list.dat.gz> [<sni_file>]
+ *
+ * where sni_file, if present, contains one server name per line; if
+ * it is absent, a synthetic corpus is generated from the rules in the
+ * list.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "public_suffix.h"
+#include "utils.h"
+
+struct test_case {
+    const char *name;
+    const char *domain;
+};
+
+// selected cases from https://raw.githubusercontent.com/publicsuffix/list/master/tests/test_psl.txt
+//
+static struct test_case test_cases[] = {
+    { "com",                     "com" },
+    { "example.com",             "example.com" },
+    { "www.example.com",         "example.com" },
+    { "WWW.Example.COM",         "Example.COM" },
+    { "www.example.com.",        "example.com" },
+    { "example.example",         "example.example" },
+    { "b.example.example",       "example.example" },
+    { "uk.com",                  "uk.com" },
+    { "example.uk.com",          "example.uk.com" },
+    { "b.example.uk.com",        "example.uk.com" },
+    { "a.b.example.uk.com",      "example.uk.com" },
+    { "test.ac",                 "test.ac" },
+    { "mm",                      "mm" },
+    { "c.mm",                    "c.mm" },
+    { "b.c.mm",                  "b.c.mm" },
+    { "a.b.c.mm",                "b.c.mm" },
+    { "test.jp",                 "test.jp" },
+    { "www.test.jp",             "test.jp" },
+    { "ac.jp",                   "ac.jp" },
+    { "test.ac.jp",              "test.ac.jp" },
+    { "www.test.ac.jp",          "test.ac.jp" },
+    { "kyoto.jp",                "kyoto.jp" },
+    { "test.kyoto.jp",           "test.kyoto.jp" },
+    { "ide.kyoto.jp",            "ide.kyoto.jp" },
+    { "b.ide.kyoto.jp",          "b.ide.kyoto.jp" },
+    { "a.b.ide.kyoto.jp",        "b.ide.kyoto.jp" },
+    { "c.kobe.jp",               "c.kobe.jp" },
+    { "b.c.kobe.jp",             "b.c.kobe.jp" },
+    { "a.b.c.kobe.jp",           "b.c.kobe.jp" },
+    { "city.kobe.jp",            "city.kobe.jp" },
+    { "www.city.kobe.jp",        "city.kobe.jp" },
+    { "ck",                      "ck" },
+    { "test.ck",                 "test.ck" },
+    { "b.test.ck",               "b.test.ck" },
+    { "a.b.test.ck",             "b.test.ck" },
+    { "www.ck",                  "www.ck" },
+    { "www.www.ck",              "www.ck" },
+    { "us",                      "us" },
+    { "test.us",                 "test.us" },
+    { "www.test.us",             "test.us" },
+    { "ak.us",                   "ak.us" },
+    { "test.ak.us",              "test.ak.us" },
+    { "www.test.ak.us",          "test.ak.us" },
+    { "k12.ak.us",               "k12.ak.us" },
+    { "test.k12.ak.us",          "test.k12.ak.us" },
+    { "www.test.k12.ak.us",      "test.k12.ak.us" },
+    { "xn--85x722f.com.cn",      "xn--85x722f.com.cn" },
+    { "www.xn--85x722f.com.cn",  "xn--85x722f.com.cn" },
+    { "shishi.xn--55qx5d.cn",    "shishi.xn--55qx5d.cn" },
+    { "www.google.co.uk",        "google.co.uk" },
+    { NULL,                      NULL }
+};
+
+int main(int argc, char *argv[]) {
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <public_suffix_list.dat.gz> [<sni_file>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct public_suffix_list psl;
+    struct timer t;
+    timer_start(&t);
+    if (psl.load(argv[1]) != 0) {
+        fprintf(stderr, "error: could not load public suffix list %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    uint64_t build_ns = timer_stop(&t);
+    fprintf(stdout, "nodes: %zu\tmemory: %zu bytes\tbuild time: %.3f ms\n",
+            psl.num_nodes(), psl.memory_usage(), build_ns / 1000000.0);
+
+    // correctness checks
+    //
+    unsigned int failures = 0;
+    for (struct test_case *tc = test_cases; tc->name != NULL; tc++) {
+        struct datum name{(const uint8_t *)tc->name, (const uint8_t *)tc->name + strlen(tc->name)};
+        struct datum domain = psl.registrable_domain(name);
+        if (domain.length() != (ssize_t)strlen(tc->domain) || memcmp(domain.data, tc->domain, domain.length()) != 0) {
+            fprintf(stdout, "FAIL: %s -> %.*s (expected %s)\n", tc->name, (int)domain.length(), domain.data, tc->domain);
+            failures++;
+        }
+    }
+    fprintf(stdout, "correctness: %u failures\n", failures);
+
+    // build the SNI corpus
+    //
+    std::vector<std::string> corpus;
+    if (argc > 2) {
+        FILE *f = fopen(argv[2], "r");
+        if (f == NULL) {
+            fprintf(stderr, "error: could not open SNI file %s\n", argv[2]);
+            return EXIT_FAILURE;
+        }
+        char line[512];
+        while (fgets(line, sizeof(line), f) != NULL) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] != '\0') {
+                corpus.push_back(line);
+            }
+        }
+        fclose(f);
+    } else {
+        const char *prefixes[] = { "www.", "api.", "cdn.static.", "a.b.c.d.", "" };
+        for (size_t i = 1; i < psl.nodes.size(); i++) {
+            std::string label{&psl.label_pool[psl.nodes[i].label], psl.nodes[i].label_len};
+            for (const char *p : prefixes) {
+                corpus.push_back(std::string{p} + "example." + label);
+            }
+        }
+    }
+    if (corpus.empty()) {
+        fprintf(stderr, "error: SNI corpus is empty\n");
+        return EXIT_FAILURE;
+    }
+
+    // lookup benchmark
+    //
+    const size_t num_lookups = 10000000;
+    size_t checksum = 0;
+    timer_start(&t);
+    for (size_t i = 0; i < num_lookups; i++) {
+        const std::string &s = corpus[i % corpus.size()];
+        struct datum name{(const uint8_t *)s.data(), (const uint8_t *)s.data() + s.length()};
+        checksum += psl.registrable_domain(name).length();
+    }
+    uint64_t lookup_ns = timer_stop(&t);
+    fprintf(stdout, "corpus: %zu names\tlookups: %zu\ttime: %.3f s\trate: %.3e lookups/sec\tns/lookup: %.1f\t(checksum %zu)\n",
+            corpus.size(), num_lookups, lookup_ns / 1e9, num_lookups * 1e9 / lookup_ns,
+            (double)lookup_ns / num_lookups, checksum);
+
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
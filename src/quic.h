@@ -13,12 +13,16 @@
 #ifndef QUIC_H
 #define QUIC_H
 
+#include <string.h>
 #include <string>
-#include <unordered_map>
+#include <vector>
 #include <openssl/aes.h>
-#include <openssl/hmac.h>
 #include <openssl/evp.h>
+#include <openssl/sha.h>
 #include <openssl/err.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include "json_object.h"
 #include "util_obj.h"
 
@@ -139,188 +143,892 @@ struct quic_initial_packet {
 };
 
 
-size_t salt_length = 20;
-uint8_t salt_v22[]     = {0x7f,0xbc,0xdb,0x0e,0x7c,0x66,0xbb,0xe9,0x19,0x3a,0x96,0xcd,0x21,0x51,0x9e,0xbd,0x7a,0x02,0x64,0x4a};
-uint8_t salt_v23_v28[] = {0xc3,0xee,0xf7,0x12,0xc7,0x2e,0xbb,0x5a,0x11,0xa7,0xd2,0x43,0x2b,0xb4,0x63,0x65,0xbe,0xf9,0xf5,0x02};
-uint8_t salt_v29_v32[] = {0xaf,0xbf,0xec,0x28,0x99,0x93,0xd2,0x4c,0x9e,0x97,0x86,0xf1,0x9c,0x61,0x11,0xe0,0x43,0x90,0xa8,0x99};
-std::unordered_map<uint8_t, uint8_t*> quic_initial_salt = {
-    {22, salt_v22},
-    {23, salt_v23_v28},
-    {24, salt_v23_v28},
-    {25, salt_v23_v28},
-    {26, salt_v23_v28},
-    {27, salt_v23_v28},
-    {28, salt_v23_v28},
-    {29, salt_v29_v32},
-    {30, salt_v29_v32},
-    {31, salt_v29_v32},
-    {32, salt_v29_v32},
+/*
+ * quic_initial_salt(version) returns the salt of the initial secrets
+ * of the QUIC draft version (the last byte of the version field), or
+ * NULL if that version is not supported
+ */
+static const size_t quic_initial_salt_length = 20;
+
+inline const uint8_t *quic_initial_salt(uint8_t version) {
+    static const uint8_t salt_v22[]     = {0x7f,0xbc,0xdb,0x0e,0x7c,0x66,0xbb,0xe9,0x19,0x3a,0x96,0xcd,0x21,0x51,0x9e,0xbd,0x7a,0x02,0x64,0x4a};
+    static const uint8_t salt_v23_v28[] = {0xc3,0xee,0xf7,0x12,0xc7,0x2e,0xbb,0x5a,0x11,0xa7,0xd2,0x43,0x2b,0xb4,0x63,0x65,0xbe,0xf9,0xf5,0x02};
+    static const uint8_t salt_v29_v32[] = {0xaf,0xbf,0xec,0x28,0x99,0x93,0xd2,0x4c,0x9e,0x97,0x86,0xf1,0x9c,0x61,0x11,0xe0,0x43,0x90,0xa8,0x99};
+    if (version == 22) {
+        return salt_v22;
+    }
+    if (version >= 23 && version <= 28) {
+        return salt_v23_v28;
+    }
+    if (version >= 29 && version <= 32) {
+        return salt_v29_v32;
+    }
+    return NULL;
+}
+
+/*
+ * quic_dcid_hash(version, dcid) is the FNV-1a hash of the version and
+ * Destination Connection ID of an Initial packet
+ */
+inline uint32_t quic_dcid_hash(uint8_t version, const struct datum &dcid) {
+    uint32_t hash = 2166136261u ^ version;
+    hash *= 16777619u;
+    for (const uint8_t *d = dcid.data; d < dcid.data_end; d++) {
+        hash = (hash ^ *d) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * struct quic_initial_keys holds the AEAD key and IV, and the header
+ * protection key, that protect the Initial packets that a client
+ * sends; they depend only on the version and the Destination
+ * Connection ID of its first Initial packet
+ */
+struct quic_initial_keys {
+    uint8_t key[16];
+    uint8_t iv[12];
+    uint8_t hp[16];
 };
 
-struct quic_initial_packet_crypto {
-    bool valid;
+#if defined(__x86_64__) || defined(__i386__)
 
-    constexpr static const uint8_t client_in_label[] = "tls13 client in";
-    constexpr static const uint8_t quic_key_label[]  = "tls13 quic key";
-    constexpr static const uint8_t quic_iv_label[]   = "tls13 quic iv";
-    constexpr static const uint8_t quic_hp_label[]   = "tls13 quic hp";
+/*
+ * quic_aesni_encrypt_blocks(n, keys, in, out) encrypts the block
+ * in[i] with the AES-128 key keys[i] into out[i], for each i < n,
+ * where n is at most quic_aesni_max_blocks, with AES-NI.  The key
+ * schedules are computed along with the rounds, since each key is
+ * used only once, and the n encryptions are interleaved round by
+ * round, so that their latencies overlap.  The SubWord of each round
+ * key is computed with AESENCLAST on the rotated word, rather than
+ * with AESKEYGENASSIST, whose throughput is much lower.
+ */
+static const size_t quic_aesni_max_blocks = 8;
 
-    uint8_t quic_key[EVP_MAX_MD_SIZE] = {0};
-    unsigned int quic_key_len = 0;
+__attribute__((target("aes,ssse3"))) inline void quic_aesni_encrypt_blocks(size_t n, const uint8_t *const *keys, const uint8_t *const *in, uint8_t (*out)[16]) {
+    static const uint8_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+    const __m128i rot_word = _mm_set1_epi32(0x0c0f0e0d);   // RotWord of the last word, in each word
+    __m128i k[quic_aesni_max_blocks];
+    __m128i s[quic_aesni_max_blocks];
+    for (size_t i = 0; i < n; i++) {
+        k[i] = _mm_loadu_si128((const __m128i *)keys[i]);
+        s[i] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)in[i]), k[i]);
+    }
+    for (unsigned int round = 0; round < 10; round++) {
+        __m128i r = _mm_set1_epi32(rcon[round]);
+        for (size_t i = 0; i < n; i++) {
+            __m128i t = _mm_aesenclast_si128(_mm_shuffle_epi8(k[i], rot_word), r);
+            __m128i key = k[i];
+            key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+            key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+            key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+            k[i] = _mm_xor_si128(key, t);
+            s[i] = (round < 9) ? _mm_aesenc_si128(s[i], k[i]) : _mm_aesenclast_si128(s[i], k[i]);
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        _mm_storeu_si128((__m128i *)out[i], s[i]);
+    }
+}
 
-    uint8_t quic_iv[EVP_MAX_MD_SIZE] = {0};
-    unsigned int quic_iv_len = 0;
+#endif
 
-    uint8_t quic_hp[EVP_MAX_MD_SIZE] = {0};
-    unsigned int quic_hp_len = 0;
+/*
+ * struct quic_crypto_engine derives and decrypts with the keys of QUIC
+ * Initial packets, for the packet processor of one thread.  The
+ * OpenSSL cipher and digest contexts are created once and reused for
+ * every packet, the HMAC state of each salt is computed only once,
+ * and the keys of recent (version, Destination Connection ID) pairs
+ * are kept in a direct-mapped cache of cache_size entries, so that
+ * they are derived only once for a client that retransmits its
+ * Initial packets.  A
+ * cache_size of zero disables the cache.
+ *
+ * Header protection uses AES-NI, when the processor has it, since
+ * OpenSSL's AES_encrypt() does not, and the expansion of a key that
+ * is used for a single block costs more than the block itself;
+ * header_protection_masks() computes the masks of several packets
+ * together.  The payloads are decrypted with AES-128-CTR, which gives
+ * the same plaintext as AES-128-GCM, without computing the GHASH of
+ * the tag, which is not checked.
+ */
+struct quic_crypto_engine {
 
-    uint8_t pn_length = 0;
+    static const size_t default_cache_size = 4096;     // must be a power of two
+    static const size_t max_dcid_length = 20;
+    static const size_t hp_batch_size = 8;            // header protection masks computed together
+    static const size_t hmac_block_size = 64;         // SHA-256 block size
+    static const size_t max_salts = 3;                // number of distinct salts in quic_initial_salt()
 
-    unsigned char plaintext[1024] = {0};
-    int16_t plaintext_len = 0;
+    struct cache_entry {
+        uint8_t version;
+        uint8_t dcid_length;                          // 0 if the entry is empty
+        uint8_t dcid[max_dcid_length];
+        struct quic_initial_keys keys;
+    };
 
-    quic_initial_packet_crypto(struct quic_initial_packet quic_pkt) {
-        const uint8_t *dcid = quic_pkt.dcid.data;
-        size_t dcid_len = quic_pkt.dcid.length();
-        uint8_t version = *(quic_pkt.version.data+3);
+    // struct hmac_state holds the SHA-256 contexts of an HMAC key,
+    // after its inner and outer pads have been hashed
+    //
+    struct hmac_state {
+        EVP_MD_CTX *inner;
+        EVP_MD_CTX *outer;
+    };
 
-        uint8_t *initial_salt;
-        auto pair = quic_initial_salt.find(version);
-        if (pair != quic_initial_salt.end()) {
-            initial_salt = pair->second;
-        } else {
-            valid = false;
+    struct salt_entry {
+        const uint8_t *salt;                          // NULL if the entry is empty
+        struct hmac_state key;
+    };
+
+    std::vector<struct cache_entry> cache;
+    struct quic_initial_keys uncached_keys;
+    EVP_CIPHER_CTX *ctr;
+    const EVP_MD *sha256;                             // fetched once, since an implicit fetch is slow
+    EVP_MD_CTX *md_ctx;
+    struct hmac_state secret;                         // HMAC state of the secret being expanded
+    struct salt_entry salts[max_salts];
+    bool aesni;                                       // header protection with AES-NI
+    uint64_t lookups;
+    uint64_t hits;
+
+    explicit quic_crypto_engine(size_t cache_size=default_cache_size) :
+        cache(cache_size),
+        uncached_keys{},
+        ctr{EVP_CIPHER_CTX_new()},
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        sha256{EVP_MD_fetch(NULL, "SHA256", NULL)},
+#else
+        sha256{EVP_sha256()},
+#endif
+        md_ctx{EVP_MD_CTX_new()},
+        secret{EVP_MD_CTX_new(), EVP_MD_CTX_new()},
+        salts{},
+        aesni{cpu_has_aesni()},
+        lookups{0},
+        hits{0} {
+
+        bool ok = sha256 && md_ctx && secret.inner && secret.outer;
+        for (struct salt_entry &e : salts) {
+            e.key.inner = EVP_MD_CTX_new();
+            e.key.outer = EVP_MD_CTX_new();
+            ok = ok && e.key.inner && e.key.outer;
+        }
+        if (ctr && (!ok || EVP_DecryptInit_ex(ctr, EVP_aes_128_ctr(), NULL, NULL, NULL) != 1)) {
+            EVP_CIPHER_CTX_free(ctr);
+            ctr = NULL;
+        }
+    }
+
+    ~quic_crypto_engine() {
+        EVP_CIPHER_CTX_free(ctr);
+        EVP_MD_CTX_free(md_ctx);
+        EVP_MD_CTX_free(secret.inner);
+        EVP_MD_CTX_free(secret.outer);
+        for (struct salt_entry &e : salts) {
+            EVP_MD_CTX_free(e.key.inner);
+            EVP_MD_CTX_free(e.key.outer);
+        }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        EVP_MD_free(const_cast<EVP_MD *>(sha256));
+#endif
+    }
+
+    quic_crypto_engine(const quic_crypto_engine &) = delete;
+    quic_crypto_engine &operator=(const quic_crypto_engine &) = delete;
+
+    // get_keys(version, dcid) returns the keys of the Initial packets
+    // with the version and dcid, which are valid until the next call,
+    // or NULL if the version is not supported, or decryption is not
+    // possible
+    //
+    const struct quic_initial_keys *get_keys(uint8_t version, const struct datum &dcid) {
+        if (ctr == NULL || dcid.is_not_empty() == false || (size_t)dcid.length() > max_dcid_length) {
+            return NULL;
+        }
+        const uint8_t *salt = quic_initial_salt(version);
+        if (salt == NULL) {
+            return NULL;
+        }
+        lookups++;
+        if (cache.size() == 0) {
+            return derive(salt, dcid, uncached_keys) ? &uncached_keys : NULL;
+        }
+
+        struct cache_entry &e = cache[quic_dcid_hash(version, dcid) & (cache.size() - 1)];
+        if (e.dcid_length == dcid.length() && e.version == version && memcmp(e.dcid, dcid.data, e.dcid_length) == 0) {
+            hits++;
+            return &e.keys;
+        }
+        if (derive(salt, dcid, e.keys) == false) {
+            e.dcid_length = 0;
+            return NULL;
+        }
+        e.version = version;
+        e.dcid_length = dcid.length();
+        memcpy(e.dcid, dcid.data, e.dcid_length);
+        return &e.keys;
+    }
+
+    // header_protection_masks(n, keys, samples, masks) computes the
+    // header protection mask of each of n packets, which is the
+    // encryption of its sample with the header protection key in its
+    // keys, up to hp_batch_size packets at a time
+    //
+    void header_protection_masks(size_t n, const struct quic_initial_keys *const *keys, const uint8_t *const *samples, uint8_t (*masks)[16]) const {
+#if defined(__x86_64__) || defined(__i386__)
+        if (aesni) {
+            const uint8_t *hp[hp_batch_size];
+            for (size_t i = 0; i < n; i += hp_batch_size) {
+                size_t batch = (n - i < hp_batch_size) ? n - i : hp_batch_size;
+                for (size_t j = 0; j < batch; j++) {
+                    hp[j] = keys[i + j]->hp;
+                }
+                quic_aesni_encrypt_blocks(batch, hp, samples + i, masks + i);
+            }
             return;
         }
+#endif
+        for (size_t i = 0; i < n; i++) {
+            AES_KEY hp_key;
+            AES_set_encrypt_key(keys[i]->hp, 128, &hp_key);
+            AES_encrypt(samples[i], masks[i], &hp_key);
+        }
+    }
+
+    // decrypt(key, iv, ciphertext, length, plaintext) decrypts length
+    // bytes of the ciphertext of an AES-128-GCM payload, without its
+    // tag, into plaintext, and returns the length of the plaintext, or
+    // -1 on error.  GCM encrypts the payload in counter mode, starting
+    // from the counter block iv || 2 (NIST SP 800-38D), so that is
+    // used directly.
+    //
+    int decrypt(const uint8_t *key, const uint8_t *iv, const uint8_t *ciphertext, int length, uint8_t *plaintext) {
+        uint8_t counter[16];
+        memcpy(counter, iv, 12);
+        counter[12] = 0;
+        counter[13] = 0;
+        counter[14] = 0;
+        counter[15] = 2;
+        int len = 0;
+        if (EVP_DecryptInit_ex(ctr, NULL, NULL, key, counter) != 1) {
+            return -1;
+        }
+        if (EVP_DecryptUpdate(ctr, plaintext, &len, ciphertext, length) != 1) {
+            return -1;
+        }
+        return len;
+    }
+
+private:
+
+    static bool cpu_has_aesni() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __builtin_cpu_supports("aes");
+#else
+        return false;
+#endif
+    }
+
+    // hmac_key(key, key_len, h) sets h to the HMAC-SHA256 state of
+    // the key, in which the inner and outer pads have been hashed; a
+    // key that is longer than a block is hashed first (RFC 2104)
+    //
+    bool hmac_key(const uint8_t *key, size_t key_len, struct hmac_state &h) {
+        uint8_t hashed_key[SHA256_DIGEST_LENGTH];
+        if (key_len > hmac_block_size) {
+            unsigned int hashed_len = 0;
+            if (EVP_DigestInit_ex(md_ctx, sha256, NULL) != 1
+                || EVP_DigestUpdate(md_ctx, key, key_len) != 1
+                || EVP_DigestFinal_ex(md_ctx, hashed_key, &hashed_len) != 1) {
+                return false;
+            }
+            key = hashed_key;
+            key_len = hashed_len;
+        }
+        uint8_t ipad[hmac_block_size];
+        uint8_t opad[hmac_block_size];
+        memset(ipad, 0x36, sizeof(ipad));
+        memset(opad, 0x5c, sizeof(opad));
+        for (size_t i = 0; i < key_len; i++) {
+            ipad[i] ^= key[i];
+            opad[i] ^= key[i];
+        }
+        return EVP_DigestInit_ex(h.inner, sha256, NULL) == 1
+            && EVP_DigestUpdate(h.inner, ipad, sizeof(ipad)) == 1
+            && EVP_DigestInit_ex(h.outer, sha256, NULL) == 1
+            && EVP_DigestUpdate(h.outer, opad, sizeof(opad)) == 1;
+    }
+
+    // hmac(h, data, data_len, out) computes the HMAC-SHA256 of data,
+    // with the key of the state h, into out, which must hold
+    // SHA256_DIGEST_LENGTH bytes; h is left unchanged, so that it can
+    // be used again
+    //
+    bool hmac(const struct hmac_state &h, const uint8_t *data, size_t data_len, uint8_t *out) {
+        unsigned int len = 0;
+        return EVP_MD_CTX_copy_ex(md_ctx, h.inner) == 1
+            && EVP_DigestUpdate(md_ctx, data, data_len) == 1
+            && EVP_DigestFinal_ex(md_ctx, out, &len) == 1
+            && EVP_MD_CTX_copy_ex(md_ctx, h.outer) == 1
+            && EVP_DigestUpdate(md_ctx, out, len) == 1
+            && EVP_DigestFinal_ex(md_ctx, out, &len) == 1;
+    }
+
+    // salt_key(salt) returns the HMAC state keyed with salt, which is
+    // computed only once per salt, or NULL on error
+    //
+    const struct hmac_state *salt_key(const uint8_t *salt) {
+        for (struct salt_entry &e : salts) {
+            if (e.salt == salt) {
+                return &e.key;
+            }
+            if (e.salt == NULL) {
+                if (hmac_key(salt, quic_initial_salt_length, e.key) == false) {
+                    return NULL;
+                }
+                e.salt = salt;
+                return &e.key;
+            }
+        }
+        return NULL;
+    }
+
+    // expand_label(secret, label, out, length) is HKDF-Expand-Label
+    // from TLS 1.3 (RFC 8446, Section 7.1), with the secret given as
+    // its HMAC state, an empty context and a length of at most
+    // SHA256_DIGEST_LENGTH bytes
+    //
+    bool expand_label(const struct hmac_state &secret, const char *label, uint8_t *out, uint8_t length) {
+        uint8_t info[2 + 1 + 255 + 1 + 1];
+        size_t label_len = strlen(label);
+        info[0] = 0;
+        info[1] = length;
+        info[2] = 6 + label_len;
+        memcpy(info + 3, "tls13 ", 6);
+        memcpy(info + 9, label, label_len);
+        info[9 + label_len] = 0;      // context length
+        info[10 + label_len] = 1;     // counter of the first (and only) block
+        uint8_t block[SHA256_DIGEST_LENGTH];
+        if (hmac(secret, info, 11 + label_len, block) == false) {
+            return false;
+        }
+        memcpy(out, block, length);
+        return true;
+    }
+
+    // derive(salt, dcid, keys) derives the client's Initial keys from
+    // the salt of the version and the Destination Connection ID, and
+    // returns false on error
+    //
+    bool derive(const uint8_t *salt, const struct datum &dcid, struct quic_initial_keys &keys) {
+        uint8_t initial_secret[SHA256_DIGEST_LENGTH];
+        uint8_t client_initial_secret[SHA256_DIGEST_LENGTH];
+        const struct hmac_state *salt_state = salt_key(salt);
+        return salt_state != NULL
+            && hmac(*salt_state, dcid.data, dcid.length(), initial_secret)
+            && hmac_key(initial_secret, sizeof(initial_secret), secret)
+            && expand_label(secret, "client in", client_initial_secret, sizeof(client_initial_secret))
+            && hmac_key(client_initial_secret, sizeof(client_initial_secret), secret)
+            && expand_label(secret, "quic key", keys.key, sizeof(keys.key))
+            && expand_label(secret, "quic iv", keys.iv, sizeof(keys.iv))
+            && expand_label(secret, "quic hp", keys.hp, sizeof(keys.hp));
+    }
+};
 
-        uint8_t initial_secret[EVP_MAX_MD_SIZE];
-        unsigned int initial_secret_len = 0;
-        HMAC(EVP_sha256(), initial_salt, salt_length, dcid, dcid_len, initial_secret, &initial_secret_len);
+/*
+ * struct quic_initial_packet_crypto removes the header protection of a
+ * client's QUIC Initial packet, with the keys that engine provides, and
+ * decrypt() decrypts its payload, without its authentication tag, into
+ * plaintext; packets whose payload is longer than max_plaintext_length
+ * are not decrypted
+ */
+struct quic_initial_packet_crypto {
+    static const size_t max_plaintext_length = 4096;
+    static const size_t tag_length = 16;
 
-        uint8_t c_initial_secret[EVP_MAX_MD_SIZE] = {0};
-        unsigned int c_initial_secret_len = 0;
-        kdf_tls13(initial_secret, initial_secret_len, client_in_label, sizeof(client_in_label)-1, 32, c_initial_secret, &c_initial_secret_len);
-        kdf_tls13(c_initial_secret, c_initial_secret_len, quic_key_label, sizeof(quic_key_label)-1, 16, quic_key, &quic_key_len);
-        kdf_tls13(c_initial_secret, c_initial_secret_len, quic_iv_label, sizeof(quic_iv_label)-1, 12, quic_iv, &quic_iv_len);
-        kdf_tls13(c_initial_secret, c_initial_secret_len, quic_hp_label, sizeof(quic_hp_label)-1, 16, quic_hp, &quic_hp_len);
+    bool valid;
+    struct quic_crypto_engine &engine;
+    const struct quic_initial_keys *keys;
+    uint8_t quic_iv[12];
+    uint8_t pn_length = 0;
 
-        AES_KEY enc_key;
-        AES_set_encrypt_key(quic_hp, 128, &enc_key);
-        uint8_t buf[32] = {0};
-        AES_encrypt(quic_pkt.data.data+4, buf, &enc_key);
+    unsigned char plaintext[max_plaintext_length];
+    int plaintext_len = 0;
+
+    quic_initial_packet_crypto(const struct quic_initial_packet &quic_pkt, struct quic_crypto_engine &crypto_engine) :
+        valid{false},
+        engine{crypto_engine},
+        keys{engine.get_keys(*(quic_pkt.version.data+3), quic_pkt.dcid)} {
+
+        if (keys == NULL) {
+            return;
+        }
+
+        uint8_t buf[16];
+        const uint8_t *sample = quic_pkt.data.data+4;
+        engine.header_protection_masks(1, &keys, &sample, &buf);
         pn_length = quic_pkt.connection_info ^ (buf[0] & 0x0f);
         pn_length = (pn_length & 0x03) + 1;
 
-	for (uint8_t i = quic_iv_len-pn_length; i < quic_iv_len; i++) {
-	  quic_iv[i] ^= (buf[(i-(quic_iv_len-pn_length))+1] ^ *(quic_pkt.data.data + (i-(quic_iv_len-pn_length))));
-	}
+        memcpy(quic_iv, keys->iv, sizeof(quic_iv));
+        for (uint8_t i = sizeof(quic_iv)-pn_length; i < sizeof(quic_iv); i++) {
+            quic_iv[i] ^= (buf[(i-(sizeof(quic_iv)-pn_length))+1] ^ *(quic_pkt.data.data + (i-(sizeof(quic_iv)-pn_length))));
+        }
 
         valid = true;
     }
 
     void decrypt(const uint8_t *data, unsigned int length) {
-        uint16_t cipher_len = (length-pn_length < 1024) ? length-pn_length : 1024;
-        plaintext_len = gcm_decrypt(data+pn_length, cipher_len, quic_key, quic_iv, plaintext);
-        if (plaintext_len == -1) { // error
-            valid = false;
+        if (!valid) {
             return;
         }
-
-        if ((plaintext[4] != 0x01) || (plaintext[8] != 0x03) || (plaintext[9] != 0x03)) {
+        if (length <= pn_length + tag_length || length - pn_length - tag_length > max_plaintext_length) {
             valid = false;
             return;
         }
+        plaintext_len = engine.decrypt(keys->key, quic_iv, data+pn_length, length-pn_length-tag_length, plaintext);
+        if (plaintext_len <= 0) {
+            valid = false;
+        }
+    }
 
+    bool is_not_empty() {
+        return valid;
     }
 
-    // adapted from https://wiki.openssl.org/index.php/EVP_Authenticated_Encryption_and_Decryption
-    int gcm_decrypt(const unsigned char *ciphertext, int ciphertext_len,
-                    unsigned char *key, unsigned char *iv,
-                    unsigned char *plaintext)
-    {
-        EVP_CIPHER_CTX *ctx;
-        int len;
-        int plaintext_len;
+    // frames() returns the frames of the decrypted payload
+    //
+    struct datum frames() const {
+        return datum{plaintext, plaintext + plaintext_len};
+    }
+};
 
-        /* Create and initialise the context */
-        if(!(ctx = EVP_CIPHER_CTX_new()))
-            return -1;
+/*
+ * quic_read_varint(d, value) reads a variable-length integer (RFC
+ * 9000, Section 16) from d into value and returns true, or returns
+ * false, and leaves d unchanged, if d is too short to hold it
+ */
+inline bool quic_read_varint(struct datum &d, uint64_t *value) {
+    if (d.is_not_empty() == false) {
+        return false;
+    }
+    size_t length = (size_t)1 << (*d.data >> 6);
+    if ((size_t)d.length() < length) {
+        return false;
+    }
+    uint64_t x = *d.data & 0x3f;
+    for (size_t i = 1; i < length; i++) {
+        x = (x << 8) | d.data[i];
+    }
+    d.data += length;
+    *value = x;
+    return true;
+}
 
-        /* Initialise the decryption operation. */
-        if(!EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL))
-            return -1;
+/*
+ * struct quic_crypto_frame is the stream offset and data of a CRYPTO
+ * frame
+ */
+struct quic_crypto_frame {
+    uint64_t offset;
+    struct datum data;
+};
 
-        /* Initialise key and IV */
-        if(!EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv))
+/*
+ * quic_parse_initial_frames(d, frames, max_frames) parses the frames
+ * in d, the payload of an Initial packet, which can only hold PADDING,
+ * PING, ACK, CRYPTO and CONNECTION_CLOSE frames, and writes its CRYPTO
+ * frames into frames.  It returns the number of CRYPTO frames, or -1
+ * if d holds any other frame, a truncated frame, or more than
+ * max_frames CRYPTO frames, as it almost always does if it was
+ * decrypted with the wrong keys.
+ */
+inline int quic_parse_initial_frames(struct datum d, struct quic_crypto_frame *frames, int max_frames) {
+    int num_frames = 0;
+    while (d.is_not_empty()) {
+        uint64_t type;
+        if (quic_read_varint(d, &type) == false) {
             return -1;
-
-        /*
-         * Provide the message to be decrypted, and obtain the plaintext output.
-         * EVP_DecryptUpdate can be called multiple times if necessary
-         */
-        if(!EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, ciphertext_len))
+        }
+        switch (type) {
+        case 0x00:   // PADDING, which usually fills the rest of the packet
+            while (d.data + sizeof(uint64_t) <= d.data_end) {
+                uint64_t x;
+                memcpy(&x, d.data, sizeof(x));
+                if (x != 0) {
+                    break;
+                }
+                d.data += sizeof(x);
+            }
+            while (d.data < d.data_end && *d.data == 0x00) {
+                d.data++;
+            }
+            break;
+        case 0x01:   // PING
+            break;
+        case 0x02:   // ACK
+        case 0x03:   // ACK, with ECN counts
+            {
+                uint64_t largest_acknowledged, ack_delay, range_count, first_range;
+                if (quic_read_varint(d, &largest_acknowledged) == false ||
+                    quic_read_varint(d, &ack_delay) == false ||
+                    quic_read_varint(d, &range_count) == false ||
+                    quic_read_varint(d, &first_range) == false) {
+                    return -1;
+                }
+                for (uint64_t i = 0; i < range_count; i++) {
+                    uint64_t gap, range_length;
+                    if (quic_read_varint(d, &gap) == false || quic_read_varint(d, &range_length) == false) {
+                        return -1;
+                    }
+                }
+                if (type == 0x03) {
+                    uint64_t ect0, ect1, ecn_ce;
+                    if (quic_read_varint(d, &ect0) == false ||
+                        quic_read_varint(d, &ect1) == false ||
+                        quic_read_varint(d, &ecn_ce) == false) {
+                        return -1;
+                    }
+                }
+            }
+            break;
+        case 0x06:   // CRYPTO
+            {
+                uint64_t offset, length;
+                if (quic_read_varint(d, &offset) == false ||
+                    quic_read_varint(d, &length) == false ||
+                    length > (uint64_t)d.length() ||
+                    num_frames == max_frames) {
+                    return -1;
+                }
+                frames[num_frames].offset = offset;
+                frames[num_frames].data = datum{d.data, d.data + length};
+                num_frames++;
+                d.data += length;
+            }
+            break;
+        case 0x1c:   // CONNECTION_CLOSE
+            {
+                uint64_t error_code, frame_type, reason_length;
+                if (quic_read_varint(d, &error_code) == false ||
+                    quic_read_varint(d, &frame_type) == false ||
+                    quic_read_varint(d, &reason_length) == false ||
+                    reason_length > (uint64_t)d.length()) {
+                    return -1;
+                }
+                d.data += reason_length;
+            }
+            break;
+        default:
             return -1;
-        plaintext_len = len;
+        }
+    }
+    return num_frames;
+}
+
+/*
+ * struct quic_crypto_stream reassembles the start of the CRYPTO stream
+ * of a client's Initial packets, which is its ClientHello, from frames
+ * that can arrive in any order, overlap, and be split across packets.
+ * The received byte ranges are kept sorted and merged in range[], so
+ * that a stream with more than max_ranges gaps can not be reassembled.
+ */
+struct quic_crypto_stream {
+    static const unsigned int max_ranges = 16;
+    static const size_t min_client_hello_length = 4 + 2 + 32;   // handshake header, version and random
 
-        /*
-         * Finalise the decryption. A positive return value indicates success,
-         * anything else is a failure - the plaintext is not trustworthy.
-         */
-        EVP_DecryptFinal_ex(ctx, plaintext + len, &len);
+    struct byte_range {
+        uint32_t start;
+        uint32_t end;
+    };
 
-        /* Clean up */
-        EVP_CIPHER_CTX_free(ctx);
+    std::vector<uint8_t> data;            // the stream, from offset zero
+    uint32_t length;                      // of the ClientHello, with its handshake header, or 0 if not yet known
+    unsigned int num_ranges;
+    struct byte_range range[max_ranges];
 
-        plaintext_len += len;
-        return plaintext_len;
+    quic_crypto_stream() : data{}, length{0}, num_ranges{0} { }
+
+    void reset() {
+        length = 0;
+        num_ranges = 0;
     }
 
-    void kdf_tls13(uint8_t *secret, unsigned int secret_length, const uint8_t *label, const unsigned int label_len,
-                   uint8_t length, uint8_t *out_, unsigned int *out_len) {
-        uint8_t *new_label = new uint8_t[4+label_len]();
-        new_label[1] = length;
-        new_label[2] = label_len;
-        for (uint i = 0; i < label_len; i++) {
-            new_label[3+i] = label[i];
+    // add(offset, d, max_length) copies the data d of a CRYPTO frame
+    // into the stream at offset, and returns true, or returns false if
+    // the stream can not hold a ClientHello: it does not start with
+    // one, or it would have to be longer than max_length or have more
+    // than max_ranges gaps.  The data after the end of the ClientHello
+    // is ignored.
+    //
+    bool add(uint64_t offset, const struct datum &d, size_t max_length) {
+        uint64_t end = offset + d.length();
+        if (length != 0) {
+            if (offset >= length) {
+                return true;
+            }
+            if (end > length) {
+                end = length;
+            }
+        }
+        if (offset >= end) {
+            return true;
+        }
+        if (end > max_length) {
+            return false;
+        }
+        if (end > data.size()) {
+            data.resize(end);
         }
+        memcpy(data.data() + offset, d.data, end - offset);
 
-        uint8_t ind = 0;
-        uint8_t block[EVP_MAX_MD_SIZE];
-        uint8_t new_block[512] = {0};
-        unsigned int block_len = 0;
-        while (*out_len < length) {
-            ind++;
+        // merge [offset, end) with the ranges that it overlaps or
+        // touches, which are range[i] through range[j-1]
+        //
+        uint32_t start = offset;
+        uint32_t stop = end;
+        unsigned int i = 0;
+        while (i < num_ranges && range[i].end < start) {
+            i++;
+        }
+        unsigned int j = i;
+        while (j < num_ranges && range[j].start <= stop) {
+            start = range[j].start < start ? range[j].start : start;
+            stop = range[j].end > stop ? range[j].end : stop;
+            j++;
+        }
+        if (i == j) {
+            if (num_ranges == max_ranges) {
+                return false;
+            }
+            memmove(&range[i+1], &range[i], (num_ranges - i) * sizeof(range[0]));
+            num_ranges++;
+        } else if (j > i + 1) {
+            memmove(&range[i+1], &range[j], (num_ranges - j) * sizeof(range[0]));
+            num_ranges -= j - i - 1;
+        }
+        range[i].start = start;
+        range[i].end = stop;
 
-            for (unsigned int i = 0; i < block_len; i++) {
-                new_block[i] = block[i];
+        // the handshake header gives the length of the ClientHello
+        //
+        if (length == 0 && range[0].start == 0 && range[0].end >= 4) {
+            if (data[0] != 0x01) {
+                return false;   // not a ClientHello
             }
-            for (unsigned int i = block_len; i < block_len+label_len+4; i++) {
-                new_block[i] = new_label[i];
+            length = 4 + (data[1] << 16 | data[2] << 8 | data[3]);
+            if (length < min_client_hello_length || length > max_length) {
+                return false;
             }
-            new_block[block_len+label_len+4] = ind;
+        }
+        return true;
+    }
 
-            HMAC(EVP_sha256(), secret, secret_length, new_block, block_len+label_len+5, block, &block_len);
+    bool is_complete() const {
+        return length != 0 && range[0].start == 0 && range[0].end >= length;
+    }
 
-            for (unsigned int i = 0; i < block_len; i++) {
-                out_[*out_len] = block[i];
-                (*out_len)++;
-                if (*out_len >= length) {
-                    delete[] new_label;
-                    return ;
-                }
-            }
+    // client_hello() returns the body of the ClientHello of a complete
+    // stream, which starts with its legacy version, or a null datum if
+    // that version is not TLS 1.2
+    //
+    struct datum client_hello() const {
+        return complete_client_hello(datum{data.data(), data.data() + length});
+    }
+
+    // complete_client_hello(d) returns the body of the ClientHello at
+    // the start of d, or a null datum if d does not hold all of one
+    // whose legacy version is TLS 1.2
+    //
+    static struct datum complete_client_hello(const struct datum &d) {
+        if ((size_t)d.length() < min_client_hello_length || d.data[0] != 0x01) {
+            return datum{};
         }
-        delete[] new_label;
+        size_t hello_length = 4 + (d.data[1] << 16 | d.data[2] << 8 | d.data[3]);
+        if (hello_length < min_client_hello_length || hello_length > (size_t)d.length() ||
+            d.data[4] != 0x03 || d.data[5] != 0x03) {
+            return datum{};
+        }
+        return datum{d.data + 4, d.data + hello_length};
     }
 
-    bool is_not_empty() {
-        return valid;
+    // release() frees the memory of the stream, and returns its size
+    //
+    size_t release() {
+        size_t size = data.size();
+        std::vector<uint8_t>().swap(data);
+        reset();
+        return size;
     }
 };
 
-constexpr uint8_t quic_initial_packet_crypto::client_in_label[];
-constexpr uint8_t quic_initial_packet_crypto::quic_key_label[];
-constexpr uint8_t quic_initial_packet_crypto::quic_iv_label[];
-constexpr uint8_t quic_initial_packet_crypto::quic_hp_label[];
+/*
+ * struct quic_crypto_reassembler finds the ClientHellos in the Initial
+ * packets of clients, for the packet processor of one thread.  The
+ * ClientHello of most clients is in the CRYPTO frames of a single
+ * packet, and is reassembled without any state or memory allocation;
+ * a larger one, such as one with a post-quantum key share, is split
+ * across several packets, and is reassembled in a stream kept for the
+ * version and Destination Connection ID of those packets, which is
+ * the same for all of the Initial packets of a client's first flight.
+ *
+ * The streams are kept in a direct-mapped table of num_streams
+ * entries, in which a new stream replaces any other in its entry.  A
+ * stream is abandoned if it is not complete within timeout seconds,
+ * or if it would need more than max_message_length bytes, or the
+ * streams would need more than memory_limit bytes in all.  A stream
+ * that has been completed or abandoned stays in the table until it
+ * times out, so that the retransmissions of its packets are ignored.
+ */
+struct quic_crypto_reassembler {
+
+    static const size_t default_num_streams = 1024;          // must be a power of two
+    static const size_t default_memory_limit = 1024 * 1024;
+    static const size_t max_message_length = 16384;
+    static const unsigned int timeout = 10;                   // seconds
+    static const int max_frames = 64;                         // CRYPTO frames per packet
+
+    struct stream_entry {
+        uint8_t version;
+        uint8_t dcid_length;                                  // 0 if the entry is empty
+        uint8_t dcid[quic_crypto_engine::max_dcid_length];
+        bool done;                                            // completed or abandoned
+        unsigned int timestamp;                               // seconds, of the first packet
+        struct quic_crypto_stream stream;
+    };
+
+    std::vector<struct stream_entry> streams;
+    struct quic_crypto_stream packet_stream;                  // reused for every packet
+    size_t memory_limit;
+    size_t bytes_held;
+    size_t reap_index;
+    struct stream_entry *completed_entry;                     // released on the next call
+    uint64_t started;
+    uint64_t completed;
+    uint64_t abandoned;
+
+    explicit quic_crypto_reassembler(size_t num_streams=default_num_streams, size_t memory=default_memory_limit) :
+        streams(num_streams),
+        packet_stream{},
+        memory_limit{memory},
+        bytes_held{0},
+        reap_index{0},
+        completed_entry{nullptr},
+        started{0},
+        completed{0},
+        abandoned{0} { }
+
+    quic_crypto_reassembler(const quic_crypto_reassembler &) = delete;
+    quic_crypto_reassembler &operator=(const quic_crypto_reassembler &) = delete;
+
+    // client_hello(pkt, crypto, sec) returns the body of the ClientHello
+    // that the decrypted Initial packet pkt, which arrived at the time
+    // sec (in seconds), completes, which is valid until the next call,
+    // or a null datum if there is none
+    //
+    struct datum client_hello(const struct quic_initial_packet &pkt, const struct quic_initial_packet_crypto &crypto, unsigned int sec) {
+        if (completed_entry) {
+            bytes_held -= completed_entry->stream.release();
+            completed_entry = nullptr;
+        }
+        reap(sec);
+
+        struct quic_crypto_frame frames[max_frames];
+        int num_frames = quic_parse_initial_frames(crypto.frames(), frames, max_frames);
+        if (num_frames <= 0) {
+            return datum{};
+        }
+
+        // the common cases: a ClientHello in a single CRYPTO frame,
+        // which needs no copy, or in several frames of a single packet
+        //
+        if (num_frames == 1 && frames[0].offset == 0) {
+            struct datum hello = quic_crypto_stream::complete_client_hello(frames[0].data);
+            if (hello.is_not_null()) {
+                return hello;
+            }
+        }
+        packet_stream.reset();
+        bool in_packet = true;
+        for (int i = 0; i < num_frames && in_packet; i++) {
+            in_packet = packet_stream.add(frames[i].offset, frames[i].data, quic_initial_packet_crypto::max_plaintext_length);
+        }
+        if (in_packet && packet_stream.is_complete()) {
+            return packet_stream.client_hello();
+        }
+
+        if (streams.size() == 0 || (size_t)pkt.dcid.length() > quic_crypto_engine::max_dcid_length) {
+            return datum{};
+        }
+        uint8_t version = pkt.version.data[3];
+        struct stream_entry &e = streams[quic_dcid_hash(version, pkt.dcid) & (streams.size() - 1)];
+        if (e.dcid_length != 0 &&
+            (e.dcid_length != pkt.dcid.length() || e.version != version || memcmp(e.dcid, pkt.dcid.data, e.dcid_length) != 0 ||
+             sec - e.timestamp > timeout)) {
+            remove(e);
+        }
+        if (e.dcid_length == 0) {
+            e.version = version;
+            e.dcid_length = pkt.dcid.length();
+            memcpy(e.dcid, pkt.dcid.data, e.dcid_length);
+            e.done = false;
+            e.timestamp = sec;
+            started++;
+        }
+        if (e.done) {
+            return datum{};   // a retransmission
+        }
+        for (int i = 0; i < num_frames; i++) {
+            size_t size = e.stream.data.size();
+            size_t max_length = size + (memory_limit - bytes_held);
+            if (max_length > max_message_length) {
+                max_length = max_message_length;
+            }
+            bool ok = e.stream.add(frames[i].offset, frames[i].data, max_length);
+            bytes_held += e.stream.data.size() - size;
+            if (!ok) {
+                bytes_held -= e.stream.release();
+                e.done = true;
+                abandoned++;
+                return datum{};
+            }
+        }
+        if (e.stream.is_complete()) {
+            e.done = true;
+            completed++;
+            completed_entry = &e;
+            return e.stream.client_hello();
+        }
+        return datum{};
+    }
+
+private:
+
+    // remove(e) empties the entry e, and abandons its stream if it is
+    // not done
+    //
+    void remove(struct stream_entry &e) {
+        if (!e.done) {
+            abandoned++;
+        }
+        bytes_held -= e.stream.release();
+        e.dcid_length = 0;
+    }
+
+    // reap(sec) removes the entry after the last one that it checked,
+    // if it has timed out, so that the whole table is checked once in
+    // every num_streams packets
+    //
+    void reap(unsigned int sec) {
+        if (streams.size() == 0) {
+            return;
+        }
+        struct stream_entry &e = streams[reap_index];
+        reap_index = (reap_index + 1) & (streams.size() - 1);
+        if (e.dcid_length != 0 && sec - e.timestamp > timeout) {
+            remove(e);
+        }
+    }
+};
 
 #endif /* QUIC_H */
@@ -0,0 +1,471 @@
+/*
+ * quic_bench.cc
+ *
+ * benchmarks the decryption of QUIC Initial packets, stage by stage,
+ * in Initials per second on one core
+ *
+ * usage: quic_bench [--repeat n] [--json] corpus...
+ *
+ * Each corpus argument is a pcap file, or a directory whose .pcap and
+ * .mcap files are used.  The UDP payloads that mercury classifies as
+ * QUIC, and that hold a client's Initial packet of a supported
+ * version, are kept, and each of these stages is timed over all of
+ * them:
+ *
+ *    derive_keys     the derivation of the Initial keys from the DCID
+ *    hp_openssl      the header protection masks, with OpenSSL
+ *    hp_aesni        the header protection masks, with AES-NI, for
+ *                    one packet at a time and for batches of
+ *                    quic_crypto_engine::hp_batch_size packets
+ *    decrypt_gcm     the decryption of the payload with AES-128-GCM,
+ *                    through OpenSSL, as mercury used to do it
+ *    decrypt_ctr     the decryption of the payload with AES-128-CTR,
+ *                    as quic_crypto_engine::decrypt() does it
+ *    initial         all of the processing of an Initial packet, up
+ *                    to and including the parsing of its ClientHello,
+ *                    with the keys derived for every packet (as for
+ *                    new connections), and with them cached (as for
+ *                    retransmissions)
+ *
+ * Before they are timed, the header protection masks computed with
+ * AES-NI, and the plaintext decrypted with AES-128-CTR, are checked
+ * against those computed with OpenSSL and AES-128-GCM; the benchmark
+ * fails if any of them differ.  Each stage is run over all of the
+ * packets once to warm up the caches, and then repeat times (default:
+ * 7), each of which takes at least 10ms; the ns/initial and
+ * initials/s are those of the median run.  With --json, the results
+ * are written as one JSON object per line, for regression tracking;
+ * otherwise, as a table.
+ *
+ * Copyright (c) 2020 Cisco Systems, Inc. All rights reserved.
+ * License at https://github.com/cisco/mercury/blob/master/LICENSE
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+#include "extractor.h"
+#include "eth.h"
+#include "udp.h"
+#include "tcpip.h"
+#include "tls.h"
+#include "quic.h"
+#include "utils.h"
+
+struct global_variables global_vars;   /* normally defined in config.c */
+
+// read_pcap_file(filename, packets) reads all of the packets in a
+// pcap file (with microsecond or nanosecond timestamps) into packets
+//
+static bool read_pcap_file(const char *filename, std::vector<std::vector<uint8_t>> &packets) {
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open file %s\n", filename);
+        return false;
+    }
+    uint32_t file_header[6];
+    if (fread(file_header, sizeof(file_header), 1, f) != 1
+        || (file_header[0] != 0xa1b2c3d4 && file_header[0] != 0xa1b23c4d)) {
+        fprintf(stderr, "error: %s is not a pcap file in host byte order\n", filename);
+        fclose(f);
+        return false;
+    }
+    uint32_t packet_header[4];
+    while (fread(packet_header, sizeof(packet_header), 1, f) == 1) {
+        std::vector<uint8_t> p(packet_header[2]);
+        if (fread(p.data(), 1, p.size(), f) != p.size()) {
+            break;
+        }
+        packets.push_back(p);
+    }
+    fclose(f);
+    return true;
+}
+
+// read_corpus(path, packets) reads the pcap file path, or the .pcap
+// and .mcap files in the directory path, in name order
+//
+static bool read_corpus(const char *path, std::vector<std::vector<uint8_t>> &packets) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "error: could not open %s\n", path);
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        return read_pcap_file(path, packets);
+    }
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "error: could not open directory %s\n", path);
+        return false;
+    }
+    std::vector<std::string> names;
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        std::string name = d->d_name;
+        size_t dot = name.rfind('.');
+        if (dot != std::string::npos && (name.substr(dot) == ".pcap" || name.substr(dot) == ".mcap")) {
+            names.push_back(std::string(path) + "/" + name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (const auto &n : names) {
+        if (read_pcap_file(n.c_str(), packets) == false) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// struct initial holds a client's Initial packet, and what each stage
+// needs to process it on its own: its keys, the sample for its header
+// protection, and its IV and ciphertext after that is removed
+//
+struct initial {
+    std::vector<uint8_t> payload;
+    struct quic_initial_keys keys;
+    const uint8_t *sample;
+    uint8_t iv[12];
+    const uint8_t *ciphertext;
+    int ciphertext_len;
+};
+
+// extract_initials(packets, initials) adds the UDP payloads of the
+// packets that hold a client's Initial packet to initials
+//
+static void extract_initials(const std::vector<std::vector<uint8_t>> &packets, std::vector<struct initial> &initials) {
+    struct quic_crypto_engine engine{0};
+    for (const auto &packet : packets) {
+        struct key k;
+        struct datum pkt{packet.data(), packet.data() + packet.size()};
+        size_t transport_proto = 0;
+        size_t ethertype = 0;
+        datum_process_eth(&pkt, &ethertype);
+        switch(ethertype) {
+        case ETH_TYPE_IP:
+            datum_process_ipv4(&pkt, &transport_proto, &k);
+            break;
+        case ETH_TYPE_IPV6:
+            datum_process_ipv6(&pkt, &transport_proto, &k);
+            break;
+        default:
+            ;
+        }
+        if (transport_proto != 17) {
+            continue;
+        }
+        struct udp_packet udp_pkt;
+        udp_pkt.parse(pkt);
+        if (pkt.is_not_empty() == false) {
+            continue;
+        }
+        enum udp_msg_type msg_type = udp_get_message_type(pkt.data, pkt.length());
+        if (msg_type == udp_msg_type_unknown) {
+            msg_type = udp_pkt.estimate_msg_type_from_ports();
+        }
+        if (msg_type != udp_msg_type_quic) {
+            continue;
+        }
+        initials.emplace_back();
+        struct initial &i = initials.back();
+        i.payload.assign(pkt.data, pkt.data_end);
+        struct datum d{i.payload.data(), i.payload.data() + i.payload.size()};
+        struct quic_initial_packet quic_pkt{d};
+        if (quic_pkt.is_not_empty() == false) {
+            initials.pop_back();
+            continue;
+        }
+        struct quic_initial_packet_crypto quic_pkt_crypto{quic_pkt, engine};
+        if (quic_pkt_crypto.is_not_empty() == false ||
+            quic_pkt.data.length() <= (ssize_t)(quic_pkt_crypto.pn_length + quic_initial_packet_crypto::tag_length)) {
+            initials.pop_back();
+            continue;
+        }
+        i.keys = *quic_pkt_crypto.keys;
+        i.sample = quic_pkt.data.data + 4;
+        memcpy(i.iv, quic_pkt_crypto.quic_iv, sizeof(i.iv));
+        i.ciphertext = quic_pkt.data.data + quic_pkt_crypto.pn_length;
+        i.ciphertext_len = quic_pkt.data.length() - quic_pkt_crypto.pn_length - quic_initial_packet_crypto::tag_length;
+    }
+}
+
+// decrypt_gcm(ctx, key, iv, ciphertext, length, plaintext) decrypts
+// with AES-128-GCM, without checking the tag, as mercury used to do
+//
+static int decrypt_gcm(EVP_CIPHER_CTX *ctx, const uint8_t *key, const uint8_t *iv, const uint8_t *ciphertext, int length, uint8_t *plaintext) {
+    int len = 0;
+    if (EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv) != 1 ||
+        EVP_DecryptUpdate(ctx, plaintext, &len, ciphertext, length) != 1) {
+        return -1;
+    }
+    return len;
+}
+
+// check(initials, gcm) returns the number of initials whose header
+// protection mask with AES-NI, or plaintext with AES-128-CTR, differs
+// from the one computed with OpenSSL or AES-128-GCM, respectively
+//
+static unsigned int check(const std::vector<struct initial> &initials, EVP_CIPHER_CTX *gcm) {
+    struct quic_crypto_engine engine{0};
+    struct quic_crypto_engine scalar{0};
+    scalar.aesni = false;
+    unsigned int failures = 0;
+    static uint8_t expected[quic_initial_packet_crypto::max_plaintext_length];
+    static uint8_t actual[quic_initial_packet_crypto::max_plaintext_length];
+    for (size_t i = 0; i < initials.size(); i += quic_crypto_engine::hp_batch_size) {
+        size_t n = std::min(initials.size() - i, quic_crypto_engine::hp_batch_size);
+        const struct quic_initial_keys *keys[quic_crypto_engine::hp_batch_size];
+        const uint8_t *samples[quic_crypto_engine::hp_batch_size];
+        uint8_t masks[quic_crypto_engine::hp_batch_size][16];
+        uint8_t scalar_masks[quic_crypto_engine::hp_batch_size][16];
+        for (size_t j = 0; j < n; j++) {
+            keys[j] = &initials[i + j].keys;
+            samples[j] = initials[i + j].sample;
+        }
+        engine.header_protection_masks(n, keys, samples, masks);
+        scalar.header_protection_masks(n, keys, samples, scalar_masks);
+        for (size_t j = 0; j < n; j++) {
+            if (memcmp(masks[j], scalar_masks[j], sizeof(masks[j])) != 0) {
+                fprintf(stderr, "error: header protection mask %zu differs\n", i + j);
+                failures++;
+            }
+        }
+    }
+    for (size_t i = 0; i < initials.size(); i++) {
+        const struct initial &p = initials[i];
+        if (p.ciphertext_len > (int)sizeof(actual)) {
+            continue;
+        }
+        int expected_len = decrypt_gcm(gcm, p.keys.key, p.iv, p.ciphertext, p.ciphertext_len, expected);
+        int actual_len = engine.decrypt(p.keys.key, p.iv, p.ciphertext, p.ciphertext_len, actual);
+        if (actual_len != expected_len || memcmp(actual, expected, actual_len) != 0) {
+            fprintf(stderr, "error: plaintext %zu differs\n", i);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+struct result {
+    uint64_t initials;          // per run
+    uint64_t iterations;        // passes over the initials per run
+    uint64_t median_ns;         // of a pass
+    uint64_t min_ns;
+};
+
+static volatile uint64_t sink;   // keeps the results of the passes live
+
+// measure(pass, repeat, r) times the function pass, which makes one
+// pass over all of the initials, as described at the top of this file
+//
+template <typename F>
+static void measure(F pass, unsigned int repeat, struct result &r) {
+    const uint64_t min_run_ns = 10000000;
+    struct timer t;
+    timer_start(&t);
+    pass();                                    // warm-up
+    uint64_t ns = timer_stop(&t);
+    r.iterations = ns ? min_run_ns / ns + 1 : min_run_ns;
+
+    std::vector<uint64_t> run_ns;
+    for (unsigned int i = 0; i < repeat; i++) {
+        timer_start(&t);
+        for (uint64_t j = 0; j < r.iterations; j++) {
+            pass();
+        }
+        run_ns.push_back(timer_stop(&t) / r.iterations);
+    }
+    std::sort(run_ns.begin(), run_ns.end());
+    r.median_ns = run_ns[run_ns.size() / 2];
+    r.min_ns = run_ns[0];
+}
+
+// hp_pass(engine, initials, batch) computes the header protection
+// masks of all of the initials, batch packets at a time
+//
+static uint64_t hp_pass(const struct quic_crypto_engine &engine, const std::vector<struct initial> &initials, size_t batch) {
+    uint64_t x = 0;
+    const struct quic_initial_keys *keys[quic_crypto_engine::hp_batch_size];
+    const uint8_t *samples[quic_crypto_engine::hp_batch_size];
+    uint8_t masks[quic_crypto_engine::hp_batch_size][16];
+    for (size_t i = 0; i < initials.size(); i += batch) {
+        size_t n = std::min(initials.size() - i, batch);
+        for (size_t j = 0; j < n; j++) {
+            keys[j] = &initials[i + j].keys;
+            samples[j] = initials[i + j].sample;
+        }
+        engine.header_protection_masks(n, keys, samples, masks);
+        x += masks[0][0];
+    }
+    return x;
+}
+
+// initial_pass(engine, reassembler, initials) processes all of the
+// initials as stateful_pkt_proc does, and returns the number of
+// ClientHellos found
+//
+static uint64_t initial_pass(struct quic_crypto_engine &engine, struct quic_crypto_reassembler &reassembler, const std::vector<struct initial> &initials) {
+    uint64_t count = 0;
+    for (const auto &p : initials) {
+        struct datum d{p.payload.data(), p.payload.data() + p.payload.size()};
+        struct quic_initial_packet quic_pkt{d};
+        if (quic_pkt.is_not_empty() == false) {
+            continue;
+        }
+        struct quic_initial_packet_crypto quic_pkt_crypto{quic_pkt, engine};
+        quic_pkt_crypto.decrypt(quic_pkt.data.data, quic_pkt.data.length());
+        if (quic_pkt_crypto.is_not_empty() == false) {
+            continue;
+        }
+        struct datum client_hello = reassembler.client_hello(quic_pkt, quic_pkt_crypto, 0);
+        struct tls_client_hello hello;
+        hello.parse(client_hello);
+        count += hello.is_not_empty();
+    }
+    return count;
+}
+
+static void usage(const char *progname) {
+    fprintf(stderr, "usage: %s [--repeat n] [--json] corpus...\n", progname);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+
+    unsigned int repeat = 7;
+    bool json = false;
+    std::vector<const char *> corpus;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        } else {
+            corpus.push_back(argv[i]);
+        }
+    }
+    if (corpus.size() == 0) {
+        usage(argv[0]);
+    }
+    if (repeat == 0) {
+        repeat = 1;
+    }
+
+    std::vector<std::vector<uint8_t>> packets;
+    for (const char *c : corpus) {
+        if (read_corpus(c, packets) == false) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (proto_ident_config(NULL) != status_ok) {
+        fprintf(stderr, "error: could not configure protocol identification\n");
+        return EXIT_FAILURE;
+    }
+    std::vector<struct initial> initials;
+    extract_initials(packets, initials);
+    if (initials.size() == 0) {
+        fprintf(stderr, "error: no QUIC Initial packets in the corpus (test/data has none; see BENCH_CORPUS)\n");
+        return EXIT_FAILURE;
+    }
+
+    EVP_CIPHER_CTX *gcm = EVP_CIPHER_CTX_new();
+    if (gcm == NULL || EVP_DecryptInit_ex(gcm, EVP_aes_128_gcm(), NULL, NULL, NULL) != 1) {
+        fprintf(stderr, "error: could not initialize AES-128-GCM\n");
+        return EXIT_FAILURE;
+    }
+    struct quic_crypto_engine engine{0};
+    struct quic_crypto_engine scalar{0};
+    scalar.aesni = false;
+    unsigned int failures = check(initials, gcm);
+
+    if (json == false) {
+        fprintf(stdout, "corpus: %zu packets, %zu initials, repeat: %u, aesni: %s\n",
+                packets.size(), initials.size(), repeat, engine.aesni ? "yes" : "no");
+        fprintf(stdout, "correctness: %u failures\n", failures);
+        fprintf(stdout, "%-16s %6s %10s %10s %12s\n", "stage", "batch", "ns/initial", "min ns", "initials/s");
+    }
+    if (failures) {
+        return EXIT_FAILURE;
+    }
+
+    static uint8_t plaintext[quic_initial_packet_crypto::max_plaintext_length];
+    struct quic_crypto_engine cached_engine;
+    struct quic_crypto_reassembler reassembler;
+
+    struct stage {
+        const char *name;
+        size_t batch;
+        bool enabled;
+        std::function<uint64_t()> pass;
+    } stages[] = {
+        { "derive_keys", 1, true, [&]() {
+                uint64_t x = 0;
+                for (const auto &p : initials) {
+                    struct datum d{p.payload.data(), p.payload.data() + p.payload.size()};
+                    struct quic_initial_packet quic_pkt{d};
+                    const struct quic_initial_keys *keys = engine.get_keys(quic_pkt.version.data[3], quic_pkt.dcid);
+                    x += keys ? keys->hp[0] : 0;
+                }
+                return x;
+            } },
+        { "hp_openssl", 1, true, [&]() { return hp_pass(scalar, initials, 1); } },
+        { "hp_aesni", 1, engine.aesni, [&]() { return hp_pass(engine, initials, 1); } },
+        { "hp_aesni", quic_crypto_engine::hp_batch_size, engine.aesni, [&]() { return hp_pass(engine, initials, quic_crypto_engine::hp_batch_size); } },
+        { "decrypt_gcm", 1, true, [&]() {
+                uint64_t x = 0;
+                for (const auto &p : initials) {
+                    if (p.ciphertext_len <= (int)sizeof(plaintext)) {
+                        x += decrypt_gcm(gcm, p.keys.key, p.iv, p.ciphertext, p.ciphertext_len, plaintext);
+                    }
+                }
+                return x;
+            } },
+        { "decrypt_ctr", 1, true, [&]() {
+                uint64_t x = 0;
+                for (const auto &p : initials) {
+                    if (p.ciphertext_len <= (int)sizeof(plaintext)) {
+                        x += engine.decrypt(p.keys.key, p.iv, p.ciphertext, p.ciphertext_len, plaintext);
+                    }
+                }
+                return x;
+            } },
+        { "initial", 1, true, [&]() { return initial_pass(engine, reassembler, initials); } },
+        { "initial_cached", 1, true, [&]() { return initial_pass(cached_engine, reassembler, initials); } },
+    };
+
+    for (auto &s : stages) {
+        if (s.enabled == false) {
+            continue;
+        }
+        struct result r;
+        r.initials = initials.size();
+        measure([&s]() { sink = s.pass(); }, repeat, r);
+        double ns_per_initial = (double)r.median_ns / r.initials;
+        double min_ns_per_initial = (double)r.min_ns / r.initials;
+        double initials_per_sec = r.median_ns ? r.initials * 1e9 / r.median_ns : 0.0;
+        if (json) {
+            fprintf(stdout, "{\"bench\":\"quic\",\"stage\":\"%s\",\"batch\":%zu,\"repeat\":%u,"
+                    "\"initials\":%" PRIu64 ",\"iterations\":%" PRIu64 ","
+                    "\"ns_per_initial\":%.1f,\"min_ns_per_initial\":%.1f,\"initials_per_sec\":%.0f}\n",
+                    s.name, s.batch, repeat, r.initials, r.iterations,
+                    ns_per_initial, min_ns_per_initial, initials_per_sec);
+        } else {
+            fprintf(stdout, "%-16s %6zu %10.1f %10.1f %12.0f\n",
+                    s.name, s.batch, ns_per_initial, min_ns_per_initial, initials_per_sec);
+        }
+        fflush(stdout);
+    }
+
+    EVP_CIPHER_CTX_free(gcm);
+    return EXIT_SUCCESS;
+}
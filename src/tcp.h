@@ -11,6 +11,8 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include "mercury.h"
 #include "datum.h"
 
@@ -107,6 +109,19 @@ struct key {
     bool is_zero() const {
         return ip_vers == 0;
     }
+
+    // reverse() swaps the source and destination addresses and ports,
+    // so that the key identifies the other direction of the flow
+    //
+    void reverse() {
+        std::swap(src_port, dst_port);
+        if (ip_vers == 4) {
+            std::swap(addr.ipv4.src, addr.ipv4.dst);
+        } else {
+            std::swap(addr.ipv6.src, addr.ipv6.dst);
+        }
+    }
+
     bool operator==(const key &k) const {
         switch (ip_vers) {
         case 4:
@@ -580,6 +595,10 @@ struct tcp_reassembler {
         return nullptr;
     }
 
+    bool has_segment(const struct key &k) const {
+        return segment_table.find(k) != segment_table.end();
+    }
+
     std::unordered_map<struct key, struct tcp_segment>::iterator reap(unsigned int sec) {
 
         // check for expired elements
@@ -756,4 +775,293 @@ struct flow_table_tcp {
 };
 
 
+// struct tcp_verdict_cache
+//
+// goal: skip the inspection of TCP packets in flows that are past the
+// point where any message that mercury reports can appear, at the
+// cost of a single hash table lookup.
+//
+// approach: each direction of a flow is marked as done once its
+// first data message has been processed (and, for a TLS server, its
+// certificate), and as inspect if it has sent an HTTP message, since
+// persistent connections can carry more of those; packets in
+// directions marked as done are not inspected any further.  SYN and
+// FIN/RST packets remove a flow's verdict.  Each verdict expires
+// timeout seconds after the last packet in its flow.
+//
+// The verdicts are held in a fixed array of buckets, each of which
+// holds up to ways verdicts, so that the location of a flow's verdict
+// depends only on its hash, and can be prefetched before the lookup
+// without touching any other memory; when a bucket is full, its
+// least recently used verdict is evicted.  An evicted verdict only
+// means that the flow's packets are inspected again.
+
+struct tcp_verdict_cache {
+
+    enum verdict : uint8_t {
+        inspect = 0,
+        done    = 1
+    };
+
+    struct entry {
+        struct key k;           // the zero key marks an empty entry
+        unsigned int sec;
+        enum verdict v;
+    };
+
+    static const unsigned int ways = 4;
+
+    struct bucket {
+        struct entry e[ways];
+    };
+
+    std::vector<struct bucket> buckets;
+    size_t mask;
+
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t evictions;
+
+    // the number of buckets is the smallest power of two that holds
+    // at least twice size verdicts, so that few buckets overflow
+    // while there are fewer than size flows
+    //
+    tcp_verdict_cache(unsigned int size) : buckets{}, mask{0}, lookups{0}, hits{0}, evictions{0} {
+        size_t num_buckets = 1;
+        while (num_buckets * ways < 2 * (size_t)size) {
+            num_buckets *= 2;
+        }
+        buckets.resize(num_buckets);
+        mask = num_buckets - 1;
+        count_all();
+    }
+
+    bool is_done(const struct key &k, unsigned int sec) {
+        lookups++;
+        struct entry *e = find(k);
+        if (e == nullptr) {
+            return false;
+        }
+        if (sec - e->sec >= timeout) {
+            e->k.zeroize();
+            return false;
+        }
+        e->sec = sec;
+        if (e->v == done) {
+            hits++;
+            return true;
+        }
+        return false;
+    }
+
+    // mark_done(k, sec) marks the flow k as done, unless it has been
+    // marked as inspect
+    //
+    void mark_done(const struct key &k, unsigned int sec) {
+        set(k, sec, done, false);
+    }
+
+    void mark_inspect(const struct key &k, unsigned int sec) {
+        set(k, sec, inspect, true);
+    }
+
+    void remove(const struct key &k) {
+        struct entry *e = find(k);
+        if (e) {
+            e->k.zeroize();
+        }
+    }
+
+    // prefetch(k) prefetches the bucket that holds the verdict for
+    // k, which spans at most four cache lines; it is always inlined,
+    // since GCC treats a function that only prefetches as free of
+    // side effects, and removes calls to it
+    //
+    __attribute__((always_inline)) void prefetch(const struct key &k) const {
+        const char *b = (const char *)&buckets[index(k)];
+        __builtin_prefetch(b);
+        __builtin_prefetch(b + 64);
+        __builtin_prefetch(b + 128);
+        __builtin_prefetch(b + sizeof(struct bucket) - 1);
+    }
+
+    void count_all() {
+        for (auto &b : buckets) {
+            for (auto &e : b.e) {
+                e.k.zeroize();
+                e.sec = 0;
+                e.v = inspect;
+            }
+        }
+    }
+
+    static const unsigned int timeout = 120; // seconds before verdict timeout
+
+private:
+
+    size_t index(const struct key &k) const {
+        return (std::hash<struct key>{}(k) >> 32) & mask;
+    }
+
+    struct entry *find(const struct key &k) {
+        struct bucket &b = buckets[index(k)];
+        for (auto &e : b.e) {
+            if (e.k == k) {
+                return &e;
+            }
+        }
+        return nullptr;
+    }
+
+    void set(const struct key &k, unsigned int sec, enum verdict v, bool overwrite) {
+        struct bucket &b = buckets[index(k)];
+        struct entry *victim = &b.e[0];
+        for (auto &e : b.e) {
+            if (e.k == k) {
+                if (overwrite) {
+                    e.v = v;
+                }
+                e.sec = sec;
+                return;
+            }
+            if (victim->k.is_zero()) {
+                continue;
+            }
+            if (e.k.is_zero() || sec - e.sec >= timeout || e.sec < victim->sec) {
+                victim = &e;
+            }
+        }
+        if (!victim->k.is_zero() && sec - victim->sec < timeout) {
+            evictions++;
+        }
+        victim->k = k;
+        victim->sec = sec;
+        victim->v = v;
+    }
+
+};
+
+
+// struct tcp_context_table<T>
+//
+// goal: remember a small amount of state, of type T, for the flows
+// in which mercury has seen one message and waits for another that it
+// reports together with the first (e.g. an HTTP/2 HEADERS frame that
+// follows the SETTINGS frame in a later packet), with a fixed memory
+// footprint.
+//
+// approach: a direct-mapped array of (key, time, T) entries, allocated
+// once; a flow's context is overwritten by that of any other flow
+// that maps to the same entry, and expires timeout seconds after it
+// was inserted, so that neither scans nor abandoned flows can make the
+// table grow.  A caller that reports the contexts that it abandons
+// gets the one that an insertion would overwrite from occupant(), and
+// the expired ones from reap(), which checks one entry per call, in
+// turn.  T must be trivially copyable.
+
+template <typename T>
+struct tcp_context_table {
+
+    struct entry {
+        struct key k;           // the zero key marks an empty entry
+        unsigned int sec;
+        T context;
+    };
+
+    std::vector<struct entry> entries;
+    size_t mask;
+    unsigned int timeout;
+
+    size_t reap_index;
+
+    uint64_t insertions;
+    uint64_t evictions;         // contexts overwritten before they expired
+
+    // the number of entries is the smallest power of two that is at
+    // least size
+    //
+    tcp_context_table(unsigned int size, unsigned int timeout_sec) : entries{}, mask{0}, timeout{timeout_sec}, reap_index{0}, insertions{0}, evictions{0} {
+        size_t num_entries = 1;
+        while (num_entries < size) {
+            num_entries *= 2;
+        }
+        entries.resize(num_entries);
+        mask = num_entries - 1;
+        for (auto &e : entries) {
+            e.k.zeroize();
+            e.sec = 0;
+        }
+    }
+
+    // insert(k, sec) returns the context of the flow k, which is
+    // zeroed if that flow had none, or if it had expired
+    //
+    T *insert(const struct key &k, unsigned int sec) {
+        struct entry &e = entries[index(k)];
+        if (e.k == k && sec - e.sec < timeout) {
+            e.sec = sec;
+            return &e.context;
+        }
+        if (!e.k.is_zero() && sec - e.sec < timeout) {
+            evictions++;
+        }
+        insertions++;
+        e.k = k;
+        e.sec = sec;
+        memset(&e.context, 0, sizeof(e.context));
+        return &e.context;
+    }
+
+    // find(k, sec) returns the context of the flow k, or nullptr if it
+    // has none, or if that context has expired; an expired context is
+    // left in place for reap()
+    //
+    T *find(const struct key &k, unsigned int sec) {
+        struct entry &e = entries[index(k)];
+        if (e.k == k && sec - e.sec < timeout) {
+            return &e.context;
+        }
+        return nullptr;
+    }
+
+    void remove(const struct key &k) {
+        struct entry &e = entries[index(k)];
+        if (e.k == k) {
+            e.k.zeroize();
+        }
+    }
+
+    // occupant(k, sec) returns the entry that insert(k, sec) would
+    // overwrite, if it holds the context of another flow, or an
+    // expired context of k, or nullptr otherwise
+    //
+    const struct entry *occupant(const struct key &k, unsigned int sec) const {
+        const struct entry &e = entries[index(k)];
+        if (e.k.is_zero() || (e.k == k && sec - e.sec < timeout)) {
+            return nullptr;
+        }
+        return &e;
+    }
+
+    // reap(sec) checks the next entry in turn, and returns it if its
+    // context has expired, or nullptr; the caller removes it
+    //
+    const struct entry *reap(unsigned int sec) {
+        const struct entry &e = entries[reap_index];
+        reap_index = (reap_index + 1) & mask;
+        if (e.k.is_zero() || sec - e.sec < timeout) {
+            return nullptr;
+        }
+        return &e;
+    }
+
+private:
+
+    size_t index(const struct key &k) const {
+        return (std::hash<struct key>{}(k) >> 32) & mask;
+    }
+
+};
+
+
 #endif /* MERC_TCP_H */
@@ -362,6 +362,36 @@ void tls_extensions::fingerprint(struct buffer_stream &b, enum tls_role role) co
 
 }
 
+void tls_extensions::set_supported_version(struct datum &version) const {
+
+    struct datum ext_parser{this->data, this->data_end};
+
+    while (datum_get_data_length(&ext_parser) > 0) {
+        size_t tmp_len = 0;
+        size_t tmp_type;
+
+        if (datum_read_and_skip_uint(&ext_parser, L_ExtensionType, &tmp_type) == status_err) {
+            break;
+        }
+        if (datum_read_and_skip_uint(&ext_parser, L_ExtensionLength, &tmp_len) == status_err) {
+            break;
+        }
+        const uint8_t *data = ext_parser.data;
+        if (datum_skip(&ext_parser, tmp_len) == status_err) {
+            break;
+        }
+
+        // in a server_hello, the extension holds the selected version
+        //
+        if (tmp_type == type_supported_versions && tmp_len == L_ProtocolVersion) {
+            version.data = data;
+            version.data_end = ext_parser.data;
+            return;
+        }
+    }
+
+}
+
 void tls_extensions::print_session_ticket(struct json_object &o, const char *key) const {
 
     struct datum ext_parser{this->data, this->data_end};
@@ -532,6 +562,33 @@ void tls_client_hello::operator()(struct buffer_stream &buf) const {
 }
 
 
+bool tls_client_context::set(const struct tls_client_hello &hello) {
+    struct buffer_stream buf{fingerprint, sizeof(fingerprint)};
+    hello.write_fingerprint(buf);
+    if (buf.trunc || buf.length() == 0) {
+        return false;
+    }
+    fingerprint_length = buf.length();
+
+    struct datum sn{NULL, NULL};
+    hello.extensions.set_server_name(sn);
+    server_name_length = 0;
+    if (sn.is_not_empty()) {
+        server_name_length = sn.length() < (ssize_t)sizeof(server_name) ? sn.length() : sizeof(server_name);
+        memcpy(server_name, sn.data, server_name_length);
+    }
+    return true;
+}
+
+void tls_client_context::write_json(struct json_object &tls) const {
+    struct json_object tls_client{tls, "client"};
+    tls_client.print_key_json_string("fingerprint", (const uint8_t *)fingerprint, fingerprint_length);
+    if (server_name_length) {
+        tls_client.print_key_json_string("server_name", server_name, server_name_length);
+    }
+    tls_client.close();
+}
+
 void tls_server_hello::parse(struct datum &p) {
     mercury_debug("%s: processing packet with %td bytes\n", __func__, p->data_end - p->data);
 
@@ -612,6 +669,13 @@ void tls_server_hello::write_json(struct json_object &o) const {
     //o.print_key_value("fingerprint", *this); 
 }
 
+void tls_server_hello::write_selected_parameters(struct json_object &o) const {
+    struct datum version = protocol_version;
+    extensions.set_supported_version(version);
+    o.print_key_hex("selected_version", version);
+    o.print_key_hex("selected_cipher_suite", ciphersuite_vector);
+}
+
 void tls_server_certificate::write_json(struct json_array &a, bool json_output) const {
 
     struct datum tmp_cert_list = certificate_list;
@@ -652,3 +716,61 @@ void tls_server_certificate::write_json(struct json_array &a, bool json_output)
         }
     }
 }
+
+size_t tls_server_certificate::parse_certs() const {
+
+    size_t count = 0;
+    struct datum tmp_cert_list = certificate_list;
+    while (datum_get_data_length(&tmp_cert_list) > 0) {
+
+        size_t tmp_len;
+        if (tmp_cert_list.read_uint(&tmp_len, L_CertificateLength) == false) {
+            break;
+        }
+        if (tmp_len > (unsigned)datum_get_data_length(&tmp_cert_list)) {
+            tmp_len = datum_get_data_length(&tmp_cert_list); /* truncate */
+        }
+        if (tmp_len == 0) {
+            break;
+        }
+        struct x509_cert c;
+        c.parse(tmp_cert_list.data, tmp_len);
+        if (c.certificate.is_not_null()) {
+            count++;
+        }
+        if (datum_skip(&tmp_cert_list, tmp_len) == status_err) {
+            break;
+        }
+    }
+    return count;
+}
+
+void tls_server_certificate::write_leaf_summary(struct json_object &o) const {
+    struct datum tmp_cert_list = certificate_list;
+    size_t tmp_len;
+    if (tmp_cert_list.read_uint(&tmp_len, L_CertificateLength) == false || tmp_len == 0) {
+        return;
+    }
+    if (tmp_len > (unsigned)datum_get_data_length(&tmp_cert_list)) {
+        tmp_len = datum_get_data_length(&tmp_cert_list); /* truncate */
+    }
+    struct x509_cert c;
+    c.parse(tmp_cert_list.data, tmp_len);
+    if (c.certificate.is_null()) {
+        return;
+    }
+    struct json_object_asn1 leaf{o, "leaf"};
+    if (!c.serial_number.is_null()) {
+        c.serial_number.print_as_json_hex(leaf, "serial_number");
+    }
+    if (!c.issuer.RDNsequence.is_null()) {
+        c.issuer.print_as_json(leaf, "issuer");
+    }
+    if (!c.validity.sequence.is_null()) {
+        c.validity.print_as_json(leaf);
+    }
+    if (!c.subject.RDNsequence.is_null()) {
+        c.subject.print_as_json(leaf, "subject");
+    }
+    leaf.close();
+}
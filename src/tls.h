@@ -267,6 +267,19 @@ struct tls_server_certificate {
 
     void write_json(struct json_array &a, bool json_output) const;
 
+    // parse_certs() parses each of the certificates in the list, as
+    // write_json() does when json_output is true, but writes nothing,
+    // and returns the number that were parsed; it is used to benchmark
+    // the X.509 parser, which can only be included in one source file
+    //
+    size_t parse_certs() const;
+
+    // write_leaf_summary(o) writes the serial number, issuer,
+    // validity and subject of the first certificate in the list, which
+    // is the server's own, as the object "leaf"
+    //
+    void write_leaf_summary(struct json_object &o) const;
+
 };
 
 #define L_ExtensionType            2
@@ -298,6 +311,8 @@ struct tls_extensions : public datum {
 
     void set_server_name(struct datum &server_name) const;
 
+    void set_supported_version(struct datum &version) const;
+
     void print_session_ticket(struct json_object &o, const char *key) const;
 
     void fingerprint(struct buffer_stream &b, enum tls_role role) const;
@@ -332,6 +347,35 @@ struct tls_client_hello {
     struct tls_security_assessment security_assesment();
 };
 
+/*
+ * struct tls_client_context holds copies of the fingerprint and the
+ * server name of a client_hello, so that they can be reported with
+ * the server_hello and certificate that answer it, which arrive in
+ * other packets; it is trivially copyable, so that it can be kept in
+ * a tcp_context_table
+ */
+struct tls_client_context {
+    static const size_t max_fingerprint_length = 1024;
+    static const size_t max_server_name_length = 256;
+
+    char fingerprint[max_fingerprint_length];
+    uint16_t fingerprint_length;
+    uint8_t server_name[max_server_name_length];
+    uint16_t server_name_length;
+
+    // set(hello) copies the fingerprint and server name of hello, and
+    // returns false if the fingerprint does not fit
+    //
+    bool set(const struct tls_client_hello &hello);
+
+    // write_json(tls) writes the fingerprint and the server name as
+    // "client", so that the client fingerprint of a server record is
+    // not mistaken for that of a client_hello record, which is in
+    // "fingerprints"
+    //
+    void write_json(struct json_object &tls) const;
+};
+
 #include "match.h"
 
 struct tls_server_hello {
@@ -364,6 +408,12 @@ struct tls_server_hello {
 
     void write_json(struct json_object &record) const;
 
+    // write_selected_parameters(o) writes the version and the cipher
+    // suite that the server selected; the version is that of the
+    // supported_versions extension, if there is one (TLS 1.3)
+    //
+    void write_selected_parameters(struct json_object &o) const;
+
 };
 
 
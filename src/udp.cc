@@ -110,56 +110,33 @@ struct pi_container quic = {
     QUIC_PORT
 };
 
-enum udp_msg_type udp_get_message_type(const uint8_t *udp_data,
-                                   unsigned int len) {
-
-    if (len < sizeof(dhcp_client_mask)) {
-        return udp_msg_type_unknown;
-    }
-
-    /* note: udp_data will be 32-bit aligned as per the standard */
-
-    mercury_debug("%s: udp data: %02x%02x%02x%02x%02x%02x%02x%02x\n", __func__,
-                    udp_data[0], udp_data[1], udp_data[2], udp_data[3], udp_data[4], udp_data[5], udp_data[6], udp_data[7]);
+/*
+ * udp_msg_classifier holds the UDP patterns above, in the order in
+ * which they are checked; as with the TCP patterns, only the first
+ * eight bytes of each mask and value are used
+ */
+struct protocol_classifier udp_msg_classifier;
+
+void udp_msg_classifier_init() {
+    struct protocol_classifier c;
+    c.add(dhcp_client_mask, dhcp_client_value, udp_msg_type_dhcp);
+    c.add(dtls_client_hello_mask, dtls_client_hello_value, udp_msg_type_dtls_client_hello);
+    c.add(dtls_server_hello_mask, dtls_server_hello_value, udp_msg_type_dtls_server_hello);
+    c.add(dns_server_mask, dns_server_value, udp_msg_type_dns);
+    c.add(dns_client_mask, dns_client_value, udp_msg_type_dns);
+    c.add(wireguard_mask, wireguard_value, udp_msg_type_wireguard);
+    c.add(quic_mask, quic_value, udp_msg_type_quic);
+    udp_msg_classifier = c;
+}
 
-    if (u32_compare_masked_data_to_value(udp_data,
-                                         dhcp_client_mask,
-                                         dhcp_client_value)) {
-        return udp_msg_type_dhcp;
-    }
+static struct udp_msg_classifier_initializer {
+    udp_msg_classifier_initializer() { udp_msg_classifier_init(); }
+} udp_msg_classifier_initializer;
 
-    if (u32_compare_masked_data_to_value(udp_data,
-                                         dtls_client_hello_mask,
-                                         dtls_client_hello_value)) {
-        return udp_msg_type_dtls_client_hello;
-    }
-    if (u64_compare_masked_data_to_value(udp_data,
-                                         dtls_server_hello_mask,
-                                         dtls_server_hello_value)) {
-        return udp_msg_type_dtls_server_hello;
-    }
-    if (u64_compare_masked_data_to_value(udp_data,
-                                         dns_server_mask,
-                                         dns_server_value)) {
-        return udp_msg_type_dns;
-    }
-    if (u64_compare_masked_data_to_value(udp_data,
-                                         dns_client_mask,
-                                         dns_client_value)) {
-        return udp_msg_type_dns;
-    }
-    if (u64_compare_masked_data_to_value(udp_data,
-                                         wireguard_mask,
-                                         wireguard_value)) {
-        return udp_msg_type_wireguard;
-    }
-    if (u64_compare_masked_data_to_value(udp_data,
-                                         quic_mask,
-                                         quic_value)) {
-        return udp_msg_type_quic;
-    }
+enum udp_msg_type udp_get_message_type(const uint8_t *udp_data,
+                                   unsigned int len) {
 
-    return udp_msg_type_unknown;
+    return (enum udp_msg_type)udp_msg_classifier.classify(udp_data, len);
 }
 
 /*
@@ -52,5 +52,9 @@ struct udp_packet {
 enum udp_msg_type udp_get_message_type(const uint8_t *udp_data,
                                        unsigned int len);
 
+void udp_msg_classifier_init();
+
+extern struct protocol_classifier udp_msg_classifier;   // defined in udp.cc
+
 #endif
 
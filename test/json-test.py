@@ -30,6 +30,7 @@ mercury_schema = {
                              'dtls_server': {'type': 'string'},
                              'http':        {'type': 'string'},
                              'http_server': {'type': 'string'},
+                             'http2':       {'type': 'string'},
                              'dhcp':        {'type': 'string'},
                          },
                          "additionalProperties": False
@@ -39,6 +40,7 @@ mercury_schema = {
                     'client': {
                         'type': 'object',
                         'properties': {
+                            'fingerprint': {'type': 'string'},
                             'server_name': {'type': 'string'}
                         }
                     },
@@ -77,6 +79,33 @@ mercury_schema = {
                         },
                         "additionalProperties": False
                     },
+        'http2': {'type': 'object',
+                  'properties': {
+                      'request': {
+                          'type': 'object',
+                          'properties': {
+                              'method':     {'type': 'string'},
+                              'authority':  {'type': 'string'},
+                              'scheme':     {'type': 'string'},
+                              'path':       {'type': 'string'},
+                              'user_agent': {'type': 'string'}
+                          },
+                          "additionalProperties": False
+                      },
+                      'settings': {'type': 'array',
+                                   'items': {
+                                       'type': 'object',
+                                       'properties': {
+                                           'id':    {'type': 'number'},
+                                           'value': {'type': 'number'}
+                                       },
+                                       "additionalProperties": False
+                                   }
+                      },
+                      'window_update': {'type': 'number'}
+                  },
+                  "additionalProperties": False
+              },
         'dhcp': {'type': 'object',
                  'properties': {
                      'client_mac_address': {'type': 'string'},
@@ -96,9 +125,17 @@ mercury_schema = {
                          'score':     {'type': 'number'},
                          'malware':   {'type': 'number'},
                          'p_malware': {'type': 'number'},
+                         'domain':    {'type': 'string'},
                      },
                      "additionalProperties": False
              },
+        'os_analysis': {'type': 'object',
+                        'properties': {
+                            'os':    {'type': 'string'},
+                            'score': {'type': 'number'},
+                        },
+                        "additionalProperties": False
+             },
         'dns': {'type': 'object',
                      'properties': {
                          'base64':   {'type': 'string'},